@@ -35,6 +35,8 @@ struct CDataSource {
     uint32_t (*flags)(void *handle );
     bool (*getUri)(void *handle, char *uriString, size_t bufferSize);
     void *handle;
+    // only valid if flags() includes DataSourceBase::kIsMappable.
+    const uint8_t *(*getMappedData)(void *handle, off64_t *size);
 };
 
 enum CMediaTrackReadOptions : uint32_t {
@@ -25,6 +25,7 @@
 #include <utils/Errors.h>
 #include <utils/Log.h>
 #include <utils/RefBase.h>
+#include <media/DataSourceBase.h>
 #include <media/MediaExtractorPluginApi.h>
 #include <media/NdkMediaFormat.h>
 
@@ -324,6 +325,16 @@ public:
         return mSource->flags(mSource->handle);
     }
 
+    // Returns the contents of the source if it is mapped into memory, NULL
+    // otherwise. Sources that predate getMappedData never report kIsMappable.
+    const uint8_t *getMappedData(off64_t *size) {
+        if (mSource == NULL
+                || (mSource->flags(mSource->handle) & DataSourceBase::kIsMappable) == 0) {
+            return NULL;
+        }
+        return mSource->getMappedData(mSource->handle, size);
+    }
+
     // Convenience methods:
     bool getUInt16(off64_t offset, uint16_t *x) {
         *x = 0;
@@ -42,7 +42,7 @@ namespace android {
 #define CBLK_DISABLED   0x08 // output track disabled by AudioFlinger due to underrun,
                              // need to re-start.  Unlike CBLK_UNDERRUN, this is not set
                              // immediately, but only after a long string of underruns.
-// 0x10 unused
+#define CBLK_BATCH_WAKE 0x10 // set by client: server wakes AudioRecord only when mMinimum available
 #define CBLK_LOOP_CYCLE 0x20 // set by server each time a loop cycle other than final one completes
 #define CBLK_LOOP_FINAL 0x40 // set by server when the final loop cycle completes
 #define CBLK_BUFFER_END 0x80 // set by server when the position reaches end of buffer if not looping
@@ -312,6 +312,22 @@ public:
         mCblk->mMinimum = (uint32_t) minimum;
     }
 
+    // Ask the server to wake a blocked AudioRecord only when the minimum set above is available,
+    // instead of for every buffer it releases. AudioTrack is always woken that way.
+    void        setBatchWake(bool batchWake) {
+        if (batchWake) {
+            android_atomic_or(CBLK_BATCH_WAKE, &mCblk->mFlags);
+        } else {
+            android_atomic_and(~CBLK_BATCH_WAKE, &mCblk->mFlags);
+        }
+    }
+
+    // Poll the control block for up to maxSpinNs before sleeping in obtainBuffer().
+    // If the server releases frames meanwhile then neither side makes a futex system call.
+    // The time spent polling adapts to how long the server usually takes,
+    // and there is no polling on a single core device. 0 always sleeps.
+    void        setSpinWait(int64_t maxSpinNs);
+
     // Return the number of frames that would need to be obtained and released
     // in order for the client to be aligned at start of buffer
     virtual size_t  getMisalignment();
@@ -345,6 +361,10 @@ private:
 
     Modulo<uint32_t> mEpoch;
 
+    // setSpinWait() may be called while another thread is in obtainBuffer()
+    std::atomic<int64_t> mMaxSpinNs;  // set by setSpinWait()
+    std::atomic<int64_t> mSpinNs;     // polling time, adapted between mMaxSpinNs / 16 and mMaxSpinNs
+
     // The shared buffer contents referred to by the timestamp observer
     // is initialized when the server proxy created.  A local zero timestamp
     // is initialized by the client constructor.
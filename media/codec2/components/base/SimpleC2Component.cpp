@@ -23,6 +23,8 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
+
 #include <C2Config.h>
 #include <C2Debug.h>
 #include <C2PlatformSupport.h>
@@ -36,6 +38,14 @@ std::unique_ptr<C2Work> SimpleC2Component::WorkQueue::pop_front() {
     return work;
 }
 
+void SimpleC2Component::WorkQueue::pop_front(size_t count, std::list<Entry> *entries) {
+    std::list<Entry>::iterator end = mQueue.begin();
+    for (size_t i = 0; i < count && end != mQueue.end(); ++i) {
+        ++end;
+    }
+    entries->splice(entries->end(), mQueue, mQueue.begin(), end);
+}
+
 void SimpleC2Component::WorkQueue::push_back(std::unique_ptr<C2Work> work) {
     mQueue.push_back({ std::move(work), NO_DRAIN });
 }
@@ -48,10 +58,6 @@ void SimpleC2Component::WorkQueue::clear() {
     mQueue.clear();
 }
 
-uint32_t SimpleC2Component::WorkQueue::drainMode() const {
-    return mQueue.front().drainMode;
-}
-
 void SimpleC2Component::WorkQueue::markDrain(uint32_t drainMode) {
     mQueue.push_back({ nullptr, drainMode });
 }
@@ -197,7 +203,10 @@ SimpleC2Component::SimpleC2Component(
     : mDummyReadView(DummyReadView()),
       mIntf(intf),
       mLooper(new ALooper),
-      mHandler(new WorkHandler) {
+      mHandler(new WorkHandler),
+      mBatchingEnabled(property_get_bool("debug.stagefright.c2.batch", false)),
+      mProcessingBatch(false),
+      mAverageProcessUs(-1) {
     mLooper->setName(intf->getName().c_str());
     (void)mLooper->registerHandler(mHandler);
     mLooper->start(false, false, ANDROID_PRIORITY_VIDEO);
@@ -402,8 +411,7 @@ void SimpleC2Component::finish(
     }
     if (work) {
         fillWork(work);
-        std::shared_ptr<C2Component::Listener> listener = mExecState.lock()->mListener;
-        listener->onWorkDone_nb(shared_from_this(), vec(work));
+        returnWork(std::move(work));
         ALOGV("returning pending work");
     }
 }
@@ -428,16 +436,53 @@ void SimpleC2Component::cloneAndSend(
     work->worklets.emplace_back(new C2Worklet);
     if (work) {
         fillWork(work);
-        std::shared_ptr<C2Component::Listener> listener = mExecState.lock()->mListener;
-        listener->onWorkDone_nb(shared_from_this(), vec(work));
+        returnWork(std::move(work));
         ALOGV("cloned and sending work");
     }
 }
 
+void SimpleC2Component::returnWork(std::unique_ptr<C2Work> work) {
+    if (mProcessingBatch) {
+        mBatchDoneWork.push_back(std::move(work));
+        return;
+    }
+    std::shared_ptr<C2Component::Listener> listener = mExecState.lock()->mListener;
+    listener->onWorkDone_nb(shared_from_this(), vec(work));
+}
+
+void SimpleC2Component::returnBatchDoneWork(uint64_t generation) {
+    if (mBatchDoneWork.empty()) {
+        return;
+    }
+    {
+        Mutexed<WorkQueue>::Locked queue(mWorkQueue);
+        if (queue->generation() != generation) {
+            ALOGD("batch from old generation: was %" PRIu64 " now %" PRIu64,
+                    queue->generation(), generation);
+            for (const std::unique_ptr<C2Work> &work : mBatchDoneWork) {
+                work->result = C2_NOT_FOUND;
+            }
+        }
+    }
+    std::list<std::unique_ptr<C2Work>> workItems;
+    workItems.swap(mBatchDoneWork);
+    std::shared_ptr<C2Component::Listener> listener = mExecState.lock()->mListener;
+    listener->onWorkDone_nb(shared_from_this(), std::move(workItems));
+}
+
+size_t SimpleC2Component::getBatchSize() const {
+    if (!mBatchingEnabled || mAverageProcessUs < 0) {
+        return 1;
+    }
+    if (mAverageProcessUs * (int64_t)kMaxBatchSize <= kMaxBatchDurationUs) {
+        return kMaxBatchSize;
+    }
+    return std::max(kMaxBatchDurationUs / mAverageProcessUs, (int64_t)1);
+}
+
 bool SimpleC2Component::processQueue() {
-    std::unique_ptr<C2Work> work;
+    std::list<WorkQueue::Entry> batch;
     uint64_t generation;
-    int32_t drainMode;
     bool isFlushPending = false;
     bool hasQueuedWork = false;
     {
@@ -447,9 +492,8 @@ bool SimpleC2Component::processQueue() {
         }
 
         generation = queue->generation();
-        drainMode = queue->drainMode();
         isFlushPending = queue->popPendingFlush();
-        work = queue->pop_front();
+        queue->pop_front(getBatchSize(), &batch);
         hasQueuedWork = !queue->empty();
     }
     if (isFlushPending) {
@@ -508,15 +552,62 @@ bool SimpleC2Component::processQueue() {
         }
     }
 
-    if (!work) {
-        c2_status_t err = drain(drainMode, mOutputBlockPool);
+    mProcessingBatch = mBatchingEnabled;
+    bool flushed = false;
+    bool failed = false;
+    for (WorkQueue::Entry &entry : batch) {
+        if (failed) {
+            // An earlier entry of the batch failed. Return the rest as a flush
+            // would, instead of processing them after the error.
+            if (entry.work) {
+                entry.work->result = C2_NOT_FOUND;
+                returnWork(std::move(entry.work));
+            }
+            continue;
+        }
+        if (!flushed) {
+            Mutexed<WorkQueue>::Locked queue(mWorkQueue);
+            flushed = (queue->generation() != generation);
+        }
+        if (flushed) {
+            // Flushed after it was taken from the queue. Return the work
+            // without processing it and skip the drain, as flush_sm() would
+            // have done had it still been queued.
+            if (entry.work) {
+                ALOGD("unprocessed work from old generation %" PRIu64, generation);
+                entry.work->result = C2_NOT_FOUND;
+                returnWork(std::move(entry.work));
+            }
+            continue;
+        }
+
+        const bool isWork = (entry.work != nullptr);
+        const int64_t startUs = ALooper::GetNowUs();
+        c2_status_t err = processEntry(&entry, generation);
+        if (isWork) {
+            const int64_t processUs = ALooper::GetNowUs() - startUs;
+            mAverageProcessUs = mAverageProcessUs < 0
+                    ? processUs : (mAverageProcessUs * 7 + processUs) / 8;
+        }
         if (err != C2_OK) {
+            // Return what was done before the error.
+            returnBatchDoneWork(generation);
             Mutexed<ExecState>::Locked state(mExecState);
             std::shared_ptr<C2Component::Listener> listener = state->mListener;
             state.unlock();
             listener->onError_nb(shared_from_this(), err);
+            failed = true;
         }
-        return hasQueuedWork;
+    }
+    mProcessingBatch = false;
+    returnBatchDoneWork(generation);
+    return hasQueuedWork;
+}
+
+c2_status_t SimpleC2Component::processEntry(WorkQueue::Entry *entry, uint64_t generation) {
+    std::unique_ptr<C2Work> work = std::move(entry->work);
+    if (!work) {
+        return drain(entry->drainMode, mOutputBlockPool);
     }
 
     {
@@ -543,49 +634,47 @@ bool SimpleC2Component::processQueue() {
     }
     process(work, mOutputBlockPool);
     ALOGV("processed frame #%" PRIu64, work->input.ordinal.frameIndex.peeku());
+    if (work->workletsProcessed != 0u && mProcessingBatch) {
+        // Checked against the generation with the rest of the batch.
+        ALOGV("returning this work");
+        returnWork(std::move(work));
+        return C2_OK;
+    }
+
     Mutexed<WorkQueue>::Locked queue(mWorkQueue);
     if (queue->generation() != generation) {
         ALOGD("work form old generation: was %" PRIu64 " now %" PRIu64,
                 queue->generation(), generation);
         work->result = C2_NOT_FOUND;
         queue.unlock();
-
-        Mutexed<ExecState>::Locked state(mExecState);
-        std::shared_ptr<C2Component::Listener> listener = state->mListener;
-        state.unlock();
-        listener->onWorkDone_nb(shared_from_this(), vec(work));
-        return hasQueuedWork;
+        returnWork(std::move(work));
+        return C2_OK;
     }
     if (work->workletsProcessed != 0u) {
         queue.unlock();
-        Mutexed<ExecState>::Locked state(mExecState);
         ALOGV("returning this work");
-        std::shared_ptr<C2Component::Listener> listener = state->mListener;
-        state.unlock();
-        listener->onWorkDone_nb(shared_from_this(), vec(work));
-    } else {
-        ALOGV("queue pending work");
-        work->input.buffers.clear();
-        std::unique_ptr<C2Work> unexpected;
+        returnWork(std::move(work));
+        return C2_OK;
+    }
 
-        uint64_t frameIndex = work->input.ordinal.frameIndex.peeku();
-        if (queue->pending().count(frameIndex) != 0) {
-            unexpected = std::move(queue->pending().at(frameIndex));
-            queue->pending().erase(frameIndex);
-        }
-        (void)queue->pending().insert({ frameIndex, std::move(work) });
+    ALOGV("queue pending work");
+    work->input.buffers.clear();
+    std::unique_ptr<C2Work> unexpected;
 
-        queue.unlock();
-        if (unexpected) {
-            ALOGD("unexpected pending work");
-            unexpected->result = C2_CORRUPTED;
-            Mutexed<ExecState>::Locked state(mExecState);
-            std::shared_ptr<C2Component::Listener> listener = state->mListener;
-            state.unlock();
-            listener->onWorkDone_nb(shared_from_this(), vec(unexpected));
-        }
+    uint64_t frameIndex = work->input.ordinal.frameIndex.peeku();
+    if (queue->pending().count(frameIndex) != 0) {
+        unexpected = std::move(queue->pending().at(frameIndex));
+        queue->pending().erase(frameIndex);
     }
-    return hasQueuedWork;
+    (void)queue->pending().insert({ frameIndex, std::move(work) });
+
+    queue.unlock();
+    if (unexpected) {
+        ALOGD("unexpected pending work");
+        unexpected->result = C2_CORRUPTED;
+        returnWork(std::move(unexpected));
+    }
+    return C2_OK;
 }
 
 std::shared_ptr<C2Buffer> SimpleC2Component::createLinearBuffer(
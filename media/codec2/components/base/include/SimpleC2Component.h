@@ -114,7 +114,8 @@ protected:
      * This method will retrieve the pending work according to |frameIndex| and
      * feed the work into |fillWork| function. |fillWork| must be
      * "non-blocking". Once |fillWork| returns the filled work will be returned
-     * to the client.
+     * to the client, together with the other work done in the same batch if
+     * called from process() or drain().
      *
      * \param[in]   frameIndex    the index of the pending work
      * \param[in]   fillWork      the function to fill the retrieved work.
@@ -127,7 +128,8 @@ protected:
      * This method will retrieve and clone the pending or current work according
      * to |frameIndex| and feed the work into |fillWork| function. |fillWork|
      * must be "non-blocking". Once |fillWork| returns the filled work will be
-     * returned to the client.
+     * returned to the client, together with the other work done in the same
+     * batch if called from process() or drain().
      *
      * \param[in]   frameIndex    the index of the work
      * \param[in]   currentWork   the current work under processing
@@ -204,15 +206,22 @@ private:
     public:
         typedef std::unordered_map<uint64_t, std::unique_ptr<C2Work>> PendingWork;
 
+        struct Entry {
+            std::unique_ptr<C2Work> work;
+            uint32_t drainMode;
+        };
+
         inline WorkQueue() : mFlush(false), mGeneration(0ul) {}
 
         inline uint64_t generation() const { return mGeneration; }
         inline void incGeneration() { ++mGeneration; mFlush = true; }
 
         std::unique_ptr<C2Work> pop_front();
+        // Moves up to |count| entries from the front of the queue to the end of
+        // |entries|.
+        void pop_front(size_t count, std::list<Entry> *entries);
         void push_back(std::unique_ptr<C2Work> work);
         bool empty() const;
-        uint32_t drainMode() const;
         void markDrain(uint32_t drainMode);
         inline bool popPendingFlush() {
             bool flush = mFlush;
@@ -223,11 +232,6 @@ private:
         PendingWork &pending() { return mPendingWork; }
 
     private:
-        struct Entry {
-            std::unique_ptr<C2Work> work;
-            uint32_t drainMode;
-        };
-
         bool mFlush;
         uint64_t mGeneration;
         std::list<Entry> mQueue;
@@ -238,6 +242,26 @@ private:
     class BlockingBlockPool;
     std::shared_ptr<BlockingBlockPool> mOutputBlockPool;
 
+    // processQueue() takes as many queued entries as it expects to process in
+    // kMaxBatchDurationUs, based on how long the previous ones took, and
+    // returns the work done for all of them in one onWorkDone_nb() call.
+    // This is only done if debug.stagefright.c2.batch is set to true before the
+    // component is created; otherwise one entry is taken at a time and each
+    // work is returned on its own. Entries after one that fails are returned
+    // unprocessed.
+    // Accessed on the looper thread only.
+    static constexpr size_t kMaxBatchSize = 16;
+    static constexpr int64_t kMaxBatchDurationUs = 2000;
+    const bool mBatchingEnabled;
+    bool mProcessingBatch;
+    std::list<std::unique_ptr<C2Work>> mBatchDoneWork;
+    int64_t mAverageProcessUs;
+
+    size_t getBatchSize() const;
+    c2_status_t processEntry(WorkQueue::Entry *entry, uint64_t generation);
+    void returnWork(std::unique_ptr<C2Work> work);
+    void returnBatchDoneWork(uint64_t generation);
+
     SimpleC2Component() = delete;
 };
 
@@ -0,0 +1,277 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "C2SoftComponent_test"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include <cutils/properties.h>
+#include <gtest/gtest.h>
+#include <utils/Log.h>
+
+#include <C2Buffer.h>
+#include <C2Component.h>
+#include <C2PlatformSupport.h>
+#include <C2Work.h>
+
+namespace android {
+
+namespace {
+
+// Input frame size in bytes for each component, and whether it takes PCM.
+struct ComponentInfo {
+    const char *name;
+    size_t frameSize;
+    bool pcm;
+};
+
+const char *kBatchProperty = "debug.stagefright.c2.batch";
+
+const ComponentInfo kComponents[] = {
+    { "c2.android.g711.alaw.decoder", 160, false },
+    { "c2.android.g711.mlaw.decoder", 160, false },
+    { "c2.android.raw.decoder", 3840, true },
+    { "c2.android.aac.encoder", 2048, true },
+    { "c2.android.opus.encoder", 1920, true },
+};
+
+class Listener : public C2Component::Listener {
+public:
+    virtual void onWorkDone_nb(std::weak_ptr<C2Component> component,
+                               std::list<std::unique_ptr<C2Work>> workItems) override {
+        (void)component;
+        std::lock_guard<std::mutex> lock(mLock);
+        ++mNumCalls;
+        for (std::unique_ptr<C2Work> &work : workItems) {
+            if (work->result != C2_OK) {
+                ++mNumErrors;
+            }
+            if (work->input.flags & C2FrameData::FLAG_END_OF_STREAM) {
+                mEos = true;
+            }
+            mFrameIndices.push_back(work->input.ordinal.frameIndex.peeku());
+        }
+        mCondition.notify_all();
+    }
+
+    virtual void onTripped_nb(std::weak_ptr<C2Component> component,
+                              std::vector<std::shared_ptr<C2SettingResult>> settingResult) override {
+        (void)component;
+        (void)settingResult;
+    }
+
+    virtual void onError_nb(std::weak_ptr<C2Component> component, uint32_t errorCode) override {
+        (void)component;
+        std::lock_guard<std::mutex> lock(mLock);
+        ALOGE("error %u", errorCode);
+        ++mNumErrors;
+        mCondition.notify_all();
+    }
+
+    // Waits until fewer than |maxInFlight| of the |numQueued| works queued so
+    // far are still with the component. Returns false on timeout. Cloned work
+    // counts as done, which is close enough.
+    bool waitForDone(size_t numQueued, size_t maxInFlight) {
+        std::unique_lock<std::mutex> lock(mLock);
+        return mCondition.wait_for(lock, std::chrono::seconds(5), [&] {
+            return mFrameIndices.size() + maxInFlight > numQueued;
+        });
+    }
+
+    bool waitForEos() {
+        std::unique_lock<std::mutex> lock(mLock);
+        return mCondition.wait_for(lock, std::chrono::seconds(5), [this] { return mEos; });
+    }
+
+    std::mutex mLock;
+    std::condition_variable mCondition;
+    std::vector<uint64_t> mFrameIndices;  // in the order they were returned
+    size_t mNumCalls = 0;
+    size_t mNumErrors = 0;
+    bool mEos = false;
+};
+
+template <typename Param>
+class C2SoftComponentTestBase : public ::testing::TestWithParam<Param> {
+protected:
+    void SetUp() override {
+        mListener = std::make_shared<Listener>();
+    }
+
+    void TearDown() override {
+        if (mComponent) {
+            mComponent->stop();
+            mComponent->release();
+            mComponent.reset();
+        }
+    }
+
+    bool create(const ComponentInfo &info) {
+        std::shared_ptr<C2ComponentStore> store = GetCodec2PlatformComponentStore();
+        if (store->createComponent(info.name, &mComponent) != C2_OK) {
+            return false;
+        }
+        EXPECT_EQ(C2_OK, mComponent->setListener_vb(mListener, C2_MAY_BLOCK));
+        EXPECT_EQ(C2_OK, mComponent->start());
+        return true;
+    }
+
+    // Prepares |numWorks| works, the last of which carries the end of stream.
+    // Their input buffers all share one block, filled with a tone for PCM
+    // input and with arbitrary samples otherwise.
+    void prepareWorks(const ComponentInfo &info, size_t numWorks,
+                      std::list<std::unique_ptr<C2Work>> *works) {
+        std::shared_ptr<C2BlockPool> pool;
+        ASSERT_EQ(C2_OK, GetCodec2BlockPool(C2BlockPool::BASIC_LINEAR, mComponent, &pool));
+        std::shared_ptr<C2LinearBlock> block;
+        ASSERT_EQ(C2_OK, pool->fetchLinearBlock(
+                info.frameSize * numWorks,
+                { C2MemoryUsage::CPU_READ, C2MemoryUsage::CPU_WRITE },
+                &block));
+        C2WriteView view = block->map().get();
+        ASSERT_EQ(C2_OK, view.error());
+        if (info.pcm) {
+            int16_t *samples = (int16_t *)view.data();
+            for (size_t i = 0; i < info.frameSize * numWorks / sizeof(int16_t); ++i) {
+                samples[i] = (int16_t)(8192 * sin(2 * M_PI * 440 * i / 48000));
+            }
+        } else {
+            for (size_t i = 0; i < info.frameSize * numWorks; ++i) {
+                view.data()[i] = (uint8_t)(i * 37);
+            }
+        }
+
+        for (size_t i = 0; i < numWorks; ++i) {
+            std::unique_ptr<C2Work> work(new C2Work);
+            work->input.flags = (i + 1 == numWorks)
+                    ? C2FrameData::FLAG_END_OF_STREAM : (C2FrameData::flags_t)0;
+            work->input.ordinal.frameIndex = i;
+            work->input.ordinal.timestamp = i * 20000;
+            work->input.buffers.push_back(C2Buffer::CreateLinearBuffer(
+                    block->share(i * info.frameSize, info.frameSize, C2Fence())));
+            work->worklets.clear();
+            work->worklets.emplace_back(new C2Worklet);
+            works->push_back(std::move(work));
+        }
+    }
+
+    // Queues the works one at a time, keeping at most |maxInFlight| of them
+    // with the component, and waits for the end of stream.
+    void run(std::list<std::unique_ptr<C2Work>> *works, size_t maxInFlight) {
+        size_t numQueued = 0;
+        while (!works->empty()) {
+            ASSERT_TRUE(mListener->waitForDone(numQueued, maxInFlight));
+            std::list<std::unique_ptr<C2Work>> items;
+            items.splice(items.end(), *works, works->begin());
+            ASSERT_EQ(C2_OK, mComponent->queue_nb(&items));
+            ++numQueued;
+        }
+        ASSERT_TRUE(mListener->waitForEos());
+    }
+
+    std::shared_ptr<Listener> mListener;
+    std::shared_ptr<C2Component> mComponent;
+};
+
+class C2SoftComponentTest : public C2SoftComponentTestBase<ComponentInfo> {
+};
+
+// Runs each component with batching in SimpleC2Component disabled and enabled.
+class C2SoftComponentBenchmark
+        : public C2SoftComponentTestBase<std::tuple<ComponentInfo, bool>> {
+protected:
+    void TearDown() override {
+        C2SoftComponentTestBase::TearDown();
+        property_set(kBatchProperty, "");
+    }
+};
+
+}  // namespace
+
+TEST_P(C2SoftComponentTest, ReturnsAllWork) {
+    const ComponentInfo &info = GetParam();
+    const size_t kNumWorks = 100;
+    if (!create(info)) {
+        ALOGW("%s is not available", info.name);
+        return;
+    }
+
+    std::list<std::unique_ptr<C2Work>> works;
+    ASSERT_NO_FATAL_FAILURE(prepareWorks(info, kNumWorks, &works));
+    ASSERT_NO_FATAL_FAILURE(run(&works, kNumWorks));
+
+    std::lock_guard<std::mutex> lock(mListener->mLock);
+    EXPECT_EQ(0u, mListener->mNumErrors);
+    std::vector<uint64_t> indices = mListener->mFrameIndices;
+    if (!info.pcm || strcmp(info.name, "c2.android.raw.decoder") == 0) {
+        // Work that is done as it is processed comes back in order.
+        ASSERT_EQ(kNumWorks, indices.size());
+        for (size_t i = 0; i < kNumWorks; ++i) {
+            EXPECT_EQ(i, indices[i]);
+        }
+    } else {
+        // Encoders may return work with its output, and clone work for
+        // their codec config.
+        std::sort(indices.begin(), indices.end());
+        indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+        EXPECT_EQ(kNumWorks, indices.size());
+    }
+}
+
+TEST_P(C2SoftComponentBenchmark, WorksPerSecond) {
+    const ComponentInfo &info = std::get<0>(GetParam());
+    const bool batching = std::get<1>(GetParam());
+    const size_t kNumWorks = 2000;
+    const size_t kMaxInFlight = 16;
+    ASSERT_EQ(0, property_set(kBatchProperty, batching ? "true" : "false"));
+    if (!create(info)) {
+        ALOGW("%s is not available", info.name);
+        return;
+    }
+
+    std::list<std::unique_ptr<C2Work>> works;
+    ASSERT_NO_FATAL_FAILURE(prepareWorks(info, kNumWorks, &works));
+
+    const auto start = std::chrono::steady_clock::now();
+    ASSERT_NO_FATAL_FAILURE(run(&works, kMaxInFlight));
+    const auto end = std::chrono::steady_clock::now();
+    const double seconds = std::chrono::duration<double>(end - start).count();
+
+    std::lock_guard<std::mutex> lock(mListener->mLock);
+    printf("[ BENCH    ] %s, batching %s: %.0f works/s, %.1f works per onWorkDone\n",
+           info.name, batching ? "on" : "off", kNumWorks / seconds,
+           (double)mListener->mFrameIndices.size() / mListener->mNumCalls);
+}
+
+INSTANTIATE_TEST_CASE_P(Components, C2SoftComponentTest, ::testing::ValuesIn(kComponents));
+
+INSTANTIATE_TEST_CASE_P(
+        Components, C2SoftComponentBenchmark,
+        ::testing::Combine(::testing::ValuesIn(kComponents), ::testing::Bool()));
+
+}  // namespace android
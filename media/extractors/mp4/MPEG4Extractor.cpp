@@ -143,6 +143,10 @@ private:
 
     uint8_t *mSrcBuffer;
 
+    // the file contents, if the source is a local file that could be mapped.
+    const uint8_t *mMappedData;
+    off64_t mMappedSize;
+
     bool mIsHeif;
     bool mIsAudio;
     sp<ItemTable> mItemTable;
@@ -152,6 +156,8 @@ private:
     uint64_t mElstShiftStartTicks;
 
     size_t parseNALSize(const uint8_t *data) const;
+    ssize_t readSampleData(off64_t offset, void *data, size_t size);
+    const uint8_t *getSampleData(off64_t offset, size_t size, uint8_t *buffer);
     status_t parseChunk(off64_t *offset);
     status_t parseTrackFragmentHeader(off64_t offset, off64_t size);
     status_t parseTrackFragmentRun(off64_t offset, off64_t size);
@@ -4665,6 +4671,8 @@ MPEG4Source::MPEG4Source(
       mStarted(false),
       mBuffer(NULL),
       mSrcBuffer(NULL),
+      mMappedData(NULL),
+      mMappedSize(0),
       mIsHeif(itemTable != NULL),
       mItemTable(itemTable),
       mElstShiftStartTicks(elstShiftStartTicks) {
@@ -4820,6 +4828,9 @@ media_status_t MPEG4Source::start() {
         return AMEDIA_ERROR_MALFORMED;
     }
 
+    mMappedData = mDataSource->getMappedData(&mMappedSize);
+    ALOGV("reading samples %s", mMappedData != NULL ? "from mapped file" : "through readAt");
+
     mStarted = true;
 
     return AMEDIA_OK;
@@ -4838,6 +4849,9 @@ media_status_t MPEG4Source::stop() {
     delete[] mSrcBuffer;
     mSrcBuffer = NULL;
 
+    mMappedData = NULL;
+    mMappedSize = 0;
+
     mStarted = false;
     mCurrentSampleIndex = 0;
 
@@ -5528,6 +5542,29 @@ size_t MPEG4Source::parseNALSize(const uint8_t *data) const {
     return 0;
 }
 
+ssize_t MPEG4Source::readSampleData(off64_t offset, void *data, size_t size) {
+    if (mMappedData != NULL && offset >= 0 && offset <= mMappedSize
+            && size <= (uint64_t)(mMappedSize - offset)) {
+        memcpy(data, mMappedData + offset, size);
+        return size;
+    }
+    return mDataSource->readAt(offset, data, size);
+}
+
+// Returns the |size| bytes of sample data at |offset|, directly from the
+// mapped file if possible, otherwise after reading them into |buffer|.
+const uint8_t *MPEG4Source::getSampleData(
+        off64_t offset, size_t size, uint8_t *buffer) {
+    if (mMappedData != NULL && offset >= 0 && offset <= mMappedSize
+            && size <= (uint64_t)(mMappedSize - offset)) {
+        return mMappedData + offset;
+    }
+    if (mDataSource->readAt(offset, buffer, size) < (ssize_t)size) {
+        return NULL;
+    }
+    return buffer;
+}
+
 int32_t MPEG4Source::parseHEVCLayerId(const uint8_t *data, size_t size) {
     if (data == nullptr || size < mNALLengthSize + 2) {
         return -1;
@@ -5761,7 +5798,7 @@ media_status_t MPEG4Source::read(
 
                size_t totalSize = samplesToRead * size;
                 uint8_t* buf = (uint8_t *)mBuffer->data();
-                ssize_t bytesRead = mDataSource->readAt(offset, buf, totalSize);
+                ssize_t bytesRead = readSampleData(offset, buf, totalSize);
                 if (bytesRead < (ssize_t)totalSize) {
                     mBuffer->release();
                     mBuffer = NULL;
@@ -5793,7 +5830,7 @@ media_status_t MPEG4Source::read(
                 mBuffer->set_range(0, totalSize);
             } else {
                 ssize_t num_bytes_read =
-                    mDataSource->readAt(offset, (uint8_t *)mBuffer->data(), size);
+                    readSampleData(offset, (uint8_t *)mBuffer->data(), size);
 
                 if (num_bytes_read < (ssize_t)size) {
                     mBuffer->release();
@@ -5851,7 +5888,7 @@ media_status_t MPEG4Source::read(
         dstData[dstOffset++] = (uint8_t)((size >> 8) & 0xFF);
         dstData[dstOffset++] = (uint8_t)((size >> 0) & 0xFF);
 
-        ssize_t numBytesRead = mDataSource->readAt(offset, dstData + dstOffset, size);
+        ssize_t numBytesRead = readSampleData(offset, dstData + dstOffset, size);
         if (numBytesRead != (ssize_t)size) {
             mBuffer->release();
             mBuffer = NULL;
@@ -5885,17 +5922,20 @@ media_status_t MPEG4Source::read(
     } else {
         // Whole NAL units are returned but each fragment is prefixed by
         // the start code (0x00 00 00 01).
-        ssize_t num_bytes_read = 0;
-        num_bytes_read = mDataSource->readAt(offset, mSrcBuffer, size);
+        uint8_t *dstData = (uint8_t *)mBuffer->data();
 
-        if (num_bytes_read < (ssize_t)size) {
+        // Start codes take the place of 4 byte NAL lengths, so unless the
+        // file is mapped such samples are converted in place.
+        const uint8_t *srcData = getSampleData(offset, size,
+                mNALLengthSize == 4 && size <= mBuffer->size() ? dstData : mSrcBuffer);
+
+        if (srcData == NULL) {
             mBuffer->release();
             mBuffer = NULL;
 
             return AMEDIA_ERROR_IO;
         }
 
-        uint8_t *dstData = (uint8_t *)mBuffer->data();
         size_t srcOffset = 0;
         size_t dstOffset = 0;
 
@@ -5903,7 +5943,7 @@ media_status_t MPEG4Source::read(
             bool isMalFormed = !isInRange((size_t)0u, size, srcOffset, mNALLengthSize);
             size_t nalLength = 0;
             if (!isMalFormed) {
-                nalLength = parseNALSize(&mSrcBuffer[srcOffset]);
+                nalLength = parseNALSize(&srcData[srcOffset]);
                 srcOffset += mNALLengthSize;
                 isMalFormed = !isInRange((size_t)0u, size, srcOffset, nalLength);
             }
@@ -5933,7 +5973,8 @@ media_status_t MPEG4Source::read(
             dstData[dstOffset++] = 0;
             dstData[dstOffset++] = 0;
             dstData[dstOffset++] = 1;
-            memcpy(&dstData[dstOffset], &mSrcBuffer[srcOffset], nalLength);
+            // may overlap when converting in place; dstOffset never passes srcOffset.
+            memmove(&dstData[dstOffset], &srcData[srcOffset], nalLength);
             srcOffset += nalLength;
             dstOffset += nalLength;
         }
@@ -6145,7 +6186,7 @@ media_status_t MPEG4Source::fragmentedRead(
             }
 
             ssize_t num_bytes_read =
-                mDataSource->readAt(offset, (uint8_t *)mBuffer->data(), size);
+                readSampleData(offset, (uint8_t *)mBuffer->data(), size);
 
             if (num_bytes_read < (ssize_t)size) {
                 mBuffer->release();
@@ -6194,18 +6235,14 @@ media_status_t MPEG4Source::fragmentedRead(
         ALOGV("whole NAL");
         // Whole NAL units are returned but each fragment is prefixed by
         // the start code (0x00 00 00 01).
-        ssize_t num_bytes_read = 0;
-        void *data = NULL;
         bool isMalFormed = false;
         int32_t max_size;
         if (!AMediaFormat_getInt32(mFormat, AMEDIAFORMAT_KEY_MAX_INPUT_SIZE, &max_size)
                 || !isInRange((size_t)0u, (size_t)max_size, size)) {
             isMalFormed = true;
-        } else {
-            data = mSrcBuffer;
         }
 
-        if (isMalFormed || data == NULL) {
+        if (isMalFormed || mSrcBuffer == NULL) {
             ALOGE("isMalFormed size %zu", size);
             if (mBuffer != NULL) {
                 mBuffer->release();
@@ -6213,9 +6250,14 @@ media_status_t MPEG4Source::fragmentedRead(
             }
             return AMEDIA_ERROR_MALFORMED;
         }
-        num_bytes_read = mDataSource->readAt(offset, data, size);
 
-        if (num_bytes_read < (ssize_t)size) {
+        uint8_t *dstData = (uint8_t *)mBuffer->data();
+
+        // see read() for the in place conversion.
+        const uint8_t *srcData = getSampleData(offset, size,
+                mNALLengthSize == 4 && size <= mBuffer->size() ? dstData : mSrcBuffer);
+
+        if (srcData == NULL) {
             mBuffer->release();
             mBuffer = NULL;
 
@@ -6223,7 +6265,6 @@ media_status_t MPEG4Source::fragmentedRead(
             return AMEDIA_ERROR_IO;
         }
 
-        uint8_t *dstData = (uint8_t *)mBuffer->data();
         size_t srcOffset = 0;
         size_t dstOffset = 0;
 
@@ -6231,7 +6272,7 @@ media_status_t MPEG4Source::fragmentedRead(
             isMalFormed = !isInRange((size_t)0u, size, srcOffset, mNALLengthSize);
             size_t nalLength = 0;
             if (!isMalFormed) {
-                nalLength = parseNALSize(&mSrcBuffer[srcOffset]);
+                nalLength = parseNALSize(&srcData[srcOffset]);
                 srcOffset += mNALLengthSize;
                 isMalFormed = !isInRange((size_t)0u, size, srcOffset, nalLength)
                         || !isInRange((size_t)0u, mBuffer->size(), dstOffset, (size_t)4u)
@@ -6263,7 +6304,7 @@ media_status_t MPEG4Source::fragmentedRead(
             dstData[dstOffset++] = 0;
             dstData[dstOffset++] = 0;
             dstData[dstOffset++] = 1;
-            memcpy(&dstData[dstOffset], &mSrcBuffer[srcOffset], nalLength);
+            memmove(&dstData[dstOffset], &srcData[srcOffset], nalLength);
             srcOffset += nalLength;
             dstOffset += nalLength;
         }
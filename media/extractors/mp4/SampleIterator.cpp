@@ -70,8 +70,10 @@ status_t SampleIterator::seekTo(uint32_t sampleIndex) {
         return OK;
     }
 
-    if (!mInitialized || sampleIndex < mFirstChunkSampleIndex) {
+    if (!mInitialized) {
         reset();
+    } else if (sampleIndex < mFirstChunkSampleIndex) {
+        rewindChunkRange(sampleIndex);
     }
 
     if (sampleIndex >= mStopChunkSampleIndex) {
@@ -93,36 +95,33 @@ status_t SampleIterator::seekTo(uint32_t sampleIndex) {
         (sampleIndex - mFirstChunkSampleIndex) / mSamplesPerChunk
         + mFirstChunk;
 
-    if (!mInitialized || chunk != mCurrentChunkIndex) {
+    bool sameChunk = mInitialized && chunk == mCurrentChunkIndex;
+    if (!sameChunk) {
         status_t err;
         if ((err = getChunkOffset(chunk, &mCurrentChunkOffset)) != OK) {
             ALOGE("getChunkOffset return error");
             return err;
         }
 
-        mCurrentChunkSampleSizes.clear();
-
         uint32_t firstChunkSampleIndex =
             mFirstChunkSampleIndex
                 + mSamplesPerChunk * (chunk - mFirstChunk);
 
-        for (uint32_t i = 0; i < mSamplesPerChunk; ++i) {
-            size_t sampleSize;
-            if ((err = getSampleSizeDirect(
-                            firstChunkSampleIndex + i, &sampleSize)) != OK) {
-                ALOGE("getSampleSizeDirect return error");
-                // stsc sample count is not sync with stsz sample count
-                if (err == ERROR_OUT_OF_RANGE) {
-                    ALOGW("stsc samples(%d) not sync with stsz samples(%d)", mSamplesPerChunk, i);
-                    mSamplesPerChunk = i;
-                    break;
-                } else{
-                    mCurrentChunkSampleSizes.clear();
-                    return err;
-                }
-            }
+        // firstChunkSampleIndex <= sampleIndex < mNumSampleSizes here.
+        uint32_t numSamples = mSamplesPerChunk;
+        if (numSamples > mTable->mNumSampleSizes - firstChunkSampleIndex) {
+            // stsc sample count is not sync with stsz sample count
+            numSamples = mTable->mNumSampleSizes - firstChunkSampleIndex;
+            ALOGW("stsc samples(%d) not sync with stsz samples(%d)", mSamplesPerChunk, numSamples);
+            mSamplesPerChunk = numSamples;
+        }
 
-            mCurrentChunkSampleSizes.push(sampleSize);
+        if ((err = getSampleSizesDirect(
+                        firstChunkSampleIndex, numSamples,
+                        &mCurrentChunkSampleSizes)) != OK) {
+            ALOGE("getSampleSizesDirect return error");
+            mCurrentChunkSampleSizes.clear();
+            return err;
         }
 
         mCurrentChunkIndex = chunk;
@@ -131,9 +130,14 @@ status_t SampleIterator::seekTo(uint32_t sampleIndex) {
     uint32_t chunkRelativeSampleIndex =
         (sampleIndex - mFirstChunkSampleIndex) % mSamplesPerChunk;
 
-    mCurrentSampleOffset = mCurrentChunkOffset;
-    for (uint32_t i = 0; i < chunkRelativeSampleIndex; ++i) {
-        mCurrentSampleOffset += mCurrentChunkSampleSizes[i];
+    if (sameChunk && sampleIndex == mCurrentSampleIndex + 1) {
+        // sequential access, continue from the previous sample.
+        mCurrentSampleOffset += mCurrentSampleSize;
+    } else {
+        mCurrentSampleOffset = mCurrentChunkOffset;
+        for (uint32_t i = 0; i < chunkRelativeSampleIndex; ++i) {
+            mCurrentSampleOffset += mCurrentChunkSampleSizes[i];
+        }
     }
 
     mCurrentSampleSize = mCurrentChunkSampleSizes[chunkRelativeSampleIndex];
@@ -149,6 +153,8 @@ status_t SampleIterator::seekTo(uint32_t sampleIndex) {
     if ((err = findSampleTimeAndDuration(
             sampleIndex, &mCurrentSampleTime, &mCurrentSampleDuration)) != OK) {
         ALOGE("findSampleTime return error");
+        // the current sample offset and size no longer match mCurrentSampleIndex.
+        mInitialized = false;
         return err;
     }
 
@@ -169,6 +175,10 @@ status_t SampleIterator::findChunkRange(uint32_t sampleIndex) {
 
         mFirstChunkSampleIndex = mStopChunkSampleIndex;
 
+        if (mSampleToChunkIndex == mSampleToChunkFirstSamples.size()) {
+            mSampleToChunkFirstSamples.push(mFirstChunkSampleIndex);
+        }
+
         const SampleTable::SampleToChunkEntry *entry =
             &mTable->mSampleToChunkEntries[mSampleToChunkIndex];
 
@@ -200,6 +210,30 @@ status_t SampleIterator::findChunkRange(uint32_t sampleIndex) {
     return OK;
 }
 
+void SampleIterator::rewindChunkRange(uint32_t sampleIndex) {
+    if (mSampleToChunkFirstSamples.isEmpty()) {
+        reset();
+        return;
+    }
+
+    // find the last visited entry starting at or before |sampleIndex| and
+    // let findChunkRange() continue from there.
+    size_t left = 0;
+    size_t right = mSampleToChunkFirstSamples.size();
+    while (right - left > 1) {
+        size_t center = left + (right - left) / 2;
+        if (mSampleToChunkFirstSamples[center] <= sampleIndex) {
+            left = center;
+        } else {
+            right = center;
+        }
+    }
+
+    mSampleToChunkIndex = left;
+    mFirstChunkSampleIndex = mSampleToChunkFirstSamples[left];
+    mStopChunkSampleIndex = mFirstChunkSampleIndex;
+}
+
 status_t SampleIterator::getChunkOffset(uint32_t chunk, off64_t *offset) {
     *offset = 0;
 
@@ -307,6 +341,80 @@ status_t SampleIterator::getSampleSizeDirect(
     return OK;
 }
 
+status_t SampleIterator::getSampleSizesDirect(
+        uint32_t sampleIndex, uint32_t count, Vector<size_t> *sizes) {
+    sizes->clear();
+
+    if (sampleIndex > mTable->mNumSampleSizes
+            || count > mTable->mNumSampleSizes - sampleIndex) {
+        return ERROR_OUT_OF_RANGE;
+    }
+
+    sizes->setCapacity(count);
+
+    if (mTable->mDefaultSampleSize > 0) {
+        sizes->insertAt(mTable->mDefaultSampleSize, 0, count);
+        return OK;
+    }
+
+    static const size_t kMaxReadSize = 1024;
+
+    const uint32_t fieldSize = mTable->mSampleSizeFieldSize;
+    if (fieldSize == 0) {
+        return ERROR_MALFORMED;
+    }
+    const uint32_t samplesPerRead = kMaxReadSize * 8 / fieldSize;
+
+    // one spare byte for 4 bit fields starting at an odd sample.
+    uint8_t buffer[kMaxReadSize + 1];
+
+    while (count > 0) {
+        uint32_t n = count < samplesPerRead ? count : samplesPerRead;
+
+        off64_t firstByte = (off64_t)sampleIndex * fieldSize / 8;
+        off64_t endByte = ((off64_t)(sampleIndex + n) * fieldSize + 7) / 8;
+        size_t numBytes = endByte - firstByte;
+
+        if (mTable->mDataSource->readAt(
+                    mTable->mSampleSizeOffset + 12 + firstByte,
+                    buffer, numBytes) < (ssize_t)numBytes) {
+            sizes->clear();
+            return ERROR_IO;
+        }
+
+        for (uint32_t i = 0; i < n; ++i) {
+            switch (fieldSize) {
+                case 32:
+                    sizes->push(U32_AT(&buffer[4 * i]));
+                    break;
+
+                case 16:
+                    sizes->push(U16_AT(&buffer[2 * i]));
+                    break;
+
+                case 8:
+                    sizes->push(buffer[i]);
+                    break;
+
+                default:
+                {
+                    CHECK_EQ(fieldSize, 4u);
+
+                    uint32_t x = sampleIndex + i;
+                    uint8_t byte = buffer[x / 2 - firstByte];
+                    sizes->push((x & 1) ? byte & 0x0f : byte >> 4);
+                    break;
+                }
+            }
+        }
+
+        sampleIndex += n;
+        count -= n;
+    }
+
+    return OK;
+}
+
 status_t SampleIterator::findSampleTimeAndDuration(
         uint32_t sampleIndex, uint64_t *time, uint64_t *duration) {
     if (sampleIndex >= mTable->mNumSampleSizes) {
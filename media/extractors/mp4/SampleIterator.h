@@ -44,6 +44,11 @@ struct SampleIterator {
     status_t getSampleSizeDirect(
             uint32_t sampleIndex, size_t *size);
 
+    // Reads the sizes of |count| consecutive samples with as few reads as
+    // possible.
+    status_t getSampleSizesDirect(
+            uint32_t sampleIndex, uint32_t count, Vector<size_t> *sizes);
+
 private:
     SampleTable *mTable;
 
@@ -57,6 +62,10 @@ private:
     uint32_t mSamplesPerChunk;
     uint32_t mChunkDesc;
 
+    // First sample index of each sample-to-chunk entry visited so far, so
+    // that seeking backwards does not rescan the table from the start.
+    Vector<uint32_t> mSampleToChunkFirstSamples;
+
     uint32_t mCurrentChunkIndex;
     off64_t mCurrentChunkOffset;
     Vector<size_t> mCurrentChunkSampleSizes;
@@ -74,6 +83,7 @@ private:
     uint64_t mCurrentSampleDuration;
 
     void reset();
+    void rewindChunkRange(uint32_t sampleIndex);
     status_t findChunkRange(uint32_t sampleIndex);
     status_t getChunkOffset(uint32_t chunk, off64_t *offset);
     status_t findSampleTimeAndDuration(uint32_t sampleIndex, uint64_t *time, uint64_t *duration);
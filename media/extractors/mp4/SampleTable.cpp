@@ -18,6 +18,7 @@
 //#define LOG_NDEBUG 0
 #include <utils/Log.h>
 
+#include <algorithm>
 #include <limits>
 
 #include "SampleTable.h"
@@ -128,7 +129,10 @@ SampleTable::SampleTable(DataSourceHelper *source)
       mHasTimeToSample(false),
       mTimeToSampleCount(0),
       mTimeToSample(NULL),
+      mPackedSampleTimeEntries(NULL),
+      mSampleTimeBlockBases(NULL),
       mSampleTimeEntries(NULL),
+      mSampleTimeIndexBuilt(false),
       mCompositionTimeDeltaEntries(NULL),
       mNumCompositionTimeDeltaEntries(0),
       mCompositionDeltaLookup(new CompositionDeltaLookup),
@@ -160,6 +164,12 @@ SampleTable::~SampleTable() {
     delete[] mSampleTimeEntries;
     mSampleTimeEntries = NULL;
 
+    delete[] mPackedSampleTimeEntries;
+    mPackedSampleTimeEntries = NULL;
+
+    delete[] mSampleTimeBlockBases;
+    mSampleTimeBlockBases = NULL;
+
     delete mSampleIterator;
     mSampleIterator = NULL;
 }
@@ -598,16 +608,29 @@ status_t SampleTable::getMaxSampleSize(size_t *max_size) {
 
     *max_size = 0;
 
-    for (uint32_t i = 0; i < mNumSampleSizes; ++i) {
-        size_t sample_size;
-        status_t err = getSampleSize_l(i, &sample_size);
+    if (mDefaultSampleSize > 0) {
+        if (mNumSampleSizes > 0) {
+            *max_size = mDefaultSampleSize;
+        }
+        return OK;
+    }
+
+    // Read the sample sizes in batches rather than one sample at a time.
+    static const uint32_t kMaxSamplesPerBatch = 4096;
+
+    Vector<size_t> sizes;
+    for (uint32_t i = 0; i < mNumSampleSizes; i += sizes.size()) {
+        uint32_t n = std::min(mNumSampleSizes - i, kMaxSamplesPerBatch);
+        status_t err = mSampleIterator->getSampleSizesDirect(i, n, &sizes);
 
         if (err != OK) {
             return err;
         }
 
-        if (sample_size > *max_size) {
-            *max_size = sample_size;
+        for (size_t j = 0; j < sizes.size(); ++j) {
+            if (sizes[j] > *max_size) {
+                *max_size = sizes[j];
+            }
         }
     }
 
@@ -618,30 +641,113 @@ uint32_t abs_difference(uint64_t time1, uint64_t time2) {
     return time1 > time2 ? time1 - time2 : time2 - time1;
 }
 
-// static
-int SampleTable::CompareIncreasingTime(const void *_a, const void *_b) {
-    const SampleTimeEntry *a = (const SampleTimeEntry *)_a;
-    const SampleTimeEntry *b = (const SampleTimeEntry *)_b;
-
-    if (a->mCompositionTime < b->mCompositionTime) {
-        return -1;
-    } else if (a->mCompositionTime > b->mCompositionTime) {
-        return 1;
-    }
-
-    return 0;
-}
-
 void SampleTable::buildSampleEntriesTable() {
     Mutex::Autolock autoLock(mLock);
 
-    if (mSampleTimeEntries != NULL || mNumSampleSizes == 0) {
+    if (mSampleTimeIndexBuilt || mNumSampleSizes == 0) {
         if (mNumSampleSizes == 0) {
             ALOGE("b/23247055, mNumSampleSizes(%u)", mNumSampleSizes);
         }
         return;
     }
 
+    if (!buildSampleTimeRuns_l()) {
+        mSampleTimeRuns.clear();
+        buildSortedSampleTimeEntries_l();
+    }
+
+    mSampleTimeIndexBuilt = !mSampleTimeRuns.empty()
+            || mPackedSampleTimeEntries != NULL || mSampleTimeEntries != NULL;
+}
+
+// Walks the stts and ctts runs together. Within each piece both the sample
+// duration and the composition time offset are constant, so composition time
+// is linear in the sample index. Returns false if composition times decrease
+// anywhere (frames are reordered), if the tables do not cover every sample or
+// if a time would overflow, in which case the sorted table must be used.
+bool SampleTable::buildSampleTimeRuns_l() {
+    uint32_t sttsIndex = 0;
+    uint32_t sttsRemaining = 0;
+    uint32_t delta = 0;
+
+    size_t cttsIndex = 0;
+    uint32_t cttsRemaining = 0;
+    int32_t offset = 0;
+
+    uint32_t sampleIndex = 0;
+    uint64_t sampleTime = 0;
+    uint64_t lastCompositionTime = 0;
+
+    while (sampleIndex < mNumSampleSizes) {
+        while (sttsRemaining == 0) {
+            if (sttsIndex == mTimeToSampleCount) {
+                return false;
+            }
+            sttsRemaining = mTimeToSample[2 * sttsIndex];
+            delta = mTimeToSample[2 * sttsIndex + 1];
+            ++sttsIndex;
+        }
+
+        while (cttsRemaining == 0) {
+            if (cttsIndex == mNumCompositionTimeDeltaEntries) {
+                // samples past the end of ctts have no offset.
+                cttsRemaining = mNumSampleSizes - sampleIndex;
+                offset = 0;
+                break;
+            }
+            cttsRemaining = (uint32_t)mCompositionTimeDeltaEntries[2 * cttsIndex];
+            offset = mCompositionTimeDeltaEntries[2 * cttsIndex + 1];
+            ++cttsIndex;
+        }
+
+        uint32_t n = std::min(std::min(sttsRemaining, cttsRemaining),
+                mNumSampleSizes - sampleIndex);
+
+        if (offset < 0 ? sampleTime < (uint64_t)(-(int64_t)offset)
+                       : sampleTime > UINT64_MAX - offset) {
+            return false;
+        }
+        uint64_t firstTime = offset < 0
+                ? sampleTime - (uint64_t)(-(int64_t)offset) : sampleTime + offset;
+
+        uint64_t span;
+        uint64_t lastTime;
+        if (__builtin_mul_overflow((uint64_t)n, (uint64_t)delta, &span)
+                || __builtin_add_overflow(sampleTime, span, &sampleTime)
+                || __builtin_add_overflow(firstTime, span - delta, &lastTime)) {
+            return false;
+        }
+
+        if (!mSampleTimeRuns.empty() && firstTime < lastCompositionTime) {
+            return false;
+        }
+        lastCompositionTime = lastTime;
+
+        bool extendsLastRun = false;
+        if (!mSampleTimeRuns.empty()) {
+            const SampleTimeRun &run = mSampleTimeRuns.top();
+            extendsLastRun = run.mDelta == delta && run.mFirstTime
+                    + (uint64_t)(sampleIndex - run.mFirstSample) * delta == firstTime;
+        }
+        if (!extendsLastRun) {
+            SampleTimeRun run;
+            run.mFirstSample = sampleIndex;
+            run.mDelta = delta;
+            run.mFirstTime = firstTime;
+            mSampleTimeRuns.push(run);
+        }
+
+        sampleIndex += n;
+        sttsRemaining -= n;
+        cttsRemaining -= n;
+    }
+
+    ALOGV("%u samples indexed by %zu time runs",
+            mNumSampleSizes, mSampleTimeRuns.size());
+    return true;
+}
+
+void SampleTable::buildSortedSampleTimeEntries_l() {
     mTotalSize += (uint64_t)mNumSampleSizes * sizeof(SampleTimeEntry);
     if (mTotalSize > kMaxTotalSize) {
         ALOGE("Sample entry table size would make sample table too large.\n"
@@ -711,8 +817,91 @@ void SampleTable::buildSampleEntriesTable() {
         }
     }
 
-    qsort(mSampleTimeEntries, mNumSampleSizes, sizeof(SampleTimeEntry),
-          CompareIncreasingTime);
+    std::sort(mSampleTimeEntries, mSampleTimeEntries + mNumSampleSizes,
+            [](const SampleTimeEntry &a, const SampleTimeEntry &b) {
+                return a.mCompositionTime < b.mCompositionTime;
+            });
+
+    // Pack the sorted entries, unless a block spans more than 32 bits of time.
+    uint32_t numBlocks =
+            (mNumSampleSizes + kSampleTimeBlockSize - 1) / kSampleTimeBlockSize;
+    mPackedSampleTimeEntries =
+            new (std::nothrow) PackedSampleTimeEntry[mNumSampleSizes];
+    mSampleTimeBlockBases = new (std::nothrow) uint64_t[numBlocks];
+
+    bool packed = mPackedSampleTimeEntries != NULL && mSampleTimeBlockBases != NULL;
+    for (uint32_t i = 0; packed && i < mNumSampleSizes; ++i) {
+        uint64_t base;
+        if (i % kSampleTimeBlockSize == 0) {
+            base = mSampleTimeEntries[i].mCompositionTime;
+            mSampleTimeBlockBases[i / kSampleTimeBlockSize] = base;
+        } else {
+            base = mSampleTimeBlockBases[i / kSampleTimeBlockSize];
+        }
+        uint64_t timeDelta = mSampleTimeEntries[i].mCompositionTime - base;
+        if (timeDelta > UINT32_MAX) {
+            packed = false;
+            break;
+        }
+        mPackedSampleTimeEntries[i].mSampleIndex = mSampleTimeEntries[i].mSampleIndex;
+        mPackedSampleTimeEntries[i].mTimeDelta = (uint32_t)timeDelta;
+    }
+
+    if (packed) {
+        delete[] mSampleTimeEntries;
+        mSampleTimeEntries = NULL;
+        mTotalSize -= (uint64_t)mNumSampleSizes * sizeof(SampleTimeEntry);
+        mTotalSize += (uint64_t)mNumSampleSizes * sizeof(PackedSampleTimeEntry)
+                + (uint64_t)numBlocks * sizeof(uint64_t);
+    } else {
+        delete[] mPackedSampleTimeEntries;
+        mPackedSampleTimeEntries = NULL;
+        delete[] mSampleTimeBlockBases;
+        mSampleTimeBlockBases = NULL;
+    }
+}
+
+uint64_t SampleTable::getCompositionTimeAt(uint32_t index) const {
+    if (mPackedSampleTimeEntries != NULL) {
+        return mSampleTimeBlockBases[index / kSampleTimeBlockSize]
+                + mPackedSampleTimeEntries[index].mTimeDelta;
+    }
+
+    if (mSampleTimeEntries != NULL) {
+        return mSampleTimeEntries[index].mCompositionTime;
+    }
+
+    if (mSampleTimeRuns.empty()) {
+        return 0;
+    }
+
+    // find the last run starting at or before |index|.
+    size_t left = 0;
+    size_t right = mSampleTimeRuns.size();
+    while (right - left > 1) {
+        size_t center = left + (right - left) / 2;
+        if (mSampleTimeRuns[center].mFirstSample <= index) {
+            left = center;
+        } else {
+            right = center;
+        }
+    }
+
+    const SampleTimeRun &run = mSampleTimeRuns[left];
+    return run.mFirstTime + (uint64_t)(index - run.mFirstSample) * run.mDelta;
+}
+
+uint32_t SampleTable::getSampleIndexAt(uint32_t index) const {
+    if (mPackedSampleTimeEntries != NULL) {
+        return mPackedSampleTimeEntries[index].mSampleIndex;
+    }
+
+    if (mSampleTimeEntries != NULL) {
+        return mSampleTimeEntries[index].mSampleIndex;
+    }
+
+    // presentation order is decode order.
+    return index;
 }
 
 status_t SampleTable::findSampleAtTime(
@@ -720,7 +909,7 @@ status_t SampleTable::findSampleAtTime(
         uint32_t *sample_index, uint32_t flags) {
     buildSampleEntriesTable();
 
-    if (mSampleTimeEntries == NULL) {
+    if (!mSampleTimeIndexBuilt) {
         return ERROR_OUT_OF_RANGE;
     }
 
@@ -728,7 +917,7 @@ status_t SampleTable::findSampleAtTime(
         if (req_time >= mNumSampleSizes) {
             return ERROR_OUT_OF_RANGE;
         }
-        *sample_index = mSampleTimeEntries[req_time].mSampleIndex;
+        *sample_index = getSampleIndexAt(req_time);
         return OK;
     }
 
@@ -744,7 +933,7 @@ status_t SampleTable::findSampleAtTime(
         } else if (req_time > centerTime) {
             left = center + 1;
         } else {
-            *sample_index = mSampleTimeEntries[center].mSampleIndex;
+            *sample_index = getSampleIndexAt(center);
             return OK;
         }
     }
@@ -793,7 +982,7 @@ status_t SampleTable::findSampleAtTime(
         }
     }
 
-    *sample_index = mSampleTimeEntries[closestIndex].mSampleIndex;
+    *sample_index = getSampleIndexAt(closestIndex);
     return OK;
 }
 
@@ -987,9 +1176,8 @@ status_t SampleTable::getMetaDataForSample(
                     && (mSyncSamples[mLastSyncSampleIndex] <= sampleIndex)
                 ? mLastSyncSampleIndex : 0;
 
-            while (i < mNumSyncSamples && mSyncSamples[i] < sampleIndex) {
-                ++i;
-            }
+            i = std::lower_bound(mSyncSamples + i, mSyncSamples + mNumSyncSamples,
+                    sampleIndex) - mSyncSamples;
 
             if (i < mNumSyncSamples && mSyncSamples[i] == sampleIndex) {
                 *isSyncSample = true;
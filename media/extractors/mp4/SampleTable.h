@@ -24,6 +24,7 @@
 #include <media/MediaExtractorPluginHelper.h>
 #include <media/stagefright/MediaErrors.h>
 #include <utils/RefBase.h>
+#include <utils/Vector.h>
 #include <utils/threads.h>
 
 namespace android {
@@ -126,12 +127,38 @@ private:
     uint32_t mTimeToSampleCount;
     uint32_t* mTimeToSample;
 
+    // Presentation order index, built lazily by buildSampleEntriesTable().
+    // If composition times never decrease in decode order (no reordering),
+    // it is the stts and ctts runs merged, so its size depends on the number
+    // of runs rather than the number of samples.
+    struct SampleTimeRun {
+        uint32_t mFirstSample;
+        uint32_t mDelta;
+        uint64_t mFirstTime;
+    };
+    Vector<SampleTimeRun> mSampleTimeRuns;
+
+    // Otherwise the samples are sorted by composition time and stored in
+    // blocks of kSampleTimeBlockSize, each entry holding its time relative
+    // to the first entry of its block.
+    static const uint32_t kSampleTimeBlockSize = 64;
+
     struct SampleTimeEntry {
         uint32_t mSampleIndex;
         uint64_t mCompositionTime;
     };
+    struct PackedSampleTimeEntry {
+        uint32_t mSampleIndex;
+        uint32_t mTimeDelta;
+    };
+    PackedSampleTimeEntry *mPackedSampleTimeEntries;
+    uint64_t *mSampleTimeBlockBases;
+
+    // Full entries are only kept if a block spans more than 32 bits of time.
     SampleTimeEntry *mSampleTimeEntries;
 
+    bool mSampleTimeIndexBuilt;
+
     int32_t *mCompositionTimeDeltaEntries;
     size_t mNumCompositionTimeDeltaEntries;
     CompositionDeltaLookup *mCompositionDeltaLookup;
@@ -158,17 +185,20 @@ private:
     // normally we don't round
     inline uint64_t getSampleTime(
             size_t sample_index, uint64_t scale_num, uint64_t scale_den) const {
-        return (sample_index < (size_t)mNumSampleSizes && mSampleTimeEntries != NULL
-                && scale_den != 0)
-                ? (mSampleTimeEntries[sample_index].mCompositionTime * scale_num) / scale_den : 0;
+        return (sample_index < (size_t)mNumSampleSizes && scale_den != 0)
+                ? (getCompositionTimeAt(sample_index) * scale_num) / scale_den : 0;
     }
 
+    // |index| is a position in presentation order.
+    uint64_t getCompositionTimeAt(uint32_t index) const;
+    uint32_t getSampleIndexAt(uint32_t index) const;
+
     status_t getSampleSize_l(uint32_t sample_index, size_t *sample_size);
     int32_t getCompositionTimeOffset(uint32_t sampleIndex);
 
-    static int CompareIncreasingTime(const void *, const void *);
-
     void buildSampleEntriesTable();
+    bool buildSampleTimeRuns_l();
+    void buildSortedSampleTimeEntries_l();
 
     SampleTable(const SampleTable &);
     SampleTable &operator=(const SampleTable &);
@@ -0,0 +1,334 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "SampleTable_test"
+
+#include <gtest/gtest.h>
+#include <utils/Log.h>
+
+#include <media/stagefright/foundation/ADebug.h>
+#include <media/stagefright/foundation/ByteUtils.h>
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "SampleTable.h"
+
+namespace android {
+
+// Data source over a memory buffer holding the sample table boxes.
+class MemoryDataSource : public DataSourceHelper {
+public:
+    MemoryDataSource()
+        : DataSourceHelper((CDataSource *)NULL),
+          mNumReads(0) {
+    }
+
+    virtual ssize_t readAt(off64_t offset, void *data, size_t size) {
+        ++mNumReads;
+        if (offset < 0 || (size_t)offset >= mData.size()) {
+            return 0;
+        }
+        size_t n = std::min(size, mData.size() - (size_t)offset);
+        memcpy(data, &mData[offset], n);
+        return n;
+    }
+
+    virtual status_t getSize(off64_t *size) {
+        *size = mData.size();
+        return OK;
+    }
+
+    virtual uint32_t flags() {
+        return 0;
+    }
+
+    // Appends a full box payload (version/flags, entry count, entries) and
+    // returns its offset.
+    off64_t appendBox(uint32_t versionFlags, const std::vector<uint32_t> &fields) {
+        off64_t offset = mData.size();
+        append32(versionFlags);
+        for (uint32_t field : fields) {
+            append32(field);
+        }
+        return offset;
+    }
+
+    size_t sizeFrom(off64_t offset) const {
+        return mData.size() - offset;
+    }
+
+    std::vector<uint8_t> mData;
+    size_t mNumReads;
+
+private:
+    void append32(uint32_t x) {
+        mData.push_back(x >> 24);
+        mData.push_back(x >> 16);
+        mData.push_back(x >> 8);
+        mData.push_back(x);
+    }
+};
+
+// A synthetic track with |numSamples| samples of varying size, a sync sample
+// every kGopSize samples and, if |reordered|, IPBB style composition offsets.
+struct SyntheticTrack {
+    enum : uint32_t {
+        kDelta = 375,  // 240fps at 90kHz
+        kSamplesPerChunk = 7,
+        kGopSize = 30,
+    };
+
+    SyntheticTrack(uint32_t numSamples, bool reordered, int32_t cttsShift = 0)
+        : mNumSamples(numSamples) {
+        uint32_t numChunks = (numSamples + kSamplesPerChunk - 1) / kSamplesPerChunk;
+        uint64_t offset = 4096;
+        uint32_t sampleIndex = 0;
+        for (uint32_t chunk = 0; chunk < numChunks; ++chunk) {
+            mChunkOffsets.push_back(offset);
+            for (uint32_t i = 0; i < kSamplesPerChunk && sampleIndex < numSamples; ++i) {
+                uint32_t size = 1000 + (sampleIndex * 7919u) % 5000;
+                mSizes.push_back(size);
+                mOffsets.push_back(offset);
+                offset += size;
+                ++sampleIndex;
+            }
+            offset += 64;
+        }
+
+        for (uint32_t i = 0; i < numSamples; ++i) {
+            int32_t compositionOffset = cttsShift;
+            if (reordered) {
+                // decode order I P B B is presented as I B B P.
+                static const int32_t kSlots[] = { 1, 3, 0, 0 };
+                compositionOffset = kSlots[i % 4] * (int32_t)kDelta;
+            }
+            mCompositionOffsets.push_back(compositionOffset);
+            mTimes.push_back((uint64_t)i * kDelta + compositionOffset);
+        }
+    }
+
+    sp<SampleTable> open(MemoryDataSource *source, bool withCtts) {
+        sp<SampleTable> table = new SampleTable(source);
+
+        std::vector<uint32_t> fields = { 1, mNumSamples, kDelta };
+        off64_t stts = source->appendBox(0, fields);
+        EXPECT_EQ(OK, table->setTimeToSampleParams(stts, source->sizeFrom(stts)));
+
+        if (withCtts) {
+            fields = { 0 };
+            for (uint32_t i = 0; i < mNumSamples; ++i) {
+                size_t n = fields.size();
+                if (n > 1 && (int32_t)fields[n - 1] == mCompositionOffsets[i]) {
+                    ++fields[n - 2];
+                } else {
+                    fields.push_back(1);
+                    fields.push_back(mCompositionOffsets[i]);
+                    ++fields[0];
+                }
+            }
+            off64_t ctts = source->appendBox(0, fields);
+            EXPECT_EQ(OK, table->setCompositionTimeToSampleParams(
+                    ctts, source->sizeFrom(ctts)));
+        }
+
+        fields = { 1, 1, kSamplesPerChunk, 1 };
+        if (mNumSamples % kSamplesPerChunk != 0) {
+            // the last chunk is partial.
+            fields.insert(fields.end(), {
+                    (uint32_t)mChunkOffsets.size(), mNumSamples % kSamplesPerChunk, 1 });
+            ++fields[0];
+        }
+        off64_t stsc = source->appendBox(0, fields);
+        EXPECT_EQ(OK, table->setSampleToChunkParams(stsc, source->sizeFrom(stsc)));
+
+        fields = { 0, mNumSamples };
+        fields.insert(fields.end(), mSizes.begin(), mSizes.end());
+        off64_t stsz = source->appendBox(0, fields);
+        EXPECT_EQ(OK, table->setSampleSizeParams(
+                FOURCC("stsz"), stsz, source->sizeFrom(stsz)));
+
+        fields = { (uint32_t)mChunkOffsets.size() };
+        for (uint64_t offset : mChunkOffsets) {
+            fields.push_back(offset >> 32);
+            fields.push_back(offset);
+        }
+        off64_t co64 = source->appendBox(0, fields);
+        EXPECT_EQ(OK, table->setChunkOffsetParams(
+                FOURCC("co64"), co64, source->sizeFrom(co64)));
+
+        fields = { (mNumSamples + kGopSize - 1) / kGopSize };
+        for (uint32_t i = 0; i < mNumSamples; i += kGopSize) {
+            fields.push_back(i + 1);
+        }
+        off64_t stss = source->appendBox(0, fields);
+        EXPECT_EQ(OK, table->setSyncSampleParams(stss, source->sizeFrom(stss)));
+
+        EXPECT_TRUE(table->isValid());
+        return table;
+    }
+
+    uint32_t mNumSamples;
+    std::vector<uint64_t> mChunkOffsets;
+    std::vector<uint32_t> mSizes;
+    std::vector<uint64_t> mOffsets;
+    std::vector<int32_t> mCompositionOffsets;
+    std::vector<uint64_t> mTimes;
+};
+
+static int64_t nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ll + ts.tv_nsec / 1000;
+}
+
+class SampleTableTest : public ::testing::Test {
+protected:
+    void checkMetaData(SyntheticTrack &track, const sp<SampleTable> &table, uint32_t i) {
+        off64_t offset;
+        size_t size;
+        uint64_t time;
+        bool isSync;
+        uint64_t duration;
+        ASSERT_EQ(OK, table->getMetaDataForSample(i, &offset, &size, &time, &isSync, &duration));
+        EXPECT_EQ(track.mOffsets[i], (uint64_t)offset) << "sample " << i;
+        EXPECT_EQ(track.mSizes[i], size) << "sample " << i;
+        EXPECT_EQ(track.mTimes[i], time) << "sample " << i;
+        EXPECT_EQ(i % SyntheticTrack::kGopSize == 0, isSync) << "sample " << i;
+        EXPECT_EQ((uint64_t)SyntheticTrack::kDelta, duration) << "sample " << i;
+    }
+
+    void checkFindSampleAtTime(SyntheticTrack &track, const sp<SampleTable> &table) {
+        std::vector<uint32_t> presentationOrder(track.mNumSamples);
+        for (uint32_t i = 0; i < track.mNumSamples; ++i) {
+            presentationOrder[i] = i;
+        }
+        std::sort(presentationOrder.begin(), presentationOrder.end(),
+                [&track](uint32_t a, uint32_t b) { return track.mTimes[a] < track.mTimes[b]; });
+
+        for (uint32_t i = 0; i < track.mNumSamples; ++i) {
+            uint32_t sampleIndex;
+            ASSERT_EQ(OK, table->findSampleAtTime(
+                    i, 1, 1, &sampleIndex, SampleTable::kFlagFrameIndex));
+            EXPECT_EQ(presentationOrder[i], sampleIndex);
+
+            uint32_t expected = presentationOrder[i];
+            ASSERT_EQ(OK, table->findSampleAtTime(
+                    track.mTimes[expected], 1, 1, &sampleIndex, SampleTable::kFlagClosest));
+            EXPECT_EQ(expected, sampleIndex);
+
+            // a time just after the sample rounds down with kFlagBefore and up
+            // with kFlagAfter.
+            ASSERT_EQ(OK, table->findSampleAtTime(
+                    track.mTimes[expected] + 1, 1, 1, &sampleIndex, SampleTable::kFlagBefore));
+            EXPECT_EQ(expected, sampleIndex);
+            if (i + 1 < track.mNumSamples) {
+                ASSERT_EQ(OK, table->findSampleAtTime(
+                        track.mTimes[expected] + 1, 1, 1, &sampleIndex,
+                        SampleTable::kFlagAfter));
+                EXPECT_EQ(presentationOrder[i + 1], sampleIndex);
+            }
+        }
+    }
+};
+
+TEST_F(SampleTableTest, MetaDataTest) {
+    SyntheticTrack track(10000, false /* reordered */);
+    MemoryDataSource source;
+    sp<SampleTable> table = track.open(&source, false /* withCtts */);
+
+    ASSERT_EQ(track.mNumSamples, table->countSamples());
+
+    size_t maxSize;
+    ASSERT_EQ(OK, table->getMaxSampleSize(&maxSize));
+    EXPECT_EQ(*std::max_element(track.mSizes.begin(), track.mSizes.end()), maxSize);
+
+    // sequential, then backwards and random access.
+    for (uint32_t i = 0; i < track.mNumSamples; ++i) {
+        checkMetaData(track, table, i);
+    }
+    for (uint32_t i = track.mNumSamples - 1; i > 13; i -= 13) {
+        checkMetaData(track, table, i);
+    }
+    srand(42);
+    for (uint32_t i = 0; i < 1000; ++i) {
+        checkMetaData(track, table, rand() % track.mNumSamples);
+    }
+}
+
+TEST_F(SampleTableTest, FindSampleAtTimeTest) {
+    SyntheticTrack track(3000, false /* reordered */);
+    MemoryDataSource source;
+    sp<SampleTable> table = track.open(&source, false /* withCtts */);
+    checkFindSampleAtTime(track, table);
+}
+
+TEST_F(SampleTableTest, FindSampleAtTimeConstantOffsetTest) {
+    SyntheticTrack track(3000, false /* reordered */, 2 * SyntheticTrack::kDelta);
+    MemoryDataSource source;
+    sp<SampleTable> table = track.open(&source, true /* withCtts */);
+    checkFindSampleAtTime(track, table);
+}
+
+TEST_F(SampleTableTest, FindSampleAtTimeReorderedTest) {
+    SyntheticTrack track(3001, true /* reordered */);
+    MemoryDataSource source;
+    sp<SampleTable> table = track.open(&source, true /* withCtts */);
+    checkFindSampleAtTime(track, table);
+    for (uint32_t i = 0; i < track.mNumSamples; ++i) {
+        checkMetaData(track, table, i);
+    }
+}
+
+// Measures opening a three hour 240fps track: reading the maximum sample size
+// and building the presentation order index, as MPEG4Source does on start and
+// on the first seek.
+TEST_F(SampleTableTest, OpenBenchmark) {
+    static const uint32_t kNumSamples = 240 * 3600 * 3;
+
+    for (bool reordered : { false, true }) {
+        SyntheticTrack track(kNumSamples, reordered);
+        MemoryDataSource source;
+        sp<SampleTable> table = track.open(&source, reordered /* withCtts */);
+
+        size_t readsBefore = source.mNumReads;
+        int64_t startUs = nowUs();
+        size_t maxSize;
+        ASSERT_EQ(OK, table->getMaxSampleSize(&maxSize));
+        int64_t maxSizeUs = nowUs();
+        uint32_t sampleIndex;
+        ASSERT_EQ(OK, table->findSampleAtTime(
+                track.mTimes[kNumSamples / 2], 1, 1, &sampleIndex, SampleTable::kFlagClosest));
+        int64_t indexUs = nowUs();
+        EXPECT_EQ(kNumSamples / 2, sampleIndex);
+
+        for (uint32_t i = 0; i < kNumSamples; i += 997) {
+            checkMetaData(track, table, i);
+        }
+
+        printf("[ BENCH    ] %u samples%s: max sample size %lld us (%zu reads), "
+                "time index %lld us\n",
+                kNumSamples, reordered ? " (reordered)" : "",
+                (long long)(maxSizeUs - startUs), source.mNumReads - readsBefore,
+                (long long)(indexUs - maxSizeUs));
+    }
+}
+
+}  // namespace android
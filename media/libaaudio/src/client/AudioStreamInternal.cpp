@@ -98,8 +98,13 @@ aaudio_result_t AudioStreamInternal::open(const AudioStreamBuilder &builder) {
     if (getFormat() == AUDIO_FORMAT_DEFAULT) {
         setFormat(AUDIO_FORMAT_PCM_FLOAT);
     }
-    // Request FLOAT for the shared mixer.
-    request.getConfiguration().setFormat(AUDIO_FORMAT_PCM_FLOAT);
+    // Request FLOAT for the shared mixer. I16 output is mixed without conversion,
+    // and is what an exclusive stream gets for FLOAT anyway.
+    if (getDirection() == AAUDIO_DIRECTION_OUTPUT && getFormat() == AUDIO_FORMAT_PCM_16_BIT) {
+        request.getConfiguration().setFormat(AUDIO_FORMAT_PCM_16_BIT);
+    } else {
+        request.getConfiguration().setFormat(AUDIO_FORMAT_PCM_FLOAT);
+    }
 
     // Build the request to send to the server.
     request.setUserId(getuid());
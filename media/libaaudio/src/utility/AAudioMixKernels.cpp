@@ -0,0 +1,149 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__aarch64__) || defined(__ARM_NEON__)
+#define USE_NEON 1
+#include <arm_neon.h>
+#elif defined(__SSE2__)  // Part of the x86_64 ABI, and of the x86 ABI on Android.
+#define USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+#include "AAudioMixKernels.h"
+
+// Four float lanes, with the few operations the kernels need.
+#if defined(USE_NEON)
+typedef float32x4_t float4;
+static inline float4 float4_load(const float *p) { return vld1q_f32(p); }
+static inline void float4_store(float *p, float4 v) { vst1q_f32(p, v); }
+static inline float4 float4_dup(float f) { return vdupq_n_f32(f); }
+static inline float4 float4_add(float4 a, float4 b) { return vaddq_f32(a, b); }
+static inline float4 float4_mul(float4 a, float4 b) { return vmulq_f32(a, b); }
+static inline float4 float4_from_i16(const int16_t *p) {
+    return vcvtq_f32_s32(vmovl_s16(vld1_s16(p)));
+}
+static inline float4 float4_from_i32(const int32_t *p) { return vcvtq_f32_s32(vld1q_s32(p)); }
+#elif defined(USE_SSE)
+typedef __m128 float4;
+static inline float4 float4_load(const float *p) { return _mm_loadu_ps(p); }
+static inline void float4_store(float *p, float4 v) { _mm_storeu_ps(p, v); }
+static inline float4 float4_dup(float f) { return _mm_set1_ps(f); }
+static inline float4 float4_add(float4 a, float4 b) { return _mm_add_ps(a, b); }
+static inline float4 float4_mul(float4 a, float4 b) { return _mm_mul_ps(a, b); }
+static inline float4 float4_from_i16(const int16_t *p) {
+    __m128i shorts = _mm_loadl_epi64((const __m128i *) p);
+    // Put each sample in the top half of a 32-bit lane, then shift it down with sign.
+    return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(shorts, shorts), 16));
+}
+static inline float4 float4_from_i32(const int32_t *p) {
+    return _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) p));
+}
+#endif
+
+namespace {
+
+constexpr int kBytesPerI24Packed = 3;
+
+// Reads samples of one format as floats in the range -1.0 to 1.0.
+struct SourceFloat {
+    typedef float sample_t;
+    static float get(const float *source, int32_t index) {
+        return source[index];
+    }
+#if defined(USE_NEON) || defined(USE_SSE)
+    static float4 get4(const float *source, int32_t index) {
+        return float4_load(&source[index]);
+    }
+#endif
+};
+
+struct SourceI16 {
+    typedef int16_t sample_t;
+    static constexpr float kScale = 1.0f / 32768;
+    static float get(const int16_t *source, int32_t index) {
+        return source[index] * kScale;
+    }
+#if defined(USE_NEON) || defined(USE_SSE)
+    static float4 get4(const int16_t *source, int32_t index) {
+        return float4_mul(float4_from_i16(&source[index]), float4_dup(kScale));
+    }
+#endif
+};
+
+struct SourceP24 {
+    typedef uint8_t sample_t;
+    static constexpr float kScale = 1.0f / (float) (1UL << 31);
+    // Assembles a little endian sample in the top of 32 bits so the sign is correct.
+    static int32_t unpack(const uint8_t *source, int32_t index) {
+        const uint8_t *bytes = &source[index * kBytesPerI24Packed];
+        return (int32_t) (((uint32_t) bytes[2] << 24)
+                | ((uint32_t) bytes[1] << 16)
+                | ((uint32_t) bytes[0] << 8));
+    }
+    static float get(const uint8_t *source, int32_t index) {
+        return unpack(source, index) * kScale;
+    }
+#if defined(USE_NEON) || defined(USE_SSE)
+    static float4 get4(const uint8_t *source, int32_t index) {
+        // Four packed samples are exactly three little endian words.
+        uint32_t words[3];
+        memcpy(words, &source[index * kBytesPerI24Packed], sizeof(words));
+        const int32_t samples[4] = {
+            (int32_t) (words[0] << 8),
+            (int32_t) (((words[0] >> 16) & 0xff00) | (words[1] << 16)),
+            (int32_t) (((words[1] >> 8) & 0xffff00) | (words[2] << 24)),
+            (int32_t) (words[2] & 0xffffff00),
+        };
+        return float4_mul(float4_from_i32(samples), float4_dup(kScale));
+    }
+#endif
+};
+
+template <typename Source>
+void mix(float *destination, const typename Source::sample_t *source,
+         int32_t numFrames, int32_t samplesPerFrame) {
+    const int32_t numSamples = numFrames * samplesPerFrame;
+    int32_t i = 0;
+#if defined(USE_NEON) || defined(USE_SSE)
+    for (; i + 4 <= numSamples; i += 4) {
+        float4_store(&destination[i],
+                float4_add(float4_load(&destination[i]), Source::get4(source, i)));
+    }
+#endif
+    for (; i < numSamples; i++) {
+        destination[i] += Source::get(source, i);
+    }
+}
+
+} // anonymous namespace
+
+void AAudioMix_float(float *destination, const float *source,
+                     int32_t numFrames, int32_t samplesPerFrame) {
+    mix<SourceFloat>(destination, source, numFrames, samplesPerFrame);
+}
+
+void AAudioMix_i16(float *destination, const int16_t *source,
+                   int32_t numFrames, int32_t samplesPerFrame) {
+    mix<SourceI16>(destination, source, numFrames, samplesPerFrame);
+}
+
+void AAudioMix_p24(float *destination, const uint8_t *source,
+                   int32_t numFrames, int32_t samplesPerFrame) {
+    mix<SourceP24>(destination, source, numFrames, samplesPerFrame);
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AAUDIO_MIX_KERNELS_H
+#define AAUDIO_MIX_KERNELS_H
+
+#include <stdint.h>
+
+/*
+ * Kernels that add interleaved client data into a float mix buffer.
+ *
+ * Integer samples are converted to float as they are mixed, so a stream in
+ * I16 or packed I24 format is mixed straight from its FIFO.
+ *
+ * The kernels use NEON or SSE2 when available.
+ */
+
+void AAudioMix_float(float *destination, const float *source,
+                     int32_t numFrames, int32_t samplesPerFrame);
+
+void AAudioMix_i16(float *destination, const int16_t *source,
+                   int32_t numFrames, int32_t samplesPerFrame);
+
+/**
+ * @param source little endian signed 24-bit samples, packed in 3 bytes each
+ */
+void AAudioMix_p24(float *destination, const uint8_t *source,
+                   int32_t numFrames, int32_t samplesPerFrame);
+
+#endif //AAUDIO_MIX_KERNELS_H
@@ -0,0 +1,197 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Test the kernels used by the AAudio service mixer,
+ * and measure the cost of mixing a burst from many shared streams.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "fifo/FifoBuffer.h"
+#include "utility/AAudioMixKernels.h"
+
+using android::FifoBuffer;
+using android::WrappingBuffer;
+
+constexpr int kBytesPerI24Packed = 3;
+
+static int64_t getNanoseconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Source samples in every format, with the float version holding the exact
+// value of the integer ones.
+struct TestSignal {
+    TestSignal(int32_t numSamples, int seed)
+            : floats(numSamples), shorts(numSamples), packed(numSamples * kBytesPerI24Packed) {
+        for (int32_t i = 0; i < numSamples; i++) {
+            const int32_t value24 = (int32_t) (sinf(0.01f * (i + seed * 7)) * 8388607.0f);
+            const int16_t value16 = (int16_t) (value24 >> 8);
+            shorts[i] = value16;
+            packed[i * kBytesPerI24Packed] = value24 & 0xff;
+            packed[i * kBytesPerI24Packed + 1] = (value24 >> 8) & 0xff;
+            packed[i * kBytesPerI24Packed + 2] = (value24 >> 16) & 0xff;
+            floats[i] = value24 / 8388608.0f;
+        }
+    }
+
+    std::vector<float> floats;
+    std::vector<int16_t> shorts;
+    std::vector<uint8_t> packed;
+};
+
+TEST(test_mix_kernels, formats) {
+    constexpr int32_t kNumFrames = 97; // odd, to exercise the tail after the vector loop
+    for (int32_t samplesPerFrame : {1, 2, 3, 4, 6, 8}) {
+        const int32_t numSamples = kNumFrames * samplesPerFrame;
+        const TestSignal signal(numSamples, samplesPerFrame);
+        std::vector<float> expected(numSamples, 0.25f);
+        std::vector<float> expected16(numSamples, 0.25f);
+        for (int32_t i = 0; i < numSamples; i++) {
+            expected[i] += signal.floats[i];
+            expected16[i] += signal.shorts[i] / 32768.0f;
+        }
+
+        std::vector<float> mixFloat(numSamples, 0.25f);
+        std::vector<float> mixI16(numSamples, 0.25f);
+        std::vector<float> mixP24(numSamples, 0.25f);
+        // Mix in two parts, like a wrapping FIFO.
+        const int32_t split = kNumFrames / 3;
+        const int32_t offset = split * samplesPerFrame;
+        AAudioMix_float(mixFloat.data(), signal.floats.data(), split, samplesPerFrame);
+        AAudioMix_float(&mixFloat[offset], &signal.floats[offset], kNumFrames - split,
+                        samplesPerFrame);
+        AAudioMix_i16(mixI16.data(), signal.shorts.data(), split, samplesPerFrame);
+        AAudioMix_i16(&mixI16[offset], &signal.shorts[offset], kNumFrames - split,
+                      samplesPerFrame);
+        AAudioMix_p24(mixP24.data(), signal.packed.data(), split, samplesPerFrame);
+        AAudioMix_p24(&mixP24[offset], &signal.packed[offset * kBytesPerI24Packed],
+                      kNumFrames - split, samplesPerFrame);
+
+        for (int32_t i = 0; i < numSamples; i++) {
+            ASSERT_NEAR(expected[i], mixFloat[i], 1e-6)
+                    << "float channels:" << samplesPerFrame << " at " << i;
+            ASSERT_NEAR(expected16[i], mixI16[i], 1e-6)
+                    << "I16 channels:" << samplesPerFrame << " at " << i;
+            ASSERT_NEAR(expected[i], mixP24[i], 1e-6)
+                    << "P24 channels:" << samplesPerFrame << " at " << i;
+        }
+    }
+}
+
+TEST(test_mix_kernels, float_is_exact) {
+    constexpr int32_t kNumSamples = 2 * 192 + 1;
+    const TestSignal signal(kNumSamples, 3);
+    std::vector<float> expected(kNumSamples, -0.125f);
+    std::vector<float> output(kNumSamples, -0.125f);
+    for (int32_t i = 0; i < kNumSamples; i++) {
+        expected[i] += signal.floats[i];
+    }
+    AAudioMix_float(output.data(), signal.floats.data(), kNumSamples, 1);
+    EXPECT_EQ(0, memcmp(expected.data(), output.data(), kNumSamples * sizeof(float)));
+}
+
+enum MixMode {
+    MIX_MODE_SCALAR,       // the float loop the service used before the kernels
+    MIX_MODE_KERNEL,       // vector kernels
+};
+
+// Mixes bursts from streamCount stereo FIFOs, as AAudioServiceEndpointPlay does,
+// and returns the average time to mix one burst.
+static double measureBurstNanos(int streamCount, int32_t bytesPerSample, MixMode mode) {
+    constexpr int32_t kSamplesPerFrame = 2;
+    constexpr int32_t kFramesPerBurst = 192; // 4 msec at 48 kHz
+    constexpr int32_t kCapacityInFrames = kFramesPerBurst * 3 - 1; // so reads wrap
+    constexpr int kNumBursts = 2000;
+
+    const int32_t bytesPerFrame = bytesPerSample * kSamplesPerFrame;
+    const TestSignal signal(kFramesPerBurst * kSamplesPerFrame, streamCount);
+    const void *burstData = bytesPerSample == sizeof(float) ? (const void *) signal.floats.data()
+            : bytesPerSample == sizeof(int16_t) ? (const void *) signal.shorts.data()
+            : (const void *) signal.packed.data();
+
+    std::vector<std::unique_ptr<FifoBuffer>> fifos;
+    for (int i = 0; i < streamCount; i++) {
+        fifos.emplace_back(new FifoBuffer(bytesPerFrame, kCapacityInFrames));
+    }
+    std::vector<float> output(kFramesPerBurst * kSamplesPerFrame);
+
+    int64_t elapsedNanos = 0;
+    for (int burst = 0; burst < kNumBursts; burst++) {
+        for (auto &fifo : fifos) {
+            fifo->write(burstData, kFramesPerBurst); // the clients
+        }
+
+        const int64_t startNanos = getNanoseconds();
+        memset(output.data(), 0, output.size() * sizeof(float));
+        for (auto &fifo : fifos) {
+            WrappingBuffer wrappingBuffer;
+            fifo->getFullDataAvailable(&wrappingBuffer);
+            float *destination = output.data();
+            for (int part = 0; part < WrappingBuffer::SIZE; part++) {
+                const int32_t numFrames = wrappingBuffer.numFrames[part];
+                const void *source = wrappingBuffer.data[part];
+                if (numFrames <= 0) {
+                    continue;
+                }
+                if (mode == MIX_MODE_SCALAR) {
+                    const float *floatSource = (const float *) source;
+                    for (int32_t i = 0; i < numFrames * kSamplesPerFrame; i++) {
+                        *destination++ += *floatSource++;
+                    }
+                    continue;
+                }
+                if (bytesPerSample == sizeof(float)) {
+                    AAudioMix_float(destination, (const float *) source, numFrames,
+                                    kSamplesPerFrame);
+                } else if (bytesPerSample == sizeof(int16_t)) {
+                    AAudioMix_i16(destination, (const int16_t *) source, numFrames,
+                                  kSamplesPerFrame);
+                } else {
+                    AAudioMix_p24(destination, (const uint8_t *) source, numFrames,
+                                  kSamplesPerFrame);
+                }
+                destination += numFrames * kSamplesPerFrame;
+            }
+            fifo->advanceReadIndex(kFramesPerBurst);
+        }
+        elapsedNanos += getNanoseconds() - startNanos;
+    }
+    return (double) elapsedNanos / kNumBursts;
+}
+
+TEST(test_mix_kernels, burst_benchmark) {
+    for (int streamCount : {1, 2, 4, 8, 16, 32}) {
+        printf("[ BENCH    ] streams:%2d  ns/burst: float scalar %7.0f, float %7.0f,"
+               " I16 %7.0f, P24 %7.0f\n",
+               streamCount,
+               measureBurstNanos(streamCount, sizeof(float), MIX_MODE_SCALAR),
+               measureBurstNanos(streamCount, sizeof(float), MIX_MODE_KERNEL),
+               measureBurstNanos(streamCount, sizeof(int16_t), MIX_MODE_KERNEL),
+               measureBurstNanos(streamCount, kBytesPerI24Packed, MIX_MODE_KERNEL));
+    }
+}
@@ -574,6 +574,20 @@ status_t AudioRecord::getTimestamp(ExtendedTimestamp *timestamp)
     return status;
 }
 
+status_t AudioRecord::setWakeupPolicy(int64_t maxSpinNs, uint32_t wakeupFrames)
+{
+    AutoMutex lock(mLock);
+    if (mProxy == 0) {
+        return NO_INIT;
+    }
+    mMaxSpinNs = maxSpinNs;
+    mWakeupFrames = wakeupFrames;
+    mProxy->setMinimum(mWakeupFrames != 0 ? mWakeupFrames : mNotificationFramesAct);
+    mProxy->setBatchWake(mWakeupFrames != 0);
+    mProxy->setSpinWait(mMaxSpinNs);
+    return NO_ERROR;
+}
+
 // ---- Explicit Routing ---------------------------------------------------
 status_t AudioRecord::setInputDevice(audio_port_handle_t deviceId) {
     AutoMutex lock(mLock);
@@ -832,7 +846,9 @@ status_t AudioRecord::createRecord_l(const Modulo<uint32_t> &epoch, const String
     // update proxy
     mProxy = new AudioRecordClientProxy(cblk, buffers, mFrameCount, mFrameSize);
     mProxy->setEpoch(epoch);
-    mProxy->setMinimum(mNotificationFramesAct);
+    mProxy->setMinimum(mWakeupFrames != 0 ? mWakeupFrames : mNotificationFramesAct);
+    mProxy->setBatchWake(mWakeupFrames != 0);
+    mProxy->setSpinWait(mMaxSpinNs);
 
     mDeathNotifier = new DeathNotifier(this);
     IInterface::asBinder(mAudioRecord)->linkToDeath(mDeathNotifier, this);
@@ -1076,6 +1076,19 @@ ssize_t AudioTrack::setBufferSizeInFrames(size_t bufferSizeInFrames)
     return (ssize_t) mProxy->setBufferSizeInFrames((uint32_t) bufferSizeInFrames);
 }
 
+status_t AudioTrack::setWakeupPolicy(int64_t maxSpinNs, uint32_t wakeupFrames)
+{
+    AutoMutex lock(mLock);
+    if (mOutput == AUDIO_IO_HANDLE_NONE || mProxy.get() == 0) {
+        return NO_INIT;
+    }
+    mMaxSpinNs = maxSpinNs;
+    mWakeupFrames = wakeupFrames;
+    mProxy->setMinimum(mWakeupFrames != 0 ? mWakeupFrames : mNotificationFramesAct);
+    mProxy->setSpinWait(mMaxSpinNs);
+    return NO_ERROR;
+}
+
 status_t AudioTrack::setLoop(uint32_t loopStart, uint32_t loopEnd, int loopCount)
 {
     if (mSharedBuffer == 0 || isOffloadedOrDirect()) {
@@ -1605,7 +1618,8 @@ status_t AudioTrack::createTrack_l()
     playbackRateTemp.mSpeed = effectiveSpeed;
     playbackRateTemp.mPitch = effectivePitch;
     mProxy->setPlaybackRate(playbackRateTemp);
-    mProxy->setMinimum(mNotificationFramesAct);
+    mProxy->setMinimum(mWakeupFrames != 0 ? mWakeupFrames : mNotificationFramesAct);
+    mProxy->setSpinWait(mMaxSpinNs);
 
     mDeathNotifier = new DeathNotifier(this);
     IInterface::asBinder(mAudioTrack)->linkToDeath(mDeathNotifier, this);
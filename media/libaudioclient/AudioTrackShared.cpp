@@ -17,6 +17,8 @@
 #define LOG_TAG "AudioTrackShared"
 //#define LOG_NDEBUG 0
 
+#include <algorithm>
+
 #include <android-base/macros.h>
 #include <private/media/AudioTrackShared.h>
 #include <utils/Log.h>
@@ -24,6 +26,7 @@
 
 #include <linux/futex.h>
 #include <sys/syscall.h>
+#include <unistd.h>
 
 namespace android {
 
@@ -47,6 +50,21 @@ static uint32_t incrementSequence(uint32_t self, uint32_t other) {
     return other + 1; // we're behind, so move just ahead of other.
 }
 
+static inline int64_t monotonicNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Hint to the CPU that we are polling.
+static inline void cpuRelax() {
+#if defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield" ::: "memory");
+#elif defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+}
+
 audio_track_cblk_t::audio_track_cblk_t()
     : mServer(0), mFutex(0), mMinimum(0)
     , mVolumeLR(GAIN_MINIFLOAT_PACKED_UNITY), mSampleRate(0), mSendLevel(0)
@@ -72,6 +90,8 @@ ClientProxy::ClientProxy(audio_track_cblk_t* cblk, void *buffers, size_t frameCo
         size_t frameSize, bool isOut, bool clientInServer)
     : Proxy(cblk, buffers, frameCount, frameSize, isOut, clientInServer)
     , mEpoch(0)
+    , mMaxSpinNs(0)
+    , mSpinNs(0)
     , mTimestampObserver(&cblk->mExtendedTimestampQueue)
 {
     setBufferSizeInFrames(frameCount);
@@ -109,6 +129,15 @@ uint32_t ClientProxy::setBufferSizeInFrames(uint32_t size)
     return clippedSize;
 }
 
+void ClientProxy::setSpinWait(int64_t maxSpinNs)
+{
+    // Polling only helps if the server can run on another core meanwhile.
+    static const bool multiCore = sysconf(_SC_NPROCESSORS_CONF) > 1;
+    maxSpinNs = multiCore && maxSpinNs > 0 ? maxSpinNs : 0;
+    mMaxSpinNs.store(maxSpinNs, std::memory_order_relaxed);
+    mSpinNs.store(maxSpinNs, std::memory_order_relaxed);
+}
+
 __attribute__((no_sanitize("integer")))
 status_t ClientProxy::obtainBuffer(Buffer* buffer, const struct timespec *requested,
         struct timespec *elapsed)
@@ -143,6 +172,9 @@ status_t ClientProxy::obtainBuffer(Buffer* buffer, const struct timespec *reques
     bool beforeIsValid = false;
     audio_track_cblk_t* cblk = mCblk;
     bool ignoreInitialPendingInterrupt = true;
+    int64_t spinNs = mSpinNs.load(std::memory_order_relaxed);  // how long to poll
+    int64_t spinStartNs = 0;        // when polling started, or 0 if not polling
+    bool slept = false;             // whether a futex wait was needed
     // check for shared memory corruption
     if (mIsShutdown) {
         status = NO_INIT;
@@ -232,8 +264,47 @@ status_t ClientProxy::obtainBuffer(Buffer* buffer, const struct timespec *reques
             buffer->mNonContig = avail - part1;
             mUnreleased = part1;
             status = NO_ERROR;
+            if (spinStartNs != 0) {
+                // Aim to poll for about twice as long as the server usually takes.
+                const int64_t maxSpinNs = mMaxSpinNs.load(std::memory_order_relaxed);
+                int64_t nextSpinNs = mSpinNs.load(std::memory_order_relaxed);
+                if (slept) {
+                    nextSpinNs -= nextSpinNs / 8;
+                } else {
+                    nextSpinNs += (2 * (monotonicNs() - spinStartNs) - nextSpinNs) / 8;
+                }
+                mSpinNs.store(std::max(maxSpinNs / 16, std::min(nextSpinNs, maxSpinNs)),
+                        std::memory_order_relaxed);
+            }
             break;
         }
+        // Poll before sleeping. CBLK_FUTEX_WAKE stays set meanwhile,
+        // so the server does not need a futex wake either.
+        if (spinNs > 0 && timeout != TIMEOUT_ZERO) {
+            const int64_t nowNs = monotonicNs();
+            if (spinStartNs == 0) {
+                spinStartNs = nowNs;
+                // Do not poll for longer than the caller wants to wait.
+                if (timeout != TIMEOUT_INFINITE) {
+                    spinNs = std::min(spinNs,
+                            (int64_t) requested->tv_sec * 1000000000 + requested->tv_nsec);
+                }
+            }
+            if (nowNs - spinStartNs < spinNs) {
+                cpuRelax();
+                continue;
+            }
+            // The time spent polling counts against the timeout.
+            spinNs = 0;
+            if (measure) {
+                const int64_t spunNs = nowNs - spinStartNs;
+                total.tv_sec += spunNs / 1000000000;
+                if ((total.tv_nsec += spunNs % 1000000000) >= 1000000000) {
+                    total.tv_nsec -= 1000000000;
+                    total.tv_sec++;
+                }
+            }
+        }
         struct timespec remaining;
         const struct timespec *ts;
         switch (timeout) {
@@ -275,6 +346,7 @@ status_t ClientProxy::obtainBuffer(Buffer* buffer, const struct timespec *reques
         }
         int32_t old = android_atomic_and(~CBLK_FUTEX_WAKE, &cblk->mFutex);
         if (!(old & CBLK_FUTEX_WAKE)) {
+            slept = true;
             if (measure && !beforeIsValid) {
                 clock_gettime(CLOCK_MONOTONIC, &before);
                 beforeIsValid = true;
@@ -873,8 +945,10 @@ void ServerProxy::releaseBuffer(Buffer* buffer)
     } else if (minimum > half) {
         minimum = half;
     }
-    // FIXME AudioRecord wakeup needs to be optimized; it currently wakes up client every time
-    if (!mIsOut || (mAvailToClient + stepCount >= minimum)) {
+    // AudioRecord is woken up for every release unless it asked for batched wakeups.
+    const bool batchWake = mIsOut
+            || (android_atomic_acquire_load(&cblk->mFlags) & CBLK_BATCH_WAKE);
+    if (!batchWake || (mAvailToClient + stepCount >= minimum)) {
         ALOGV("mAvailToClient=%zu stepCount=%zu minimum=%zu", mAvailToClient, stepCount, minimum);
         int32_t old = android_atomic_or(CBLK_FUTEX_WAKE, &cblk->mFutex);
         if (!(old & CBLK_FUTEX_WAKE)) {
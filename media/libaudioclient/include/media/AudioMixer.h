@@ -136,6 +136,8 @@ public:
         pthread_once(&sOnceControl, &sInitRoutine);
     }
 
+    ~AudioMixer();
+
     // Create a new track in the mixer.
     //
     // \param name        a unique user-provided integer associated with the track.
@@ -180,6 +182,10 @@ public:
 
     size_t      getUnreleasedFrames(int name) const;
 
+    // Frames the track's provider has released but that have not been mixed yet, when
+    // tracks are mixed on workers; the provider's position is ahead of the mix by as much.
+    size_t      getPrefetchedFrames(int name) const;
+
     std::string trackNames() const {
         std::stringstream ss;
         for (const auto &pair : mTracks) {
@@ -209,6 +215,28 @@ public:
         return audio_channel_mask_is_valid(channelMask); // the RemixBufferProvider is flexible.
     }
 
+    // Resample and convert tracks on up to workerCount additional threads when more than
+    // one track needs resampling; 0 (the default) processes all tracks on the calling thread.
+    // The output is identical to the single threaded mix.
+    //
+    // Buffer providers are only called on the thread that calls process(): it copies the
+    // input each track needs for one buffer before the workers start, and the workers only
+    // run the resamplers and mixing kernels on these copies. A few input frames per track
+    // may thus be released to the provider one process() ahead of being mixed, see
+    // getPrefetchedFrames(). The copies are kept in a ring per track that is sized when the
+    // track is configured.
+    //
+    // process() waits for the tracks that workers have started, so the workers run with the
+    // scheduling policy and priority of the thread that first calls process(). This puts
+    // thread wakeups on the mixer thread's path; enable it only where the mixing saved on
+    // that thread outweighs them.
+    void        setWorkerCount(size_t workerCount);
+    static constexpr size_t MAX_WORKER_COUNT = 8;
+
+    // Enables the NEON, SSE or AVX2 mixing kernels where the CPU supports them (the default),
+    // or restricts all mixers in the process to the scalar code, e.g. for comparison in tests.
+    static void setVectorKernelsEnabled(bool enabled);
+
 private:
 
     /* For multi-format functions (calls template functions
@@ -280,10 +308,11 @@ private:
         bool        needsRamp() { return (volumeInc[0] | volumeInc[1] | auxInc) != 0; }
         bool        setResampler(uint32_t trackSampleRate, uint32_t devSampleRate);
         bool        doesResample() const { return mResampler.get() != nullptr; }
-        void        resetResampler() { if (mResampler.get() != nullptr) mResampler->reset(); }
+        void        resetResampler();
         void        adjustVolumeRamp(bool aux, bool useFloat = false);
         size_t      getUnreleasedFrames() const { return mResampler.get() != nullptr ?
                                                     mResampler->getUnreleasedFrames() : 0; };
+        size_t      getPrefetchedFrames() const;
 
         status_t    prepareForDownmix();
         void        unprepareForDownmix();
@@ -362,6 +391,8 @@ private:
          * 6) mPostDownmixReformatBufferProvider: If not NULL, performs reformatting from
          *    the downmixer requirements to the mixer engine input requirements.
          * 7) mTimestretchBufferProvider: Adds timestretching for playback rate
+         * 8) mPrefetchBufferProvider: If not NULL, copies the track input ahead of use so that
+         *    worker threads never call the providers above, see setWorkerCount().
          */
         AudioBufferProvider*     mInputBufferProvider;    // externally provided buffer provider.
         // TODO: combine mAdjustChannelsBufferProvider and
@@ -372,6 +403,7 @@ private:
         std::unique_ptr<PassthruBufferProvider> mDownmixerBufferProvider;
         std::unique_ptr<PassthruBufferProvider> mPostDownmixReformatBufferProvider;
         std::unique_ptr<PassthruBufferProvider> mTimestretchBufferProvider;
+        std::unique_ptr<PrefetchBufferProvider> mPrefetchBufferProvider;
 
         int32_t     sessionId;
 
@@ -409,6 +441,16 @@ private:
         uint32_t             mAdjustNonDestructiveOutChannelCount;
         bool                 mKeepContractedChannels;
 
+        // frame size of the input of the hooks, for mPrefetchBufferProvider.
+        size_t hookInputFrameSize() const {
+            return (mDownmixerBufferProvider.get() != nullptr ? mMixerChannelCount : channelCount)
+                    * audio_bytes_per_sample(mMixerInFormat);
+        }
+
+        // Output of this track for the current process(), mixed by a worker thread
+        // into a buffer of its own; nullptr if the track is mixed in place.
+        int32_t*             mPreparedBuffer = nullptr;
+
         float getHapticScaleGamma() const {
         // Need to keep consistent with the value in VibratorService.
         switch (mHapticIntensity) {
@@ -472,6 +514,11 @@ private:
     void process__nop();
     void process__genericNoResampling();
     void process__genericResampling();
+
+    void resampleTrack(Track *t, int32_t *out, int32_t *temp);
+    void prepareForPrefetch(Track *t);
+    void prefetchTrack(Track *t);
+    void prepareTracksInParallel();
     void process__oneTrack16BitsStereoNoResampling();
 
     template <int MIXTYPE, typename TO, typename TI, typename TA>
@@ -510,6 +557,14 @@ private:
     // track smart pointers, by name, in increasing order of name.
     std::map<int /* name */, std::shared_ptr<Track>> mTracks;
 
+    // threads that resample tracks for process__genericResampling(), if enabled.
+    class WorkerPool;
+    size_t mWorkerCount = 0;
+    std::unique_ptr<WorkerPool> mWorkers;
+    std::vector<Track *> mParallelTracks;                      // tracks given to the workers
+    std::vector<std::unique_ptr<int32_t[]>> mTrackBuffers;     // one per parallel track
+    std::vector<std::unique_ptr<int32_t[]>> mWorkerResampleTemps; // one per thread
+
     static pthread_once_t sOnceControl; // initialized in constructor by first new
 };
 
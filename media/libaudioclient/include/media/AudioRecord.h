@@ -267,6 +267,26 @@ public:
      */
             uint32_t    getNotificationPeriodInFrames() const { return mNotificationFramesAct; }
 
+    /* Lower the cost of waking up for apps that transfer small buffers at a high rate.
+     *
+     * Parameters:
+     *
+     * maxSpinNs:    When read() or obtainBuffer() would block, first poll the buffer
+     *               for up to this long. If AudioFlinger is ready meanwhile then neither side
+     *               makes a system call. The time spent polling adapts to how long AudioFlinger
+     *               usually takes, and a single core device never polls.
+     *               0 always blocks, which is the default.
+     * wakeupFrames: Only wake a blocked read() or obtainBuffer() once this many frames
+     *               are available, instead of every time AudioFlinger releases a buffer.
+     *               0 restores the default.
+     *
+     * The policy is kept if the track is re-created.
+     * Returned status (from utils/Errors.h) can be:
+     *  - NO_ERROR: successful operation
+     *  - NO_INIT: the track is not initialized
+     */
+            status_t    setWakeupPolicy(int64_t maxSpinNs, uint32_t wakeupFrames);
+
     /*
      * return metrics information for the current instance.
      */
@@ -637,6 +657,8 @@ private:
                                                     // as specified in constructor or set()
     uint32_t                mNotificationFramesAct; // actual number of frames between each
                                                     // notification callback
+    int64_t                 mMaxSpinNs = 0;         // see setWakeupPolicy()
+    uint32_t                mWakeupFrames = 0;      // see setWakeupPolicy(), 0 is default
     bool                    mRefreshRemaining;      // processAudioBuffer() should refresh
                                                     // mRemainingFrames and mRetryOnPartialBuffer
 
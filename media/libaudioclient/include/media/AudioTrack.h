@@ -394,6 +394,26 @@ public:
      */
             ssize_t     setBufferSizeInFrames(size_t size);
 
+    /* Lower the cost of waking up for apps that transfer small buffers at a high rate.
+     *
+     * Parameters:
+     *
+     * maxSpinNs:    When write() or obtainBuffer() would block, first poll the buffer
+     *               for up to this long. If AudioFlinger is ready meanwhile then neither side
+     *               makes a system call. The time spent polling adapts to how long AudioFlinger
+     *               usually takes, and a single core device never polls.
+     *               0 always blocks, which is the default.
+     * wakeupFrames: Only wake a blocked write() or obtainBuffer() once this many frames are free,
+     *               instead of once the notification period is free.
+     *               0 restores the default.
+     *
+     * The policy is kept if the track is re-created.
+     * Returned status (from utils/Errors.h) can be:
+     *  - NO_ERROR: successful operation
+     *  - NO_INIT: the track is not initialized
+     */
+            status_t    setWakeupPolicy(int64_t maxSpinNs, uint32_t wakeupFrames);
+
     /* Return the static buffer specified in constructor or set(), or 0 for streaming mode */
             sp<IMemory> sharedBuffer() const { return mSharedBuffer; }
 
@@ -1107,6 +1127,8 @@ public:
     uint32_t                mNotificationFramesAct; // actual number of frames between each
                                                     // notification callback,
                                                     // at initial source sample rate
+    int64_t                 mMaxSpinNs = 0;         // see setWakeupPolicy()
+    uint32_t                mWakeupFrames = 0;      // see setWakeupPolicy(), 0 is default
     bool                    mRefreshRemaining;      // processAudioBuffer() should refresh
                                                     // mRemainingFrames and mRetryOnPartialBuffer
 
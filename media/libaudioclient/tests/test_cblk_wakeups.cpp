@@ -0,0 +1,312 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measure how often a client blocked in obtainBuffer() is woken up by the server,
+ * and how late, when 2 msec buffers go through an audio_track_cblk_t.
+ * The client and server proxies run in two threads of this process.
+ */
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <private/media/AudioTrackShared.h>
+
+using namespace android;
+
+constexpr size_t kFramesPerBuffer = 96;       // 2 msec at 48 kHz
+constexpr int64_t kBufferPeriodNs = 2000000;
+constexpr int64_t kRunNs = 500000000;
+constexpr int64_t kMaxSpinNs = 500000;
+constexpr size_t kFrameSize = sizeof(int32_t); // each frame holds its index
+
+static int64_t getNanoseconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Voluntary context switches of the calling thread, which is one per futex wait.
+static int64_t getVoluntaryContextSwitches() {
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_nvcsw;
+}
+
+static void sleepUntil(int64_t timeNs) {
+    struct timespec ts;
+    ts.tv_sec = timeNs / 1000000000;
+    ts.tv_nsec = timeNs % 1000000000;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+}
+
+// A control block and data buffer, as AudioFlinger would allocate in shared memory.
+// The proxies need a power of 2 frame count for streaming.
+struct SharedTrack {
+    explicit SharedTrack(size_t frameCount) : data(frameCount) {
+        cblk = new (&cblkStorage) audio_track_cblk_t();
+    }
+    ~SharedTrack() {
+        cblk->~audio_track_cblk_t();
+    }
+
+    std::aligned_storage<sizeof(audio_track_cblk_t), alignof(audio_track_cblk_t)>::type
+            cblkStorage;
+    audio_track_cblk_t *cblk;
+    std::vector<int32_t> data;
+};
+
+struct WakeupResult {
+    double wakeupsPerSecond = 0;
+    double meanLatencyMicros = 0;
+    double maxLatencyMicros = 0;
+    bool dataCorrect = true;
+};
+
+// Client side of the transfer, which keeps statistics on how it was woken.
+class ClientLoop {
+public:
+    explicit ClientLoop(const sp<ClientProxy> &proxy) : mProxy(proxy) {}
+
+    // Obtain and release up to frameCount frames, blocking until some are available.
+    // Calls transfer(frame) for each one.
+    template <typename Transfer>
+    bool transferSome(size_t frameCount, const std::atomic<int64_t> &lastReleaseNs,
+                      Transfer transfer) {
+        static const struct timespec kTimeout = {0, 100000000};
+        Proxy::Buffer buffer;
+        buffer.mFrameCount = frameCount;
+        const int64_t startNs = getNanoseconds();
+        status_t status = mProxy->obtainBuffer(&buffer, &kTimeout);
+        if (status != NO_ERROR) {
+            return false;
+        }
+        // Frames released by the server while we waited: how late did we get them?
+        const int64_t releaseNs = lastReleaseNs.load();
+        if (releaseNs > startNs) {
+            const int64_t latencyNs = getNanoseconds() - releaseNs;
+            mLatencySumNs += latencyNs;
+            mLatencyMaxNs = std::max(mLatencyMaxNs, latencyNs);
+            mLatencyCount++;
+        }
+        int32_t *frames = static_cast<int32_t *>(buffer.mRaw);
+        for (size_t i = 0; i < buffer.mFrameCount; i++) {
+            transfer(frames[i]);
+        }
+        mFramesTransferred += buffer.mFrameCount;
+        mProxy->releaseBuffer(&buffer);
+        return true;
+    }
+
+    void fillResult(WakeupResult *result, int64_t contextSwitches, int64_t elapsedNs) const {
+        result->wakeupsPerSecond = contextSwitches * 1e9 / elapsedNs;
+        if (mLatencyCount > 0) {
+            result->meanLatencyMicros = mLatencySumNs / 1000.0 / mLatencyCount;
+            result->maxLatencyMicros = mLatencyMaxNs / 1000.0;
+        }
+    }
+
+    int64_t framesTransferred() const { return mFramesTransferred; }
+
+private:
+    sp<ClientProxy> mProxy;
+    int64_t mLatencySumNs = 0;
+    int64_t mLatencyMaxNs = 0;
+    int64_t mLatencyCount = 0;
+    int64_t mFramesTransferred = 0;
+};
+
+// Busy work, like a game rendering its next buffer.
+static void renderFor(int64_t durationNs) {
+    const int64_t endNs = getNanoseconds() + durationNs;
+    while (getNanoseconds() < endNs) {
+    }
+}
+
+// An AudioTrack that renders then writes 2 msec buffers,
+// with a server that consumes one per period.
+static WakeupResult runTrack(int64_t maxSpinNs, int64_t renderNs) {
+    SharedTrack shared(256);
+    sp<AudioTrackClientProxy> client = new AudioTrackClientProxy(shared.cblk,
+            shared.data.data(), shared.data.size(), kFrameSize, true /*clientInServer*/);
+    sp<AudioTrackServerProxy> server = new AudioTrackServerProxy(shared.cblk,
+            shared.data.data(), shared.data.size(), kFrameSize, true /*clientInServer*/);
+    client->setBufferSizeInFrames(2 * kFramesPerBuffer);
+    client->setMinimum(kFramesPerBuffer);
+    client->setSpinWait(maxSpinNs);
+
+    std::atomic<bool> running{true};
+    std::atomic<int64_t> lastReleaseNs{0};
+    WakeupResult result;
+
+    std::thread serverThread([&]() {
+        int32_t expected = 0;
+        int64_t periodNs = getNanoseconds();
+        while (running) {
+            periodNs += kBufferPeriodNs;
+            sleepUntil(periodNs);
+            size_t framesToRead = kFramesPerBuffer;
+            while (framesToRead > 0) {
+                Proxy::Buffer buffer;
+                buffer.mFrameCount = framesToRead;
+                if (server->obtainBuffer(&buffer) != NO_ERROR) {
+                    break; // underrun
+                }
+                const int32_t *frames = static_cast<const int32_t *>(buffer.mRaw);
+                for (size_t i = 0; i < buffer.mFrameCount; i++) {
+                    if (frames[i] != expected++) {
+                        result.dataCorrect = false;
+                    }
+                }
+                framesToRead -= buffer.mFrameCount;
+                server->releaseBuffer(&buffer);
+                lastReleaseNs = getNanoseconds();
+            }
+        }
+        client->interrupt();
+    });
+
+    ClientLoop loop(client);
+    int32_t next = 0;
+    const int64_t startNs = getNanoseconds();
+    const int64_t startSwitches = getVoluntaryContextSwitches();
+    while (getNanoseconds() - startNs < kRunNs) {
+        renderFor(renderNs);
+        size_t framesToWrite = kFramesPerBuffer;
+        while (framesToWrite > 0) {
+            const int64_t before = loop.framesTransferred();
+            if (!loop.transferSome(framesToWrite, lastReleaseNs,
+                                   [&](int32_t &frame) { frame = next++; })) {
+                break;
+            }
+            framesToWrite -= loop.framesTransferred() - before;
+        }
+    }
+    loop.fillResult(&result, getVoluntaryContextSwitches() - startSwitches,
+                    getNanoseconds() - startNs);
+    running = false;
+    serverThread.join();
+    return result;
+}
+
+// An AudioRecord that reads as soon as it can, with a server that writes one buffer per period.
+static WakeupResult runRecord(int64_t maxSpinNs, uint32_t wakeupFrames) {
+    SharedTrack shared(512);
+    sp<AudioRecordClientProxy> client = new AudioRecordClientProxy(shared.cblk,
+            shared.data.data(), shared.data.size(), kFrameSize);
+    sp<AudioRecordServerProxy> server = new AudioRecordServerProxy(shared.cblk,
+            shared.data.data(), shared.data.size(), kFrameSize, false /*clientInServer*/);
+    client->setMinimum(wakeupFrames);
+    client->setBatchWake(wakeupFrames != 0);
+    client->setSpinWait(maxSpinNs);
+
+    std::atomic<bool> running{true};
+    std::atomic<int64_t> lastReleaseNs{0};
+    WakeupResult result;
+
+    std::thread serverThread([&]() {
+        int32_t next = 0;
+        int64_t periodNs = getNanoseconds();
+        while (running) {
+            periodNs += kBufferPeriodNs;
+            sleepUntil(periodNs);
+            size_t framesToWrite = kFramesPerBuffer;
+            while (framesToWrite > 0) {
+                Proxy::Buffer buffer;
+                buffer.mFrameCount = framesToWrite;
+                if (server->obtainBuffer(&buffer) != NO_ERROR) {
+                    break; // overrun
+                }
+                int32_t *frames = static_cast<int32_t *>(buffer.mRaw);
+                for (size_t i = 0; i < buffer.mFrameCount; i++) {
+                    frames[i] = next++;
+                }
+                framesToWrite -= buffer.mFrameCount;
+                server->releaseBuffer(&buffer);
+                lastReleaseNs = getNanoseconds();
+            }
+        }
+        client->interrupt();
+    });
+
+    ClientLoop loop(client);
+    int32_t expected = 0;
+    const int64_t startNs = getNanoseconds();
+    const int64_t startSwitches = getVoluntaryContextSwitches();
+    while (getNanoseconds() - startNs < kRunNs) {
+        loop.transferSome(kFramesPerBuffer, lastReleaseNs, [&](int32_t &frame) {
+            if (frame != expected++) {
+                result.dataCorrect = false;
+            }
+        });
+    }
+    loop.fillResult(&result, getVoluntaryContextSwitches() - startSwitches,
+                    getNanoseconds() - startNs);
+    running = false;
+    serverThread.join();
+    return result;
+}
+
+static void printResult(const char *name, const WakeupResult &result) {
+    printf("[ BENCH    ] %-28s wakeups/sec %6.1f  latency usec mean %7.1f max %7.1f\n",
+           name, result.wakeupsPerSecond, result.meanLatencyMicros, result.maxLatencyMicros);
+}
+
+TEST(test_cblk_wakeups, track_2ms_buffers) {
+    // The client renders for most of the period, so it usually waits only briefly.
+    const int64_t renderNs = kBufferPeriodNs * 3 / 4;
+    WakeupResult futex = runTrack(0, renderNs);
+    printResult("track futex", futex);
+    EXPECT_TRUE(futex.dataCorrect);
+    WakeupResult spin = runTrack(kMaxSpinNs, renderNs);
+    printResult("track spin then futex", spin);
+    EXPECT_TRUE(spin.dataCorrect);
+}
+
+TEST(test_cblk_wakeups, record_2ms_buffers) {
+    WakeupResult futex = runRecord(0, 0);
+    printResult("record futex", futex);
+    EXPECT_TRUE(futex.dataCorrect);
+    WakeupResult batch = runRecord(0, 2 * kFramesPerBuffer);
+    printResult("record batch 2 buffers", batch);
+    EXPECT_TRUE(batch.dataCorrect);
+    WakeupResult spin = runRecord(kMaxSpinNs, 0);
+    printResult("record spin then futex", spin);
+    EXPECT_TRUE(spin.dataCorrect);
+}
+
+TEST(test_cblk_wakeups, spin_within_timeout) {
+    // Nothing is ever written, so obtainBuffer() polls and then waits for the rest of the
+    // timeout. Polling for longer than the timeout must not make it return later.
+    SharedTrack shared(512);
+    sp<AudioRecordClientProxy> client = new AudioRecordClientProxy(shared.cblk,
+            shared.data.data(), shared.data.size(), kFrameSize);
+    client->setSpinWait(100000000);
+    for (const int64_t timeoutNs : {(int64_t) 5000000, (int64_t) 50000000}) {
+        const struct timespec timeout = {0, (long) timeoutNs};
+        Proxy::Buffer buffer;
+        buffer.mFrameCount = kFramesPerBuffer;
+        const int64_t startNs = getNanoseconds();
+        EXPECT_NE(NO_ERROR, client->obtainBuffer(&buffer, &timeout));
+        EXPECT_LT(getNanoseconds() - startNs, timeoutNs + 20000000) << "timeout " << timeoutNs;
+    }
+}
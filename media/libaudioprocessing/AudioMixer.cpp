@@ -18,14 +18,24 @@
 #define LOG_TAG "AudioMixer"
 //#define LOG_NDEBUG 0
 
+#include <errno.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <sched.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
 #include <utils/Errors.h>
 #include <utils/Log.h>
+#include <utils/Timers.h>
 
 #include <cutils/compiler.h>
 #include <utils/Debug.h>
@@ -37,6 +47,7 @@
 #include <media/AudioMixer.h>
 
 #include "AudioMixerOps.h"
+#include "AudioMixerOpsVector.h"
 
 // The FCC_2 macro refers to the Fixed Channel Count of 2 for the legacy integer mixer.
 #ifndef FCC_2
@@ -186,6 +197,11 @@ status_t AudioMixer::create(
         t->prepareForReformat();
         t->prepareForAdjustChannelsNonDestructive(mFrameCount);
         t->prepareForAdjustChannels();
+        if (mWorkerCount > 0) {
+            t->mPrefetchBufferProvider.reset(new PrefetchBufferProvider(t->hookInputFrameSize()));
+            t->reconfigureBufferProviders();
+            prepareForPrefetch(t.get());
+        }
 
         mTracks[name] = t;
         return OK;
@@ -263,6 +279,7 @@ bool AudioMixer::setChannelMasks(int name,
         // recreate the resampler with updated format, channels, saved sampleRate.
         track->setResampler(resetToSampleRate /*trackSampleRate*/, mSampleRate /*devSampleRate*/);
     }
+    prepareForPrefetch(track.get());
     return true;
 }
 
@@ -475,6 +492,10 @@ void AudioMixer::Track::reconfigureBufferProviders()
         mTimestretchBufferProvider->setBufferProvider(bufferProvider);
         bufferProvider = mTimestretchBufferProvider.get();
     }
+    if (mPrefetchBufferProvider.get() != nullptr) {
+        mPrefetchBufferProvider->setBufferProvider(bufferProvider);
+        bufferProvider = mPrefetchBufferProvider.get();
+    }
 }
 
 void AudioMixer::destroy(int name)
@@ -683,6 +704,7 @@ void AudioMixer::setParameter(int name, int target, int param, void *value)
                 track->mFormat = format;
                 ALOGV("setParameter(TRACK, FORMAT, %#x)", format);
                 track->prepareForReformat();
+                prepareForPrefetch(track.get());
                 invalidate();
             }
             } break;
@@ -736,6 +758,7 @@ void AudioMixer::setParameter(int name, int target, int param, void *value)
             if (track->setResampler(uint32_t(valueInt), mSampleRate)) {
                 ALOGV("setParameter(RESAMPLE, SAMPLE_RATE, %u)",
                         uint32_t(valueInt));
+                prepareForPrefetch(track.get());
                 invalidate();
             }
             break;
@@ -814,6 +837,17 @@ void AudioMixer::setParameter(int name, int target, int param, void *value)
     }
 }
 
+void AudioMixer::Track::resetResampler()
+{
+    if (mResampler.get() != nullptr) {
+        mResampler->reset();
+    }
+    // the prefetched input would follow the reset without a ramp.
+    if (mPrefetchBufferProvider.get() != nullptr) {
+        mPrefetchBufferProvider->reset();
+    }
+}
+
 bool AudioMixer::Track::setResampler(uint32_t trackSampleRate, uint32_t devSampleRate)
 {
     if (trackSampleRate != devSampleRate || mResampler.get() != nullptr) {
@@ -944,11 +978,34 @@ size_t AudioMixer::getUnreleasedFrames(int name) const
 {
     const auto it = mTracks.find(name);
     if (it != mTracks.end()) {
+        // with prefetching, the frames the resampler holds were released upstream already.
+        if (it->second->mPrefetchBufferProvider.get() != nullptr) {
+            return 0;
+        }
         return it->second->getUnreleasedFrames();
     }
     return 0;
 }
 
+size_t AudioMixer::getPrefetchedFrames(int name) const
+{
+    const auto it = mTracks.find(name);
+    if (it != mTracks.end()) {
+        return it->second->getPrefetchedFrames();
+    }
+    return 0;
+}
+
+size_t AudioMixer::Track::getPrefetchedFrames() const
+{
+    if (mPrefetchBufferProvider.get() == nullptr) {
+        return 0;
+    }
+    // the ring holds the frames the resampler has consumed but not released as well.
+    const size_t frames = mPrefetchBufferProvider->framesAvailable();
+    return frames - std::min(frames, getUnreleasedFrames());
+}
+
 void AudioMixer::setBufferProvider(int name, AudioBufferProvider* bufferProvider)
 {
     LOG_ALWAYS_FATAL_IF(!exists(name), "invalid name: %d", name);
@@ -958,6 +1015,9 @@ void AudioMixer::setBufferProvider(int name, AudioBufferProvider* bufferProvider
         return; // don't reset any buffer providers if identical.
     }
     // reset order from downstream to upstream buffer providers.
+    if (track->mPrefetchBufferProvider.get() != nullptr) {
+        track->mPrefetchBufferProvider->reset(); // holds no upstream buffer
+    }
     if (track->mTimestretchBufferProvider.get() != nullptr) {
         track->mTimestretchBufferProvider->reset();
     } else if (track->mPostDownmixReformatBufferProvider.get() != nullptr) {
@@ -994,7 +1054,6 @@ void AudioMixer::process__validate()
 
         mEnabled.emplace_back(name);  // we add to mEnabled in order of name.
         mGroups[t->mainBuffer].emplace_back(name); // mGroups also in order of name.
-
         uint32_t n = 0;
         // FIXME can overflow (mask is only 3 bits)
         n |= NEEDS_CHANNEL_1 + t->channelCount - 1;
@@ -1518,48 +1577,294 @@ void AudioMixer::process__genericResampling()
     int32_t * const outTemp = mOutputTemp.get(); // naked ptr
     size_t numFrames = mFrameCount;
 
+    if (mWorkerCount > 0) {
+        prepareTracksInParallel();
+    }
+
     for (const auto &pair : mGroups) {
         const auto &group = pair.second;
         const std::shared_ptr<Track> &t1 = mTracks[group[0]];
 
         // clear temp buffer
-        memset(outTemp, 0, sizeof(*outTemp) * t1->mMixerChannelCount * mFrameCount);
+        memset(outTemp, 0, sizeof(*outTemp) * t1->mMixerChannelCount * numFrames);
         for (const int name : group) {
             const std::shared_ptr<Track> &t = mTracks[name];
-            int32_t *aux = NULL;
-            if (CC_UNLIKELY(t->needs & NEEDS_AUX)) {
-                aux = t->auxBuffer;
+            if (t->mPreparedBuffer != nullptr) {
+                // Add in group order, as the track hooks would have, so the mix
+                // does not depend on which thread finished first.
+                const size_t sampleCount = numFrames * t->mMixerChannelCount;
+                if (t->mMixerInFormat == AUDIO_FORMAT_PCM_FLOAT) {
+                    float *out = reinterpret_cast<float *>(outTemp);
+                    const float *in = reinterpret_cast<const float *>(t->mPreparedBuffer);
+                    for (size_t i = 0; i < sampleCount; ++i) {
+                        out[i] += in[i];
+                    }
+                } else {
+                    for (size_t i = 0; i < sampleCount; ++i) {
+                        outTemp[i] += t->mPreparedBuffer[i];
+                    }
+                }
+                t->mPreparedBuffer = nullptr;
+            } else {
+                resampleTrack(t.get(), outTemp, mResampleTemp.get() /* naked ptr */);
             }
+        }
+        convertMixerFormat(t1->mainBuffer, t1->mMixerFormat,
+                outTemp, t1->mMixerInFormat, numFrames * t1->mMixerChannelCount);
+    }
+}
 
-            // this is a little goofy, on the resampling case we don't
-            // acquire/release the buffers because it's done by
-            // the resampler.
-            if (t->needs & NEEDS_RESAMPLE) {
-                (t.get()->*t->hook)(outTemp, numFrames, mResampleTemp.get() /* naked ptr */, aux);
-            } else {
+// mixes mFrameCount frames of a track into out, for process__genericResampling()
+void AudioMixer::resampleTrack(Track *t, int32_t *out, int32_t *temp)
+{
+    const size_t numFrames = mFrameCount;
+    int32_t *aux = NULL;
+    if (CC_UNLIKELY(t->needs & NEEDS_AUX)) {
+        aux = t->auxBuffer;
+    }
 
-                size_t outFrames = 0;
+    // this is a little goofy, on the resampling case we don't
+    // acquire/release the buffers because it's done by
+    // the resampler.
+    if (t->needs & NEEDS_RESAMPLE) {
+        (t->*t->hook)(out, numFrames, temp, aux);
+    } else {
 
-                while (outFrames < numFrames) {
-                    t->buffer.frameCount = numFrames - outFrames;
-                    t->bufferProvider->getNextBuffer(&t->buffer);
-                    t->mIn = t->buffer.raw;
-                    // t->mIn == nullptr can happen if the track was flushed just after having
-                    // been enabled for mixing.
-                    if (t->mIn == nullptr) break;
+        size_t outFrames = 0;
 
-                    (t.get()->*t->hook)(
-                            outTemp + outFrames * t->mMixerChannelCount, t->buffer.frameCount,
-                            mResampleTemp.get() /* naked ptr */,
-                            aux != nullptr ? aux + outFrames : nullptr);
-                    outFrames += t->buffer.frameCount;
+        while (outFrames < numFrames) {
+            t->buffer.frameCount = numFrames - outFrames;
+            t->bufferProvider->getNextBuffer(&t->buffer);
+            t->mIn = t->buffer.raw;
+            // t->mIn == nullptr can happen if the track was flushed just after having
+            // been enabled for mixing.
+            if (t->mIn == nullptr) break;
 
-                    t->bufferProvider->releaseBuffer(&t->buffer);
-                }
+            (t->*t->hook)(
+                    out + outFrames * t->mMixerChannelCount, t->buffer.frameCount,
+                    temp, aux != nullptr ? aux + outFrames : nullptr);
+            outFrames += t->buffer.frameCount;
+
+            t->bufferProvider->releaseBuffer(&t->buffer);
+        }
+    }
+}
+
+/* A small pool of threads that runs the jobs of one process() call together
+ * with the calling thread. Jobs are claimed one at a time, so the mixer thread
+ * keeps working through the tracks even if the workers are not scheduled, and
+ * only waits for jobs that a worker has already started. That wait spins for a
+ * short while first, as a started job usually finishes within it, so that the
+ * mixer thread does not need to be woken up again.
+ */
+class AudioMixer::WorkerPool {
+public:
+    // job(index, thread) is called for each index in [0, jobCount); thread is 0 for the
+    // calling thread and 1..workerCount for the workers.
+    using job_t = std::function<void(size_t index, size_t thread)>;
+
+    // The workers take the scheduling policy and priority of the creating thread.
+    explicit WorkerPool(size_t workerCount) {
+        Scheduling scheduling;
+        if (pthread_getschedparam(pthread_self(), &scheduling.policy, &scheduling.param) != 0) {
+            scheduling.policy = SCHED_OTHER;
+            scheduling.param.sched_priority = 0;
+        }
+        errno = 0;
+        scheduling.nice = getpriority(PRIO_PROCESS, 0 /* this thread */);
+        if (errno != 0) {
+            scheduling.nice = 0;
+        }
+        for (size_t i = 1; i <= workerCount; ++i) {
+            mThreads.emplace_back(&WorkerPool::threadLoop, this, i, scheduling);
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mExit = true;
+        }
+        mWorkCond.notify_all();
+        for (auto &thread : mThreads) {
+            thread.join();
+        }
+    }
+
+    void run(size_t jobCount, const job_t &job) {
+        std::unique_lock<std::mutex> lock(mLock);
+        mJob = &job;
+        mJobCount = jobCount;
+        mNextJob = 0;
+        mFinishedJobs = 0;
+        mWorkCond.notify_all();
+        runJobs_l(lock, 0 /* thread */);
+        if (mFinishedJobs != jobCount) {
+            lock.unlock();
+            const nsecs_t deadlineNs = systemTime() + kSpinNs;
+            while (mFinishedJobs.load(std::memory_order_acquire) != jobCount
+                    && systemTime() < deadlineNs) {
             }
+            lock.lock();
+            mDoneCond.wait(lock, [this] { return mFinishedJobs == mJobCount; });
         }
-        convertMixerFormat(t1->mainBuffer, t1->mMixerFormat,
-                outTemp, t1->mMixerInFormat, numFrames * t1->mMixerChannelCount);
+        mJob = nullptr;
+        mJobCount = 0;
+    }
+
+private:
+    struct Scheduling {
+        int policy;
+        sched_param param;
+        int nice;
+    };
+
+    // how long run() spins for the jobs that workers have started before it sleeps.
+    static constexpr nsecs_t kSpinNs = 50000;
+
+    void threadLoop(size_t thread, Scheduling scheduling) {
+        pthread_setname_np(pthread_self(), "AudioMixerWork");
+        // set explicitly, as a policy with SCHED_RESET_ON_FORK is not inherited.
+        if (pthread_setschedparam(pthread_self(), scheduling.policy, &scheduling.param) != 0
+                || setpriority(PRIO_PROCESS, 0 /* this thread */, scheduling.nice) != 0) {
+            ALOGW("worker %zu cannot use policy %d priority %d nice %d of the mixer thread",
+                    thread, scheduling.policy, scheduling.param.sched_priority,
+                    scheduling.nice);
+        }
+        std::unique_lock<std::mutex> lock(mLock);
+        while (!mExit) {
+            runJobs_l(lock, thread);
+            mWorkCond.wait(lock);
+        }
+    }
+
+    void runJobs_l(std::unique_lock<std::mutex> &lock, size_t thread) {
+        while (mNextJob < mJobCount) {
+            const size_t index = mNextJob++;
+            const job_t &job = *mJob;
+            lock.unlock();
+            job(index, thread);
+            lock.lock();
+            if (++mFinishedJobs == mJobCount) {
+                mDoneCond.notify_one();
+            }
+        }
+    }
+
+    std::mutex mLock;
+    std::condition_variable mWorkCond;   // signaled when jobs are posted or on exit
+    std::condition_variable mDoneCond;   // signaled when the last job finishes
+    const job_t *mJob = nullptr;
+    size_t mJobCount = 0;
+    size_t mNextJob = 0;
+    std::atomic<size_t> mFinishedJobs{0}; // changed with mLock held, read by run() without
+    bool mExit = false;
+    std::vector<std::thread> mThreads;
+};
+
+AudioMixer::~AudioMixer()
+{
+}
+
+void AudioMixer::setWorkerCount(size_t workerCount)
+{
+    if (workerCount > MAX_WORKER_COUNT) {
+        ALOGW("%s: %zu workers requested, using %zu",
+                __func__, workerCount, MAX_WORKER_COUNT);
+        workerCount = MAX_WORKER_COUNT;
+    }
+    if (workerCount == mWorkerCount) {
+        return;
+    }
+    mWorkers.reset();
+    mWorkerCount = workerCount;
+    for (const auto &pair : mTracks) {
+        Track *t = pair.second.get();
+        if (workerCount > 0 && t->mPrefetchBufferProvider.get() == nullptr) {
+            t->mPrefetchBufferProvider.reset(new PrefetchBufferProvider(t->hookInputFrameSize()));
+        } else if (workerCount == 0) {
+            t->mPrefetchBufferProvider.reset(nullptr);
+        }
+        t->reconfigureBufferProviders();
+        prepareForPrefetch(t);
+    }
+}
+
+// sizes the prefetch ring of a track for one process() when the track is configured,
+// so that process() does not allocate.
+void AudioMixer::prepareForPrefetch(Track *t)
+{
+    if (t->mPrefetchBufferProvider.get() == nullptr) {
+        return;
+    }
+    // prefetchTrack() asks for the input of one buffer plus the frames the resampler still
+    // holds from the previous one, which come from the same ring and are at most as many.
+    const size_t frameCount = 2 * sourceFramesNeeded(t->sampleRate, mFrameCount, mSampleRate);
+    if (t->mPrefetchBufferProvider->configure(t->hookInputFrameSize(), frameCount)
+            && t->mResampler.get() != nullptr) {
+        // the buffer the resampler holds was in the ring that was replaced.
+        t->mResampler->reset();
+    }
+}
+
+// copies the input a track needs for one process() from its buffer providers, so that
+// the workers do not call them.
+void AudioMixer::prefetchTrack(Track *t)
+{
+    size_t frameCount = mFrameCount;
+    if (t->needs & NEEDS_RESAMPLE) {
+        // the bound PlaybackThread also uses to tell whether a track is ready, which
+        // includes the frames that the resampler has consumed but not yet released.
+        frameCount = sourceFramesNeeded(t->sampleRate, mFrameCount, mSampleRate)
+                + t->getUnreleasedFrames();
+    }
+    t->mPrefetchBufferProvider->prefetch(frameCount);
+}
+
+// resamples the tracks that do not send to an aux buffer on the worker pool,
+// each into a buffer of its own, for process__genericResampling() to add up.
+void AudioMixer::prepareTracksInParallel()
+{
+    mParallelTracks.clear();
+    for (const int name : mEnabled) {
+        Track *t = mTracks[name].get();
+        // aux sends accumulate into a buffer shared by several tracks, so the
+        // order of the additions and thus the result would vary.
+        if ((t->needs & NEEDS_AUX) == 0 && t->mPrefetchBufferProvider.get() != nullptr) {
+            mParallelTracks.push_back(t);
+        }
+    }
+    if (mParallelTracks.size() < 2) {
+        mParallelTracks.clear();
+        return;
+    }
+
+    const size_t bufferSize = MAX_NUM_CHANNELS * mFrameCount;
+    while (mTrackBuffers.size() < mParallelTracks.size()) {
+        mTrackBuffers.emplace_back(new int32_t[bufferSize]);
+    }
+    if (mWorkers.get() == nullptr) {
+        mWorkers.reset(new WorkerPool(mWorkerCount));
+        mWorkerResampleTemps.clear();
+        for (size_t i = 0; i <= mWorkerCount; ++i) {
+            mWorkerResampleTemps.emplace_back(new int32_t[bufferSize]);
+        }
+    }
+
+    // the buffer providers are not thread safe, so all of them are called here.
+    for (Track *t : mParallelTracks) {
+        prefetchTrack(t);
+        t->mPrefetchBufferProvider->setPullEnabled(false);
+    }
+    mWorkers->run(mParallelTracks.size(), [this](size_t index, size_t thread) {
+        Track *t = mParallelTracks[index];
+        int32_t *out = mTrackBuffers[index].get();
+        memset(out, 0, sizeof(*out) * t->mMixerChannelCount * mFrameCount);
+        resampleTrack(t, out, mWorkerResampleTemps[thread].get());
+        t->mPreparedBuffer = out;
+    });
+    for (Track *t : mParallelTracks) {
+        t->mPrefetchBufferProvider->setPullEnabled(true);
     }
 }
 
@@ -1651,9 +1956,20 @@ void AudioMixer::process__oneTrack16BitsStereoNoResampling()
 
 /*static*/ pthread_once_t AudioMixer::sOnceControl = PTHREAD_ONCE_INIT;
 
+// One of MIX_KERNEL_* (see AudioMixerOpsVector.h), read by the track hooks.
+static std::atomic<int> sMixKernel(MIX_KERNEL_SCALAR);
+
 /*static*/ void AudioMixer::sInitRoutine()
 {
     DownmixerBufferProvider::init(); // for the downmixer
+    sMixKernel = mixKernelDetect();
+    ALOGV("mix kernel %d", sMixKernel.load());
+}
+
+/*static*/ void AudioMixer::setVectorKernelsEnabled(bool enabled)
+{
+    pthread_once(&sOnceControl, &sInitRoutine);
+    sMixKernel = enabled ? mixKernelDetect() : MIX_KERNEL_SCALAR;
 }
 
 /* TODO: consider whether this level of optimization is necessary.
@@ -1675,6 +1991,17 @@ template <int MIXTYPE,
 static void volumeRampMulti(uint32_t channels, TO* out, size_t frameCount,
         const TI* in, TA* aux, TV *vol, const TV *volinc, TAV *vola, TAV volainc)
 {
+    const int kernel = sMixKernel.load(std::memory_order_relaxed);
+    if (aux == NULL && kernel != MIX_KERNEL_SCALAR) {
+        const size_t frames = volumeRampMultiVector<MIXTYPE>(
+                kernel, channels, out, frameCount, in, vol, volinc);
+        if (frames == frameCount) {
+            return;
+        }
+        out += frames * channels;
+        in += frames * (MIXTYPE == MIXTYPE_MONOEXPAND ? 1 : channels);
+        frameCount -= frames;
+    }
     switch (channels) {
     case 1:
         volumeRampMulti<MIXTYPE, 1>(out, frameCount, in, aux, vol, volinc, vola, volainc);
@@ -1719,6 +2046,17 @@ template <int MIXTYPE,
 static void volumeMulti(uint32_t channels, TO* out, size_t frameCount,
         const TI* in, TA* aux, const TV *vol, TAV vola)
 {
+    const int kernel = sMixKernel.load(std::memory_order_relaxed);
+    if (aux == NULL && kernel != MIX_KERNEL_SCALAR) {
+        const size_t frames = volumeMultiVector<MIXTYPE>(
+                kernel, channels, out, frameCount, in, vol);
+        if (frames == frameCount) {
+            return;
+        }
+        out += frames * channels;
+        in += frames * (MIXTYPE == MIXTYPE_MONOEXPAND ? 1 : channels);
+        frameCount -= frames;
+    }
     switch (channels) {
     case 1:
         volumeMulti<MIXTYPE, 1>(out, frameCount, in, aux, vol, vola);
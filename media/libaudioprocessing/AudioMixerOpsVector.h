@@ -0,0 +1,668 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_MIXER_OPS_VECTOR_H
+#define ANDROID_AUDIO_MIXER_OPS_VECTOR_H
+
+// depends on AudioMixerOps.h
+
+#if defined(__aarch64__) || defined(__ARM_NEON__)
+#ifndef USE_NEON
+#define USE_NEON (true)
+#endif
+#else
+#define USE_NEON (false)
+#endif
+#if USE_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(__SSSE3__)  // Should be supported in x86 ABI for both 32 & 64-bit.
+#define USE_SSE (true)
+#include <tmmintrin.h>
+#else
+#define USE_SSE (false)
+#endif
+
+#if defined(__SSE4_1__)  // Part of the x86_64 ABI, optional for 32-bit x86.
+#include <smmintrin.h>
+#endif
+
+// AVX2 is not part of any Android ABI, so it is compiled per function
+// and only used when the CPU reports it at run time.
+#if defined(__i386__) || defined(__x86_64__)
+#define USE_AVX2 (true)
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define USE_AVX2 (false)
+#endif
+
+namespace android {
+
+/*
+ * Vector kernels for the volumeRampMulti and volumeMulti cases that dominate
+ * the mixer thread: float or int16_t tracks accumulated into the mixer buffer
+ * without an aux send, 1 or 2 channels when ramping, any channel count otherwise.
+ *
+ * The kernels are bit-exact with the templates in AudioMixerOps.h:
+ * products and sums are computed separately (never fused) and ramp volumes
+ * advance by the same sequence of additions as the scalar code, lane by lane.
+ *
+ * Each function returns the number of frames it mixed, so the caller finishes
+ * the remainder with the scalar templates.  The ramp functions leave vol at the
+ * volume of the next frame.  A return of 0 means the case is not vectorized.
+ */
+
+enum {
+    MIX_KERNEL_SCALAR,  // templates in AudioMixerOps.h only
+    MIX_KERNEL_VECTOR,  // NEON or SSE, as selected at compile time
+    MIX_KERNEL_AVX2,    // x86 with AVX2, selected at run time
+};
+
+static inline int mixKernelDetect()
+{
+#if USE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return MIX_KERNEL_AVX2;
+    }
+#endif
+    return USE_NEON || USE_SSE ? MIX_KERNEL_VECTOR : MIX_KERNEL_SCALAR;
+}
+
+// Returns true if MIXTYPE with the given channel count uses a separate volume
+// per channel, that is vol[0] for even samples and vol[1] for odd samples.
+template <int MIXTYPE>
+static inline bool mixStereoVolume(uint32_t channels)
+{
+    return channels == 2 && (MIXTYPE == MIXTYPE_MULTI || MIXTYPE == MIXTYPE_MULTI_SAVEONLY);
+}
+
+// Fills lanes with the ramp volumes of the first frames, in frame order,
+// advancing vol by the same additions as volumeRampMulti.
+template <int NCHAN, int LANES, typename TV>
+static inline void mixRampLanes(TV *lanes, TV *vol, const TV *volinc)
+{
+    for (int i = 0; i < LANES; i += NCHAN) {
+        for (int j = 0; j < NCHAN; ++j) {
+            lanes[i + j] = vol[j];
+            vol[j] += volinc[j];
+        }
+    }
+}
+
+// Mixes the samples left over by a vector loop, which starts on an even sample.
+template <bool SAVE, typename TO, typename TI, typename TV>
+static inline void mixTail(TO *out, const TI *in, size_t count, TV vol0, TV vol1)
+{
+    for (size_t i = 0; i < count; ++i) {
+        const TV vol = (i & 1) ? vol1 : vol0;
+        if (SAVE) {
+            out[i] = MixMul<TO, TI, TV>(in[i], vol);
+        } else {
+            out[i] += MixMul<TO, TI, TV>(in[i], vol);
+        }
+    }
+}
+
+#if USE_NEON
+
+template <bool SAVE>
+static inline size_t mixFloatNeon(float *out, const float *in, size_t count,
+        float vol0, float vol1)
+{
+    const float volArray[4] = {vol0, vol1, vol0, vol1};
+    const float32x4_t vol = vld1q_f32(volArray);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        float32x4_t a = vmulq_f32(vld1q_f32(in + i), vol);
+        float32x4_t b = vmulq_f32(vld1q_f32(in + i + 4), vol);
+        if (!SAVE) {
+            a = vaddq_f32(vld1q_f32(out + i), a);
+            b = vaddq_f32(vld1q_f32(out + i + 4), b);
+        }
+        vst1q_f32(out + i, a);
+        vst1q_f32(out + i + 4, b);
+    }
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t a = vmulq_f32(vld1q_f32(in + i), vol);
+        if (!SAVE) {
+            a = vaddq_f32(vld1q_f32(out + i), a);
+        }
+        vst1q_f32(out + i, a);
+    }
+    return i;
+}
+
+template <bool SAVE, int NCHAN>
+static inline size_t mixRampFloatNeon(float *out, const float *in, size_t frameCount,
+        float *vol, const float *volinc)
+{
+    static constexpr int kFrames = 4 / NCHAN;
+    if (frameCount < kFrames) {
+        return 0;
+    }
+    float lanes[4];
+    float incs[4];
+    float cur[NCHAN];
+    for (int j = 0; j < NCHAN; ++j) {
+        cur[j] = vol[j];
+    }
+    mixRampLanes<NCHAN, 4>(lanes, cur, volinc);
+    for (int i = 0; i < 4; ++i) {
+        incs[i] = volinc[i % NCHAN];
+    }
+    float32x4_t v = vld1q_f32(lanes);
+    const float32x4_t inc = vld1q_f32(incs);
+    size_t frames = 0;
+    for (; frames + kFrames <= frameCount; frames += kFrames) {
+        float32x4_t a = vmulq_f32(vld1q_f32(in), v);
+        if (!SAVE) {
+            a = vaddq_f32(vld1q_f32(out), a);
+        }
+        vst1q_f32(out, a);
+        in += 4;
+        out += 4;
+        for (int k = 0; k < kFrames; ++k) {
+            v = vaddq_f32(v, inc);
+        }
+    }
+    vst1q_f32(lanes, v);
+    for (int j = 0; j < NCHAN; ++j) {
+        vol[j] = lanes[j];
+    }
+    return frames;
+}
+
+static inline size_t mixInt16Neon(int32_t *out, const int16_t *in, size_t count,
+        int16_t vol0, int16_t vol1)
+{
+    const int16_t volArray[4] = {vol0, vol1, vol0, vol1};
+    const int16x4_t vol = vld1_s16(volArray);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const int16x8_t s = vld1q_s16(in + i);
+        vst1q_s32(out + i, vmlal_s16(vld1q_s32(out + i), vget_low_s16(s), vol));
+        vst1q_s32(out + i + 4, vmlal_s16(vld1q_s32(out + i + 4), vget_high_s16(s), vol));
+    }
+    return i;
+}
+
+template <int NCHAN>
+static inline size_t mixRampInt16Neon(int32_t *out, const int16_t *in, size_t frameCount,
+        int32_t *vol, const int32_t *volinc)
+{
+    static constexpr int kFrames = 4 / NCHAN;
+    if (frameCount < kFrames) {
+        return 0;
+    }
+    int32_t lanes[4];
+    int32_t incs[4];
+    int32_t cur[NCHAN];
+    for (int j = 0; j < NCHAN; ++j) {
+        cur[j] = vol[j];
+    }
+    mixRampLanes<NCHAN, 4>(lanes, cur, volinc);
+    for (int i = 0; i < 4; ++i) {
+        incs[i] = volinc[i % NCHAN] * kFrames;
+    }
+    int32x4_t v = vld1q_s32(lanes);
+    const int32x4_t inc = vld1q_s32(incs);
+    size_t frames = 0;
+    for (; frames + kFrames <= frameCount; frames += kFrames) {
+        const int32x4_t s = vmovl_s16(vld1_s16(in));
+        vst1q_s32(out, vmlaq_s32(vld1q_s32(out), s, vshrq_n_s32(v, 16)));
+        in += 4;
+        out += 4;
+        v = vaddq_s32(v, inc);
+    }
+    vst1q_s32(lanes, v);
+    for (int j = 0; j < NCHAN; ++j) {
+        vol[j] = lanes[j];
+    }
+    return frames;
+}
+
+#endif // USE_NEON
+
+#if USE_SSE
+
+template <bool SAVE>
+static inline size_t mixFloatSSE(float *out, const float *in, size_t count,
+        float vol0, float vol1)
+{
+    const __m128 vol = _mm_setr_ps(vol0, vol1, vol0, vol1);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(in + i), vol);
+        __m128 b = _mm_mul_ps(_mm_loadu_ps(in + i + 4), vol);
+        if (!SAVE) {
+            a = _mm_add_ps(_mm_loadu_ps(out + i), a);
+            b = _mm_add_ps(_mm_loadu_ps(out + i + 4), b);
+        }
+        _mm_storeu_ps(out + i, a);
+        _mm_storeu_ps(out + i + 4, b);
+    }
+    for (; i + 4 <= count; i += 4) {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(in + i), vol);
+        if (!SAVE) {
+            a = _mm_add_ps(_mm_loadu_ps(out + i), a);
+        }
+        _mm_storeu_ps(out + i, a);
+    }
+    return i;
+}
+
+template <bool SAVE, int NCHAN>
+static inline size_t mixRampFloatSSE(float *out, const float *in, size_t frameCount,
+        float *vol, const float *volinc)
+{
+    static constexpr int kFrames = 4 / NCHAN;
+    if (frameCount < kFrames) {
+        return 0;
+    }
+    float lanes[4] __attribute__((aligned(16)));
+    float incs[4] __attribute__((aligned(16)));
+    float cur[NCHAN];
+    for (int j = 0; j < NCHAN; ++j) {
+        cur[j] = vol[j];
+    }
+    mixRampLanes<NCHAN, 4>(lanes, cur, volinc);
+    for (int i = 0; i < 4; ++i) {
+        incs[i] = volinc[i % NCHAN];
+    }
+    __m128 v = _mm_load_ps(lanes);
+    const __m128 inc = _mm_load_ps(incs);
+    size_t frames = 0;
+    for (; frames + kFrames <= frameCount; frames += kFrames) {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(in), v);
+        if (!SAVE) {
+            a = _mm_add_ps(_mm_loadu_ps(out), a);
+        }
+        _mm_storeu_ps(out, a);
+        in += 4;
+        out += 4;
+        for (int k = 0; k < kFrames; ++k) {
+            v = _mm_add_ps(v, inc);
+        }
+    }
+    _mm_store_ps(lanes, v);
+    for (int j = 0; j < NCHAN; ++j) {
+        vol[j] = lanes[j];
+    }
+    return frames;
+}
+
+static inline size_t mixInt16SSE(int32_t *out, const int16_t *in, size_t count,
+        int16_t vol0, int16_t vol1)
+{
+    // Interleaving each sample with zero lets _mm_madd_epi16 form the
+    // exact 32-bit products sample * volume.
+    const __m128i vol = _mm_setr_epi16(vol0, 0, vol1, 0, vol0, 0, vol1, 0);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        __m128i *o = reinterpret_cast<__m128i *>(out + i);
+        _mm_storeu_si128(o, _mm_add_epi32(_mm_loadu_si128(o),
+                _mm_madd_epi16(_mm_unpacklo_epi16(s, zero), vol)));
+        _mm_storeu_si128(o + 1, _mm_add_epi32(_mm_loadu_si128(o + 1),
+                _mm_madd_epi16(_mm_unpackhi_epi16(s, zero), vol)));
+    }
+    return i;
+}
+
+template <int NCHAN>
+static inline size_t mixRampInt16SSE(int32_t *out, const int16_t *in, size_t frameCount,
+        int32_t *vol, const int32_t *volinc)
+{
+#if defined(__SSE4_1__)
+    static constexpr int kFrames = 4 / NCHAN;
+    if (frameCount < kFrames) {
+        return 0;
+    }
+    int32_t lanes[4] __attribute__((aligned(16)));
+    int32_t incs[4] __attribute__((aligned(16)));
+    int32_t cur[NCHAN];
+    for (int j = 0; j < NCHAN; ++j) {
+        cur[j] = vol[j];
+    }
+    mixRampLanes<NCHAN, 4>(lanes, cur, volinc);
+    for (int i = 0; i < 4; ++i) {
+        incs[i] = volinc[i % NCHAN] * kFrames;
+    }
+    __m128i v = _mm_load_si128(reinterpret_cast<const __m128i *>(lanes));
+    const __m128i inc = _mm_load_si128(reinterpret_cast<const __m128i *>(incs));
+    size_t frames = 0;
+    for (; frames + kFrames <= frameCount; frames += kFrames) {
+        const __m128i s = _mm_cvtepi16_epi32(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i *>(in)));
+        __m128i *o = reinterpret_cast<__m128i *>(out);
+        _mm_storeu_si128(o, _mm_add_epi32(_mm_loadu_si128(o),
+                _mm_mullo_epi32(s, _mm_srai_epi32(v, 16))));
+        in += 4;
+        out += 4;
+        v = _mm_add_epi32(v, inc);
+    }
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), v);
+    for (int j = 0; j < NCHAN; ++j) {
+        vol[j] = lanes[j];
+    }
+    return frames;
+#else
+    // _mm_mullo_epi32 needs SSE4.1; the ramp stays scalar on plain SSSE3.
+    (void)out;
+    (void)in;
+    (void)frameCount;
+    (void)vol;
+    (void)volinc;
+    return 0;
+#endif
+}
+
+#endif // USE_SSE
+
+#if USE_AVX2
+
+template <bool SAVE>
+AVX2_TARGET static size_t mixFloatAVX2(float *out, const float *in, size_t count,
+        float vol0, float vol1)
+{
+    const __m256 vol = _mm256_setr_ps(vol0, vol1, vol0, vol1, vol0, vol1, vol0, vol1);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256 a = _mm256_mul_ps(_mm256_loadu_ps(in + i), vol);
+        __m256 b = _mm256_mul_ps(_mm256_loadu_ps(in + i + 8), vol);
+        if (!SAVE) {
+            a = _mm256_add_ps(_mm256_loadu_ps(out + i), a);
+            b = _mm256_add_ps(_mm256_loadu_ps(out + i + 8), b);
+        }
+        _mm256_storeu_ps(out + i, a);
+        _mm256_storeu_ps(out + i + 8, b);
+    }
+    for (; i + 8 <= count; i += 8) {
+        __m256 a = _mm256_mul_ps(_mm256_loadu_ps(in + i), vol);
+        if (!SAVE) {
+            a = _mm256_add_ps(_mm256_loadu_ps(out + i), a);
+        }
+        _mm256_storeu_ps(out + i, a);
+    }
+    return i;
+}
+
+template <bool SAVE, int NCHAN>
+AVX2_TARGET static size_t mixRampFloatAVX2(float *out, const float *in, size_t frameCount,
+        float *vol, const float *volinc)
+{
+    static constexpr int kFrames = 8 / NCHAN;
+    if (frameCount < kFrames) {
+        return 0;
+    }
+    float lanes[8] __attribute__((aligned(32)));
+    float incs[8] __attribute__((aligned(32)));
+    float cur[NCHAN];
+    for (int j = 0; j < NCHAN; ++j) {
+        cur[j] = vol[j];
+    }
+    mixRampLanes<NCHAN, 8>(lanes, cur, volinc);
+    for (int i = 0; i < 8; ++i) {
+        incs[i] = volinc[i % NCHAN];
+    }
+    __m256 v = _mm256_load_ps(lanes);
+    const __m256 inc = _mm256_load_ps(incs);
+    size_t frames = 0;
+    for (; frames + kFrames <= frameCount; frames += kFrames) {
+        __m256 a = _mm256_mul_ps(_mm256_loadu_ps(in), v);
+        if (!SAVE) {
+            a = _mm256_add_ps(_mm256_loadu_ps(out), a);
+        }
+        _mm256_storeu_ps(out, a);
+        in += 8;
+        out += 8;
+        for (int k = 0; k < kFrames; ++k) {
+            v = _mm256_add_ps(v, inc);
+        }
+    }
+    _mm256_store_ps(lanes, v);
+    for (int j = 0; j < NCHAN; ++j) {
+        vol[j] = lanes[j];
+    }
+    return frames;
+}
+
+AVX2_TARGET static size_t mixInt16AVX2(int32_t *out, const int16_t *in, size_t count,
+        int16_t vol0, int16_t vol1)
+{
+    const __m256i vol = _mm256_setr_epi32(vol0, vol1, vol0, vol1, vol0, vol1, vol0, vol1);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i s = _mm256_cvtepi16_epi32(
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)));
+        __m256i *o = reinterpret_cast<__m256i *>(out + i);
+        _mm256_storeu_si256(o, _mm256_add_epi32(_mm256_loadu_si256(o),
+                _mm256_mullo_epi32(s, vol)));
+    }
+    return i;
+}
+
+template <int NCHAN>
+AVX2_TARGET static size_t mixRampInt16AVX2(int32_t *out, const int16_t *in, size_t frameCount,
+        int32_t *vol, const int32_t *volinc)
+{
+    static constexpr int kFrames = 8 / NCHAN;
+    if (frameCount < kFrames) {
+        return 0;
+    }
+    int32_t lanes[8] __attribute__((aligned(32)));
+    int32_t incs[8] __attribute__((aligned(32)));
+    int32_t cur[NCHAN];
+    for (int j = 0; j < NCHAN; ++j) {
+        cur[j] = vol[j];
+    }
+    mixRampLanes<NCHAN, 8>(lanes, cur, volinc);
+    for (int i = 0; i < 8; ++i) {
+        incs[i] = volinc[i % NCHAN] * kFrames;
+    }
+    __m256i v = _mm256_load_si256(reinterpret_cast<const __m256i *>(lanes));
+    const __m256i inc = _mm256_load_si256(reinterpret_cast<const __m256i *>(incs));
+    size_t frames = 0;
+    for (; frames + kFrames <= frameCount; frames += kFrames) {
+        const __m256i s = _mm256_cvtepi16_epi32(
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(in)));
+        __m256i *o = reinterpret_cast<__m256i *>(out);
+        _mm256_storeu_si256(o, _mm256_add_epi32(_mm256_loadu_si256(o),
+                _mm256_mullo_epi32(s, _mm256_srai_epi32(v, 16))));
+        in += 8;
+        out += 8;
+        v = _mm256_add_epi32(v, inc);
+    }
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), v);
+    for (int j = 0; j < NCHAN; ++j) {
+        vol[j] = lanes[j];
+    }
+    return frames;
+}
+
+#endif // USE_AVX2
+
+/*
+ * Dispatch by type.  The generic versions handle the cases without a kernel.
+ */
+
+template <int MIXTYPE, typename TO, typename TI, typename TV>
+static inline size_t volumeMultiVector(int kernel __unused, uint32_t channels __unused,
+        TO* out __unused, size_t frameCount __unused, const TI* in __unused,
+        const TV *vol __unused)
+{
+    return 0;
+}
+
+template <int MIXTYPE>
+static inline size_t volumeMultiVector(int kernel, uint32_t channels,
+        float* out, size_t frameCount, const float* in, const float *vol)
+{
+    if (MIXTYPE == MIXTYPE_MONOEXPAND) {
+        return 0;
+    }
+    static constexpr bool SAVE = MIXTYPE == MIXTYPE_MULTI_SAVEONLY
+            || MIXTYPE == MIXTYPE_MULTI_SAVEONLY_MONOVOL;
+    const float vol1 = mixStereoVolume<MIXTYPE>(channels) ? vol[1] : vol[0];
+    const size_t count = frameCount * channels;
+    size_t done = 0;
+    switch (kernel) {
+#if USE_AVX2
+    case MIX_KERNEL_AVX2:
+        done = mixFloatAVX2<SAVE>(out, in, count, vol[0], vol1);
+        break;
+#endif
+#if USE_NEON
+    case MIX_KERNEL_VECTOR:
+        done = mixFloatNeon<SAVE>(out, in, count, vol[0], vol1);
+        break;
+#elif USE_SSE
+    case MIX_KERNEL_VECTOR:
+        done = mixFloatSSE<SAVE>(out, in, count, vol[0], vol1);
+        break;
+#endif
+    default:
+        return 0;
+    }
+    mixTail<SAVE>(out + done, in + done, count - done, vol[0], vol1);
+    return frameCount;
+}
+
+template <int MIXTYPE>
+static inline size_t volumeMultiVector(int kernel, uint32_t channels,
+        int32_t* out, size_t frameCount, const int16_t* in, const int16_t *vol)
+{
+    if (MIXTYPE != MIXTYPE_MULTI && MIXTYPE != MIXTYPE_MULTI_MONOVOL) {
+        return 0;
+    }
+    const int16_t vol1 = mixStereoVolume<MIXTYPE>(channels) ? vol[1] : vol[0];
+    const size_t count = frameCount * channels;
+    size_t done = 0;
+    switch (kernel) {
+#if USE_AVX2
+    case MIX_KERNEL_AVX2:
+        done = mixInt16AVX2(out, in, count, vol[0], vol1);
+        break;
+#endif
+#if USE_NEON
+    case MIX_KERNEL_VECTOR:
+        done = mixInt16Neon(out, in, count, vol[0], vol1);
+        break;
+#elif USE_SSE
+    case MIX_KERNEL_VECTOR:
+        done = mixInt16SSE(out, in, count, vol[0], vol1);
+        break;
+#endif
+    default:
+        return 0;
+    }
+    mixTail<false /* SAVE */>(out + done, in + done, count - done, vol[0], vol1);
+    return frameCount;
+}
+
+template <int MIXTYPE, typename TO, typename TI, typename TV>
+static inline size_t volumeRampMultiVector(int kernel __unused, uint32_t channels __unused,
+        TO* out __unused, size_t frameCount __unused, const TI* in __unused,
+        TV *vol __unused, const TV *volinc __unused)
+{
+    return 0;
+}
+
+template <int MIXTYPE, bool SAVE, int NCHAN>
+static inline size_t volumeRampMultiFloat(int kernel, float* out, size_t frameCount,
+        const float* in, float *vol, const float *volinc)
+{
+    switch (kernel) {
+#if USE_AVX2
+    case MIX_KERNEL_AVX2:
+        return mixRampFloatAVX2<SAVE, NCHAN>(out, in, frameCount, vol, volinc);
+#endif
+#if USE_NEON
+    case MIX_KERNEL_VECTOR:
+        return mixRampFloatNeon<SAVE, NCHAN>(out, in, frameCount, vol, volinc);
+#elif USE_SSE
+    case MIX_KERNEL_VECTOR:
+        return mixRampFloatSSE<SAVE, NCHAN>(out, in, frameCount, vol, volinc);
+#endif
+    default:
+        return 0;
+    }
+}
+
+template <int MIXTYPE>
+static inline size_t volumeRampMultiVector(int kernel, uint32_t channels,
+        float* out, size_t frameCount, const float* in, float *vol, const float *volinc)
+{
+    static constexpr bool SAVE = MIXTYPE == MIXTYPE_MULTI_SAVEONLY;
+    if (MIXTYPE != MIXTYPE_MULTI && MIXTYPE != MIXTYPE_MULTI_SAVEONLY) {
+        return 0;
+    }
+    switch (channels) {
+    case 1:
+        return volumeRampMultiFloat<MIXTYPE, SAVE, 1>(kernel, out, frameCount, in, vol, volinc);
+    case 2:
+        return volumeRampMultiFloat<MIXTYPE, SAVE, 2>(kernel, out, frameCount, in, vol, volinc);
+    default:
+        // more channels ramp a single volume per frame, which does not fit the lanes.
+        return 0;
+    }
+}
+
+template <int NCHAN>
+static inline size_t volumeRampMultiInt16(int kernel, int32_t* out, size_t frameCount,
+        const int16_t* in, int32_t *vol, const int32_t *volinc)
+{
+    switch (kernel) {
+#if USE_AVX2
+    case MIX_KERNEL_AVX2:
+        return mixRampInt16AVX2<NCHAN>(out, in, frameCount, vol, volinc);
+#endif
+#if USE_NEON
+    case MIX_KERNEL_VECTOR:
+        return mixRampInt16Neon<NCHAN>(out, in, frameCount, vol, volinc);
+#elif USE_SSE
+    case MIX_KERNEL_VECTOR:
+        return mixRampInt16SSE<NCHAN>(out, in, frameCount, vol, volinc);
+#endif
+    default:
+        return 0;
+    }
+}
+
+template <int MIXTYPE>
+static inline size_t volumeRampMultiVector(int kernel, uint32_t channels,
+        int32_t* out, size_t frameCount, const int16_t* in, int32_t *vol, const int32_t *volinc)
+{
+    if (MIXTYPE != MIXTYPE_MULTI) {
+        return 0;
+    }
+    switch (channels) {
+    case 1:
+        return volumeRampMultiInt16<1>(kernel, out, frameCount, in, vol, volinc);
+    case 2:
+        return volumeRampMultiInt16<2>(kernel, out, frameCount, in, vol, volinc);
+    default:
+        return 0;
+    }
+}
+
+} // namespace android
+
+#endif /* ANDROID_AUDIO_MIXER_OPS_VECTOR_H */
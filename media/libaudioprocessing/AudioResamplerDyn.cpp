@@ -23,6 +23,11 @@
 #include <dlfcn.h>
 #include <math.h>
 
+#include <functional>
+#include <map>
+#include <mutex>
+#include <tuple>
+
 #include <cutils/compiler.h>
 #include <cutils/properties.h>
 #include <utils/Debug.h>
@@ -59,6 +64,100 @@ namespace android {
  * r = extra space for implementing the ring buffer
  */
 
+/*
+ * FilterCache shares the polyphase filter banks between resamplers.
+ *
+ * Filters are keyed by every parameter of the Kaiser design, so a cached filter
+ * is identical to a newly designed one. The cache holds weak references: the
+ * coefficients are freed when the last resampler using them lets go.
+ */
+class FilterCache {
+public:
+    using Key = std::tuple<int /* coefType */, int /* phases */, int /* halfLength */,
+            double /* stopBandAtten */, double /* fcr */>;
+
+    static FilterCache& getInstance() {
+        static FilterCache instance;
+        return instance;
+    }
+
+    // Returns the filter for key, of size bytes, calling design() to fill in
+    // a new filter if it is not in use by another resampler.
+    std::shared_ptr<void> get(const Key &key, size_t size,
+            const std::function<void(void *coefs)> &design) {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            std::shared_ptr<void> coefs = find_l(key);
+            if (coefs.get() != nullptr) {
+                ++mHits;
+                return coefs;
+            }
+        }
+
+        // design outside of the lock, as this can take a few milliseconds.
+        void *buffer = nullptr;
+        int ret = posix_memalign(&buffer, CACHE_LINE_SIZE /* alignment */, size);
+        LOG_ALWAYS_FATAL_IF(ret != 0, "Cannot allocate buffer memory, ret %d", ret);
+        std::shared_ptr<void> coefs(buffer, free);
+        design(buffer);
+
+        std::lock_guard<std::mutex> lock(mLock);
+        ++mMisses;
+        std::shared_ptr<void> other = find_l(key);
+        if (other.get() != nullptr) {
+            return other; // designed concurrently by another resampler
+        }
+        // forget filters that are no longer used.
+        for (auto it = mFilters.begin(); it != mFilters.end(); ) {
+            if (it->second.coefs.expired()) {
+                it = mFilters.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        mFilters[key] = Entry{coefs, size};
+        return coefs;
+    }
+
+    AudioResamplerDynFilterCacheStats getStats() {
+        std::lock_guard<std::mutex> lock(mLock);
+        AudioResamplerDynFilterCacheStats stats = {mHits, mMisses, 0, 0};
+        for (const auto &pair : mFilters) {
+            if (!pair.second.coefs.expired()) {
+                ++stats.filters;
+                stats.bytes += pair.second.size;
+            }
+        }
+        return stats;
+    }
+
+private:
+    struct Entry {
+        std::weak_ptr<void> coefs;
+        size_t size;
+    };
+
+    std::shared_ptr<void> find_l(const Key &key) {
+        auto it = mFilters.find(key);
+        return it != mFilters.end() ? it->second.coefs.lock() : nullptr;
+    }
+
+    std::mutex mLock;
+    std::map<Key, Entry> mFilters;
+    uint64_t mHits = 0;
+    uint64_t mMisses = 0;
+};
+
+template<typename TC>
+static constexpr int coefType() {
+    return is_same<TC, int16_t>::value ? 0 : is_same<TC, int32_t>::value ? 1 : 2;
+}
+
+AudioResamplerDynFilterCacheStats getAudioResamplerDynFilterCacheStats()
+{
+    return FilterCache::getInstance().getStats();
+}
+
 template<typename TC, typename TI, typename TO>
 AudioResamplerDyn<TC, TI, TO>::InBuffer::InBuffer()
     : mState(NULL), mImpulse(NULL), mRingFull(NULL), mStateCount(0)
@@ -183,7 +282,7 @@ AudioResamplerDyn<TC, TI, TO>::AudioResamplerDyn(
         int inChannelCount, int32_t sampleRate, src_quality quality)
     : AudioResampler(inChannelCount, sampleRate, quality),
       mResampleFunc(0), mFilterSampleRate(0), mFilterQuality(DEFAULT_QUALITY),
-    mCoefBuffer(NULL)
+      mFilterPolyphase(false)
 {
     mVolumeSimd[0] = mVolumeSimd[1] = 0;
     // The AudioResampler base class assumes we are always ready for 1:1 resampling.
@@ -208,7 +307,6 @@ AudioResamplerDyn<TC, TI, TO>::AudioResamplerDyn(
 template<typename TC, typename TI, typename TO>
 AudioResamplerDyn<TC, TI, TO>::~AudioResamplerDyn()
 {
-    free(mCoefBuffer);
 }
 
 template<typename TC, typename TI, typename TO>
@@ -264,24 +362,20 @@ void AudioResamplerDyn<TC, TI, TO>::createKaiserFir(Constants &c,
     const int phases = c.mL;
     const int halfLength = c.mHalfNumCoefs;
 
-    // create buffer
-    TC *coefs = nullptr;
-    int ret = posix_memalign(
-            reinterpret_cast<void **>(&coefs),
-            CACHE_LINE_SIZE /* alignment */,
-            (phases + 1) * halfLength * sizeof(TC));
-    LOG_ALWAYS_FATAL_IF(ret != 0, "Cannot allocate buffer memory, ret %d", ret);
-    c.mFirCoefs = coefs;
-    free(mCoefBuffer);
-    mCoefBuffer = coefs;
-
     // square the computed minimum passband value (extra safety).
     double attenuation =
             computeWindowedSincMinimumPassbandValue(stopBandAtten);
     attenuation *= attenuation;
 
-    // design filter
-    firKaiserGen(coefs, phases, halfLength, stopBandAtten, fcr, attenuation);
+    // design filter, or share it with resamplers of the same design.
+    mCoefBuffer = FilterCache::getInstance().get(
+            FilterCache::Key(coefType<TC>(), phases, halfLength, stopBandAtten, fcr),
+            (phases + 1) * halfLength * sizeof(TC),
+            [&](void *coefs) {
+                firKaiserGen(static_cast<TC *>(coefs),
+                        phases, halfLength, stopBandAtten, fcr, attenuation);
+            });
+    c.mFirCoefs = static_cast<const TC *>(mCoefBuffer.get());
 
     // update the design criteria
     mNormalizedCutoffFrequency = fcr;
@@ -307,7 +401,7 @@ void AudioResamplerDyn<TC, TI, TO>::createKaiserFir(Constants &c,
 
     const int32_t passSteps = 1000;
 
-    testFir(coefs, c.mL, c.mHalfNumCoefs, fp, fs, passSteps, passSteps * c.mL /*stopSteps*/,
+    testFir(c.mFirCoefs, c.mL, c.mHalfNumCoefs, fp, fs, passSteps, passSteps * c.mL /*stopSteps*/,
             passMin, passMax, passRipple, stopMax, stopRipple);
     ALOGD("passband(%lf, %lf): %.8lf %.8lf %.8lf\n", 0., fp, passMin, passMax, passRipple);
     ALOGD("stopband(%lf, %lf): %.8lf %.3lf\n", fs, 0.5, stopMax, stopRipple);
@@ -342,6 +436,20 @@ static bool isClose(int32_t newSampleRate, int32_t prevSampleRate,
     return pdiff < prevSampleRate>>4 && adiff < filterSampleRate>>3;
 }
 
+// Largest numerator or denominator of a sample rate ratio resampled by the polyphase
+// resampler, e.g. 16 kHz to 48 kHz is 1:3 and 32 kHz to 48 kHz is 2:3.
+static constexpr int32_t kMaxPolyphaseRatio = 8;
+
+static bool isPolyphaseRatio(int32_t inSampleRate, int32_t outSampleRate)
+{
+    if (inSampleRate <= 0 || inSampleRate == outSampleRate) {
+        return false;
+    }
+    const int32_t divisor = gcd(outSampleRate, inSampleRate);
+    return inSampleRate / divisor <= kMaxPolyphaseRatio
+            && outSampleRate / divisor <= kMaxPolyphaseRatio;
+}
+
 template<typename TC, typename TI, typename TO>
 void AudioResamplerDyn<TC, TI, TO>::setSampleRate(int32_t inSampleRate)
 {
@@ -354,12 +462,18 @@ void AudioResamplerDyn<TC, TI, TO>::setSampleRate(int32_t inSampleRate)
 
     mInSampleRate = inSampleRate;
 
+    // A small integer ratio such as 16 kHz to 48 kHz gets a filter with exactly one phase
+    // per output frame of the ratio, so that no phase is ever interpolated.
+    // That filter can't be interpolated for any other ratio either.
+    const bool polyphase = isPolyphaseRatio(inSampleRate, mSampleRate);
+
     // TODO: Add precalculated Equiripple filters
 
-    if (mFilterQuality != getQuality() ||
+    if (mFilterQuality != getQuality() || polyphase || mFilterPolyphase ||
             !isClose(inSampleRate, oldSampleRate, mFilterSampleRate, mSampleRate)) {
         mFilterSampleRate = inSampleRate;
         mFilterQuality = getQuality();
+        mFilterPolyphase = polyphase;
 
         double stopBandAtten;
         double tbwCheat = 1.; // how much we "cheat" into aliasing
@@ -502,7 +616,10 @@ void AudioResamplerDyn<TC, TI, TO>::setSampleRate(int32_t inSampleRate)
         // if we know that the filter will be used for dynamic sample rate changes,
         // that would allow us skip this part for fixed sample rate resamplers.
         //
-        while (phases<63) {
+        // The polyphase filter of a small integer ratio is used as is: its few phases
+        // keep the whole filter in cache.
+        //
+        while (!polyphase && phases<63) {
             phases *= 2; // this code only needed to support dynamic rate changes
         }
 
@@ -549,7 +666,35 @@ void AudioResamplerDyn<TC, TI, TO>::setSampleRate(int32_t inSampleRate)
     LOG_ALWAYS_FATAL_IF(mChannelCount < 1 || mChannelCount > 8,
             "Resampler channels(%d) must be between 1 to 8", mChannelCount);
     // stride 16 (falls back to stride 2 for machines that do not support NEON)
-    if (locked) {
+    if (isPolyphase()) {
+        // a small integer ratio is always locked.
+        switch (mChannelCount) {
+        case 1:
+            mResampleFunc = &AudioResamplerDyn<TC, TI, TO>::resamplePolyphase<1, 16>;
+            break;
+        case 2:
+            mResampleFunc = &AudioResamplerDyn<TC, TI, TO>::resamplePolyphase<2, 16>;
+            break;
+        case 3:
+            mResampleFunc = &AudioResamplerDyn<TC, TI, TO>::resamplePolyphase<3, 16>;
+            break;
+        case 4:
+            mResampleFunc = &AudioResamplerDyn<TC, TI, TO>::resamplePolyphase<4, 16>;
+            break;
+        case 5:
+            mResampleFunc = &AudioResamplerDyn<TC, TI, TO>::resamplePolyphase<5, 16>;
+            break;
+        case 6:
+            mResampleFunc = &AudioResamplerDyn<TC, TI, TO>::resamplePolyphase<6, 16>;
+            break;
+        case 7:
+            mResampleFunc = &AudioResamplerDyn<TC, TI, TO>::resamplePolyphase<7, 16>;
+            break;
+        case 8:
+            mResampleFunc = &AudioResamplerDyn<TC, TI, TO>::resamplePolyphase<8, 16>;
+            break;
+        }
+    } else if (locked) {
         switch (mChannelCount) {
         case 1:
             mResampleFunc = &AudioResamplerDyn<TC, TI, TO>::resample<1, true, 16>;
@@ -606,7 +751,7 @@ void AudioResamplerDyn<TC, TI, TO>::setSampleRate(int32_t inSampleRate)
     }
 #ifdef DEBUG_RESAMPLER
     printf("channels:%d  %s  stride:%d  %s  coef:%d  shift:%d\n",
-            mChannelCount, locked ? "locked" : "interpolated",
+            mChannelCount, isPolyphase() ? "polyphase" : locked ? "locked" : "interpolated",
             stride, useS32 ? "S32" : "S16", 2*c.mHalfNumCoefs, c.mShift);
 #endif
 }
@@ -750,6 +895,80 @@ resample_exit:
     return outputIndex / OUTPUT_CHANNELS;
 }
 
+/* Resamples a small integer ratio of L output frames for M input frames, with a filter
+ * of L phases. Output frame k uses phase (k * M) % L as is, and the input advances
+ * by M frames per L output frames, so there is no fractional phase to track.
+ */
+template<typename TC, typename TI, typename TO>
+template<int CHANNELS, int STRIDE>
+size_t AudioResamplerDyn<TC, TI, TO>::resamplePolyphase(TO* out, size_t outFrameCount,
+        AudioBufferProvider* provider)
+{
+    const int OUTPUT_CHANNELS = (CHANNELS < 2) ? 2 : CHANNELS;
+    const Constants& c(mConstants);
+    const TC* const coefs = c.mFirCoefs;
+    const int halfNumCoefs = c.mHalfNumCoefs;
+    const uint32_t phases = c.mL;                           // L
+    const uint32_t inputStep = mPhaseIncrement >> c.mShift; // M
+    const TO* const volumeSimd = mVolumeSimd;
+    TI* impulse = mInBuffer.getImpulse();
+    size_t inputIndex = 0;
+    size_t outputIndex = 0;
+    const size_t outputSampleCount = outFrameCount * OUTPUT_CHANNELS;
+
+    // phase >= phases when input frames are needed before the next output frame,
+    // which is carried over to the next call if the provider runs out.
+    uint32_t phase = mPhaseFraction >> c.mShift;
+
+    // only fetch the input needed up to the last output frame, so that
+    // no buffer is held on return.
+    size_t inFrameCount = outFrameCount == 0 ? 0 :
+            (phase + inputStep * (uint64_t)(outFrameCount - 1)) / phases;
+
+    while (outputIndex < outputSampleCount) {
+        if (phase >= phases) {
+            if (mBuffer.frameCount == 0) {
+                ALOG_ASSERT(inFrameCount > 0);
+                mBuffer.frameCount = inFrameCount;
+                provider->getNextBuffer(&mBuffer);
+                if (mBuffer.raw == NULL) {
+                    // We are either at the end of playback or in an underrun situation.
+                    // Reset buffer to prevent pop noise at the next buffer.
+                    mInBuffer.reset();
+                    break;
+                }
+                inFrameCount -= mBuffer.frameCount;
+            }
+            const TI* const in = reinterpret_cast<const TI*>(mBuffer.raw);
+            do {
+                mInBuffer.template readAdvance<CHANNELS>(impulse, halfNumCoefs, in, inputIndex);
+                inputIndex++;
+                phase -= phases;
+            } while (phase >= phases && inputIndex < mBuffer.frameCount);
+            if (inputIndex >= mBuffer.frameCount) {
+                inputIndex = 0;
+                provider->releaseBuffer(&mBuffer);
+            }
+            continue;
+        }
+
+        // output frames until the next input frame is needed,
+        // the same way as fir() with a locked phase.
+        do {
+            ProcessL<CHANNELS, STRIDE>(&out[outputIndex], halfNumCoefs,
+                    coefs + phase * halfNumCoefs, coefs + (phases - phase) * halfNumCoefs,
+                    impulse, impulse + CHANNELS, volumeSimd);
+            outputIndex += OUTPUT_CHANNELS;
+            phase += inputStep;
+        } while (phase < phases && outputIndex < outputSampleCount);
+    }
+
+    ALOG_ASSERT(inputIndex == 0 && mBuffer.frameCount == 0);
+    mInBuffer.setImpulse(impulse);
+    mPhaseFraction = phase << c.mShift;
+    return outputIndex / OUTPUT_CHANNELS;
+}
+
 /* instantiate templates used by AudioResampler::create */
 template class AudioResamplerDyn<float, float, float>;
 template class AudioResamplerDyn<int16_t, int16_t, int32_t>;
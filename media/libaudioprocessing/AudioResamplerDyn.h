@@ -21,10 +21,26 @@
 #include <sys/types.h>
 #include <android/log.h>
 
+#include <memory>
+
 #include <media/AudioResampler.h>
 
 namespace android {
 
+/* Statistics of the filter cache shared by all AudioResamplerDyn instances.
+ * Resamplers with the same filter design (coefficient type, phases, length,
+ * stopband attenuation and cutoff) share one copy of the coefficients, which
+ * is freed when the last of them changes filter or is destroyed.
+ */
+struct AudioResamplerDynFilterCacheStats {
+    uint64_t hits;      // filters found in the cache
+    uint64_t misses;    // filters designed
+    size_t filters;     // filters currently in use
+    size_t bytes;       // memory of the filters currently in use
+};
+
+AudioResamplerDynFilterCacheStats getAudioResamplerDynFilterCacheStats();
+
 /* AudioResamplerDyn
  *
  * This class template is used for floating point and integer resamplers.
@@ -93,6 +109,18 @@ public:
         return mNormalizedCutoffFrequency;
     }
 
+    // True if the filter has exactly the phases of a small integer ratio,
+    // and the polyphase resampler is used, see setSampleRate().
+    bool isPolyphase() const {
+        return mFilterPolyphase && mPolyphaseEnabled;
+    }
+
+    // For testing, resample small integer ratios with the generic locked phase
+    // resampler instead, using the same filter. Call before setSampleRate().
+    void setPolyphaseEnabled(bool enabled) {
+        mPolyphaseEnabled = enabled;
+    }
+
 private:
 
     class Constants { // stores the filter constants.
@@ -155,6 +183,9 @@ private:
     template<int CHANNELS, bool LOCKED, int STRIDE>
     size_t resample(TO* out, size_t outFrameCount, AudioBufferProvider* provider);
 
+    template<int CHANNELS, int STRIDE>
+    size_t resamplePolyphase(TO* out, size_t outFrameCount, AudioBufferProvider* provider);
+
     // define a pointer to member function type for resample
     typedef size_t (AudioResamplerDyn<TC, TI, TO>::*resample_ABP_t)(TO* out,
             size_t outFrameCount, AudioBufferProvider* provider);
@@ -166,7 +197,9 @@ private:
      resample_ABP_t mResampleFunc;     // called function for resampling
             int32_t mFilterSampleRate; // designed filter sample rate.
         src_quality mFilterQuality;    // designed filter quality.
-              void* mCoefBuffer;       // if a filter is created, this is not null
+               bool mFilterPolyphase;  // designed filter has one phase per output of the ratio.
+               bool mPolyphaseEnabled = true;
+    std::shared_ptr<void> mCoefBuffer; // if a filter is created, this is not null
 
     // Property selected design parameters.
               // This will enable fixed high quality resampling.
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioTimestretchWsola"
+//#define LOG_NDEBUG 0
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <log/log.h>
+#include <media/AudioResamplerPublic.h>
+
+#include "AudioTimestretchWsola.h"
+#include "AudioResamplerFirOps.h" // USE_NEON and USE_SSE are defined here
+
+namespace android {
+
+// Sum of a[i] * b[i] for i in [0, count).
+static inline float dotProduct(const float *a, const float *b, size_t count)
+{
+    size_t i = 0;
+#if USE_NEON
+    float32x4_t acc0 = vdupq_n_f32(0.);
+    float32x4_t acc1 = vdupq_n_f32(0.);
+    for (; i + 8 <= count; i += 8) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    acc0 = vaddq_f32(acc0, acc1);
+    float32x2_t acc = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+    float sum = vget_lane_f32(vpadd_f32(acc, acc), 0);
+#elif USE_SSE
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (; i + 8 <= count; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    acc0 = _mm_add_ps(acc0, acc1);
+    acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+    acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+    float sum = _mm_cvtss_f32(acc0);
+#else
+    float sum = 0.;
+#endif
+    for (; i < count; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// Cross-correlation of a and b normalized by the energy of b, which is enough
+// to compare the b that best matches a given a.
+static inline double similarity(double correlation, double energy)
+{
+    return energy > 0. ? correlation / sqrt(energy) : 0.;
+}
+
+AudioTimestretchWsola::AudioTimestretchWsola(uint32_t channelCount, uint32_t sampleRate) :
+        mChannelCount(channelCount),
+        mHopFrames(std::max(sampleRate / 100, 16u)),              // 10 msec
+        mSearchFrames(std::max(sampleRate / 160, 8u)),            // 6.25 msec
+        mCoarseStep(std::max(sampleRate / 16000, 1u)),
+        mCoarseFrames(mHopFrames / 2),
+        mFadeIn(mHopFrames),
+        mSpeed(1.0f),
+        // The input needed at once spans the hops the speed skips, and the lookahead.
+        mHistoryFrames((size_t)ceilf(AUDIO_TIMESTRETCH_SPEED_MAX * mHopFrames)
+                + getLookaheadFrames() + mHopFrames),
+        mHistory(mHistoryFrames * mChannelCount)
+{
+    // Raised cosine, so that the gain is 1 where the segments are in phase.
+    for (size_t i = 0; i < mHopFrames; ++i) {
+        mFadeIn[i] = 0.5 - 0.5 * cos(M_PI * (i + 0.5) / mHopFrames);
+    }
+    // The most frames read at once are those of the search window.
+    const size_t maxFrames = 2 * mSearchFrames + mHopFrames + 1;
+    mJoin[0].resize(maxFrames * mChannelCount);
+    mJoin[1].resize(maxFrames * mChannelCount);
+    reset();
+}
+
+void AudioTimestretchWsola::setSpeed(float speed)
+{
+    mSpeed = speed;
+}
+
+void AudioTimestretchWsola::reset()
+{
+    // The first hop starts with the first frame: there is nothing to crossfade from.
+    mNominal = 0.;
+    mPrevious = 0;
+    mNext = 0;
+    mOffset = 0;
+    mHopReady = true;
+    mStart = 0;
+    mHistoryStart = 0;
+}
+
+void AudioTimestretchWsola::copyFromHistory(float *dst, int64_t position, size_t frames) const
+{
+    const size_t slot = position % mHistoryFrames;
+    const size_t first = std::min(frames, mHistoryFrames - slot);
+    memcpy(dst, mHistory.data() + slot * mChannelCount, first * mChannelCount * sizeof(float));
+    memcpy(dst + first * mChannelCount, mHistory.data(),
+            (frames - first) * mChannelCount * sizeof(float));
+}
+
+void AudioTimestretchWsola::copyToHistory(int64_t position, const float *src, size_t frames)
+{
+    const size_t slot = position % mHistoryFrames;
+    const size_t first = std::min(frames, mHistoryFrames - slot);
+    memcpy(mHistory.data() + slot * mChannelCount, src, first * mChannelCount * sizeof(float));
+    memcpy(mHistory.data(), src + first * mChannelCount,
+            (frames - first) * mChannelCount * sizeof(float));
+}
+
+const float *AudioTimestretchWsola::getFrames(int64_t position, size_t frames,
+        const float *src, size_t srcFrames, int join)
+{
+    const int64_t end = position + frames;
+    if (position < mHistoryStart || end > mStart + (int64_t)srcFrames) {
+        return nullptr;
+    }
+    if (position >= mStart) {
+        return src + (position - mStart) * mChannelCount;
+    }
+    const size_t slot = position % mHistoryFrames;
+    if (end <= mStart && slot + frames <= mHistoryFrames) {
+        return mHistory.data() + slot * mChannelCount;
+    }
+    const size_t historyFrames = std::min(end, mStart) - position;
+    float *buffer = mJoin[join].data();
+    copyFromHistory(buffer, position, historyFrames);
+    if (end > mStart) {
+        memcpy(buffer + historyFrames * mChannelCount, src,
+                (end - mStart) * mChannelCount * sizeof(float));
+    }
+    return buffer;
+}
+
+bool AudioTimestretchWsola::searchNextSegment(const float *src, size_t srcFrames)
+{
+    // At normal speed the continuation is the next segment: the input is copied.
+    if (mSpeed == 1.0f) {
+        mNominal = mPrevious;
+        mNext = mPrevious;
+        mHopReady = true;
+        return true;
+    }
+
+    const float *target = getFrames(mPrevious, mHopFrames, src, srcFrames, 0);
+    const int64_t center = llround(mNominal);
+    const int64_t low = std::max(center - (int64_t)mSearchFrames, mHistoryStart);
+    const int64_t high = std::max(center + (int64_t)mSearchFrames, low);
+    const float *window = getFrames(low, high - low + mHopFrames, src, srcFrames, 1);
+    if (target == nullptr || window == nullptr) {
+        return false;
+    }
+
+    // Coarse search over the start of the overlap, with the energy of each
+    // candidate updated as the window slides.
+    const size_t coarseSamples = mCoarseFrames * mChannelCount;
+    const size_t stepSamples = mCoarseStep * mChannelCount;
+    double energy = dotProduct(window, window, coarseSamples);
+    int64_t best = low;
+    double bestSimilarity = -INFINITY;
+    for (int64_t position = low; position <= high; position += mCoarseStep) {
+        const float *candidate = window + (position - low) * mChannelCount;
+        const double value = similarity(
+                dotProduct(target, candidate, coarseSamples), energy);
+        if (value > bestSimilarity) {
+            bestSimilarity = value;
+            best = position;
+        }
+        if (position + (int64_t)mCoarseStep <= high) {
+            const float *entering = candidate + coarseSamples;
+            energy += dotProduct(entering, entering, stepSamples)
+                    - dotProduct(candidate, candidate, stepSamples);
+            energy = std::max(energy, 0.);
+        }
+    }
+
+    // Refine around it over the whole overlap.
+    const size_t hopSamples = mHopFrames * mChannelCount;
+    const int64_t first = std::max(best - (int64_t)mCoarseStep + 1, low);
+    const int64_t last = std::min(best + (int64_t)mCoarseStep - 1, high);
+    bestSimilarity = -INFINITY;
+    for (int64_t position = first; position <= last; ++position) {
+        const float *candidate = window + (position - low) * mChannelCount;
+        const double value = similarity(dotProduct(target, candidate, hopSamples),
+                dotProduct(candidate, candidate, hopSamples));
+        if (value > bestSimilarity) {
+            bestSimilarity = value;
+            best = position;
+        }
+    }
+
+    ALOGV("searchNextSegment() nominal %lld next %lld", (long long)center, (long long)best);
+    mNext = best;
+    mHopReady = true;
+    return true;
+}
+
+int64_t AudioTimestretchWsola::getNeededStart() const
+{
+    int64_t start = std::min(mPrevious + (int64_t)mOffset,
+            (int64_t)llround(mNominal) - (int64_t)mSearchFrames);
+    if (mHopReady) {
+        start = std::min(start, mNext + (int64_t)mOffset);
+    }
+    return std::max(start, mHistoryStart);
+}
+
+size_t AudioTimestretchWsola::process(float *dst, size_t dstFrames,
+        const float *src, size_t *srcFrames)
+{
+    size_t written = 0;
+    while (written < dstFrames) {
+        if (!mHopReady && !searchNextSegment(src, *srcFrames)) {
+            break;
+        }
+        const size_t remaining = mHopFrames - mOffset;
+        const float *previous = getFrames(mPrevious + mOffset, remaining, src, *srcFrames, 0);
+        const float *next = getFrames(mNext + mOffset, remaining, src, *srcFrames, 1);
+        if (previous == nullptr || next == nullptr) {
+            break;
+        }
+
+        const size_t frames = std::min(remaining, dstFrames - written);
+        float *out = dst + written * mChannelCount;
+        for (size_t i = 0; i < frames; ++i) {
+            const float fadeIn = mFadeIn[mOffset + i];
+            for (size_t j = 0; j < mChannelCount; ++j) {
+                const float from = *previous++;
+                *out++ = from + (*next++ - from) * fadeIn;
+            }
+        }
+        written += frames;
+        mOffset += frames;
+        if (mOffset == mHopFrames) {
+            mPrevious = mNext + mHopFrames;
+            mNominal += (double)mSpeed * mHopFrames;
+            mOffset = 0;
+            mHopReady = false;
+        }
+    }
+
+    // Consume the input before the first frame still needed, and leave the rest.
+    const int64_t neededStart = getNeededStart();
+    size_t consumed = 0;
+    if (neededStart > mStart) {
+        consumed = std::min(neededStart - mStart, (int64_t)*srcFrames);
+        mHistoryStart = mStart + consumed;
+    } else {
+        mHistoryStart = neededStart;
+        if (written == 0) {
+            // src is too short for the next hop: keep it, to be joined with what follows.
+            // What doesn't fit is presented again, which only happens above the maximum speed.
+            const size_t historyFrames = mStart - mHistoryStart;
+            consumed = std::min(*srcFrames, mHistoryFrames - historyFrames);
+            copyToHistory(mStart, src, consumed);
+        }
+    }
+    mStart += consumed;
+    *srcFrames = consumed;
+    return written;
+}
+
+} // namespace android
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_TIMESTRETCH_WSOLA_H
+#define ANDROID_AUDIO_TIMESTRETCH_WSOLA_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <vector>
+
+namespace android {
+
+/* AudioTimestretchWsola
+ *
+ * Changes the speed of interleaved float audio without changing its pitch,
+ * by waveform similarity overlap-add (WSOLA).
+ *
+ * Each hop of output crossfades from the continuation of the input segment used
+ * for the previous hop to the input segment near the nominal position, speed hops
+ * later, that is the most similar to that continuation. The similarity is the
+ * normalized cross-correlation over all channels of the frame.
+ *
+ * The input is used where the caller has it: process() only consumes the frames
+ * that are no longer needed, and expects the others to be presented again at the
+ * start of the next call, so a buffer provider can leave them unreleased. Frames
+ * are copied only when the caller can't present enough of them at once, to a ring
+ * allocated on construction for up to AUDIO_TIMESTRETCH_SPEED_MAX.
+ */
+class AudioTimestretchWsola {
+public:
+    AudioTimestretchWsola(uint32_t channelCount, uint32_t sampleRate);
+
+    // Takes effect from the next hop.
+    void setSpeed(float speed);
+
+    // Writes up to dstFrames frames of time-stretched audio to dst.
+    // src continues the input of the previous call, from the first frame not consumed.
+    // srcFrames [in/out] is the number of frames in src (return with consumed).
+    // Returns the number of frames written to dst.
+    size_t process(float *dst, size_t dstFrames, const float *src, size_t *srcFrames);
+
+    // Forgets the input, for a discontinuity.
+    void reset();
+
+    // Input frames, beyond those the speed calls for, to present to process()
+    // for it to write all of the output requested.
+    size_t getLookaheadFrames() const {
+        return 2 * (mHopFrames + mSearchFrames);
+    }
+
+private:
+    const uint32_t mChannelCount;
+    const size_t   mHopFrames;       // output frames per hop, also the overlap
+    const size_t   mSearchFrames;    // a segment is searched +/- this from its nominal position
+    const size_t   mCoarseStep;      // frames between positions of the coarse search
+    const size_t   mCoarseFrames;    // frames correlated by the coarse search
+    std::vector<float> mFadeIn;      // crossfade weight of the new segment, per frame of a hop
+
+    float   mSpeed;
+    double  mNominal;     // nominal input position of the segment of the next hop to search
+    int64_t mPrevious;    // input position of the continuation of the previous segment
+    int64_t mNext;        // input position of the segment of the current hop
+    size_t  mOffset;      // frames of the current hop already written
+    bool    mHopReady;    // mNext is known for the current hop
+
+    // Input frames [mHistoryStart, mStart) copied from previous calls,
+    // followed by src at mStart. Input frame p is at frame p % mHistoryFrames of the ring.
+    int64_t mStart;
+    int64_t mHistoryStart;
+    const size_t mHistoryFrames;
+    std::vector<float> mHistory;
+    std::vector<float> mJoin[2];  // for frames that wrap around the ring or continue in src
+
+    // Copies frames [position, position + frames) of the history to dst.
+    void copyFromHistory(float *dst, int64_t position, size_t frames) const;
+
+    // Copies frames to the history, from input position position.
+    void copyToHistory(int64_t position, const float *src, size_t frames);
+
+    // Returns frames [position, position + frames) of the input, or nullptr
+    // if they are not all available yet.
+    const float *getFrames(int64_t position, size_t frames,
+            const float *src, size_t srcFrames, int join);
+
+    // Sets mNext for the current hop. Returns false if more input is needed.
+    bool searchNextSegment(const float *src, size_t srcFrames);
+
+    // First input position still needed.
+    int64_t getNeededStart() const;
+};
+
+} // namespace android
+
+#endif // ANDROID_AUDIO_TIMESTRETCH_WSOLA_H
@@ -22,6 +22,7 @@
 #include <audio_utils/primitives.h>
 #include <audio_utils/format.h>
 #include <audio_utils/channels.h>
+#include <cutils/properties.h>
 #include <sonic.h>
 #include <media/audiohal/EffectBufferHalInterface.h>
 #include <media/audiohal/EffectHalInterface.h>
@@ -31,6 +32,8 @@
 #include <system/audio_effects/effect_downmix.h>
 #include <utils/Log.h>
 
+#include "AudioTimestretchWsola.h"
+
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(x) (sizeof(x)/sizeof((x)[0]))
 #endif
@@ -401,7 +404,8 @@ void ClampFloatBufferProvider::copyFrames(void *dst, const void *src, size_t fra
 }
 
 TimestretchBufferProvider::TimestretchBufferProvider(int32_t channelCount,
-        audio_format_t format, uint32_t sampleRate, const AudioPlaybackRate &playbackRate) :
+        audio_format_t format, uint32_t sampleRate, const AudioPlaybackRate &playbackRate,
+        Engine engine) :
         mChannelCount(channelCount),
         mFormat(format),
         mSampleRate(sampleRate),
@@ -409,30 +413,48 @@ TimestretchBufferProvider::TimestretchBufferProvider(int32_t channelCount,
         mLocalBufferFrameCount(0),
         mLocalBufferData(NULL),
         mRemaining(0),
-        mSonicStream(sonicCreateStream(sampleRate, mChannelCount)),
+        mSonicStream(NULL),
         mFallbackFailErrorShown(false),
         mAudioPlaybackRateValid(false)
 {
-    LOG_ALWAYS_FATAL_IF(mSonicStream == NULL,
-            "TimestretchBufferProvider can't allocate Sonic stream");
+    if (engine == ENGINE_WSOLA && format == AUDIO_FORMAT_PCM_FLOAT) {
+        mWsola.reset(new AudioTimestretchWsola(mChannelCount, sampleRate));
+    } else {
+        mSonicStream = sonicCreateStream(sampleRate, mChannelCount);
+        LOG_ALWAYS_FATAL_IF(mSonicStream == NULL,
+                "TimestretchBufferProvider can't allocate Sonic stream");
+    }
 
     setPlaybackRate(playbackRate);
-    ALOGV("TimestretchBufferProvider(%p)(%u, %#x, %u %f %f %d %d)",
+    ALOGV("TimestretchBufferProvider(%p)(%u, %#x, %u %f %f %d %d %s)",
             this, channelCount, format, sampleRate, playbackRate.mSpeed,
-            playbackRate.mPitch, playbackRate.mStretchMode, playbackRate.mFallbackMode);
+            playbackRate.mPitch, playbackRate.mStretchMode, playbackRate.mFallbackMode,
+            mWsola ? "wsola" : "sonic");
     mBuffer.frameCount = 0;
 }
 
 TimestretchBufferProvider::~TimestretchBufferProvider()
 {
     ALOGV("~TimestretchBufferProvider(%p)", this);
-    sonicDestroyStream(mSonicStream);
+    if (mSonicStream != NULL) {
+        sonicDestroyStream(mSonicStream);
+    }
     if (mBuffer.frameCount != 0) {
         mTrackBufferProvider->releaseBuffer(&mBuffer);
     }
     free(mLocalBufferData);
 }
 
+// static
+TimestretchBufferProvider::Engine TimestretchBufferProvider::getDefaultEngine()
+{
+    char value[PROPERTY_VALUE_MAX];
+    if (property_get("af.timestretch.engine", value, NULL) > 0 && !strcmp(value, "wsola")) {
+        return ENGINE_WSOLA;
+    }
+    return ENGINE_SONIC;
+}
+
 status_t TimestretchBufferProvider::getNextBuffer(
         AudioBufferProvider::Buffer *pBuffer)
 {
@@ -468,6 +490,10 @@ status_t TimestretchBufferProvider::getNextBuffer(
     do {
         mBuffer.frameCount = mPlaybackRate.mSpeed == AUDIO_TIMESTRETCH_SPEED_NORMAL
                 ? outputDesired : outputDesired * mPlaybackRate.mSpeed + 1;
+        if (mWsola) {
+            // the frames it doesn't consume are presented again by the next request.
+            mBuffer.frameCount += mWsola->getLookaheadFrames();
+        }
 
         status_t res = mTrackBufferProvider->getNextBuffer(&mBuffer);
 
@@ -533,6 +559,9 @@ void TimestretchBufferProvider::releaseBuffer(AudioBufferProvider::Buffer *pBuff
 void TimestretchBufferProvider::reset()
 {
     mRemaining = 0;
+    if (mWsola) {
+        mWsola->reset();
+    }
 }
 
 void TimestretchBufferProvider::setBufferProvider(AudioBufferProvider *p) {
@@ -542,6 +571,9 @@ void TimestretchBufferProvider::setBufferProvider(AudioBufferProvider *p) {
         return;
     }
     mBuffer.frameCount = 0;
+    if (mWsola) {
+        mWsola->reset();
+    }
     PassthruBufferProvider::setBufferProvider(p);
 }
 
@@ -549,11 +581,19 @@ status_t TimestretchBufferProvider::setPlaybackRate(const AudioPlaybackRate &pla
 {
     mPlaybackRate = playbackRate;
     mFallbackFailErrorShown = false;
-    sonicSetSpeed(mSonicStream, mPlaybackRate.mSpeed);
+    if (mWsola) {
+        mWsola->setSpeed(mPlaybackRate.mSpeed);
+    } else {
+        sonicSetSpeed(mSonicStream, mPlaybackRate.mSpeed);
+    }
     //TODO: pitch is ignored for now
     //TODO: optimize: if parameters are the same, don't do any extra computation.
 
+    const bool wasValid = mAudioPlaybackRateValid;
     mAudioPlaybackRateValid = isAudioPlaybackRateValid(mPlaybackRate);
+    if (mWsola && mAudioPlaybackRateValid && !wasValid) {
+        mWsola->reset(); // the fallback consumed input without it
+    }
     return OK;
 }
 
@@ -607,6 +647,12 @@ void TimestretchBufferProvider::processFrames(void *dstBuffer, size_t *dstFrames
     } else {
         switch (mFormat) {
         case AUDIO_FORMAT_PCM_FLOAT:
+            if (mWsola) {
+                // reads src in place, and consumes only what it no longer needs.
+                *dstFrames = mWsola->process((float*)dstBuffer, *dstFrames,
+                        (const float*)srcBuffer, srcFrames);
+                break;
+            }
             if (sonicWriteFloatToStream(mSonicStream, (float*)srcBuffer, *srcFrames) != 1) {
                 ALOGE("sonicWriteFloatToStream cannot realloc");
                 *srcFrames = 0; // cannot consume all of srcBuffer
@@ -693,5 +739,106 @@ void AdjustChannelsBufferProvider::reset()
     mContractedWrittenFrames = 0;
     CopyBufferProvider::reset();
 }
+
+// ----------------------------------------------------------------------------
+
+PrefetchBufferProvider::PrefetchBufferProvider(size_t frameSize) :
+        mFrameSize(frameSize),
+        mFrameCapacity(0),
+        mFront(0),
+        mFrames(0),
+        mHeld(0),
+        mPullEnabled(true)
+{
+    ALOGV("PrefetchBufferProvider(%p)(%zu)", this, frameSize);
+}
+
+status_t PrefetchBufferProvider::getNextBuffer(AudioBufferProvider::Buffer *pBuffer)
+{
+    ALOG_ASSERT(mHeld == 0, "getNextBuffer() with %zu frames held", mHeld);
+    if (mFrames == 0 && mPullEnabled) {
+        fill(pBuffer->frameCount);
+    }
+    if (mFrames == 0) {
+        pBuffer->raw = NULL;
+        pBuffer->frameCount = 0;
+        return NOT_ENOUGH_DATA;
+    }
+    pBuffer->frameCount = std::min({pBuffer->frameCount, mFrames, mFrameCapacity - mFront});
+    pBuffer->raw = mData.get() + mFront * mFrameSize;
+    mHeld = pBuffer->frameCount;
+    return OK;
+}
+
+void PrefetchBufferProvider::releaseBuffer(AudioBufferProvider::Buffer *pBuffer)
+{
+    // after a reset() the held frames are gone already.
+    const size_t frameCount = std::min(pBuffer->frameCount, mHeld);
+    mFront = (mFront + frameCount) % std::max(mFrameCapacity, (size_t)1);
+    mFrames -= frameCount;
+    mHeld = 0;
+    pBuffer->raw = NULL;
+    pBuffer->frameCount = 0;
+}
+
+void PrefetchBufferProvider::reset()
+{
+    mFront = 0;
+    mFrames = 0;
+    mHeld = 0;
+}
+
+void PrefetchBufferProvider::setBufferProvider(AudioBufferProvider *p)
+{
+    if (mTrackBufferProvider == p) {
+        return;
+    }
+    reset();
+    PassthruBufferProvider::setBufferProvider(p);
+}
+
+bool PrefetchBufferProvider::configure(size_t frameSize, size_t frameCount)
+{
+    if (mFrameSize == frameSize && mFrameCapacity >= frameCount) {
+        return false;
+    }
+    ALOGV("%s(%zu, %zu) discards %zu frames", __func__, frameSize, frameCount, mFrames);
+    reset();
+    mData.reset(new uint8_t[frameCount * frameSize]);
+    mFrameCapacity = frameCount;
+    mFrameSize = frameSize;
+    return true;
+}
+
+size_t PrefetchBufferProvider::prefetch(size_t frameCount)
+{
+    if (mFrames < frameCount) {
+        fill(frameCount - mFrames);
+    }
+    return mFrames;
+}
+
+void PrefetchBufferProvider::fill(size_t frameCount)
+{
+    if (mTrackBufferProvider == NULL) {
+        return;
+    }
+    while (frameCount > 0 && mFrames < mFrameCapacity) {
+        // the free space up to the end of the ring, or up to the first unreleased frame.
+        const size_t back = (mFront + mFrames) % mFrameCapacity;
+        AudioBufferProvider::Buffer buffer;
+        buffer.frameCount = std::min(frameCount,
+                back < mFront ? mFront - back : mFrameCapacity - back);
+        const status_t status = mTrackBufferProvider->getNextBuffer(&buffer);
+        if (status != OK || buffer.raw == NULL || buffer.frameCount == 0) {
+            break;
+        }
+        memcpy(mData.get() + back * mFrameSize, buffer.raw, buffer.frameCount * mFrameSize);
+        mFrames += buffer.frameCount;
+        frameCount -= buffer.frameCount;
+        mTrackBufferProvider->releaseBuffer(&buffer);
+    }
+}
+
 // ----------------------------------------------------------------------------
 } // namespace android
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "audioflinger_mixer_tests"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <log/log.h>
+#include <audio_utils/primitives.h>
+#include <media/AudioBufferProvider.h>
+#include <media/AudioMixer.h>
+#include "test_utils.h"
+
+using namespace android;
+
+static int64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* A SignalProvider that counts the calls from other threads than the one that
+ * created it, which owns it as AudioFlinger's mixer thread owns its tracks.
+ */
+class OwnedSignalProvider : public SignalProvider {
+public:
+    virtual android::status_t getNextBuffer(Buffer* buffer) {
+        if (std::this_thread::get_id() != mOwner) {
+            ++sForeignCalls;
+        }
+        return SignalProvider::getNextBuffer(buffer);
+    }
+
+    virtual void releaseBuffer(Buffer* buffer) {
+        if (std::this_thread::get_id() != mOwner) {
+            ++sForeignCalls;
+        }
+        SignalProvider::releaseBuffer(buffer);
+    }
+
+    static std::atomic<int> sForeignCalls;
+
+private:
+    const std::thread::id mOwner = std::this_thread::get_id();
+};
+
+std::atomic<int> OwnedSignalProvider::sForeignCalls;
+
+/* Mixes trackCount sine tracks at assorted sample rates into a 48 kHz float
+ * output, so every track is resampled by process__genericResampling().
+ * Odd tracks are 16 bit, and the volume ramps every few buffers. If withAux is
+ * true the first track also sends to an aux buffer, appended to the output.
+ * Returns the output and the processing time per output frame.
+ */
+static std::vector<float> mix(size_t trackCount, size_t workerCount, bool withAux,
+        double *nsPerFrame) {
+    static const uint32_t kSampleRate = 48000;
+    static const uint32_t kTrackSampleRates[] = {44100, 32000, 22050, 16000, 11025, 96000};
+    static const size_t kMixerFrameCount = 960;
+    static const size_t kBuffers = 100;
+    static const int kRampPeriod = 8; // buffers between volume changes
+    static const uint32_t kChannels = 2;
+    const audio_channel_mask_t channelMask = audio_channel_out_mask_from_count(kChannels);
+    const audio_format_t mixerFormat = AUDIO_FORMAT_PCM_FLOAT;
+
+    std::vector<OwnedSignalProvider> providers(trackCount);
+    std::vector<audio_format_t> formats(trackCount);
+    for (size_t i = 0; i < trackCount; ++i) {
+        const uint32_t sampleRate = kTrackSampleRates[i % ARRAY_SIZE(kTrackSampleRates)];
+        const double seconds = 2.5 * kMixerFrameCount * kBuffers / kSampleRate;
+        if (i & 1) {
+            providers[i].setSine<int16_t>(kChannels, 200 + 31 * i, sampleRate, seconds);
+            formats[i] = AUDIO_FORMAT_PCM_16_BIT;
+        } else {
+            providers[i].setSine<float>(kChannels, 200 + 31 * i, sampleRate, seconds);
+            formats[i] = AUDIO_FORMAT_PCM_FLOAT;
+        }
+    }
+
+    const size_t mixSamples = kMixerFrameCount * kBuffers * kChannels;
+    std::vector<float> output(mixSamples + (withAux ? kMixerFrameCount * kBuffers : 0));
+    float *aux = withAux ? &output[mixSamples] : nullptr;
+
+    AudioMixer mixer(kMixerFrameCount, kSampleRate);
+    mixer.setWorkerCount(workerCount);
+    float volumes[2] = {
+        AudioMixer::UNITY_GAIN_FLOAT / trackCount,
+        AudioMixer::UNITY_GAIN_FLOAT / trackCount / 2,
+    };
+    for (size_t i = 0; i < trackCount; ++i) {
+        const status_t status = mixer.create(i, channelMask, formats[i], AUDIO_SESSION_OUTPUT_MIX);
+        LOG_ALWAYS_FATAL_IF(status != OK);
+        mixer.setBufferProvider(i, &providers[i]);
+        mixer.setParameter(i, AudioMixer::TRACK, AudioMixer::MIXER_FORMAT,
+                (void *)(uintptr_t)mixerFormat);
+        mixer.setParameter(i, AudioMixer::TRACK, AudioMixer::FORMAT,
+                (void *)(uintptr_t)formats[i]);
+        mixer.setParameter(i, AudioMixer::TRACK, AudioMixer::MIXER_CHANNEL_MASK,
+                (void *)(uintptr_t)channelMask);
+        mixer.setParameter(i, AudioMixer::TRACK, AudioMixer::CHANNEL_MASK,
+                (void *)(uintptr_t)channelMask);
+        mixer.setParameter(i, AudioMixer::RESAMPLE, AudioMixer::SAMPLE_RATE,
+                (void *)(uintptr_t)providers[i].getSampleRate());
+        mixer.setParameter(i, AudioMixer::VOLUME, AudioMixer::VOLUME0, &volumes[0]);
+        mixer.setParameter(i, AudioMixer::VOLUME, AudioMixer::VOLUME1, &volumes[0]);
+        if (withAux && i == 0) {
+            mixer.setParameter(i, AudioMixer::VOLUME, AudioMixer::AUXLEVEL, &volumes[0]);
+        }
+        mixer.enable(i);
+    }
+
+    int64_t elapsedNs = 0;
+    for (size_t buffer = 0; buffer < kBuffers; ++buffer) {
+        for (size_t i = 0; i < trackCount; ++i) {
+            mixer.setParameter(i, AudioMixer::TRACK, AudioMixer::MAIN_BUFFER,
+                    &output[buffer * kMixerFrameCount * kChannels]);
+            if (withAux && i == 0) {
+                mixer.setParameter(i, AudioMixer::TRACK, AudioMixer::AUX_BUFFER,
+                        aux + buffer * kMixerFrameCount);
+            }
+            if (buffer % kRampPeriod == 0) {
+                float *volume = &volumes[(buffer / kRampPeriod) & 1];
+                mixer.setParameter(i, AudioMixer::RAMP_VOLUME, AudioMixer::VOLUME0, volume);
+                mixer.setParameter(i, AudioMixer::RAMP_VOLUME, AudioMixer::VOLUME1, volume);
+            }
+        }
+        const int64_t startNs = nowNs();
+        mixer.process();
+        elapsedNs += nowNs() - startNs;
+    }
+
+    if (nsPerFrame != nullptr) {
+        *nsPerFrame = (double)elapsedNs / (kMixerFrameCount * kBuffers);
+    }
+    return output;
+}
+
+TEST(audioflinger_mixer, parallel_resampling_deterministic) {
+    OwnedSignalProvider::sForeignCalls = 0;
+    for (size_t trackCount : {2, 3, 7, 16}) {
+        const std::vector<float> reference = mix(trackCount, 0 /* workerCount */,
+                true /* withAux */, nullptr);
+        for (size_t workerCount : {1, 3}) {
+            for (int run = 0; run < 3; ++run) {
+                const std::vector<float> output = mix(trackCount, workerCount,
+                        true /* withAux */, nullptr);
+                ASSERT_EQ(reference.size(), output.size());
+                EXPECT_EQ(0, memcmp(reference.data(), output.data(),
+                        reference.size() * sizeof(float)))
+                        << "tracks:" << trackCount << " workers:" << workerCount;
+            }
+        }
+    }
+    // the buffer providers are only called on the mixer thread.
+    EXPECT_EQ(0, OwnedSignalProvider::sForeignCalls);
+}
+
+TEST(audioflinger_mixer, parallel_resampling_benchmark) {
+    for (size_t trackCount : {2, 4, 8, 16, 32}) {
+        printf("tracks:%zu", trackCount);
+        for (size_t workerCount : {0, 1, 3}) {
+            double nsPerFrame;
+            (void)mix(trackCount, workerCount, false /* withAux */, &nsPerFrame);
+            printf("  workers:%zu %.1f ns/frame", workerCount, nsPerFrame);
+        }
+        printf("\n");
+    }
+}
@@ -142,4 +142,11 @@ createwav "" "tests/mixer_i_i"
 createwav "-f -m" "tests/mixer_f_f"
 createwav "-m" "tests/mixer_i_f"
 
+#
+# Verify the vector mixing kernels are bit-exact with the scalar code
+# and report the mixing cost per output frame for several track counts.
+#
+adb shell test-mixer -b 1,2,4,8,12,16,20
+adb shell test-mixer -f -m -b 1,2,4,8,12,16,20
+
 popd
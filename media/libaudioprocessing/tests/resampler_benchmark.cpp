@@ -0,0 +1,415 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measure the cost and the quality of every AudioResampler::src_quality
+ * over common sample rate pairs, channel counts and input formats.
+ *
+ * One CSV line is written per configuration, always in the same order,
+ * so that the reports of two builds or two devices can be diffed.
+ * With -Q only the quality is measured, which gives the same report on every run.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "resampler_benchmark"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <media/AudioBufferProvider.h>
+#include <media/AudioResampler.h>
+#include "test_utils.h"
+
+using namespace android;
+
+// Frames output per call to resample(), as AudioMixer would for a 5 msec buffer.
+static constexpr size_t kFramesPerCall = 240;
+
+// The test tone, which is not a sub-multiple of any of the sample rates.
+static constexpr double kToneFreq = 997.;
+
+// Number of harmonics of the tone counted as distortion.
+static constexpr int kMaxHarmonic = 5;
+
+// Number of frequencies at which the passband gain is measured.
+static constexpr int kRippleSteps = 16;
+
+struct Quality {
+    AudioResampler::src_quality quality;
+    const char *name;
+};
+
+// Named as for test-resampler -q.
+static const Quality kQualities[] = {
+    { AudioResampler::LOW_QUALITY, "lq" },
+    { AudioResampler::MED_QUALITY, "mq" },
+    { AudioResampler::HIGH_QUALITY, "hq" },
+    { AudioResampler::VERY_HIGH_QUALITY, "vhq" },
+    { AudioResampler::DYN_LOW_QUALITY, "dlq" },
+    { AudioResampler::DYN_MED_QUALITY, "dmq" },
+    { AudioResampler::DYN_HIGH_QUALITY, "dhq" },
+};
+
+static const struct {
+    int32_t inRate;
+    int32_t outRate;
+} kRatePairs[] = {
+    { 8000, 48000 },
+    { 16000, 48000 },
+    { 22050, 48000 },
+    { 32000, 48000 },
+    { 44100, 48000 },
+    { 48000, 44100 },
+    { 96000, 48000 },
+    { 48000, 16000 },
+    { 48000, 96000 },
+};
+
+static const int kChannelCounts[] = { 1, 2, 8 };
+
+static const audio_format_t kFormats[] = { AUDIO_FORMAT_PCM_16_BIT, AUDIO_FORMAT_PCM_FLOAT };
+
+struct Config {
+    const Quality *quality;
+    audio_format_t format;
+    int channels;
+    int32_t inRate;
+    int32_t outRate;
+
+    bool isFloat() const {
+        return format == AUDIO_FORMAT_PCM_FLOAT;
+    }
+
+    // Mono is output as stereo.
+    int outputChannels() const {
+        return std::max(channels, 2);
+    }
+
+    size_t outputFrameSize() const {
+        return outputChannels() * (isFloat() ? sizeof(float) : sizeof(int32_t));
+    }
+};
+
+struct Result {
+    double nsPerFrame = NAN;
+    double cyclesPerFrame = NAN;
+    double cpuPercent = NAN;    // of one CPU, to resample in real time
+    double sinadDb = NAN;       // tone to noise and distortion
+    double thdDb = NAN;         // harmonics to tone
+    double rippleDb = NAN;      // peak to peak gain over the passband
+};
+
+// Only the dynamic resamplers take float input or more than 2 channels.
+static bool isSupported(const Quality &quality, audio_format_t format, int channels) {
+    switch (quality.quality) {
+    case AudioResampler::DYN_LOW_QUALITY:
+    case AudioResampler::DYN_MED_QUALITY:
+    case AudioResampler::DYN_HIGH_QUALITY:
+        return true;
+    default:
+        return format == AUDIO_FORMAT_PCM_16_BIT && channels <= 2;
+    }
+}
+
+static AudioResampler *createResampler(const Config &config) {
+    AudioResampler *resampler = AudioResampler::create(
+            config.format, config.channels, config.outRate, config.quality->quality);
+    resampler->setSampleRate(config.inRate);
+    resampler->setVolume(AudioResampler::UNITY_GAIN_FLOAT, AudioResampler::UNITY_GAIN_FLOAT);
+    return resampler;
+}
+
+static int64_t getNanoseconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Counts the CPU cycles of the calling thread, where the kernel allows it.
+class CycleCounter {
+public:
+    CycleCounter() {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        mFd = syscall(__NR_perf_event_open, &attr, 0 /* pid */, -1 /* cpu */,
+                      -1 /* group_fd */, 0 /* flags */);
+    }
+
+    ~CycleCounter() {
+        if (mFd >= 0) {
+            close(mFd);
+        }
+    }
+
+    // Returns -1 if cycles can't be counted.
+    int64_t read() const {
+        int64_t count;
+        if (mFd < 0 || ::read(mFd, &count, sizeof(count)) != sizeof(count)) {
+            return -1;
+        }
+        return count;
+    }
+
+private:
+    int mFd;
+};
+
+// Resamples outputFrames of a full scale sine at freq,
+// and returns the first output channel with full scale 1.
+static std::vector<double> resampleSine(const Config &config, double freq, size_t outputFrames) {
+    // A little more input than needed, for the filter delay.
+    const double seconds = (double)outputFrames / config.outRate + 0.05;
+    SignalProvider provider;
+    if (config.isFloat()) {
+        provider.setSine<float>(config.channels, freq, config.inRate, seconds);
+    } else {
+        provider.setSine<int16_t>(config.channels, freq, config.inRate, seconds);
+    }
+
+    std::vector<uint8_t> output(outputFrames * config.outputFrameSize());
+    AudioResampler *resampler = createResampler(config);
+    for (size_t i = 0; i < outputFrames; ) {
+        const size_t frames = std::min(kFramesPerCall, outputFrames - i);
+        resampler->resample((int32_t *)&output[i * config.outputFrameSize()], frames, &provider);
+        i += frames;
+    }
+    delete resampler;
+
+    std::vector<double> channel(outputFrames);
+    const size_t stride = config.outputChannels();
+    for (size_t i = 0; i < outputFrames; ++i) {
+        if (config.isFloat()) {
+            channel[i] = ((const float *)output.data())[i * stride];
+        } else {
+            // Q4.27
+            channel[i] = ((const int32_t *)output.data())[i * stride] / (double)(1 << 27);
+        }
+    }
+    return channel;
+}
+
+// Mean power of the component at freq, which must have a whole number of cycles in x.
+// A sine of amplitude a has power a * a / 2.
+static double tonePower(const double *x, size_t n, double freq, double sampleRate) {
+    double re = 0.;
+    double im = 0.;
+    const double w = 2. * M_PI * freq / sampleRate;
+    for (size_t i = 0; i < n; ++i) {
+        re += x[i] * cos(w * i);
+        im -= x[i] * sin(w * i);
+    }
+    return 2. * (re * re + im * im) / ((double)n * n);
+}
+
+static double meanPower(const double *x, size_t n) {
+    double mean = 0.;
+    for (size_t i = 0; i < n; ++i) {
+        mean += x[i];
+    }
+    mean /= n;
+
+    double power = 0.;
+    for (size_t i = 0; i < n; ++i) {
+        power += (x[i] - mean) * (x[i] - mean);
+    }
+    return power / n;
+}
+
+static double toDb(double ratio) {
+    return 10. * log10(std::max(ratio, 1e-30));
+}
+
+// SINAD and THD of the tone, over 1 second so that every harmonic has whole cycles.
+static void measureDistortion(const Config &config, Result *result) {
+    const size_t skip = config.outRate / 10;  // past the filter delay
+    const size_t n = config.outRate;
+    const std::vector<double> out = resampleSine(config, kToneFreq, skip + n);
+    const double *x = out.data() + skip;
+
+    const double tone = tonePower(x, n, kToneFreq, config.outRate);
+    const double total = meanPower(x, n);
+    double harmonics = 0.;
+    const double nyquist = std::min(config.inRate, config.outRate) / 2.;
+    for (int k = 2; k <= kMaxHarmonic && k * kToneFreq < nyquist; ++k) {
+        harmonics += tonePower(x, n, k * kToneFreq, config.outRate);
+    }
+
+    result->sinadDb = toDb(tone / std::max(total - tone, 0.));
+    result->thdDb = toDb(harmonics / tone);
+}
+
+// Gain at frequencies up to 40% of the lower sample rate, or 20 kHz.
+// Each is measured over 100 msec, so frequencies are multiples of 10 Hz.
+static void measureRipple(const Config &config, Result *result) {
+    const size_t skip = config.outRate / 10;
+    const size_t n = config.outRate / 10;
+    const double low = 50.;
+    const double high = std::min(20000., 0.4 * std::min(config.inRate, config.outRate));
+
+    double minDb = INFINITY;
+    double maxDb = -INFINITY;
+    for (int i = 0; i < kRippleSteps; ++i) {
+        double freq = low * pow(high / low, (double)i / (kRippleSteps - 1));
+        freq = 10. * floor(freq / 10.);
+        const std::vector<double> out = resampleSine(config, freq, skip + n);
+        const double gainDb = toDb(tonePower(out.data() + skip, n, freq, config.outRate) / 0.5);
+        minDb = std::min(minDb, gainDb);
+        maxDb = std::max(maxDb, gainDb);
+    }
+    result->rippleDb = maxDb - minDb;
+}
+
+// Resamples a chirp, 1 second of output at a time, until at least minTimeNs has passed,
+// and keeps the fastest second.
+static void measurePerformance(const Config &config, int64_t minTimeNs, Result *result) {
+    SignalProvider provider;
+    if (config.isFloat()) {
+        provider.setChirp<float>(config.channels, 0., config.inRate / 2., config.inRate, 1.1);
+    } else {
+        provider.setChirp<int16_t>(config.channels, 0., config.inRate / 2., config.inRate, 1.1);
+    }
+
+    const size_t outputFrames = config.outRate;
+    std::vector<uint8_t> output(outputFrames * config.outputFrameSize());
+    AudioResampler *resampler = createResampler(config);
+    CycleCounter cycleCounter;
+
+    int64_t bestNs = INT64_MAX;
+    int64_t bestCycles = -1;
+    const int64_t endNs = getNanoseconds() + minTimeNs;
+    for (int pass = 0; pass < 3 || getNanoseconds() < endNs; ++pass) {
+        provider.reset();
+        memset(output.data(), 0, output.size());
+
+        const int64_t startCycles = cycleCounter.read();
+        const int64_t startNs = getNanoseconds();
+        for (size_t i = 0; i < outputFrames; ) {
+            const size_t frames = std::min(kFramesPerCall, outputFrames - i);
+            resampler->resample((int32_t *)&output[i * config.outputFrameSize()], frames,
+                                &provider);
+            i += frames;
+        }
+        const int64_t elapsedNs = getNanoseconds() - startNs;
+        const int64_t endCycles = cycleCounter.read();
+
+        if (elapsedNs < bestNs) {
+            bestNs = elapsedNs;
+            bestCycles = startCycles >= 0 && endCycles >= 0 ? endCycles - startCycles : -1;
+        }
+    }
+    delete resampler;
+
+    result->nsPerFrame = (double)bestNs / outputFrames;
+    if (bestCycles >= 0) {
+        result->cyclesPerFrame = (double)bestCycles / outputFrames;
+    }
+    result->cpuPercent = 100. * bestNs / 1e9;  // output frames are 1 second
+}
+
+static int usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-Q] [-P] [-t msec] [-o output-file]\n", name);
+    fprintf(stderr, "    -Q    measure quality only, which gives the same report on every run\n");
+    fprintf(stderr, "    -P    measure performance only\n");
+    fprintf(stderr, "    -t    minimum time spent measuring each performance (default 200)\n");
+    fprintf(stderr, "    -o    write the CSV report to output-file instead of stdout\n");
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[]) {
+    bool measureQuality = true;
+    bool measureSpeed = true;
+    int64_t minTimeNs = 200000000;
+    FILE *out = stdout;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "QPt:o:")) != -1) {
+        switch (ch) {
+        case 'Q':
+            measureSpeed = false;
+            break;
+        case 'P':
+            measureQuality = false;
+            break;
+        case 't':
+            minTimeNs = atoll(optarg) * 1000000;
+            break;
+        case 'o':
+            out = fopen(optarg, "w");
+            if (out == NULL) {
+                perror(optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if (optind != argc || (!measureQuality && !measureSpeed)) {
+        return usage(argv[0]);
+    }
+
+    fprintf(out, "quality,format,channels,in_rate,out_rate,"
+                 "ns_per_frame,cycles_per_frame,cpu_percent,"
+                 "sinad_db,thd_db,passband_ripple_db\n");
+
+    for (const Quality &quality : kQualities) {
+        for (audio_format_t format : kFormats) {
+            for (int channels : kChannelCounts) {
+                if (!isSupported(quality, format, channels)) {
+                    continue;
+                }
+                for (const auto &rates : kRatePairs) {
+                    const Config config = {
+                            &quality, format, channels, rates.inRate, rates.outRate };
+                    Result result;
+                    if (measureSpeed) {
+                        measurePerformance(config, minTimeNs, &result);
+                    }
+                    if (measureQuality) {
+                        measureDistortion(config, &result);
+                        measureRipple(config, &result);
+                    }
+                    fprintf(out, "%s,%s,%d,%d,%d,%.2f,%.1f,%.3f,%.1f,%.1f,%.3f\n",
+                            quality.name, config.isFloat() ? "float" : "i16",
+                            channels, config.inRate, config.outRate,
+                            result.nsPerFrame, result.cyclesPerFrame, result.cpuPercent,
+                            result.sinadDb, result.thdDb, result.rippleDb);
+                    fflush(out);
+                }
+            }
+        }
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return EXIT_SUCCESS;
+}
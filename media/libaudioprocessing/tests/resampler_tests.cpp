@@ -30,6 +30,7 @@
 
 #include <iostream>
 #include <memory>
+#include <numeric>
 #include <utility>
 #include <vector>
 
@@ -65,8 +66,9 @@ void resample(int channels, void *output,
         if (thisFrames == 0 || thisFrames > outputFrames - i) {
             thisFrames = outputFrames - i;
         }
+        // mono is output as stereo.
         size_t framesResampled = resampler->resample(
-                (int32_t*) output + channels*i, thisFrames, provider);
+                (int32_t*) output + (channels == 1 ? 2 : channels)*i, thisFrames, provider);
         // we should have enough buffer space, so there is no short count.
         ASSERT_EQ(thisFrames, framesResampled);
         i += thisFrames;
@@ -601,3 +603,224 @@ TEST(audioflinger_resampler, generalresponse) {
         }
     }
 }
+
+// Resamplers with the same filter design share one copy of the coefficients,
+// which is released with the last resampler using it.
+TEST(audioflinger_resampler, filtercache) {
+    using ResamplerType = android::AudioResamplerDyn<float, float, float>;
+    auto createResampler = [](int channels, int32_t inSampleRate,
+            android::AudioResampler::src_quality quality) {
+        std::unique_ptr<ResamplerType> rdyn(
+                static_cast<ResamplerType *>(
+                        android::AudioResampler::create(
+                                AUDIO_FORMAT_PCM_FLOAT,
+                                channels,
+                                44100 /* outSampleRate */,
+                                quality)));
+        rdyn->setSampleRate(inSampleRate);
+        return rdyn;
+    };
+
+    const android::AudioResamplerDynFilterCacheStats before =
+            android::getAudioResamplerDynFilterCacheStats();
+
+    // below 48 kHz output the filter design depends on the quality.
+    auto r1 = createResampler(2, 48000, android::AudioResampler::DYN_HIGH_QUALITY);
+    auto r2 = createResampler(2, 48000, android::AudioResampler::DYN_HIGH_QUALITY);
+    // the channel count does not change the filter.
+    auto r3 = createResampler(1, 48000, android::AudioResampler::DYN_HIGH_QUALITY);
+    auto r4 = createResampler(2, 48000, android::AudioResampler::DYN_MED_QUALITY);
+    auto r5 = createResampler(2, 32000, android::AudioResampler::DYN_HIGH_QUALITY);
+
+    EXPECT_EQ(r1->getFilterCoefs(), r2->getFilterCoefs());
+    EXPECT_EQ(r1->getFilterCoefs(), r3->getFilterCoefs());
+    EXPECT_NE(r1->getFilterCoefs(), r4->getFilterCoefs());
+    EXPECT_NE(r1->getFilterCoefs(), r5->getFilterCoefs());
+
+    const android::AudioResamplerDynFilterCacheStats shared =
+            android::getAudioResamplerDynFilterCacheStats();
+    EXPECT_EQ(before.hits + 2, shared.hits);
+    EXPECT_EQ(before.misses + 3, shared.misses);
+    EXPECT_EQ(before.filters + 3, shared.filters);
+    EXPECT_GT(shared.bytes, before.bytes);
+
+    // a shared filter outlives the resampler that designed it.
+    r1.reset();
+    r2.reset();
+    EXPECT_EQ(before.filters + 3, android::getAudioResamplerDynFilterCacheStats().filters);
+
+    r3.reset();
+    r4.reset();
+    r5.reset();
+    const android::AudioResamplerDynFilterCacheStats after =
+            android::getAudioResamplerDynFilterCacheStats();
+    EXPECT_EQ(before.filters, after.filters);
+    EXPECT_EQ(before.bytes, after.bytes);
+
+    printf("filter cache hits:%llu misses:%llu\n",
+            (unsigned long long)after.hits, (unsigned long long)after.misses);
+}
+
+template <typename TC, typename TI, typename TO>
+static std::unique_ptr<android::AudioResamplerDyn<TC, TI, TO>> createDynResampler(
+        size_t channels, unsigned inputFreq, unsigned outputFreq,
+        android::AudioResampler::src_quality quality, bool polyphase)
+{
+    using ResamplerType = android::AudioResamplerDyn<TC, TI, TO>;
+    std::unique_ptr<ResamplerType> rdyn(
+            static_cast<ResamplerType *>(
+                    android::AudioResampler::create(
+                            is_same<TI, float>::value
+                                    ? AUDIO_FORMAT_PCM_FLOAT : AUDIO_FORMAT_PCM_16_BIT,
+                            channels,
+                            outputFreq,
+                            quality)));
+    rdyn->setPolyphaseEnabled(polyphase);
+    rdyn->setSampleRate(inputFreq);
+    rdyn->setVolume(android::AudioResampler::UNITY_GAIN_FLOAT,
+            android::AudioResampler::UNITY_GAIN_FLOAT);
+    return rdyn;
+}
+
+// TC = filter coefficient type of the quality
+// TI = resampler input type, int16_t or float
+// TO = resampler output type, int32_t or float
+template <typename TC, typename TI, typename TO>
+void testPolyphase(size_t channels, unsigned inputFreq, unsigned outputFreq,
+        android::AudioResampler::src_quality quality)
+{
+    SignalProvider provider;
+    provider.setChirp<TI>(channels, 0., inputFreq / 2., inputFreq, 0.1 /* time */);
+
+    const size_t outputFrames = ((int64_t) provider.getNumFrames() * outputFreq) / inputFreq;
+    const size_t outputChannels = channels == 1 ? 2 : channels;
+    const size_t outputFrameSize = outputChannels * sizeof(TO);
+    std::vector<TO> reference(outputFrames * outputChannels);
+    std::vector<TO> test(outputFrames * outputChannels);
+
+    // the reference run, with the generic locked phase resampler.
+    auto generic = createDynResampler<TC, TI, TO>(
+            channels, inputFreq, outputFreq, quality, false /* polyphase */);
+    ASSERT_FALSE(generic->isPolyphase());
+    resample(channels, reference.data(), outputFrames, {outputFrames}, &provider, generic.get());
+
+    // the test run, in small chunks of input and output.
+    provider.reset();
+    provider.setIncr({1, 3});
+    auto polyphase = createDynResampler<TC, TI, TO>(
+            channels, inputFreq, outputFreq, quality, true /* polyphase */);
+    ASSERT_TRUE(polyphase->isPolyphase());
+    EXPECT_EQ((int) (outputFreq / std::gcd(inputFreq, outputFreq)), polyphase->getPhases());
+    EXPECT_EQ(generic->getFilterCoefs(), polyphase->getFilterCoefs());
+    resample(channels, test.data(), outputFrames, {1, 2, 3, 160}, &provider, polyphase.get());
+
+    buffercmp(reference.data(), test.data(), outputFrameSize, outputFrames);
+}
+
+/* Polyphase resampler test
+ *
+ * Small integer ratios use a filter with one phase per output frame of the ratio.
+ * The polyphase resampler must give exactly the output of the generic locked phase
+ * resampler with that filter, whatever the buffer sizes.
+ */
+TEST(audioflinger_resampler, polyphase_bitexact) {
+    static constexpr struct {
+        unsigned inputFreq;
+        unsigned outputFreq;
+    } kRatios[] = {
+        {8000, 48000},
+        {16000, 48000},
+        {24000, 48000},
+        {32000, 48000},
+        {48000, 96000},
+        {96000, 48000},
+        {48000, 32000},
+        {48000, 16000},
+    };
+    static constexpr size_t kChannels[] = {1, 2, 6};
+
+    for (const auto &ratio : kRatios) {
+        for (size_t channels : kChannels) {
+            testPolyphase<int16_t, int16_t, int32_t>(channels,
+                    ratio.inputFreq, ratio.outputFreq, android::AudioResampler::DYN_MED_QUALITY);
+            testPolyphase<int32_t, int16_t, int32_t>(channels,
+                    ratio.inputFreq, ratio.outputFreq, android::AudioResampler::DYN_HIGH_QUALITY);
+            testPolyphase<float, float, float>(channels,
+                    ratio.inputFreq, ratio.outputFreq, android::AudioResampler::DYN_HIGH_QUALITY);
+        }
+    }
+}
+
+// The polyphase filter is replaced when the sample rate moves off the ratio.
+TEST(audioflinger_resampler, polyphase_ratechange) {
+    auto rdyn = createDynResampler<float, float, float>(
+            2 /* channels */, 24000, 48000, android::AudioResampler::DYN_HIGH_QUALITY, true);
+    EXPECT_TRUE(rdyn->isPolyphase());
+    EXPECT_EQ(2, rdyn->getPhases());
+
+    rdyn->setSampleRate(24100); // e.g. a playback rate change
+    EXPECT_FALSE(rdyn->isPolyphase());
+    EXPECT_GE(rdyn->getPhases(), 63);
+
+    rdyn->setSampleRate(16000);
+    EXPECT_TRUE(rdyn->isPolyphase());
+    EXPECT_EQ(3, rdyn->getPhases());
+
+    rdyn->setSampleRate(44100); // 147:160 is interpolated
+    EXPECT_FALSE(rdyn->isPolyphase());
+}
+
+template <typename TC, typename TI, typename TO>
+static double resampleNanosPerFrame(size_t channels, unsigned inputFreq, unsigned outputFreq,
+        android::AudioResampler::src_quality quality, bool polyphase)
+{
+    SignalProvider provider;
+    provider.setChirp<TI>(channels, 0., inputFreq / 2., inputFreq, 1.1 /* time */);
+    const size_t outputFrames = outputFreq; // 1 second
+    std::vector<TO> output(outputFrames * (channels == 1 ? 2 : channels));
+    auto rdyn = createDynResampler<TC, TI, TO>(
+            channels, inputFreq, outputFreq, quality, polyphase);
+
+    int64_t bestNs = INT64_MAX;
+    for (int i = 0; i < 5; ++i) {
+        provider.reset();
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        resample(channels, output.data(), outputFrames, {240}, &provider, rdyn.get());
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        bestNs = std::min(bestNs, (int64_t) (end.tv_sec - start.tv_sec) * 1000000000
+                + end.tv_nsec - start.tv_nsec);
+    }
+    return (double) bestNs / outputFrames;
+}
+
+// Compares the speed of the polyphase and generic locked phase resamplers.
+TEST(audioflinger_resampler, polyphase_speed) {
+    static constexpr struct {
+        unsigned inputFreq;
+        unsigned outputFreq;
+    } kRatios[] = {
+        {16000, 48000},
+        {48000, 96000},
+        {96000, 48000},
+    };
+
+    for (const auto &ratio : kRatios) {
+        const double generic = resampleNanosPerFrame<int32_t, int16_t, int32_t>(2,
+                ratio.inputFreq, ratio.outputFreq, android::AudioResampler::DYN_HIGH_QUALITY,
+                false /* polyphase */);
+        const double polyphase = resampleNanosPerFrame<int32_t, int16_t, int32_t>(2,
+                ratio.inputFreq, ratio.outputFreq, android::AudioResampler::DYN_HIGH_QUALITY,
+                true /* polyphase */);
+        const double genericFloat = resampleNanosPerFrame<float, float, float>(2,
+                ratio.inputFreq, ratio.outputFreq, android::AudioResampler::DYN_HIGH_QUALITY,
+                false /* polyphase */);
+        const double polyphaseFloat = resampleNanosPerFrame<float, float, float>(2,
+                ratio.inputFreq, ratio.outputFreq, android::AudioResampler::DYN_HIGH_QUALITY,
+                true /* polyphase */);
+        printf("%u -> %u stereo ns/frame  i16 generic:%.2lf polyphase:%.2lf"
+                "  float generic:%.2lf polyphase:%.2lf\n",
+                ratio.inputFreq, ratio.outputFreq, generic, polyphase,
+                genericFloat, polyphaseFloat);
+    }
+}
@@ -10,3 +10,7 @@ adb root && adb wait-for-device remount
 
 adb shell /data/nativetest/resampler_tests/resampler_tests
 adb shell /data/nativetest64/resampler_tests/resampler_tests
+adb shell /data/nativetest/mixer_tests/mixer_tests
+adb shell /data/nativetest64/mixer_tests/mixer_tests
+adb shell /data/nativetest/timestretch_tests/timestretch_tests
+adb shell /data/nativetest64/timestretch_tests/timestretch_tests
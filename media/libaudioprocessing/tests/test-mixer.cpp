@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <inttypes.h>
 #include <math.h>
+#include <time.h>
 #include <vector>
 #include <audio_utils/primitives.h>
 #include <audio_utils/sndfile.h>
@@ -39,6 +40,8 @@ static void usage(const char* name) {
     fprintf(stderr, "Usage: %s [-f] [-m] [-c channels]"
                     " [-s sample-rate] [-o <output-file>] [-a <aux-buffer-file>] [-P csv]"
                     " (<input-file> | <command>)+\n", name);
+    fprintf(stderr, "       %s [-f] [-m] [-c channels] [-s sample-rate] -b <track-counts csv>\n",
+                    name);
     fprintf(stderr, "    -f    enable floating point input track by default\n");
     fprintf(stderr, "    -m    enable floating point mixer output\n");
     fprintf(stderr, "    -c    number of mixer output channels\n");
@@ -46,6 +49,8 @@ static void usage(const char* name) {
     fprintf(stderr, "    -o    <output-file> WAV file, pcm16 (or float if -m specified)\n");
     fprintf(stderr, "    -a    <aux-buffer-file>\n");
     fprintf(stderr, "    -P    # frames provided per call to resample() in CSV format\n");
+    fprintf(stderr, "    -b    for each track count, verify the vector mixing kernels are\n"
+                    "          bit-exact with the scalar code and report ns per output frame\n");
     fprintf(stderr, "    <input-file> is a WAV file\n");
     fprintf(stderr, "    <command> can be 'sine:[(i|f),]<channels>,<frequency>,<samplerate>'\n");
     fprintf(stderr, "                     'chirp:[(i|f),]<channels>,<samplerate>'\n");
@@ -90,6 +95,110 @@ const char *parseFormat(const char *s, bool *useFloat) {
     return s;
 }
 
+static int64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Mixes trackCount sine tracks without resampling, as on a primary output,
+ * ramping the volume every few buffers so that both the ramp and the
+ * constant volume kernels are used. Returns the mixer output and the
+ * processing time per output frame.
+ */
+static std::vector<char> benchmarkMix(size_t trackCount, bool useFloat, bool useMixerFloat,
+        uint32_t sampleRate, uint32_t channels, bool useVector, double *nsPerFrame) {
+    static const double kSeconds = 2;
+    static const size_t kMixerFrameCount = 960;
+    static const int kRampPeriod = 16; // buffers between volume changes
+    const audio_format_t format = useFloat ? AUDIO_FORMAT_PCM_FLOAT : AUDIO_FORMAT_PCM_16_BIT;
+    const audio_format_t mixerFormat = useMixerFloat
+            ? AUDIO_FORMAT_PCM_FLOAT : AUDIO_FORMAT_PCM_16_BIT;
+    const audio_channel_mask_t channelMask = audio_channel_out_mask_from_count(channels);
+    const size_t outputFrameSize = channels * (useMixerFloat ? sizeof(float) : sizeof(int16_t));
+
+    std::vector<SignalProvider> providers(trackCount);
+    for (size_t i = 0; i < trackCount; ++i) {
+        if (useFloat) {
+            providers[i].setSine<float>(channels, 100 + 37 * i, sampleRate, kSeconds);
+        } else {
+            providers[i].setSine<int16_t>(channels, 100 + 37 * i, sampleRate, kSeconds);
+        }
+    }
+    const size_t outputFrames =
+            providers[0].getNumFrames() / kMixerFrameCount * kMixerFrameCount;
+    std::vector<char> output(outputFrames * outputFrameSize);
+
+    AudioMixer::setVectorKernelsEnabled(useVector);
+    AudioMixer *mixer = new AudioMixer(kMixerFrameCount, sampleRate);
+    float volumes[2] = {
+        AudioMixer::UNITY_GAIN_FLOAT / trackCount,
+        AudioMixer::UNITY_GAIN_FLOAT / trackCount / 3,
+    };
+    for (size_t i = 0; i < trackCount; ++i) {
+        const status_t status = mixer->create(i, channelMask, format, AUDIO_SESSION_OUTPUT_MIX);
+        LOG_ALWAYS_FATAL_IF(status != OK);
+        mixer->setBufferProvider(i, &providers[i]);
+        mixer->setParameter(i, AudioMixer::TRACK, AudioMixer::MIXER_FORMAT,
+                (void *)(uintptr_t)mixerFormat);
+        mixer->setParameter(i, AudioMixer::TRACK, AudioMixer::FORMAT,
+                (void *)(uintptr_t)format);
+        mixer->setParameter(i, AudioMixer::TRACK, AudioMixer::MIXER_CHANNEL_MASK,
+                (void *)(uintptr_t)channelMask);
+        mixer->setParameter(i, AudioMixer::TRACK, AudioMixer::CHANNEL_MASK,
+                (void *)(uintptr_t)channelMask);
+        mixer->setParameter(i, AudioMixer::RESAMPLE, AudioMixer::SAMPLE_RATE,
+                (void *)(uintptr_t)sampleRate);
+        mixer->setParameter(i, AudioMixer::VOLUME, AudioMixer::VOLUME0, &volumes[0]);
+        mixer->setParameter(i, AudioMixer::VOLUME, AudioMixer::VOLUME1, &volumes[0]);
+        mixer->enable(i);
+    }
+
+    int64_t elapsedNs = 0;
+    for (size_t i = 0; i < outputFrames; i += kMixerFrameCount) {
+        const int buffer = i / kMixerFrameCount;
+        for (size_t j = 0; j < trackCount; ++j) {
+            mixer->setParameter(j, AudioMixer::TRACK, AudioMixer::MAIN_BUFFER,
+                    &output[i * outputFrameSize]);
+            if (buffer % kRampPeriod == 0) {
+                float *volume = &volumes[(buffer / kRampPeriod) & 1];
+                mixer->setParameter(j, AudioMixer::RAMP_VOLUME, AudioMixer::VOLUME0, volume);
+                mixer->setParameter(j, AudioMixer::RAMP_VOLUME, AudioMixer::VOLUME1, volume);
+            }
+        }
+        const int64_t startNs = nowNs();
+        mixer->process();
+        elapsedNs += nowNs() - startNs;
+    }
+    delete mixer;
+    AudioMixer::setVectorKernelsEnabled(true);
+
+    *nsPerFrame = (double)elapsedNs / outputFrames;
+    return output;
+}
+
+static int benchmark(const std::vector<int>& trackCounts, bool useFloat, bool useMixerFloat,
+        uint32_t sampleRate, uint32_t channels) {
+    int result = EXIT_SUCCESS;
+    for (int trackCount : trackCounts) {
+        if (trackCount <= 0) {
+            continue;
+        }
+        double scalarNs, vectorNs;
+        const std::vector<char> scalarOutput = benchmarkMix(
+                trackCount, useFloat, useMixerFloat, sampleRate, channels, false, &scalarNs);
+        const std::vector<char> vectorOutput = benchmarkMix(
+                trackCount, useFloat, useMixerFloat, sampleRate, channels, true, &vectorNs);
+        const bool bitExact = scalarOutput == vectorOutput;
+        printf("tracks:%d  scalar:%.2f ns/frame  vector:%.2f ns/frame  %s\n",
+                trackCount, scalarNs, vectorNs, bitExact ? "bit-exact" : "MISMATCH");
+        if (!bitExact) {
+            result = EXIT_FAILURE;
+        }
+    }
+    return result;
+}
+
 int main(int argc, char* argv[]) {
     const char* const progname = argv[0];
     bool useInputFloat = false;
@@ -98,13 +207,14 @@ int main(int argc, char* argv[]) {
     uint32_t outputSampleRate = 48000;
     uint32_t outputChannels = 2; // stereo for now
     std::vector<int> Pvalues;
+    std::vector<int> trackCounts;
     const char* outputFilename = NULL;
     const char* auxFilename = NULL;
     std::vector<int32_t> names;
     std::vector<SignalProvider> providers;
     std::vector<audio_format_t> formats;
 
-    for (int ch; (ch = getopt(argc, argv, "fmc:s:o:a:P:")) != -1;) {
+    for (int ch; (ch = getopt(argc, argv, "fmc:s:o:a:P:b:")) != -1;) {
         switch (ch) {
         case 'f':
             useInputFloat = true;
@@ -130,6 +240,12 @@ int main(int argc, char* argv[]) {
                 return EXIT_FAILURE;
             }
             break;
+        case 'b':
+            if (parseCSV(optarg, trackCounts) < 0) {
+                fprintf(stderr, "incorrect syntax for -b option\n");
+                return EXIT_FAILURE;
+            }
+            break;
         case '?':
         default:
             usage(progname);
@@ -139,6 +255,11 @@ int main(int argc, char* argv[]) {
     argc -= optind;
     argv += optind;
 
+    if (!trackCounts.empty()) {
+        return benchmark(trackCounts, useInputFloat, useMixerFloat,
+                outputSampleRate, outputChannels);
+    }
+
     if (argc == 0) {
         usage(progname);
         return EXIT_FAILURE;
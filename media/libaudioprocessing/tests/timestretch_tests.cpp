@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "timestretch_tests"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <log/log.h>
+#include <media/AudioBufferProvider.h>
+#include <media/BufferProviders.h>
+
+#include "test_utils.h"
+
+using android::TimestretchBufferProvider;
+
+static const uint32_t kSampleRate = 48000;
+// Two tones whose sum repeats every 20 msec, longer than the search for a segment.
+static const double kToneFreqs[] = { 1000., 1350. };
+static const size_t kTonePeriod = kSampleRate / 50;
+static const size_t kRequestFrames = 192; // as the mixer would, 4 msec at a time
+static const float kSpeeds[] = { 0.5, 0.75, 1.25, 1.5, 2., 3., 4. };
+
+static int64_t getNanoseconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Time-stretches all of the provider's data, and returns it.
+static std::vector<float> stretch(android::AudioBufferProvider *provider,
+        size_t channels, float speed, TimestretchBufferProvider::Engine engine,
+        int64_t *elapsedNs = nullptr)
+{
+    android::AudioPlaybackRate playbackRate = android::AUDIO_PLAYBACK_RATE_DEFAULT;
+    playbackRate.mSpeed = speed;
+    TimestretchBufferProvider timestretch(channels, AUDIO_FORMAT_PCM_FLOAT, kSampleRate,
+            playbackRate, engine);
+    timestretch.setBufferProvider(provider);
+
+    std::vector<float> output;
+    const int64_t startNs = getNanoseconds();
+    for (;;) {
+        android::AudioBufferProvider::Buffer buffer;
+        buffer.frameCount = kRequestFrames;
+        if (timestretch.getNextBuffer(&buffer) != android::OK || buffer.frameCount == 0) {
+            break;
+        }
+        const float *data = (const float *)buffer.raw;
+        output.insert(output.end(), data, data + buffer.frameCount * channels);
+        timestretch.releaseBuffer(&buffer);
+    }
+    if (elapsedNs != nullptr) {
+        *elapsedNs = getNanoseconds() - startNs;
+    }
+    return output;
+}
+
+static std::vector<float> createTones(size_t channels, double seconds)
+{
+    const size_t frames = kSampleRate * seconds;
+    std::vector<float> data(frames * channels);
+    for (size_t i = 0; i < frames; ++i) {
+        double y = 0.;
+        for (double freq : kToneFreqs) {
+            y += 0.5 * sin(2. * M_PI * freq * i / kSampleRate);
+        }
+        for (size_t j = 0; j < channels; ++j) {
+            data[i * channels + j] = y / (j + 1);
+        }
+    }
+    return data;
+}
+
+// Signal to noise ratio in dB of channel 0 of the stretched tones: the power of the tones
+// over the power of everything else, in each period after the first.
+// The phase of the tones is allowed to change from one period to the next.
+static double toneSnr(const std::vector<float> &output, size_t channels)
+{
+    double power = 0.;
+    double tones = 0.;
+    for (size_t start = kTonePeriod; start + kTonePeriod <= output.size() / channels;
+            start += kTonePeriod) {
+        const float *x = output.data() + start * channels;
+        for (size_t i = 0; i < kTonePeriod; ++i) {
+            power += x[i * channels] * x[i * channels];
+        }
+        for (double freq : kToneFreqs) {
+            const double w = 2. * M_PI * freq / kSampleRate;
+            double re = 0.;
+            double im = 0.;
+            for (size_t i = 0; i < kTonePeriod; ++i) {
+                re += x[i * channels] * cos(w * i);
+                im -= x[i * channels] * sin(w * i);
+            }
+            tones += 2. * (re * re + im * im) / kTonePeriod;
+        }
+    }
+    return 10. * log10(tones / std::max(power - tones, 1e-20));
+}
+
+TEST(timestretch, wsola_normal_speed) {
+    const size_t channels = 2;
+    SignalProvider provider;
+    provider.setChirp<float>(channels, 20., kSampleRate / 2., kSampleRate, 1. /* time */);
+
+    std::vector<float> input(provider.getNumFrames() * channels);
+    createChirp<float>(input.data(), provider.getNumFrames(), channels, kSampleRate,
+            20., kSampleRate / 2.);
+
+    std::vector<float> output = stretch(&provider, channels, 1.0f,
+            TimestretchBufferProvider::ENGINE_WSOLA);
+
+    // The input is copied.
+    ASSERT_GE(output.size(), input.size() * 9 / 10);
+    EXPECT_EQ(0, memcmp(output.data(), input.data(), output.size() * sizeof(float)));
+}
+
+TEST(timestretch, wsola_speeds) {
+    const double kMinSnrDb = 15.;
+    for (size_t channels : { 1, 2, 6 }) {
+        for (float speed : kSpeeds) {
+            std::vector<float> input = createTones(channels, 2. /* seconds */);
+            TestProvider provider(input.data(), input.size() / channels,
+                    channels * sizeof(float), std::vector<int>());
+            std::vector<float> output = stretch(&provider, channels, speed,
+                    TimestretchBufferProvider::ENGINE_WSOLA);
+
+            // All but the last hops of input are output, speed times faster.
+            const double frames = output.size() / channels;
+            EXPECT_NEAR(2. * kSampleRate / speed, frames, kSampleRate / 20.)
+                    << "channels " << channels << " speed " << speed;
+            EXPECT_GT(toneSnr(output, channels), kMinSnrDb)
+                    << "channels " << channels << " speed " << speed;
+        }
+    }
+}
+
+TEST(timestretch, wsola_short_buffers) {
+    // Upstream buffers that are shorter than a hop, as from a ring buffer that wraps around,
+    // give the same output.
+    const size_t channels = 2;
+    const std::vector<int> incr = { 7, 301, 1, 89, 1024, 33 };
+    std::vector<float> speeds(std::begin(kSpeeds), std::end(kSpeeds));
+    speeds.push_back(AUDIO_TIMESTRETCH_SPEED_MAX); // the most input kept between calls
+    for (float speed : speeds) {
+        SignalProvider reference;
+        reference.setChirp<float>(channels, 20., kSampleRate / 2., kSampleRate, 1. /* time */);
+        SignalProvider provider;
+        provider.setChirp<float>(channels, 20., kSampleRate / 2., kSampleRate, 1. /* time */);
+        provider.setIncr(incr);
+
+        std::vector<float> expected = stretch(&reference, channels, speed,
+                TimestretchBufferProvider::ENGINE_WSOLA);
+        std::vector<float> output = stretch(&provider, channels, speed,
+                TimestretchBufferProvider::ENGINE_WSOLA);
+        ASSERT_EQ(expected.size(), output.size()) << "speed " << speed;
+        EXPECT_EQ(0, memcmp(expected.data(), output.data(), output.size() * sizeof(float)))
+                << "speed " << speed;
+    }
+}
+
+TEST(timestretch, benchmark) {
+    const size_t channels = 2;
+    const double seconds = 5.;
+    for (float speed : kSpeeds) {
+        double nsPerFrame[2];
+        double snr[2];
+        for (int engine = 0; engine < 2; ++engine) {
+            std::vector<float> input = createTones(channels, seconds);
+            TestProvider provider(input.data(), input.size() / channels,
+                    channels * sizeof(float), std::vector<int>());
+            int64_t elapsedNs;
+            std::vector<float> output = stretch(&provider, channels, speed,
+                    engine == 0 ? TimestretchBufferProvider::ENGINE_SONIC
+                            : TimestretchBufferProvider::ENGINE_WSOLA, &elapsedNs);
+            nsPerFrame[engine] = (double)elapsedNs * channels / output.size();
+            snr[engine] = toneSnr(output, channels);
+        }
+        printf("[ BENCH    ] speed %4.2f  sonic %6.1f ns/frame snr %5.1f dB"
+                "  wsola %6.1f ns/frame snr %5.1f dB\n",
+                speed, nsPerFrame[0], snr[0], nsPerFrame[1], snr[1]);
+    }
+}
@@ -20,6 +20,8 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <memory>
+
 #include <media/AudioBufferProvider.h>
 #include <media/AudioResamplerPublic.h>
 #include <system/audio.h>
@@ -32,6 +34,7 @@ typedef struct sonicStreamStruct *sonicStream;
 
 namespace android {
 
+class AudioTimestretchWsola;
 class EffectBufferHalInterface;
 class EffectHalInterface;
 class EffectsFactoryHalInterface;
@@ -176,11 +179,22 @@ protected:
 // TimestretchBufferProvider derives from PassthruBufferProvider for time stretching
 class TimestretchBufferProvider : public PassthruBufferProvider {
 public:
+    // Time stretching algorithms
+    enum Engine {
+        ENGINE_SONIC,   // the Sonic library
+        ENGINE_WSOLA,   // AudioTimestretchWsola, for AUDIO_FORMAT_PCM_FLOAT (else Sonic)
+    };
+
     TimestretchBufferProvider(int32_t channelCount,
             audio_format_t format, uint32_t sampleRate,
-            const AudioPlaybackRate &playbackRate);
+            const AudioPlaybackRate &playbackRate,
+            Engine engine = getDefaultEngine());
     virtual ~TimestretchBufferProvider();
 
+    // Returns the engine set by the property af.timestretch.engine,
+    // "sonic" (the default) or "wsola".
+    static Engine getDefaultEngine();
+
     // Overrides AudioBufferProvider methods
     virtual status_t getNextBuffer(Buffer* buffer);
     virtual void releaseBuffer(Buffer* buffer);
@@ -213,6 +227,7 @@ private:
                                                   // to caller
     size_t               mRemaining;              // remaining data in local buffer
     sonicStream          mSonicStream;            // handle to sonic timestretch object
+    std::unique_ptr<AudioTimestretchWsola> mWsola; // used instead of sonic if not null
     //FIXME: this dependency should be abstracted out
     bool                 mFallbackFailErrorShown; // log fallback error only once
     bool                 mAudioPlaybackRateValid; // flag for current parameters validity
@@ -253,6 +268,50 @@ protected:
     size_t               mContractedWrittenFrames;
     size_t               mContractedFrameSize;
 };
+
+// PrefetchBufferProvider copies frames from the upstream provider ahead of use, so that
+// they can be consumed on another thread without calling the upstream provider there.
+// Frames are copied into a ring, so a buffer that is still held downstream is not moved
+// by a later prefetch(). When the ring is empty, getNextBuffer() pulls from upstream only
+// if pulling is enabled, and otherwise returns no frames as an underrun would.
+class PrefetchBufferProvider : public PassthruBufferProvider {
+public:
+    explicit PrefetchBufferProvider(size_t frameSize);
+
+    // Overrides AudioBufferProvider methods
+    status_t getNextBuffer(Buffer *buffer) override;
+    void releaseBuffer(Buffer *buffer) override;
+
+    // Overrides PassthruBufferProvider; prefetched frames are discarded.
+    void reset() override;
+    void setBufferProvider(AudioBufferProvider *p) override;
+
+    // Copies frames from upstream until frameCount frames are available, the upstream
+    // provider has no more, or the ring is full. Returns the frames available.
+    size_t prefetch(size_t frameCount);
+    size_t framesAvailable() const { return mFrames; }
+
+    // Sets the frame size and makes the ring hold at least frameCount frames. Called when
+    // the track is configured, so that neither prefetch() nor getNextBuffer() allocate.
+    // Returns true if the prefetched frames were discarded, on a new frame size or when
+    // the ring grows; a buffer held downstream must then be dropped without being used.
+    bool configure(size_t frameSize, size_t frameCount);
+
+    // Whether getNextBuffer() may call the upstream provider; only the thread that owns
+    // the upstream provider may enable this.
+    void setPullEnabled(bool enabled) { mPullEnabled = enabled; }
+
+private:
+    void fill(size_t frameCount);
+
+    size_t               mFrameSize;
+    std::unique_ptr<uint8_t[]> mData;
+    size_t               mFrameCapacity;  // size of mData in frames
+    size_t               mFront;          // first unreleased frame
+    size_t               mFrames;         // unreleased frames, including those held
+    size_t               mHeld;           // frames of the buffer held downstream
+    bool                 mPullEnabled;
+};
 // ----------------------------------------------------------------------------
 } // namespace android
 
@@ -103,7 +103,8 @@ status_t CallbackDataSource::getSize(off64_t *size) {
 }
 
 uint32_t CallbackDataSource::flags() {
-    return mIDataSource->getFlags();
+    // the remote source cannot be mapped into this process.
+    return mIDataSource->getFlags() & ~kIsMappable;
 }
 
 void CallbackDataSource::close() {
@@ -187,7 +188,8 @@ status_t TinyCacheSource::getSize(off64_t *size) {
 }
 
 uint32_t TinyCacheSource::flags() {
-    return mSource->flags();
+    // reads have to go through the cache.
+    return mSource->flags() & ~kIsMappable;
 }
 
 sp<DecryptHandle> TinyCacheSource::DrmInitialization(const char *mime) {
@@ -23,6 +23,7 @@
 #include <media/stagefright/Utils.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -33,7 +34,12 @@ ClearFileSource::ClearFileSource(const char *filename)
     : mFd(-1),
       mOffset(0),
       mLength(-1),
-      mName("<null>") {
+      mName("<null>"),
+      mMapping(NULL),
+      mMappingSize(0),
+      mMappedData(NULL),
+      mMappingFailed(false),
+      mMappable(false) {
 
     if (filename) {
         mName = String8::format("FileSource(%s)", filename);
@@ -43,6 +49,7 @@ ClearFileSource::ClearFileSource(const char *filename)
 
     if (mFd >= 0) {
         mLength = lseek64(mFd, 0, SEEK_END);
+        mMappable = CannotShrink(mFd, true /* opened */);
     } else {
         ALOGE("Failed to open file '%s'. (%s)", filename, strerror(errno));
     }
@@ -52,7 +59,12 @@ ClearFileSource::ClearFileSource(int fd, int64_t offset, int64_t length)
     : mFd(fd),
       mOffset(offset),
       mLength(length),
-      mName("<null>") {
+      mName("<null>"),
+      mMapping(NULL),
+      mMappingSize(0),
+      mMappedData(NULL),
+      mMappingFailed(false),
+      mMappable(false) {
     ALOGV("fd=%d (%s), offset=%lld, length=%lld",
             fd, nameForFd(fd).c_str(), (long long) offset, (long long) length);
 
@@ -87,9 +99,29 @@ ClearFileSource::ClearFileSource(int fd, int64_t offset, int64_t length)
             (long long) mOffset,
             (long long) mLength);
 
+    mMappable = CannotShrink(mFd, false /* opened */);
+}
+
+// Reading a mapping past the end of its file raises SIGBUS, so only files
+// that nobody else can truncate are mapped: memfds sealed against shrinking,
+// and files this source opened itself that no other user can write to.
+// static
+bool ClearFileSource::CannotShrink(int fd, bool opened) {
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals >= 0 && (seals & F_SEAL_SHRINK)) {
+        return true;
+    }
+    struct stat s;
+    return opened && fstat(fd, &s) == 0 && S_ISREG(s.st_mode)
+            && s.st_uid == geteuid() && (s.st_mode & (S_IWGRP | S_IWOTH)) == 0;
 }
 
 ClearFileSource::~ClearFileSource() {
+    if (mMapping != NULL) {
+        munmap(mMapping, mMappingSize);
+        mMapping = NULL;
+    }
+
     if (mFd >= 0) {
         ::close(mFd);
         mFd = -1;
@@ -128,6 +160,41 @@ ssize_t ClearFileSource::readAt_l(off64_t offset, void *data, size_t size) {
     return ::read(mFd, data, size);
 }
 
+const uint8_t *ClearFileSource::getMappedData(off64_t *size) {
+    Mutex::Autolock autoLock(mLock);
+
+    if (mMappedData == NULL && !mMappingFailed) {
+        mMappingFailed = true;
+
+        // the mapping must start on a page boundary.
+        off64_t pageOffset = mOffset % sysconf(_SC_PAGE_SIZE);
+        uint64_t mappingSize = (uint64_t)mLength + pageOffset;
+
+        // the file may have been truncated since the source was created.
+        struct stat s;
+        if (!mMappable || mFd < 0 || mLength <= 0 || mappingSize > SIZE_MAX
+                || fstat(mFd, &s) != 0 || mOffset + mLength > s.st_size) {
+            return NULL;
+        }
+
+        void *mapping = mmap64(NULL, (size_t)mappingSize, PROT_READ, MAP_PRIVATE,
+                mFd, mOffset - pageOffset);
+        if (mapping == MAP_FAILED) {
+            ALOGW("failed to map %s (%s)", mName.string(), strerror(errno));
+            return NULL;
+        }
+        mMapping = mapping;
+        mMappingSize = (size_t)mappingSize;
+        mMappedData = (const uint8_t *)mapping + pageOffset;
+        mMappingFailed = false;
+    }
+
+    if (mMappedData != NULL) {
+        *size = mLength;
+    }
+    return mMappedData;
+}
+
 status_t ClearFileSource::getSize(off64_t *size) {
     Mutex::Autolock autoLock(mLock);
 
@@ -62,6 +62,27 @@ FileSource::~FileSource() {
     }
 }
 
+uint32_t FileSource::flags() {
+    Mutex::Autolock autoLock(mLock);
+
+    uint32_t flags = ClearFileSource::flags();
+    if (mDecryptHandle != NULL) {
+        // the file contents have to be decrypted by readAt().
+        flags &= ~kIsMappable;
+    }
+    return flags;
+}
+
+const uint8_t *FileSource::getMappedData(off64_t *size) {
+    {
+        Mutex::Autolock autoLock(mLock);
+        if (mDecryptHandle != NULL) {
+            return NULL;
+        }
+    }
+    return ClearFileSource::getMappedData(size);
+}
+
 ssize_t FileSource::readAt(off64_t offset, void *data, size_t size) {
     if (mFd < 0) {
         return NO_INIT;
@@ -22,15 +22,18 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <pthread.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <utils/Log.h>
 
 #include <functional>
+#include <vector>
 
 #include <media/MediaSource.h>
 #include <media/stagefright/foundation/ADebug.h>
@@ -73,6 +76,9 @@ static const int64_t kInitialDelayTimeUs     = 700000LL;
 static const int64_t kMaxMetadataSize = 0x4000000LL;   // 64MB max per-frame metadata size
 static const int64_t kMaxCttsOffsetTimeUs = 30 * 60 * 1000000LL;  // 30 minutes
 static const size_t kESDSScratchBufferSize = 10;  // kMaxAtomSize in Mpeg4Extractor 64MB
+static const uint32_t kSyncSampleFlags = 0x02000000;     // depends on no other sample
+static const uint32_t kNonSyncSampleFlags = 0x01010000;  // depends on others, non-sync
+static const int64_t kMaxMoovDelayUs = 1000000LL;  // wait for every track before the moov
 
 static const char kMetaKey_Version[]    = "com.android.version";
 static const char kMetaKey_Manufacturer[]      = "com.android.manufacturer";
@@ -132,6 +138,7 @@ public:
     void addItemOffsetAndSize(off64_t offset, size_t size, bool isExif);
     void flushItemRefs();
     int32_t getTrackId() const { return mTrackId; }
+    int32_t getTimeScale() const { return mTimeScale; }
     status_t dump(int fd, const Vector<String16>& args) const;
     static const char *getFourCCForMime(const char *mime);
     const char *getTrackType() const;
@@ -305,6 +312,8 @@ private:
 
     List<MediaBuffer *> mChunkSamples;
 
+    // Number of samples, which in a fragmented file are not in the stsz table
+    size_t              mNumSamples;
     bool                mSamplesHaveSameSize;
     ListTableEntries<uint32_t, 1> *mStszTableEntries;
 
@@ -509,6 +518,12 @@ void MPEG4Writer::initInternal(int fd, bool isFirstSession) {
     mAssociationEntryCount = 0;
     mNumGrids = 0;
     mHasRefs = false;
+    mSampleHeadersSize = 0;
+    mSampleIovecs.clear();
+    mFragmentDurationUs = 0;
+    mFragmentStartTimeUs = -1;
+    mFragmentSequenceNumber = 0;
+    mMehdOffset = 0;
 
     // Following variables only need to be set for the first recording session.
     // And they will stay the same for all the recording sessions.
@@ -563,7 +578,7 @@ status_t MPEG4Writer::Track::dump(
     snprintf(buffer, SIZE, "       reached EOS: %s\n",
             mReachedEOS? "true": "false");
     result.append(buffer);
-    snprintf(buffer, SIZE, "       frames encoded : %d\n", mStszTableEntries->count());
+    snprintf(buffer, SIZE, "       frames encoded : %zu\n", mNumSamples);
     result.append(buffer);
     snprintf(buffer, SIZE, "       duration encoded : %" PRId64 " us\n", mTrackDurationUs);
     result.append(buffer);
@@ -855,13 +870,26 @@ status_t MPEG4Writer::start(MetaData *param) {
     CHECK_GT(mTimeScale, 0);
     ALOGV("movie time scale: %d", mTimeScale);
 
+    int64_t fragmentDurationUs;
+    if (param &&
+        param->findInt64(kKeyFragmentDurationUs, &fragmentDurationUs) &&
+        fragmentDurationUs > 0) {
+        if (mHasFileLevelMeta) {
+            ALOGW("Fragmented output is not supported for HEIF files");
+        } else {
+            mFragmentDurationUs = fragmentDurationUs;
+        }
+    }
+
     /*
      * When the requested file size limit is small, the priority
      * is to meet the file size limit requirement, rather than
      * to make the file streamable. mStreamableFile does not tell
      * whether the actual recorded file is streamable or not.
+     * A fragmented file has its moov box ahead of the media data
+     * anyway.
      */
-    mStreamableFile =
+    mStreamableFile = !isFragmented() &&
         (mMaxFileSizeLimitBytes != 0 &&
          mMaxFileSizeLimitBytes >= kMinStreamableFileSizeInBytes);
 
@@ -912,34 +940,40 @@ status_t MPEG4Writer::start(MetaData *param) {
 
     mFreeBoxOffset = mOffset;
 
-    if (mInMemoryCacheSize == 0) {
-        int32_t bitRate = -1;
-        if (mHasFileLevelMeta) {
-            mInMemoryCacheSize += estimateFileLevelMetaSize(param);
-        }
-        if (mHasMoovBox) {
-            if (param) {
-                param->findInt32(kKeyBitRate, &bitRate);
+    if (isFragmented()) {
+        // The moov box and the fragments are appended by the writer
+        // thread, see writeFragment().
+        mMdatOffset = mOffset;
+    } else {
+        if (mInMemoryCacheSize == 0) {
+            int32_t bitRate = -1;
+            if (mHasFileLevelMeta) {
+                mInMemoryCacheSize += estimateFileLevelMetaSize(param);
+            }
+            if (mHasMoovBox) {
+                if (param) {
+                    param->findInt32(kKeyBitRate, &bitRate);
+                }
+                mInMemoryCacheSize += estimateMoovBoxSize(bitRate);
             }
-            mInMemoryCacheSize += estimateMoovBoxSize(bitRate);
         }
-    }
-    if (mStreamableFile) {
-        // Reserve a 'free' box only for streamable file
-        lseek64(mFd, mFreeBoxOffset, SEEK_SET);
-        writeInt32(mInMemoryCacheSize);
-        write("free", 4);
-        mMdatOffset = mFreeBoxOffset + mInMemoryCacheSize;
-    } else {
-        mMdatOffset = mOffset;
-    }
+        if (mStreamableFile) {
+            // Reserve a 'free' box only for streamable file
+            lseek64(mFd, mFreeBoxOffset, SEEK_SET);
+            writeInt32(mInMemoryCacheSize);
+            write("free", 4);
+            mMdatOffset = mFreeBoxOffset + mInMemoryCacheSize;
+        } else {
+            mMdatOffset = mOffset;
+        }
 
-    mOffset = mMdatOffset;
-    lseek64(mFd, mMdatOffset, SEEK_SET);
-    if (mUse32BitOffset) {
-        write("????mdat", 8);
-    } else {
-        write("\x00\x00\x00\x01mdat????????", 16);
+        mOffset = mMdatOffset;
+        lseek64(mFd, mMdatOffset, SEEK_SET);
+        if (mUse32BitOffset) {
+            write("????mdat", 8);
+        } else {
+            write("\x00\x00\x00\x01mdat????????", 16);
+        }
     }
 
     status_t err = startWriterThread();
@@ -1117,6 +1151,26 @@ status_t MPEG4Writer::reset(bool stopSource) {
 
     stopWriterThread();
 
+    // The fragments are all written by the writer thread, only the
+    // duration in the 'mehd' box is left to fill in. The moov box and the
+    // fragments are already in the file, so this is done on error too.
+    if (isFragmented()) {
+        if (mMehdOffset > 0) {
+            lseek64(mFd, mMehdOffset + 12, SEEK_SET);
+            uint64_t duration = (maxDurationUs * mTimeScale + 5E5) / 1E6;
+            duration = hton64(duration);
+            if (::write(mFd, &duration, 8) != 8) {
+                ALOGE("Failed to write the fragment duration: %s", strerror(errno));
+                if (err == OK) {
+                    err = ERROR_IO;
+                }
+            }
+            lseek64(mFd, mOffset, SEEK_SET);
+        }
+        release();
+        return err;
+    }
+
     // Do not write out movie header on error.
     if (err != OK) {
         release();
@@ -1262,35 +1316,67 @@ void MPEG4Writer::writeMoovBox(int64_t durationUs) {
         writeUdtaBox();
     }
     writeMoovLevelMetaBox();
-    // Loop through all the tracks to get the global time offset if there is
-    // any ctts table appears in a video track.
-    int64_t minCttsOffsetTimeUs = kMaxCttsOffsetTimeUs;
-    for (List<Track *>::iterator it = mTracks.begin();
-        it != mTracks.end(); ++it) {
-        if (!(*it)->isHeic()) {
-            minCttsOffsetTimeUs =
-                std::min(minCttsOffsetTimeUs, (*it)->getMinCttsOffsetTimeUs());
+    // The moov box of a fragmented file has no samples to adjust the start
+    // time for; the fragments carry their own composition offsets.
+    if (!isFragmented()) {
+        // Loop through all the tracks to get the global time offset if there is
+        // any ctts table appears in a video track.
+        int64_t minCttsOffsetTimeUs = kMaxCttsOffsetTimeUs;
+        for (List<Track *>::iterator it = mTracks.begin();
+            it != mTracks.end(); ++it) {
+            if (!(*it)->isHeic()) {
+                minCttsOffsetTimeUs =
+                    std::min(minCttsOffsetTimeUs, (*it)->getMinCttsOffsetTimeUs());
+            }
         }
-    }
-    ALOGI("Ajust the moov start time from %lld us -> %lld us",
-            (long long)mStartTimestampUs,
-            (long long)(mStartTimestampUs + minCttsOffsetTimeUs - kMaxCttsOffsetTimeUs));
-    // Adjust the global start time.
-    mStartTimestampUs += minCttsOffsetTimeUs - kMaxCttsOffsetTimeUs;
+        ALOGI("Ajust the moov start time from %lld us -> %lld us",
+                (long long)mStartTimestampUs,
+                (long long)(mStartTimestampUs + minCttsOffsetTimeUs - kMaxCttsOffsetTimeUs));
+        // Adjust the global start time.
+        mStartTimestampUs += minCttsOffsetTimeUs - kMaxCttsOffsetTimeUs;
 
-    // Add mStartTimeOffsetBFramesUs(-ve or zero) to the duration of first entry in STTS.
-    mStartTimeOffsetBFramesUs = minCttsOffsetTimeUs - kMaxCttsOffsetTimeUs;
-    ALOGV("mStartTimeOffsetBFramesUs :%" PRId32, mStartTimeOffsetBFramesUs);
+        // Add mStartTimeOffsetBFramesUs(-ve or zero) to the duration of first entry in STTS.
+        mStartTimeOffsetBFramesUs = minCttsOffsetTimeUs - kMaxCttsOffsetTimeUs;
+        ALOGV("mStartTimeOffsetBFramesUs :%" PRId32, mStartTimeOffsetBFramesUs);
+    }
 
     for (List<Track *>::iterator it = mTracks.begin();
         it != mTracks.end(); ++it) {
-        if (!(*it)->isHeic()) {
+        if (!(*it)->isHeic() && isTrackInMoov(*it)) {
             (*it)->writeTrackHeader(mUse32BitOffset);
         }
     }
+    if (isFragmented()) {
+        writeMvexBox();
+    }
     endBox();  // moov
 }
 
+void MPEG4Writer::writeMvexBox() {
+    beginBox("mvex");
+    // The duration is filled in by reset().
+    mMehdOffset = mOffset;
+    beginBox("mehd");
+    writeInt32(0x01000000);    // version=1, flags=0
+    writeInt64(0);             // fragment duration
+    endBox();  // mehd
+    for (List<Track *>::iterator it = mTracks.begin();
+        it != mTracks.end(); ++it) {
+        if (!isTrackInMoov(*it)) {
+            continue;
+        }
+        beginBox("trex");
+        writeInt32(0);         // version=0, flags=0
+        writeInt32((*it)->getTrackId());
+        writeInt32(1);         // default sample description index
+        writeInt32(0);         // default sample duration
+        writeInt32(0);         // default sample size
+        writeInt32(0);         // default sample flags
+        endBox();  // trex
+    }
+    endBox();  // mvex
+}
+
 void MPEG4Writer::writeFtypBox(MetaData *param) {
     beginBox("ftyp");
 
@@ -1321,6 +1407,10 @@ void MPEG4Writer::writeFtypBox(MetaData *param) {
             writeFourcc("mp42");
         }
     }
+    if (isFragmented()) {
+        // Movie fragments with 'tfdt' boxes
+        writeFourcc("iso6");
+    }
 
     endBox();
 }
@@ -1369,6 +1459,14 @@ void MPEG4Writer::unlock() {
 off64_t MPEG4Writer::addSample_l(
         MediaBuffer *buffer, bool usePrefix,
         uint32_t tiffHdrOffset, size_t *bytesWritten) {
+    off64_t offset = queueSample_l(buffer, usePrefix, tiffHdrOffset, bytesWritten);
+    flushSamples_l();
+    return offset;
+}
+
+off64_t MPEG4Writer::queueSample_l(
+        MediaBuffer *buffer, bool usePrefix,
+        uint32_t tiffHdrOffset, size_t *bytesWritten) {
     off64_t old_offset = mOffset;
 
     if (usePrefix) {
@@ -1376,21 +1474,66 @@ off64_t MPEG4Writer::addSample_l(
     } else {
         if (tiffHdrOffset > 0) {
             tiffHdrOffset = htonl(tiffHdrOffset);
-            ::write(mFd, &tiffHdrOffset, 4); // exif_tiff_header_offset field
-            mOffset += 4;
+            // exif_tiff_header_offset field
+            queueSampleData_l(&tiffHdrOffset, 4, true /* copy */);
         }
 
-        ::write(mFd,
-              (const uint8_t *)buffer->data() + buffer->range_offset(),
-              buffer->range_length());
-
-        mOffset += buffer->range_length();
+        queueSampleData_l(
+                (const uint8_t *)buffer->data() + buffer->range_offset(),
+                buffer->range_length(), false /* copy */);
     }
 
     *bytesWritten = mOffset - old_offset;
     return old_offset;
 }
 
+void MPEG4Writer::queueSampleData_l(const void *data, size_t size, bool copy) {
+    if (mSampleIovecs.size() >= IOV_MAX ||
+            (copy && mSampleHeadersSize + size > sizeof(mSampleHeaders))) {
+        flushSamples_l();
+    }
+
+    if (copy) {
+        CHECK_LE(size, sizeof(mSampleHeaders));
+        memcpy(mSampleHeaders + mSampleHeadersSize, data, size);
+        data = mSampleHeaders + mSampleHeadersSize;
+        mSampleHeadersSize += size;
+    }
+    struct iovec iov;
+    iov.iov_base = const_cast<void *>(data);
+    iov.iov_len = size;
+    mSampleIovecs.push_back(iov);
+    mOffset += size;
+}
+
+void MPEG4Writer::flushSamples_l() {
+    struct iovec *iov = mSampleIovecs.data();
+    size_t count = mSampleIovecs.size();
+    while (count > 0) {
+        ssize_t n = ::writev(mFd, iov, std::min(count, (size_t)IOV_MAX));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ALOGE("Failed to write %zu sample pieces: %s", count, strerror(errno));
+            break;
+        }
+
+        // Skip what was written, which may end within a piece.
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    mSampleIovecs.clear();
+    mSampleHeadersSize = 0;
+}
+
 static void StripStartcode(MediaBuffer *buffer) {
     if (buffer->range_length() < 4) {
         return;
@@ -1416,9 +1559,7 @@ void MPEG4Writer::addMultipleLengthPrefixedSamples_l(MediaBuffer *buffer) {
     while (getNextNALUnit(&data, &searchSize, &nextNalStart,
             &nextNalSize, true) == OK) {
         size_t currentNalSize = nextNalStart - currentNalStart - 4 /* strip start-code */;
-        MediaBuffer *nalBuf = new MediaBuffer((void *)currentNalStart, currentNalSize);
-        addLengthPrefixedSample_l(nalBuf);
-        nalBuf->release();
+        addLengthPrefixedSample_l(currentNalStart, currentNalSize);
 
         currentNalStart = nextNalStart;
     }
@@ -1426,37 +1567,27 @@ void MPEG4Writer::addMultipleLengthPrefixedSamples_l(MediaBuffer *buffer) {
     size_t currentNalOffset = currentNalStart - dataStart;
     buffer->set_range(buffer->range_offset() + currentNalOffset,
             buffer->range_length() - currentNalOffset);
-    addLengthPrefixedSample_l(buffer);
+    addLengthPrefixedSample_l(
+            (const uint8_t *)buffer->data() + buffer->range_offset(),
+            buffer->range_length());
 }
 
-void MPEG4Writer::addLengthPrefixedSample_l(MediaBuffer *buffer) {
-    size_t length = buffer->range_length();
-
+void MPEG4Writer::addLengthPrefixedSample_l(const uint8_t *data, size_t length) {
+    uint8_t prefix[4];
     if (mUse4ByteNalLength) {
-        uint8_t x = length >> 24;
-        ::write(mFd, &x, 1);
-        x = (length >> 16) & 0xff;
-        ::write(mFd, &x, 1);
-        x = (length >> 8) & 0xff;
-        ::write(mFd, &x, 1);
-        x = length & 0xff;
-        ::write(mFd, &x, 1);
-
-        ::write(mFd,
-              (const uint8_t *)buffer->data() + buffer->range_offset(),
-              length);
-
-        mOffset += length + 4;
+        prefix[0] = length >> 24;
+        prefix[1] = (length >> 16) & 0xff;
+        prefix[2] = (length >> 8) & 0xff;
+        prefix[3] = length & 0xff;
+        queueSampleData_l(prefix, 4, true /* copy */);
     } else {
         CHECK_LT(length, 65536u);
 
-        uint8_t x = length >> 8;
-        ::write(mFd, &x, 1);
-        x = length & 0xff;
-        ::write(mFd, &x, 1);
-        ::write(mFd, (const uint8_t *)buffer->data() + buffer->range_offset(), length);
-        mOffset += length + 2;
+        prefix[0] = length >> 8;
+        prefix[1] = length & 0xff;
+        queueSampleData_l(prefix, 2, true /* copy */);
     }
+    queueSampleData_l(data, length, false /* copy */);
 }
 
 size_t MPEG4Writer::write(
@@ -1790,6 +1921,7 @@ MPEG4Writer::Track::Track(
       mTrackId(trackId),
       mTrackDurationUs(0),
       mEstimatedTrackSizeBytes(0),
+      mNumSamples(0),
       mSamplesHaveSameSize(true),
       mStszTableEntries(new ListTableEntries<uint32_t, 1>(1000)),
       mStcoTableEntries(new ListTableEntries<uint32_t, 1>(1000)),
@@ -1872,6 +2004,7 @@ void MPEG4Writer::Track::resetInternal() {
     mIsMalformed = false;
     mTrackDurationUs = 0;
     mEstimatedTrackSizeBytes = 0;
+    mNumSamples = 0;
     mSamplesHaveSameSize = 0;
     if (mStszTableEntries != NULL) {
         delete mStszTableEntries;
@@ -1911,7 +2044,10 @@ void MPEG4Writer::Track::resetInternal() {
 void MPEG4Writer::Track::updateTrackSizeEstimate() {
     mEstimatedTrackSizeBytes = mMdatSizeBytes;  // media data size
 
-    if (!isHeic() && !mOwner->isFileStreamable()) {
+    if (mOwner->isFragmented()) {
+        // Up to 16 bytes per sample in the trun box of its fragment
+        mEstimatedTrackSizeBytes += mNumSamples * 16;
+    } else if (!isHeic() && !mOwner->isFileStreamable()) {
         uint32_t stcoBoxCount = (mOwner->use32BitFileOffset()
                                 ? mStcoTableEntries->count()
                                 : mCo64TableEntries->count());
@@ -1932,6 +2068,10 @@ void MPEG4Writer::Track::updateTrackSizeEstimate() {
 
 void MPEG4Writer::Track::addOneStscTableEntry(
         size_t chunkId, size_t sampleId) {
+    // Samples of a fragmented file are described by its moof boxes.
+    if (mOwner->isFragmented()) {
+        return;
+    }
     mStscTableEntries->add(htonl(chunkId));
     mStscTableEntries->add(htonl(sampleId));
     mStscTableEntries->add(htonl(1));
@@ -1954,7 +2094,7 @@ void MPEG4Writer::Track::addOneSttsTableEntry(
 void MPEG4Writer::Track::addOneCttsTableEntry(
         size_t sampleCount, int32_t duration) {
 
-    if (!mIsVideo) {
+    if (!mIsVideo || mOwner->isFragmented()) {
         return;
     }
     mCttsTableEntries->add(htonl(sampleCount));
@@ -2303,9 +2443,8 @@ void MPEG4Writer::writeChunkToFile(Chunk* chunk) {
         chunk->mTimeStampUs, chunk->mTrack->getTrackType());
 
     int32_t isFirstSample = true;
-    while (!chunk->mSamples.empty()) {
-        List<MediaBuffer *>::iterator it = chunk->mSamples.begin();
-
+    for (List<MediaBuffer *>::iterator it = chunk->mSamples.begin();
+         it != chunk->mSamples.end(); ++it) {
         uint32_t tiffHdrOffset;
         if (!(*it)->meta_data().findInt32(
                 kKeyExifTiffOffset, (int32_t*)&tiffHdrOffset)) {
@@ -2315,7 +2454,7 @@ void MPEG4Writer::writeChunkToFile(Chunk* chunk) {
         bool usePrefix = chunk->mTrack->usePrefix() && !isExif;
 
         size_t bytesWritten;
-        off64_t offset = addSample_l(*it, usePrefix, tiffHdrOffset, &bytesWritten);
+        off64_t offset = queueSample_l(*it, usePrefix, tiffHdrOffset, &bytesWritten);
 
         if (chunk->mTrack->isHeic()) {
             chunk->mTrack->addItemOffsetAndSize(offset, bytesWritten, isExif);
@@ -2323,23 +2462,316 @@ void MPEG4Writer::writeChunkToFile(Chunk* chunk) {
             chunk->mTrack->addChunkOffset(offset);
             isFirstSample = false;
         }
+    }
 
+    // The whole chunk goes out in one go; the samples are only released
+    // once written.
+    flushSamples_l();
+    for (List<MediaBuffer *>::iterator it = chunk->mSamples.begin();
+         it != chunk->mSamples.end(); ++it) {
         (*it)->release();
         (*it) = NULL;
-        chunk->mSamples.erase(it);
     }
     chunk->mSamples.clear();
 }
 
+void MPEG4Writer::writeChunkToFragment(Chunk* chunk) {
+    ALOGV("writeChunkToFragment: %" PRId64 " from %s track",
+        chunk->mTimeStampUs, chunk->mTrack->getTrackType());
+
+    for (List<ChunkInfo>::iterator it = mChunkInfos.begin();
+         it != mChunkInfos.end(); ++it) {
+        if (it->mTrack == chunk->mTrack) {
+            for (List<MediaBuffer *>::iterator sample = chunk->mSamples.begin();
+                 sample != chunk->mSamples.end(); ++sample) {
+                it->mFragmentSamples.push_back(*sample);
+            }
+            break;
+        }
+    }
+    chunk->mSamples.clear();
+
+    if (mFragmentStartTimeUs < 0) {
+        mFragmentStartTimeUs = chunk->mTimeStampUs;
+    } else if (chunk->mTimeStampUs - mFragmentStartTimeUs >= mFragmentDurationUs
+            && writeFragment(false /* isLast */)) {
+        mFragmentStartTimeUs = chunk->mTimeStampUs;
+    }
+}
+
+bool MPEG4Writer::writeFragment(bool isLast) {
+    // Neither mLock nor anything taking it may be used here: in real time
+    // recording mode the writer thread runs unlocked, otherwise it already
+    // holds the lock.
+    if (mMehdOffset == 0 && !writeFragmentedMoovBox(isLast)) {
+        return false;
+    }
+
+    struct FragmentSample {
+        MediaBuffer *buffer;
+        uint32_t duration;
+        uint32_t size;
+        uint32_t flags;
+        int32_t compositionOffset;
+    };
+    struct TrackFragment {
+        Track *track;
+        int64_t baseDecodeTimeTicks;
+        bool hasCompositionOffsets;
+        std::vector<FragmentSample> samples;
+    };
+    std::vector<TrackFragment> fragments;
+    size_t moofSize = 8 + 16;  // moof header and mfhd box
+    for (List<ChunkInfo>::iterator it = mChunkInfos.begin();
+         it != mChunkInfos.end(); ++it) {
+        if (!it->mInMoov) {
+            // The file cannot describe a track that starts after the moov box.
+            for (List<MediaBuffer *>::iterator sample = it->mFragmentSamples.begin();
+                 sample != it->mFragmentSamples.end(); ++sample) {
+                (*sample)->release();
+            }
+            it->mFragmentSamples.clear();
+            continue;
+        }
+        std::vector<MediaBuffer *> pending;
+        for (List<MediaBuffer *>::iterator sample = it->mFragmentSamples.begin();
+             sample != it->mFragmentSamples.end(); ++sample) {
+            pending.push_back(*sample);
+        }
+
+        // The duration of a sample is only known from the next one, and
+        // the next fragment of the track has to start with a sync sample.
+        size_t count = pending.size();
+        if (!isLast) {
+            count = 0;
+            for (size_t i = pending.size(); i-- > 1;) {
+                int32_t isSync = false;
+                pending[i]->meta_data().findInt32(kKeyIsSyncFrame, &isSync);
+                if (isSync) {
+                    count = i;
+                    break;
+                }
+            }
+        }
+        if (count == 0) {
+            continue;
+        }
+
+        // Sample times are relative to the start of the movie. The decode
+        // times in the file start at 0 for every track, so the duration of
+        // the first sample spans the start offset of the track, and the
+        // composition offsets put every sample at its own time.
+        const int32_t timeScale = it->mTrack->getTimeScale();
+        auto toTicks = [this, timeScale](MediaBuffer *buffer, uint32_t key) -> int64_t {
+            int64_t timeUs;
+            CHECK(buffer->meta_data().findInt64(key, &timeUs));
+            return ((timeUs - mStartTimestampUs) * timeScale + 500000LL) / 1000000LL;
+        };
+
+        TrackFragment fragment;
+        fragment.track = it->mTrack;
+        fragment.baseDecodeTimeTicks = it->mDecodeTimeTicks;
+        fragment.hasCompositionOffsets = false;
+        for (size_t i = 0; i < count; ++i) {
+            FragmentSample sample;
+            sample.buffer = pending[i];
+            sample.size = 0;
+            int32_t isSync = false;
+            pending[i]->meta_data().findInt32(kKeyIsSyncFrame, &isSync);
+            sample.flags = isSync ? kSyncSampleFlags : kNonSyncSampleFlags;
+            sample.compositionOffset =
+                toTicks(pending[i], kKeyTime) - it->mDecodeTimeTicks;
+            if (sample.compositionOffset != 0) {
+                fragment.hasCompositionOffsets = true;
+            }
+            // The last sample of the track repeats the previous duration.
+            if (i + 1 < pending.size()) {
+                it->mLastSampleDurationTicks = std::max((int64_t)0,
+                        toTicks(pending[i + 1], kKeyDecodingTime) - it->mDecodeTimeTicks);
+            }
+            sample.duration = it->mLastSampleDurationTicks;
+            it->mDecodeTimeTicks += sample.duration;
+            fragment.samples.push_back(sample);
+            it->mFragmentSamples.erase(it->mFragmentSamples.begin());
+        }
+
+        // traf, tfhd, tfdt and trun boxes
+        moofSize += 8 + 16 + 20 + 20 +
+                count * (fragment.hasCompositionOffsets ? 16 : 12);
+        fragments.push_back(fragment);
+    }
+    if (fragments.empty()) {
+        return false;
+    }
+
+    // Write the media data first to learn the sample sizes, then go back
+    // for the moof box and the mdat header.
+    const off64_t moofOffset = mOffset;
+    const size_t mdatHeaderSize = mUse32BitOffset ? 8 : 16;
+    mOffset = moofOffset + moofSize + mdatHeaderSize;
+    lseek64(mFd, mOffset, SEEK_SET);
+    for (size_t i = 0; i < fragments.size(); ++i) {
+        bool usePrefix = fragments[i].track->usePrefix();
+        for (size_t j = 0; j < fragments[i].samples.size(); ++j) {
+            FragmentSample &sample = fragments[i].samples[j];
+            size_t bytesWritten;
+            queueSample_l(sample.buffer, usePrefix, 0 /* tiffHdrOffset */, &bytesWritten);
+            sample.size = bytesWritten;
+        }
+    }
+    flushSamples_l();
+    for (size_t i = 0; i < fragments.size(); ++i) {
+        for (size_t j = 0; j < fragments[i].samples.size(); ++j) {
+            fragments[i].samples[j].buffer->release();
+            fragments[i].samples[j].buffer = NULL;
+        }
+    }
+    const off64_t endOffset = mOffset;
+
+    mOffset = moofOffset;
+    lseek64(mFd, mOffset, SEEK_SET);
+    beginBox("moof");
+    beginBox("mfhd");
+    writeInt32(0);                          // version=0, flags=0
+    writeInt32(++mFragmentSequenceNumber);  // sequence number
+    endBox();  // mfhd
+    uint32_t dataOffset = moofSize + mdatHeaderSize;  // from the start of moof
+    for (size_t i = 0; i < fragments.size(); ++i) {
+        const TrackFragment &fragment = fragments[i];
+        beginBox("traf");
+        beginBox("tfhd");
+        writeInt32(0x020000);       // version=0, flags=default-base-is-moof
+        writeInt32(fragment.track->getTrackId());
+        endBox();  // tfhd
+        beginBox("tfdt");
+        writeInt32(1 << 24);        // version=1, flags=0
+        writeInt64(fragment.baseDecodeTimeTicks);
+        endBox();  // tfdt
+        beginBox("trun");
+        // data offset, sample duration, size and flags, and composition
+        // time offset (signed in version 1) if any are present
+        if (fragment.hasCompositionOffsets) {
+            writeInt32((1 << 24) | 0x000f01);
+        } else {
+            writeInt32(0x000701);
+        }
+        writeInt32(fragment.samples.size());
+        writeInt32(dataOffset);
+        std::vector<uint32_t> entries;
+        entries.reserve(fragment.samples.size() * 4);
+        for (size_t j = 0; j < fragment.samples.size(); ++j) {
+            const FragmentSample &sample = fragment.samples[j];
+            entries.push_back(htonl(sample.duration));
+            entries.push_back(htonl(sample.size));
+            entries.push_back(htonl(sample.flags));
+            if (fragment.hasCompositionOffsets) {
+                entries.push_back(htonl(sample.compositionOffset));
+            }
+            dataOffset += sample.size;
+        }
+        write(entries.data(), sizeof(uint32_t), entries.size());
+        endBox();  // trun
+        endBox();  // traf
+    }
+    endBox();  // moof
+    CHECK_EQ(mOffset, moofOffset + (off64_t)moofSize);
+
+    uint64_t mdatSize = endOffset - mOffset;
+    if (mUse32BitOffset) {
+        writeInt32(mdatSize);
+        writeFourcc("mdat");
+    } else {
+        writeInt32(1);
+        writeFourcc("mdat");
+        writeInt64(mdatSize);
+    }
+    CHECK_EQ(mOffset, moofOffset + (off64_t)(moofSize + mdatHeaderSize));
+
+    mOffset = endOffset;
+    lseek64(mFd, mOffset, SEEK_SET);
+    return true;
+}
+
+bool MPEG4Writer::writeFragmentedMoovBox(bool force) {
+    // The moov box needs the codec specific data of a track, which is known
+    // once the track has sent a sample. It does not change after that, and
+    // the sample came through mLock, so the track thread need not stop. A
+    // late track is only waited for up to kMaxMoovDelayUs, as the samples
+    // of the other tracks pile up meanwhile.
+    size_t readyTracks = 0;
+    int64_t minTimeUs = INT64_MAX;
+    int64_t maxTimeUs = INT64_MIN;
+    for (List<ChunkInfo>::iterator it = mChunkInfos.begin();
+         it != mChunkInfos.end(); ++it) {
+        if (it->mFragmentSamples.empty()) {
+            continue;
+        }
+        ++readyTracks;
+        int64_t timeUs;
+        CHECK(it->mFragmentSamples.front()->meta_data().findInt64(kKeyDecodingTime, &timeUs));
+        minTimeUs = std::min(minTimeUs, timeUs);
+        CHECK(it->mFragmentSamples.back()->meta_data().findInt64(kKeyDecodingTime, &timeUs));
+        maxTimeUs = std::max(maxTimeUs, timeUs);
+    }
+    if (readyTracks == 0) {
+        return false;
+    }
+    if (readyTracks < mChunkInfos.size() && !force && maxTimeUs - minTimeUs < kMaxMoovDelayUs) {
+        return false;
+    }
+
+    for (List<ChunkInfo>::iterator it = mChunkInfos.begin();
+         it != mChunkInfos.end(); ++it) {
+        it->mInMoov = !it->mFragmentSamples.empty();
+        if (!it->mInMoov) {
+            ALOGW("%s track has no sample yet, leaving it out of the file",
+                    it->mTrack->getTrackType());
+        }
+    }
+    writeMoovBox(0);
+    return true;
+}
+
+bool MPEG4Writer::isTrackInMoov(const Track *track) const {
+    if (!isFragmented()) {
+        return true;
+    }
+    for (List<ChunkInfo>::const_iterator it = mChunkInfos.begin();
+         it != mChunkInfos.end(); ++it) {
+        if (it->mTrack == track) {
+            return it->mInMoov;
+        }
+    }
+    return false;
+}
+
 void MPEG4Writer::writeAllChunks() {
     ALOGV("writeAllChunks");
     size_t outstandingChunks = 0;
     Chunk chunk;
     while (findChunkToWrite(&chunk)) {
-        writeChunkToFile(&chunk);
+        if (isFragmented()) {
+            writeChunkToFragment(&chunk);
+        } else {
+            writeChunkToFile(&chunk);
+        }
         ++outstandingChunks;
     }
 
+    if (isFragmented()) {
+        writeFragment(true /* isLast */);
+
+        // Samples are left over if a track never sent any.
+        for (List<ChunkInfo>::iterator it = mChunkInfos.begin();
+             it != mChunkInfos.end(); ++it) {
+            for (List<MediaBuffer *>::iterator sample = it->mFragmentSamples.begin();
+                 sample != it->mFragmentSamples.end(); ++sample) {
+                (*sample)->release();
+            }
+            it->mFragmentSamples.clear();
+        }
+    }
+
     sendSessionSummary();
 
     mChunkInfos.clear();
@@ -2413,7 +2845,11 @@ void MPEG4Writer::threadFunc() {
             if (mIsRealTimeRecording) {
                 mLock.unlock();
             }
-            writeChunkToFile(&chunk);
+            if (isFragmented()) {
+                writeChunkToFragment(&chunk);
+            } else {
+                writeChunkToFile(&chunk);
+            }
             if (mIsRealTimeRecording) {
                 mLock.lock();
             }
@@ -2435,6 +2871,9 @@ status_t MPEG4Writer::startWriterThread() {
         info.mTrack = *it;
         info.mPrevChunkTimestampUs = 0;
         info.mMaxInterChunkDurUs = 0;
+        info.mDecodeTimeTicks = 0;
+        info.mLastSampleDurationTicks = 0;
+        info.mInMoov = false;
         mChunkInfos.push_back(info);
     }
 
@@ -3134,7 +3573,7 @@ status_t MPEG4Writer::Track::threadEntry() {
 ////////////////////////////////////////////////////////////////////////////////
 
         if (!mIsHeic) {
-            if (mStszTableEntries->count() == 0) {
+            if (mNumSamples == 0) {
                 mFirstSampleTimeRealUs = systemTime() / 1000;
                 mOwner->setStartTimestampUs(timestampUs);
                 mStartTimestampUs = timestampUs;
@@ -3224,7 +3663,7 @@ status_t MPEG4Writer::Track::threadEntry() {
                     break;
                 }
 
-                if (mStszTableEntries->count() == 0) {
+                if (mNumSamples == 0) {
                     // Force the first ctts table entry to have one single entry
                     // so that we can do adjustment for the initial track start
                     // time offset easily in writeCttsBox().
@@ -3242,7 +3681,7 @@ status_t MPEG4Writer::Track::threadEntry() {
                 }
 
                 // Update ctts time offset range
-                if (mStszTableEntries->count() == 0) {
+                if (mNumSamples == 0) {
                     mMinCttsOffsetTicks = currCttsOffsetTimeTicks;
                     mMaxCttsOffsetTicks = currCttsOffsetTimeTicks;
                 } else {
@@ -3296,7 +3735,9 @@ status_t MPEG4Writer::Track::threadEntry() {
             // with lots of near-identical entries.
             // "close enough" here means that the current duration needs to be adjusted by less
             // than 0.1 milliseconds
-            if (lastDurationTicks && (currDurationTicks != lastDurationTicks)) {
+            // Fragmented files keep exact durations, as they have no stts table.
+            if (!mOwner->isFragmented() &&
+                    lastDurationTicks && (currDurationTicks != lastDurationTicks)) {
                 int64_t deltaUs = ((lastDurationTicks - currDurationTicks) * 1000000LL
                         + (mTimeScale / 2)) / mTimeScale;
                 if (deltaUs > -100 && deltaUs < 100) {
@@ -3306,21 +3747,36 @@ status_t MPEG4Writer::Track::threadEntry() {
                     timestampUs += deltaUs;
                 }
             }
-            mStszTableEntries->add(htonl(sampleSize));
-            if (mStszTableEntries->count() > 2) {
-
-                // Force the first sample to have its own stts entry so that
-                // we can adjust its value later to maintain the A/V sync.
-                if (mStszTableEntries->count() == 3 || currDurationTicks != lastDurationTicks) {
-                    addOneSttsTableEntry(sampleCount, lastDurationTicks);
-                    sampleCount = 1;
-                } else {
-                    ++sampleCount;
+            ++mNumSamples;
+            if (mOwner->isFragmented()) {
+                // There are no sample tables to fill in; the writer thread
+                // takes the timing of each sample from its meta data when
+                // writing it to a fragment.
+                int64_t decodingTimeUs = timestampUs + mStartTimestampUs;
+                int64_t compositionTimeUs = decodingTimeUs;
+                if (mIsVideo) {
+                    compositionTimeUs += cttsOffsetTimeUs - kMaxCttsOffsetTimeUs;
                 }
+                copy->meta_data().setInt64(kKeyDecodingTime, decodingTimeUs);
+                copy->meta_data().setInt64(kKeyTime, compositionTimeUs);
+                copy->meta_data().setInt32(kKeyIsSyncFrame, !mIsVideo || isSync);
+            } else {
+                mStszTableEntries->add(htonl(sampleSize));
+                if (mNumSamples > 2) {
+
+                    // Force the first sample to have its own stts entry so that
+                    // we can adjust its value later to maintain the A/V sync.
+                    if (mNumSamples == 3 || currDurationTicks != lastDurationTicks) {
+                        addOneSttsTableEntry(sampleCount, lastDurationTicks);
+                        sampleCount = 1;
+                    } else {
+                        ++sampleCount;
+                    }
 
+                }
             }
             if (mSamplesHaveSameSize) {
-                if (mStszTableEntries->count() >= 2 && previousSampleSize != sampleSize) {
+                if (mNumSamples >= 2 && previousSampleSize != sampleSize) {
                     mSamplesHaveSameSize = false;
                 }
                 previousSampleSize = sampleSize;
@@ -3331,8 +3787,8 @@ status_t MPEG4Writer::Track::threadEntry() {
             lastDurationTicks = currDurationTicks;
             lastTimestampUs = timestampUs;
 
-            if (isSync != 0) {
-                addOneStssTableEntry(mStszTableEntries->count());
+            if (isSync != 0 && !mOwner->isFragmented()) {
+                addOneStssTableEntry(mNumSamples);
             }
 
             if (mTrackingProgressStatus) {
@@ -3342,7 +3798,7 @@ status_t MPEG4Writer::Track::threadEntry() {
                 trackProgressStatus(timestampUs);
             }
         }
-        if (!hasMultipleTracks) {
+        if (!hasMultipleTracks && !mOwner->isFragmented()) {
             size_t bytesWritten;
             off64_t offset = mOwner->addSample_l(
                     copy, usePrefix, tiffHdrOffset, &bytesWritten);
@@ -3405,10 +3861,15 @@ status_t MPEG4Writer::Track::threadEntry() {
             bufferChunk(0);
             ++nChunks;
         }
+    } else if (mOwner->isFragmented()) {
+        if (!mChunkSamples.empty()) {
+            bufferChunk(timestampUs);
+        }
+        mTrackDurationUs += lastDurationUs;
     } else {
         // Last chunk
         if (!hasMultipleTracks) {
-            addOneStscTableEntry(1, mStszTableEntries->count());
+            addOneStscTableEntry(1, mNumSamples);
         } else if (!mChunkSamples.empty()) {
             addOneStscTableEntry(++nChunks, mChunkSamples.size());
             bufferChunk(timestampUs);
@@ -3417,14 +3878,14 @@ status_t MPEG4Writer::Track::threadEntry() {
         // We don't really know how long the last frame lasts, since
         // there is no frame time after it, just repeat the previous
         // frame's duration.
-        if (mStszTableEntries->count() == 1) {
+        if (mNumSamples == 1) {
             lastDurationUs = 0;  // A single sample's duration
             lastDurationTicks = 0;
         } else {
             ++sampleCount;  // Count for the last sample
         }
 
-        if (mStszTableEntries->count() <= 2) {
+        if (mNumSamples <= 2) {
             addOneSttsTableEntry(1, lastDurationTicks);
             if (sampleCount - 1 > 0) {
                 addOneSttsTableEntry(sampleCount - 1, lastDurationTicks);
@@ -3447,8 +3908,8 @@ status_t MPEG4Writer::Track::threadEntry() {
 
     sendTrackSummary(hasMultipleTracks);
 
-    ALOGI("Received total/0-length (%d/%d) buffers and encoded %d frames. - %s",
-            count, nZeroLengthFrames, mStszTableEntries->count(), trackName);
+    ALOGI("Received total/0-length (%d/%d) buffers and encoded %zu frames. - %s",
+            count, nZeroLengthFrames, mNumSamples, trackName);
     if (mIsAudio) {
         ALOGI("Audio track drift time: %" PRId64 " us", mOwner->getDriftTimeUs());
     }
@@ -3464,12 +3925,15 @@ bool MPEG4Writer::Track::isTrackMalFormed() const {
         return true;
     }
 
-    if (!mIsHeic && mStszTableEntries->count() == 0) {  // no samples written
+    if (!mIsHeic && mNumSamples == 0) {  // no samples written
         ALOGE("The number of recorded samples is 0");
         return true;
     }
 
-    if (mIsVideo && mStssTableEntries->count() == 0) {  // no sync frames for video
+    // The first video sample is always a sync frame, but a fragmented file
+    // does not keep an stss table to tell.
+    if (mIsVideo && !mOwner->isFragmented() &&
+            mStssTableEntries->count() == 0) {  // no sync frames for video
         ALOGE("There are no sync frames for video track");
         return true;
     }
@@ -3500,7 +3964,7 @@ void MPEG4Writer::Track::sendTrackSummary(bool hasMultipleTracks) {
 
     mOwner->notify(MEDIA_RECORDER_TRACK_EVENT_INFO,
                     trackNum | MEDIA_RECORDER_TRACK_INFO_ENCODED_FRAMES,
-                    mStszTableEntries->count());
+                    mNumSamples);
 
     {
         // The system delay time excluding the requested initial delay that
@@ -3689,7 +4153,9 @@ void MPEG4Writer::Track::writeTrackHeader(bool use32BitOffset) {
     uint32_t now = getMpeg4Time();
     mOwner->beginBox("trak");
         writeTkhdBox(now);
-        writeEdtsBox();
+        if (!mOwner->isFragmented()) {
+            writeEdtsBox();
+        }
         mOwner->beginBox("mdia");
             writeMdhdBox(now);
             writeHdlrBox();
@@ -3731,6 +4197,22 @@ void MPEG4Writer::Track::writeStblBox(bool use32BitOffset) {
         writeMetadataFourCCBox();
     }
     mOwner->endBox();  // stsd
+    if (mOwner->isFragmented()) {
+        // The fragments describe the samples. The moov box is written while
+        // the track thread is running, so its sample tables are not read.
+        const char *tables[] = { "stts", "stsz", "stsc", use32BitOffset ? "stco" : "co64" };
+        for (const char *table : tables) {
+            mOwner->beginBox(table);
+            mOwner->writeInt32(0);  // version=0, flags=0
+            if (!strcmp(table, "stsz")) {
+                mOwner->writeInt32(0);  // sample size
+            }
+            mOwner->writeInt32(0);  // entry count
+            mOwner->endBox();
+        }
+        mOwner->endBox();  // stbl
+        return;
+    }
     writeSttsBox();
     if (mIsVideo) {
         writeCttsBox();
@@ -4025,7 +4507,8 @@ void MPEG4Writer::Track::writeTkhdBox(uint32_t now) {
     mOwner->writeInt32(now);           // modification time
     mOwner->writeInt32(mTrackId);      // track id starts with 1
     mOwner->writeInt32(0);             // reserved
-    int64_t trakDurationUs = getDurationUs();
+    // The duration of a fragmented file is in its mehd box.
+    int64_t trakDurationUs = mOwner->isFragmented() ? 0 : getDurationUs();
     int32_t mvhdTimeScale = mOwner->getTimeScale();
     int32_t tkhdDuration =
         (trakDurationUs * mvhdTimeScale + 5E5) / 1E6;
@@ -4125,7 +4608,7 @@ void MPEG4Writer::Track::writeEdtsBox(){
 }
 
 void MPEG4Writer::Track::writeMdhdBox(uint32_t now) {
-    int64_t trakDurationUs = getDurationUs();
+    int64_t trakDurationUs = mOwner->isFragmented() ? 0 : getDurationUs();
     int64_t mdhdDuration = (trakDurationUs * mTimeScale + 5E5) / 1E6;
     mOwner->beginBox("mdhd");
 
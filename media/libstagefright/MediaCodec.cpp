@@ -850,7 +850,7 @@ void MediaCodec::PostReplyWithError(const sp<AReplyToken> &replyID, int32_t err)
         finalErr = DEAD_OBJECT;
     }
 
-    sp<AMessage> response = new AMessage;
+    sp<AMessage> response = AMessage::ObtainReply(replyID);
     response->setInt32("err", finalErr);
     response->postReply(replyID);
 }
@@ -1348,7 +1348,7 @@ status_t MediaCodec::queueInputBuffer(
         errorDetailMsg->clear();
     }
 
-    sp<AMessage> msg = new AMessage(kWhatQueueInputBuffer, this);
+    sp<AMessage> msg = AMessage::Obtain(kWhatQueueInputBuffer, this);
     msg->setSize("index", index);
     msg->setSize("offset", offset);
     msg->setSize("size", size);
@@ -1376,7 +1376,7 @@ status_t MediaCodec::queueSecureInputBuffer(
         errorDetailMsg->clear();
     }
 
-    sp<AMessage> msg = new AMessage(kWhatQueueInputBuffer, this);
+    sp<AMessage> msg = AMessage::Obtain(kWhatQueueInputBuffer, this);
     msg->setSize("index", index);
     msg->setSize("offset", offset);
     msg->setPointer("subSamples", (void *)subSamples);
@@ -1397,7 +1397,7 @@ status_t MediaCodec::queueSecureInputBuffer(
 }
 
 status_t MediaCodec::dequeueInputBuffer(size_t *index, int64_t timeoutUs) {
-    sp<AMessage> msg = new AMessage(kWhatDequeueInputBuffer, this);
+    sp<AMessage> msg = AMessage::Obtain(kWhatDequeueInputBuffer, this);
     msg->setInt64("timeoutUs", timeoutUs);
 
     sp<AMessage> response;
@@ -1418,7 +1418,7 @@ status_t MediaCodec::dequeueOutputBuffer(
         int64_t *presentationTimeUs,
         uint32_t *flags,
         int64_t timeoutUs) {
-    sp<AMessage> msg = new AMessage(kWhatDequeueOutputBuffer, this);
+    sp<AMessage> msg = AMessage::Obtain(kWhatDequeueOutputBuffer, this);
     msg->setInt64("timeoutUs", timeoutUs);
 
     sp<AMessage> response;
@@ -1437,7 +1437,7 @@ status_t MediaCodec::dequeueOutputBuffer(
 }
 
 status_t MediaCodec::renderOutputBufferAndRelease(size_t index) {
-    sp<AMessage> msg = new AMessage(kWhatReleaseOutputBuffer, this);
+    sp<AMessage> msg = AMessage::Obtain(kWhatReleaseOutputBuffer, this);
     msg->setSize("index", index);
     msg->setInt32("render", true);
 
@@ -1446,7 +1446,7 @@ status_t MediaCodec::renderOutputBufferAndRelease(size_t index) {
 }
 
 status_t MediaCodec::renderOutputBufferAndRelease(size_t index, int64_t timestampNs) {
-    sp<AMessage> msg = new AMessage(kWhatReleaseOutputBuffer, this);
+    sp<AMessage> msg = AMessage::Obtain(kWhatReleaseOutputBuffer, this);
     msg->setSize("index", index);
     msg->setInt32("render", true);
     msg->setInt64("timestampNs", timestampNs);
@@ -1456,7 +1456,7 @@ status_t MediaCodec::renderOutputBufferAndRelease(size_t index, int64_t timestam
 }
 
 status_t MediaCodec::releaseOutputBuffer(size_t index) {
-    sp<AMessage> msg = new AMessage(kWhatReleaseOutputBuffer, this);
+    sp<AMessage> msg = AMessage::Obtain(kWhatReleaseOutputBuffer, this);
     msg->setSize("index", index);
 
     sp<AMessage> response;
@@ -1719,7 +1719,7 @@ bool MediaCodec::handleDequeueInputBuffer(const sp<AReplyToken> &replyID, bool n
         return false;
     }
 
-    sp<AMessage> response = new AMessage;
+    sp<AMessage> response = AMessage::ObtainReply(replyID);
     response->setSize("index", index);
     response->postReply(replyID);
 
@@ -1739,7 +1739,7 @@ bool MediaCodec::handleDequeueOutputBuffer(const sp<AReplyToken> &replyID, bool
         PostReplyWithError(replyID, INFO_FORMAT_CHANGED);
         mFlags &= ~kFlagOutputFormatChanged;
     } else {
-        sp<AMessage> response = new AMessage;
+        sp<AMessage> response = AMessage::ObtainReply(replyID);
         ssize_t index = dequeuePortBuffer(kPortIndexOutput);
 
         if (index < 0) {
@@ -28,6 +28,9 @@
 #include <media/stagefright/foundation/AMessage.h>
 #include <media/stagefright/MediaErrors.h>
 
+#include <list>
+#include <map>
+
 namespace android {
 
 struct PageCache {
@@ -43,7 +46,11 @@ struct PageCache {
     void releasePage(Page *page);
 
     void appendPage(Page *page);
-    size_t releaseFromStart(size_t maxBytes);
+
+    // Releases whole pages holding at most maxBytes from the start. If keep is
+    // not NULL, it takes the pages, the first of which holds the data from offset.
+    size_t releaseFromStart(
+            size_t maxBytes, off64_t offset = 0, BlockCache *keep = NULL);
 
     size_t totalSize() const {
         return mTotalSize;
@@ -63,6 +70,55 @@ private:
     DISALLOW_EVIL_CONSTRUCTORS(PageCache);
 };
 
+// Pages the prefetch window has moved away from, each holding the data from
+// its offset. The cache owns the pages, which come from and go back to a
+// PageCache without copying their data. The least recently used pages are
+// freed to keep at most maxBytes.
+struct BlockCache {
+    explicit BlockCache(size_t maxBytes);
+    ~BlockCache();
+
+    // Takes the page holding the data from offset, unless it is empty or
+    // larger than the cache. Returns true if the page is now owned by the cache.
+    bool retain(off64_t offset, PageCache::Page *page);
+
+    // Returns the page holding the data from offset, which the caller then owns,
+    // or NULL if no kept page starts at offset.
+    PageCache::Page *take(off64_t offset);
+
+    // Copies [offset, offset + size) and returns true if all of it is kept.
+    bool copy(off64_t offset, void *data, size_t size);
+
+    // Number of bytes kept without a gap from offset.
+    size_t contiguousSize(off64_t offset) const;
+
+    size_t totalSize() const {
+        return mTotalSize;
+    }
+
+private:
+    struct Block {
+        PageCache::Page *mPage;
+        std::list<off64_t>::iterator mLruPos;
+    };
+
+    typedef std::map<off64_t, Block> BlockMap;
+
+    size_t mMaxBytes;
+    size_t mTotalSize;
+
+    BlockMap mBlocks;  // by offset, blocks don't overlap
+    std::list<off64_t> mLru;  // most recently used first
+
+    // Returns the block holding offset, if any.
+    BlockMap::iterator find(off64_t offset);
+    BlockMap::const_iterator find(off64_t offset) const;
+
+    void erase(BlockMap::iterator it);
+
+    DISALLOW_EVIL_CONSTRUCTORS(BlockCache);
+};
+
 PageCache::PageCache(size_t pageSize)
     : mPageSize(pageSize),
       mTotalSize(0) {
@@ -112,7 +168,7 @@ void PageCache::appendPage(Page *page) {
     mActivePages.push_back(page);
 }
 
-size_t PageCache::releaseFromStart(size_t maxBytes) {
+size_t PageCache::releaseFromStart(size_t maxBytes, off64_t offset, BlockCache *keep) {
     size_t bytesReleased = 0;
 
     while (maxBytes > 0 && !mActivePages.empty()) {
@@ -126,10 +182,13 @@ size_t PageCache::releaseFromStart(size_t maxBytes) {
 
         mActivePages.erase(it);
 
-        maxBytes -= page->mSize;
-        bytesReleased += page->mSize;
+        size_t size = page->mSize;
+        if (keep == NULL || !keep->retain(offset + bytesReleased, page)) {
+            releasePage(page);
+        }
 
-        releasePage(page);
+        maxBytes -= size;
+        bytesReleased += size;
     }
 
     mTotalSize -= bytesReleased;
@@ -179,6 +238,129 @@ void PageCache::copy(size_t from, void *data, size_t size) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+BlockCache::BlockCache(size_t maxBytes)
+    : mMaxBytes(maxBytes),
+      mTotalSize(0) {
+}
+
+BlockCache::~BlockCache() {
+    while (!mBlocks.empty()) {
+        erase(mBlocks.begin());
+    }
+}
+
+BlockCache::BlockMap::iterator BlockCache::find(off64_t offset) {
+    BlockMap::iterator it = mBlocks.upper_bound(offset);
+    if (it == mBlocks.begin()) {
+        return mBlocks.end();
+    }
+
+    --it;
+    if (offset >= it->first + (off64_t)it->second.mPage->mSize) {
+        return mBlocks.end();
+    }
+    return it;
+}
+
+BlockCache::BlockMap::const_iterator BlockCache::find(off64_t offset) const {
+    return const_cast<BlockCache *>(this)->find(offset);
+}
+
+void BlockCache::erase(BlockMap::iterator it) {
+    PageCache::Page *page = it->second.mPage;
+    mTotalSize -= page->mSize;
+    mLru.erase(it->second.mLruPos);
+    mBlocks.erase(it);
+
+    free(page->mData);
+    delete page;
+}
+
+bool BlockCache::retain(off64_t offset, PageCache::Page *page) {
+    if (page->mSize == 0 || page->mSize > mMaxBytes) {
+        return false;
+    }
+
+    off64_t end = offset + page->mSize;
+
+    // The window may have been fetched again at other page boundaries,
+    // what was kept of the same range is older.
+    BlockMap::iterator it = find(offset);
+    if (it == mBlocks.end()) {
+        it = mBlocks.lower_bound(offset);
+    }
+    while (it != mBlocks.end() && it->first < end) {
+        erase(it++);
+    }
+
+    while (mTotalSize + page->mSize > mMaxBytes) {
+        erase(mBlocks.find(mLru.back()));
+    }
+
+    mLru.push_front(offset);
+    Block &block = mBlocks[offset];
+    block.mPage = page;
+    block.mLruPos = mLru.begin();
+    mTotalSize += page->mSize;
+
+    return true;
+}
+
+PageCache::Page *BlockCache::take(off64_t offset) {
+    BlockMap::iterator it = mBlocks.find(offset);
+    if (it == mBlocks.end()) {
+        return NULL;
+    }
+
+    PageCache::Page *page = it->second.mPage;
+    mTotalSize -= page->mSize;
+    mLru.erase(it->second.mLruPos);
+    mBlocks.erase(it);
+
+    return page;
+}
+
+bool BlockCache::copy(off64_t offset, void *data, size_t size) {
+    if (size == 0 || contiguousSize(offset) < size) {
+        return false;
+    }
+
+    while (size > 0) {
+        BlockMap::iterator it = find(offset);
+        mLru.splice(mLru.begin(), mLru, it->second.mLruPos);
+
+        const PageCache::Page *page = it->second.mPage;
+        size_t delta = offset - it->first;
+        size_t copy = page->mSize - delta;
+        if (copy > size) {
+            copy = size;
+        }
+
+        memcpy(data, (const uint8_t *)page->mData + delta, copy);
+        data = (uint8_t *)data + copy;
+        offset += copy;
+        size -= copy;
+    }
+
+    return true;
+}
+
+size_t BlockCache::contiguousSize(off64_t offset) const {
+    size_t size = 0;
+
+    BlockMap::const_iterator it = find(offset);
+    while (it != mBlocks.end() && it->first <= offset) {
+        off64_t end = it->first + it->second.mPage->mSize;
+        size += end - offset;
+        offset = end;
+        ++it;
+    }
+
+    return size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 NuCachedSource2::NuCachedSource2(
         const sp<DataSource> &source,
         const char *cacheConfig,
@@ -188,6 +370,9 @@ NuCachedSource2::NuCachedSource2(
       mLooper(new ALooper),
       mCache(new PageCache(kPageSize)),
       mCacheOffset(0),
+      mRetained(NULL),
+      mNumHits(0),
+      mNumMisses(0),
       mFinalStatus(OK),
       mLastAccessPos(0),
       mFetching(true),
@@ -196,6 +381,7 @@ NuCachedSource2::NuCachedSource2(
       mNumRetriesLeft(kMaxNumRetries),
       mHighwaterThresholdBytes(kDefaultHighWaterThreshold),
       mLowwaterThresholdBytes(kDefaultLowWaterThreshold),
+      mRetainedThresholdBytes(kDefaultRetainedThreshold),
       mKeepAliveIntervalUs(kDefaultKeepAliveIntervalUs),
       mDisconnectAtHighwatermark(disconnectAtHighwatermark) {
     // We are NOT going to support disconnect-at-highwatermark indefinitely
@@ -214,6 +400,8 @@ NuCachedSource2::NuCachedSource2(
         mKeepAliveIntervalUs = 0;
     }
 
+    mRetained = new BlockCache(mRetainedThresholdBytes);
+
     mLooper->setName("NuCachedSource2");
     mLooper->registerHandler(mReflector);
 
@@ -234,6 +422,9 @@ NuCachedSource2::~NuCachedSource2() {
 
     delete mCache;
     mCache = NULL;
+
+    delete mRetained;
+    mRetained = NULL;
 }
 
 // static
@@ -325,6 +516,10 @@ void NuCachedSource2::onMessageReceived(const sp<AMessage> &msg) {
 void NuCachedSource2::fetchInternal() {
     ALOGV("fetchInternal");
 
+    if (fetchFromKeptData()) {
+        return;
+    }
+
     bool reconnect = false;
 
     {
@@ -363,8 +558,8 @@ void NuCachedSource2::fetchInternal() {
 
     PageCache::Page *page = mCache->acquirePage();
 
-    ssize_t n = mSource->readAt(
-            mCacheOffset + mCache->totalSize(), page->mData, kPageSize);
+    off64_t offset = mCacheOffset + mCache->totalSize();
+    ssize_t n = mSource->readAt(offset, page->mData, kPageSize);
 
     Mutex::Autolock autoLock(mLock);
 
@@ -397,6 +592,38 @@ void NuCachedSource2::fetchInternal() {
     }
 }
 
+// The window may be moving over data that was kept from before, which needs
+// neither the source nor a connection to it. Returns true if a page of it
+// was appended to the window.
+bool NuCachedSource2::fetchFromKeptData() {
+    PageCache::Page *page;
+    off64_t offset;
+    {
+        Mutex::Autolock autoLock(mLock);
+
+        offset = mCacheOffset + mCache->totalSize();
+        page = mRetained->take(offset);
+        if (page == NULL) {
+            page = mCache->acquirePage();
+        }
+    }
+
+    Mutex::Autolock autoLock(mLock);
+
+    if (page->mSize == 0) {
+        mCache->releasePage(page);
+        return false;
+    }
+
+    // As good as a read from the source, so an earlier error
+    // or end of stream no longer applies.
+    mNumRetriesLeft = kMaxNumRetries;
+    mFinalStatus = OK;
+
+    mCache->appendPage(page);
+    return true;
+}
+
 void NuCachedSource2::onFetch() {
     ALOGV("onFetch");
 
@@ -508,7 +735,7 @@ void NuCachedSource2::restartPrefetcherIfNecessary_l(
         maxBytes -= kGrayArea;
     }
 
-    size_t actualBytes = mCache->releaseFromStart(maxBytes);
+    size_t actualBytes = mCache->releaseFromStart(maxBytes, mCacheOffset, mRetained);
     mCacheOffset += actualBytes;
 
     ALOGI("restarting prefetcher, totalSize = %zu", mCache->totalSize());
@@ -533,10 +760,20 @@ ssize_t NuCachedSource2::readAt(off64_t offset, void *data, size_t size) {
         mCache->copy(delta, data, size);
 
         mLastAccessPos = offset + size;
+        ++mNumHits;
+
+        return size;
+    }
 
+    // Otherwise from data kept from earlier ranges. This doesn't move the window,
+    // so the last access position, which is relative to it, is left alone.
+    if (mRetained->copy(offset, data, size)) {
+        ++mNumHits;
         return size;
     }
 
+    ++mNumMisses;
+
     sp<AMessage> msg = new AMessage(kWhatRead, mReflector);
     msg->setInt64("offset", offset);
     msg->setPointer("data", data);
@@ -566,6 +803,13 @@ ssize_t NuCachedSource2::readAt(off64_t offset, void *data, size_t size) {
     return (ssize_t)result;
 }
 
+void NuCachedSource2::getCacheStats(CacheStats *stats) const {
+    Mutex::Autolock autoLock(mLock);
+    stats->mNumHits = mNumHits;
+    stats->mNumMisses = mNumMisses;
+    stats->mRetainedBytes = mRetained->totalSize();
+}
+
 size_t NuCachedSource2::cachedSize() {
     Mutex::Autolock autoLock(mLock);
     return mCacheOffset + mCache->totalSize();
@@ -596,7 +840,7 @@ size_t NuCachedSource2::approxDataRemaining_l(off64_t offset, status_t *finalSta
     if (offset < lastBytePosCached) {
         return lastBytePosCached - offset;
     }
-    return 0;
+    return mRetained->contiguousSize(offset);
 }
 
 ssize_t NuCachedSource2::readInternal(off64_t offset, void *data, size_t size) {
@@ -630,6 +874,9 @@ ssize_t NuCachedSource2::readInternal(off64_t offset, void *data, size_t size) {
         // does not trigger another seek.
         off64_t seekOffset = (offset > kPadding) ? offset - kPadding : 0;
 
+        // Start at a page boundary so that pages we kept can be reused.
+        seekOffset -= seekOffset % kPageSize;
+
         seekInternal_l(seekOffset);
     }
 
@@ -672,10 +919,10 @@ status_t NuCachedSource2::seekInternal_l(off64_t offset) {
 
     ALOGI("new range: offset= %lld", (long long)offset);
 
-    mCacheOffset = offset;
-
     size_t totalSize = mCache->totalSize();
-    CHECK_EQ(mCache->releaseFromStart(totalSize), totalSize);
+    CHECK_EQ(mCache->releaseFromStart(totalSize, mCacheOffset, mRetained), totalSize);
+
+    mCacheOffset = offset;
 
     mNumRetriesLeft = kMaxNumRetries;
     mFetching = true;
@@ -711,11 +958,13 @@ void NuCachedSource2::updateCacheParamsFromSystemProperty() {
 }
 
 void NuCachedSource2::updateCacheParamsFromString(const char *s) {
-    ssize_t lowwaterMarkKb, highwaterMarkKb;
+    ssize_t lowwaterMarkKb, highwaterMarkKb, retainedKb = -1;
     int keepAliveSecs;
 
-    if (sscanf(s, "%zd/%zd/%d",
-               &lowwaterMarkKb, &highwaterMarkKb, &keepAliveSecs) != 3) {
+    // The size kept outside the prefetch window is optional.
+    int numParams = sscanf(s, "%zd/%zd/%d/%zd",
+               &lowwaterMarkKb, &highwaterMarkKb, &keepAliveSecs, &retainedKb);
+    if (numParams != 3 && numParams != 4) {
         ALOGE("Failed to parse cache parameters from '%s'.", s);
         return;
     }
@@ -745,10 +994,18 @@ void NuCachedSource2::updateCacheParamsFromString(const char *s) {
         mKeepAliveIntervalUs = kDefaultKeepAliveIntervalUs;
     }
 
-    ALOGV("lowwater = %zu bytes, highwater = %zu bytes, keepalive = %lld us",
+    if (retainedKb >= 0) {
+        mRetainedThresholdBytes = retainedKb * 1024;
+    } else {
+        mRetainedThresholdBytes = kDefaultRetainedThreshold;
+    }
+
+    ALOGV("lowwater = %zu bytes, highwater = %zu bytes, keepalive = %lld us, "
+          "retained = %zu bytes",
          mLowwaterThresholdBytes,
          mHighwaterThresholdBytes,
-         (long long)mKeepAliveIntervalUs);
+         (long long)mKeepAliveIntervalUs,
+         mRetainedThresholdBytes);
 }
 
 // static
@@ -30,6 +30,7 @@
 #include "libyuv/planar_functions.h"
 #include "libyuv/video_common.h"
 #include <functional>
+#include <vector>
 #include <sys/time.h>
 
 #define USE_LIBYUV
@@ -37,13 +38,21 @@
 
 
 #if defined(__aarch64__) || defined(__ARM_NEON__)
-#define USE_NEON_Y410 1
+#define USE_NEON 1
 #else
-#define USE_NEON_Y410 0
+#define USE_NEON 0
 #endif
 
-#if USE_NEON_Y410
+#if !USE_NEON && defined(__SSE2__)
+#define USE_SSE2 1
+#else
+#define USE_SSE2 0
+#endif
+
+#if USE_NEON
 #include <arm_neon.h>
+#elif USE_SSE2
+#include <emmintrin.h>
 #endif
 
 namespace android {
@@ -54,6 +63,225 @@ static bool isRGB(OMX_COLOR_FORMATTYPE colorFormat) {
             || colorFormat == OMX_COLOR_Format32bitBGRA8888;
 }
 
+/*
+ * One row of samples for convertYUVToRGBRow(), with Y offset by -16 and U and
+ * V by -128. U and V hold one sample per pair of pixels. The rows are padded
+ * to an even width, as the readers below always read pixels in pairs.
+ */
+struct YUVRow {
+    explicit YUVRow(size_t width)
+        : mSamples(2 * ((width + 1) & ~1)),
+          y(mSamples.data()),
+          u(y + ((width + 1) & ~1)),
+          v(u + (width + 1) / 2) {
+    }
+
+    std::vector<int16_t> mSamples;
+    int16_t *y;
+    int16_t *u;
+    int16_t *v;
+};
+
+enum RGBLayout {
+    kRGB565,
+    kBGR565,    // 565 with blue in the high bits
+    kRGBA8888,
+    kBGRA8888,
+};
+
+static RGBLayout getRGBLayout(OMX_COLOR_FORMATTYPE colorFormat) {
+    switch (colorFormat) {
+    case OMX_COLOR_Format16bitRGB565:
+        return kRGB565;
+    case OMX_COLOR_Format32BitRGBA8888:
+        return kRGBA8888;
+    case OMX_COLOR_Format32bitBGRA8888:
+        return kBGRA8888;
+    default:
+        TRESPASS();
+    }
+    return kRGB565;
+}
+
+static inline uint8_t clipRGB(signed value) {
+    return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+/*
+ * Converts a row of width pixels to RGB with
+ *
+ *   B = 1.164 * (Y - 16) + 2.018 * (U - 128)
+ *   G = 1.164 * (Y - 16) - 0.813 * (V - 128) - 0.391 * (U - 128)
+ *   R = 1.164 * (Y - 16) + 1.596 * (V - 128)
+ *
+ * in 8.8 fixed point:
+ *
+ *   B = 298/256 * (Y - 16) + 517/256 * (U - 128)
+ *   G = .................. - 208/256 * (V - 128) - 100/256 * (U - 128)
+ *   R = .................. + 409/256 * (V - 128)
+ *
+ * and clips each to 0..255. The vector paths convert 8 pixels at a time with
+ * exactly the same arithmetic as the scalar path: the sums are exact in 32
+ * bits, and shifting instead of dividing by 256 only changes negative results,
+ * which clip to 0 either way.
+ */
+static void convertYUVToRGBRow(
+        const YUVRow &row, size_t width, RGBLayout layout, void *dst) {
+    size_t x = 0;
+#if USE_NEON
+    for (; x + 8 <= width; x += 8) {
+        const int16x8_t y = vld1q_s16(row.y + x);
+        const int16x4x2_t u = vzip_s16(vld1_s16(row.u + x / 2), vld1_s16(row.u + x / 2));
+        const int16x4x2_t v = vzip_s16(vld1_s16(row.v + x / 2), vld1_s16(row.v + x / 2));
+
+        const int32x4_t tmpLo = vmull_n_s16(vget_low_s16(y), 298);
+        const int32x4_t tmpHi = vmull_n_s16(vget_high_s16(y), 298);
+        const int32x4_t bLo = vmlal_n_s16(tmpLo, u.val[0], 517);
+        const int32x4_t bHi = vmlal_n_s16(tmpHi, u.val[1], 517);
+        const int32x4_t gLo = vmlal_n_s16(vmlal_n_s16(tmpLo, v.val[0], -208), u.val[0], -100);
+        const int32x4_t gHi = vmlal_n_s16(vmlal_n_s16(tmpHi, v.val[1], -208), u.val[1], -100);
+        const int32x4_t rLo = vmlal_n_s16(tmpLo, v.val[0], 409);
+        const int32x4_t rHi = vmlal_n_s16(tmpHi, v.val[1], 409);
+
+        const uint8x8_t b = vqmovun_s16(vcombine_s16(vqshrn_n_s32(bLo, 8), vqshrn_n_s32(bHi, 8)));
+        const uint8x8_t g = vqmovun_s16(vcombine_s16(vqshrn_n_s32(gLo, 8), vqshrn_n_s32(gHi, 8)));
+        const uint8x8_t r = vqmovun_s16(vcombine_s16(vqshrn_n_s32(rLo, 8), vqshrn_n_s32(rHi, 8)));
+
+        switch (layout) {
+        case kRGB565:
+        case kBGR565:
+        {
+            uint16x8_t rgb = vshll_n_u8(layout == kRGB565 ? r : b, 8);
+            rgb = vsriq_n_u16(rgb, vshll_n_u8(g, 8), 5);
+            rgb = vsriq_n_u16(rgb, vshll_n_u8(layout == kRGB565 ? b : r, 8), 11);
+            vst1q_u16((uint16_t *)dst + x, rgb);
+            break;
+        }
+        case kRGBA8888:
+        {
+            const uint8x8x4_t rgba = {{ r, g, b, vdup_n_u8(0xFF) }};
+            vst4_u8((uint8_t *)dst + 4 * x, rgba);
+            break;
+        }
+        case kBGRA8888:
+        {
+            const uint8x8x4_t bgra = {{ b, g, r, vdup_n_u8(0xFF) }};
+            vst4_u8((uint8_t *)dst + 4 * x, bgra);
+            break;
+        }
+        }
+    }
+#elif USE_SSE2
+    // _mm_madd_epi16() of (y, u) pairs with (298, 517) pairs gives B * 256.
+    const __m128i kYB = _mm_set_epi16(517, 298, 517, 298, 517, 298, 517, 298);
+    const __m128i kYG = _mm_set_epi16(-100, 298, -100, 298, -100, 298, -100, 298);
+    const __m128i kVG = _mm_set_epi16(-208, 0, -208, 0, -208, 0, -208, 0);
+    const __m128i kYR = _mm_set_epi16(409, 298, 409, 298, 409, 298, 409, 298);
+    const __m128i kZero = _mm_setzero_si128();
+    const __m128i kMax = _mm_set1_epi16(255);
+    for (; x + 8 <= width; x += 8) {
+        const __m128i y = _mm_loadu_si128((const __m128i *)(row.y + x));
+        __m128i u = _mm_loadl_epi64((const __m128i *)(row.u + x / 2));
+        __m128i v = _mm_loadl_epi64((const __m128i *)(row.v + x / 2));
+        u = _mm_unpacklo_epi16(u, u);
+        v = _mm_unpacklo_epi16(v, v);
+
+        const __m128i yuLo = _mm_unpacklo_epi16(y, u);
+        const __m128i yuHi = _mm_unpackhi_epi16(y, u);
+        const __m128i yvLo = _mm_unpacklo_epi16(y, v);
+        const __m128i yvHi = _mm_unpackhi_epi16(y, v);
+
+        __m128i b = _mm_packs_epi32(
+                _mm_srai_epi32(_mm_madd_epi16(yuLo, kYB), 8),
+                _mm_srai_epi32(_mm_madd_epi16(yuHi, kYB), 8));
+        __m128i g = _mm_packs_epi32(
+                _mm_srai_epi32(_mm_add_epi32(
+                        _mm_madd_epi16(yuLo, kYG), _mm_madd_epi16(yvLo, kVG)), 8),
+                _mm_srai_epi32(_mm_add_epi32(
+                        _mm_madd_epi16(yuHi, kYG), _mm_madd_epi16(yvHi, kVG)), 8));
+        __m128i r = _mm_packs_epi32(
+                _mm_srai_epi32(_mm_madd_epi16(yvLo, kYR), 8),
+                _mm_srai_epi32(_mm_madd_epi16(yvHi, kYR), 8));
+        b = _mm_min_epi16(_mm_max_epi16(b, kZero), kMax);
+        g = _mm_min_epi16(_mm_max_epi16(g, kZero), kMax);
+        r = _mm_min_epi16(_mm_max_epi16(r, kZero), kMax);
+
+        switch (layout) {
+        case kRGB565:
+        case kBGR565:
+        {
+            const __m128i high = layout == kRGB565 ? r : b;
+            const __m128i low = layout == kRGB565 ? b : r;
+            const __m128i rgb = _mm_or_si128(
+                    _mm_or_si128(_mm_slli_epi16(_mm_srli_epi16(high, 3), 11),
+                            _mm_slli_epi16(_mm_srli_epi16(g, 2), 5)),
+                    _mm_srli_epi16(low, 3));
+            _mm_storeu_si128((__m128i *)((uint16_t *)dst + x), rgb);
+            break;
+        }
+        case kRGBA8888:
+        case kBGRA8888:
+        {
+            const __m128i first = layout == kRGBA8888 ? r : b;
+            const __m128i third = layout == kRGBA8888 ? b : r;
+            const __m128i lowHalves = _mm_or_si128(first, _mm_slli_epi16(g, 8));
+            const __m128i highHalves = _mm_or_si128(third, _mm_set1_epi16((short)0xFF00));
+            uint32_t *out = (uint32_t *)dst + x;
+            _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi16(lowHalves, highHalves));
+            _mm_storeu_si128((__m128i *)(out + 4), _mm_unpackhi_epi16(lowHalves, highHalves));
+            break;
+        }
+        }
+    }
+#endif
+
+    for (; x < width; ++x) {
+        const signed u = row.u[x / 2];
+        const signed v = row.v[x / 2];
+        const signed tmp = row.y[x] * 298;
+        const uint8_t b = clipRGB((tmp + u * 517) / 256);
+        const uint8_t g = clipRGB((tmp - v * 208 - u * 100) / 256);
+        const uint8_t r = clipRGB((tmp + v * 409) / 256);
+
+        switch (layout) {
+        case kRGB565:
+            ((uint16_t *)dst)[x] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+            break;
+        case kBGR565:
+            ((uint16_t *)dst)[x] = ((b >> 3) << 11) | ((g >> 2) << 5) | (r >> 3);
+            break;
+        case kRGBA8888:
+            ((uint32_t *)dst)[x] = r | (g << 8) | (b << 16) | 0xFF000000u;
+            break;
+        case kBGRA8888:
+            ((uint32_t *)dst)[x] = b | (g << 8) | (r << 16) | 0xFF000000u;
+            break;
+        }
+    }
+}
+
+template <typename T, unsigned kShift>
+static void readPlanarRow(
+        const T *src_y, const T *src_u, const T *src_v, size_t width, YUVRow *row) {
+    for (size_t x = 0; x < width; x += 2) {
+        row->y[x] = (signed)(src_y[x] >> kShift) - 16;
+        row->y[x + 1] = (signed)(src_y[x + 1] >> kShift) - 16;
+        row->u[x / 2] = (signed)(src_u[x / 2] >> kShift) - 128;
+        row->v[x / 2] = (signed)(src_v[x / 2] >> kShift) - 128;
+    }
+}
+
+template <bool kVFirst>
+static void readSemiPlanarRow(
+        const uint8_t *src_y, const uint8_t *src_uv, size_t width, YUVRow *row) {
+    for (size_t x = 0; x < width; x += 2) {
+        row->y[x] = (signed)src_y[x] - 16;
+        row->y[x + 1] = (signed)src_y[x + 1] - 16;
+        row->u[x / 2] = (signed)src_uv[kVFirst ? x + 1 : x] - 128;
+        row->v[x / 2] = (signed)src_uv[kVFirst ? x : x + 1] - 128;
+    }
+}
+
 bool ColorConverter::ColorSpace::isBt709() {
     return (mStandard == ColorUtils::kColorStandardBT709);
 }
@@ -69,13 +297,10 @@ ColorConverter::ColorConverter(
         OMX_COLOR_FORMATTYPE from, OMX_COLOR_FORMATTYPE to)
     : mSrcFormat(from),
       mDstFormat(to),
-      mSrcColorSpace({0, 0, 0}),
-      mClip(NULL) {
+      mSrcColorSpace({0, 0, 0}) {
 }
 
 ColorConverter::~ColorConverter() {
-    delete[] mClip;
-    mClip = NULL;
 }
 
 bool ColorConverter::isValid() const {
@@ -269,55 +494,23 @@ status_t ColorConverter::convertCbYCrY(
         const BitmapParams &src, const BitmapParams &dst) {
     // XXX Untested
 
-    uint8_t *kAdjustedClip = initClip();
-
     uint16_t *dst_ptr = (uint16_t *)dst.mBits
         + dst.mCropTop * dst.mWidth + dst.mCropLeft;
 
     const uint8_t *src_ptr = (const uint8_t *)src.mBits
         + (src.mCropTop * dst.mWidth + src.mCropLeft) * 2;
 
+    const size_t width = src.cropWidth();
+    YUVRow row(width);
     for (size_t y = 0; y < src.cropHeight(); ++y) {
-        for (size_t x = 0; x < src.cropWidth(); x += 2) {
-            signed y1 = (signed)src_ptr[2 * x + 1] - 16;
-            signed y2 = (signed)src_ptr[2 * x + 3] - 16;
-            signed u = (signed)src_ptr[2 * x] - 128;
-            signed v = (signed)src_ptr[2 * x + 2] - 128;
-
-            signed u_b = u * 517;
-            signed u_g = -u * 100;
-            signed v_g = -v * 208;
-            signed v_r = v * 409;
-
-            signed tmp1 = y1 * 298;
-            signed b1 = (tmp1 + u_b) / 256;
-            signed g1 = (tmp1 + v_g + u_g) / 256;
-            signed r1 = (tmp1 + v_r) / 256;
-
-            signed tmp2 = y2 * 298;
-            signed b2 = (tmp2 + u_b) / 256;
-            signed g2 = (tmp2 + v_g + u_g) / 256;
-            signed r2 = (tmp2 + v_r) / 256;
-
-            uint32_t rgb1 =
-                ((kAdjustedClip[r1] >> 3) << 11)
-                | ((kAdjustedClip[g1] >> 2) << 5)
-                | (kAdjustedClip[b1] >> 3);
-
-            uint32_t rgb2 =
-                ((kAdjustedClip[r2] >> 3) << 11)
-                | ((kAdjustedClip[g2] >> 2) << 5)
-                | (kAdjustedClip[b2] >> 3);
-
-            if (x + 1 < src.cropWidth()) {
-                *(uint32_t *)(&dst_ptr[x]) = (rgb2 << 16) | rgb1;
-            } else {
-                dst_ptr[x] = rgb1;
-            }
+        const uint8_t *src_row = src_ptr + y * src.mWidth * 2;
+        for (size_t x = 0; x < width; x += 2) {
+            row.y[x] = (signed)src_row[2 * x + 1] - 16;
+            row.y[x + 1] = (signed)src_row[2 * x + 3] - 16;
+            row.u[x / 2] = (signed)src_row[2 * x] - 128;
+            row.v[x / 2] = (signed)src_row[2 * x + 2] - 128;
         }
-
-        src_ptr += src.mWidth * 2;
-        dst_ptr += dst.mWidth;
+        convertYUVToRGBRow(row, width, kRGB565, dst_ptr + y * dst.mWidth);
     }
 
     return OK;
@@ -412,109 +605,9 @@ status_t ColorConverter::convertYUV420SemiPlanarUseLibYUV(
    return OK;
 }
 
-std::function<void (void *, void *, void *, size_t,
-                    signed *, signed *, signed *, signed *)>
-getReadFromSrc(OMX_COLOR_FORMATTYPE srcFormat) {
-    switch(srcFormat) {
-    case OMX_COLOR_FormatYUV420Planar:
-        return [](void *src_y, void *src_u, void *src_v, size_t x,
-                  signed *y1, signed *y2, signed *u, signed *v) {
-            *y1 = ((uint8_t*)src_y)[x] - 16;
-            *y2 = ((uint8_t*)src_y)[x + 1] - 16;
-            *u = ((uint8_t*)src_u)[x / 2] - 128;
-            *v = ((uint8_t*)src_v)[x / 2] - 128;
-        };
-    case OMX_COLOR_FormatYUV420Planar16:
-        return [](void *src_y, void *src_u, void *src_v, size_t x,
-                signed *y1, signed *y2, signed *u, signed *v) {
-            *y1 = (signed)(((uint16_t*)src_y)[x] >> 2) - 16;
-            *y2 = (signed)(((uint16_t*)src_y)[x + 1] >> 2) - 16;
-            *u = (signed)(((uint16_t*)src_u)[x / 2] >> 2) - 128;
-            *v = (signed)(((uint16_t*)src_v)[x / 2] >> 2) - 128;
-        };
-    default:
-        TRESPASS();
-    }
-    return nullptr;
-}
-
-std::function<void (void *, bool, signed, signed, signed, signed, signed, signed)>
-getWriteToDst(OMX_COLOR_FORMATTYPE dstFormat, uint8_t *kAdjustedClip) {
-    switch (dstFormat) {
-    case OMX_COLOR_Format16bitRGB565:
-    {
-        return [kAdjustedClip](void *dst_ptr, bool uncropped,
-                               signed r1, signed g1, signed b1,
-                               signed r2, signed g2, signed b2) {
-            uint32_t rgb1 =
-                ((kAdjustedClip[r1] >> 3) << 11)
-                | ((kAdjustedClip[g1] >> 2) << 5)
-                | (kAdjustedClip[b1] >> 3);
-
-            if (uncropped) {
-                uint32_t rgb2 =
-                    ((kAdjustedClip[r2] >> 3) << 11)
-                    | ((kAdjustedClip[g2] >> 2) << 5)
-                    | (kAdjustedClip[b2] >> 3);
-
-                *(uint32_t *)dst_ptr = (rgb2 << 16) | rgb1;
-            } else {
-                *(uint16_t *)dst_ptr = rgb1;
-            }
-        };
-    }
-    case OMX_COLOR_Format32BitRGBA8888:
-    {
-        return [kAdjustedClip](void *dst_ptr, bool uncropped,
-                               signed r1, signed g1, signed b1,
-                               signed r2, signed g2, signed b2) {
-            ((uint32_t *)dst_ptr)[0] =
-                    (kAdjustedClip[r1])
-                    | (kAdjustedClip[g1] << 8)
-                    | (kAdjustedClip[b1] << 16)
-                    | (0xFF << 24);
-
-            if (uncropped) {
-                ((uint32_t *)dst_ptr)[1] =
-                        (kAdjustedClip[r2])
-                        | (kAdjustedClip[g2] << 8)
-                        | (kAdjustedClip[b2] << 16)
-                        | (0xFF << 24);
-            }
-        };
-    }
-    case OMX_COLOR_Format32bitBGRA8888:
-    {
-        return [kAdjustedClip](void *dst_ptr, bool uncropped,
-                               signed r1, signed g1, signed b1,
-                               signed r2, signed g2, signed b2) {
-            ((uint32_t *)dst_ptr)[0] =
-                    (kAdjustedClip[b1])
-                    | (kAdjustedClip[g1] << 8)
-                    | (kAdjustedClip[r1] << 16)
-                    | (0xFF << 24);
-
-            if (uncropped) {
-                ((uint32_t *)dst_ptr)[1] =
-                        (kAdjustedClip[b2])
-                        | (kAdjustedClip[g2] << 8)
-                        | (kAdjustedClip[r2] << 16)
-                        | (0xFF << 24);
-            }
-        };
-    }
-    default:
-        TRESPASS();
-    }
-    return nullptr;
-}
-
 status_t ColorConverter::convertYUV420Planar(
         const BitmapParams &src, const BitmapParams &dst) {
-    uint8_t *kAdjustedClip = initClip();
-
-    auto readFromSrc = getReadFromSrc(mSrcFormat);
-    auto writeToDst = getWriteToDst(mDstFormat, kAdjustedClip);
+    const RGBLayout layout = getRGBLayout(mDstFormat);
 
     uint8_t *dst_ptr = (uint8_t *)dst.mBits
             + dst.mCropTop * dst.mStride + dst.mCropLeft * dst.mBpp;
@@ -527,56 +620,19 @@ status_t ColorConverter::convertYUV420Planar(
 
     uint8_t *src_v = src_u + (src.mStride / 2) * (src.mHeight / 2);
 
+    const size_t width = src.cropWidth();
+    YUVRow row(width);
     for (size_t y = 0; y < src.cropHeight(); ++y) {
-        for (size_t x = 0; x < src.cropWidth(); x += 2) {
-            // B = 1.164 * (Y - 16) + 2.018 * (U - 128)
-            // G = 1.164 * (Y - 16) - 0.813 * (V - 128) - 0.391 * (U - 128)
-            // R = 1.164 * (Y - 16) + 1.596 * (V - 128)
-
-            // B = 298/256 * (Y - 16) + 517/256 * (U - 128)
-            // G = .................. - 208/256 * (V - 128) - 100/256 * (U - 128)
-            // R = .................. + 409/256 * (V - 128)
-
-            // min_B = (298 * (- 16) + 517 * (- 128)) / 256 = -277
-            // min_G = (298 * (- 16) - 208 * (255 - 128) - 100 * (255 - 128)) / 256 = -172
-            // min_R = (298 * (- 16) + 409 * (- 128)) / 256 = -223
-
-            // max_B = (298 * (255 - 16) + 517 * (255 - 128)) / 256 = 534
-            // max_G = (298 * (255 - 16) - 208 * (- 128) - 100 * (- 128)) / 256 = 432
-            // max_R = (298 * (255 - 16) + 409 * (255 - 128)) / 256 = 481
-
-            // clip range -278 .. 535
-
-            signed y1, y2, u, v;
-            readFromSrc(src_y, src_u, src_v, x, &y1, &y2, &u, &v);
-
-            signed u_b = u * 517;
-            signed u_g = -u * 100;
-            signed v_g = -v * 208;
-            signed v_r = v * 409;
-
-            signed tmp1 = y1 * 298;
-            signed b1 = (tmp1 + u_b) / 256;
-            signed g1 = (tmp1 + v_g + u_g) / 256;
-            signed r1 = (tmp1 + v_r) / 256;
-
-            signed tmp2 = y2 * 298;
-            signed b2 = (tmp2 + u_b) / 256;
-            signed g2 = (tmp2 + v_g + u_g) / 256;
-            signed r2 = (tmp2 + v_r) / 256;
-
-            bool uncropped = x + 1 < src.cropWidth();
-            writeToDst(dst_ptr + x * dst.mBpp, uncropped, r1, g1, b1, r2, g2, b2);
-        }
-
-        src_y += src.mStride;
-
-        if (y & 1) {
-            src_u += src.mStride / 2;
-            src_v += src.mStride / 2;
+        const uint8_t *row_y = src_y + y * src.mStride;
+        const uint8_t *row_u = src_u + (y / 2) * (src.mStride / 2);
+        const uint8_t *row_v = src_v + (y / 2) * (src.mStride / 2);
+        if (mSrcFormat == OMX_COLOR_FormatYUV420Planar16) {
+            readPlanarRow<uint16_t, 2>((const uint16_t *)row_y,
+                    (const uint16_t *)row_u, (const uint16_t *)row_v, width, &row);
+        } else {
+            readPlanarRow<uint8_t, 0>(row_y, row_u, row_v, width, &row);
         }
-
-        dst_ptr += dst.mStride;
+        convertYUVToRGBRow(row, width, layout, dst_ptr + y * dst.mStride);
     }
 
     return OK;
@@ -620,82 +676,6 @@ status_t ColorConverter::convertYUV420Planar16(
  *
  */
 
-#if !USE_NEON_Y410
-
-status_t ColorConverter::convertYUV420Planar16ToY410(
-        const BitmapParams &src, const BitmapParams &dst) {
-    uint8_t *dst_ptr = (uint8_t *)dst.mBits
-        + dst.mCropTop * dst.mStride + dst.mCropLeft * dst.mBpp;
-
-    const uint8_t *src_y =
-        (const uint8_t *)src.mBits + src.mCropTop * src.mStride + src.mCropLeft * src.mBpp;
-
-    const uint8_t *src_u =
-        (const uint8_t *)src.mBits + src.mStride * src.mHeight
-        + (src.mCropTop / 2) * (src.mStride / 2) + (src.mCropLeft / 2) * src.mBpp;
-
-    const uint8_t *src_v =
-        src_u + (src.mStride / 2) * (src.mHeight / 2);
-
-    // Converting two lines at a time, slightly faster
-    for (size_t y = 0; y < src.cropHeight(); y += 2) {
-        uint32_t *dst_top = (uint32_t *) dst_ptr;
-        uint32_t *dst_bot = (uint32_t *) (dst_ptr + dst.mStride);
-        uint16_t *ptr_ytop = (uint16_t*) src_y;
-        uint16_t *ptr_ybot = (uint16_t*) (src_y + src.mStride);
-        uint16_t *ptr_u = (uint16_t*) src_u;
-        uint16_t *ptr_v = (uint16_t*) src_v;
-
-        uint32_t u01, v01, y01, y23, y45, y67, uv0, uv1;
-        size_t x = 0;
-        for (; x < src.cropWidth() - 3; x += 4) {
-            u01 = *((uint32_t*)ptr_u); ptr_u += 2;
-            v01 = *((uint32_t*)ptr_v); ptr_v += 2;
-
-            y01 = *((uint32_t*)ptr_ytop); ptr_ytop += 2;
-            y23 = *((uint32_t*)ptr_ytop); ptr_ytop += 2;
-            y45 = *((uint32_t*)ptr_ybot); ptr_ybot += 2;
-            y67 = *((uint32_t*)ptr_ybot); ptr_ybot += 2;
-
-            uv0 = (u01 & 0x3FF) | ((v01 & 0x3FF) << 20);
-            uv1 = (u01 >> 16) | ((v01 >> 16) << 20);
-
-            *dst_top++ = ((y01 & 0x3FF) << 10) | uv0;
-            *dst_top++ = ((y01 >> 16) << 10) | uv0;
-            *dst_top++ = ((y23 & 0x3FF) << 10) | uv1;
-            *dst_top++ = ((y23 >> 16) << 10) | uv1;
-
-            *dst_bot++ = ((y45 & 0x3FF) << 10) | uv0;
-            *dst_bot++ = ((y45 >> 16) << 10) | uv0;
-            *dst_bot++ = ((y67 & 0x3FF) << 10) | uv1;
-            *dst_bot++ = ((y67 >> 16) << 10) | uv1;
-        }
-
-        // There should be at most 2 more pixels to process. Note that we don't
-        // need to consider odd case as the buffer is always aligned to even.
-        if (x < src.cropWidth()) {
-            u01 = *ptr_u;
-            v01 = *ptr_v;
-            y01 = *((uint32_t*)ptr_ytop);
-            y45 = *((uint32_t*)ptr_ybot);
-            uv0 = (u01 & 0x3FF) | ((v01 & 0x3FF) << 20);
-            *dst_top++ = ((y01 & 0x3FF) << 10) | uv0;
-            *dst_top++ = ((y01 >> 16) << 10) | uv0;
-            *dst_bot++ = ((y45 & 0x3FF) << 10) | uv0;
-            *dst_bot++ = ((y45 >> 16) << 10) | uv0;
-        }
-
-        src_y += src.mStride * 2;
-        src_u += src.mStride / 2;
-        src_v += src.mStride / 2;
-        dst_ptr += dst.mStride * 2;
-    }
-
-    return OK;
-}
-
-#else
-
 status_t ColorConverter::convertYUV420Planar16ToY410(
         const BitmapParams &src, const BitmapParams &dst) {
     uint8_t *out = (uint8_t *)dst.mBits
@@ -711,15 +691,17 @@ status_t ColorConverter::convertYUV420Planar16ToY410(
     const uint8_t *src_v =
         src_u + (src.mStride / 2) * (src.mHeight / 2);
 
+    const size_t width = src.cropWidth();
     for (size_t y = 0; y < src.cropHeight(); y++) {
-        uint16_t *ptr_y = (uint16_t*) src_y;
-        uint16_t *ptr_u = (uint16_t*) src_u;
-        uint16_t *ptr_v = (uint16_t*) src_v;
-        uint32_t *ptr_out = (uint32_t *) out;
+        const uint16_t *ptr_y = (const uint16_t *)(src_y + y * src.mStride);
+        const uint16_t *ptr_u = (const uint16_t *)(src_u + (y / 2) * (src.mStride / 2));
+        const uint16_t *ptr_v = (const uint16_t *)(src_v + (y / 2) * (src.mStride / 2));
+        uint32_t *ptr_out = (uint32_t *)(out + y * dst.mStride);
+        size_t x = 0;
 
+#if USE_NEON
         // Process 16-pixel at a time.
-        uint32_t *ptr_limit = ptr_out + (src.cropWidth() & ~15);
-        while (ptr_out < ptr_limit) {
+        for (; x + 16 <= width; x += 16) {
             uint16x4_t u0123 = vld1_u16(ptr_u); ptr_u += 4;
             uint16x4_t u4567 = vld1_u16(ptr_u); ptr_u += 4;
             uint16x4_t v0123 = vld1_u16(ptr_v); ptr_v += 4;
@@ -766,63 +748,48 @@ status_t ColorConverter::convertYUV420Planar16ToY410(
             dsttemp = vorrq_u32(uv6677, vshll_n_u16(ycdef, 10));
             vst1q_u32(ptr_out, dsttemp); ptr_out += 4;
         }
-
-        src_y += src.mStride;
-        if (y & 1) {
-            src_u += src.mStride / 2;
-            src_v += src.mStride / 2;
+#elif USE_SSE2
+        // Process 8-pixel at a time, masking to 10 bits as the scalar loop does.
+        const __m128i kZero = _mm_setzero_si128();
+        const __m128i kMask = _mm_set1_epi32(0x3FF);
+        for (; x + 8 <= width; x += 8) {
+            __m128i u = _mm_loadl_epi64((const __m128i *)ptr_u); ptr_u += 4;
+            __m128i v = _mm_loadl_epi64((const __m128i *)ptr_v); ptr_v += 4;
+            __m128i y = _mm_loadu_si128((const __m128i *)ptr_y); ptr_y += 8;
+
+            u = _mm_and_si128(_mm_unpacklo_epi16(u, kZero), kMask);
+            v = _mm_and_si128(_mm_unpacklo_epi16(v, kZero), kMask);
+            const __m128i uv = _mm_or_si128(u, _mm_slli_epi32(v, 20));
+
+            const __m128i y0123 = _mm_slli_epi32(
+                    _mm_and_si128(_mm_unpacklo_epi16(y, kZero), kMask), 10);
+            const __m128i y4567 = _mm_slli_epi32(
+                    _mm_and_si128(_mm_unpackhi_epi16(y, kZero), kMask), 10);
+
+            _mm_storeu_si128((__m128i *)ptr_out,
+                    _mm_or_si128(y0123, _mm_unpacklo_epi32(uv, uv)));
+            _mm_storeu_si128((__m128i *)(ptr_out + 4),
+                    _mm_or_si128(y4567, _mm_unpackhi_epi32(uv, uv)));
+            ptr_out += 8;
         }
-        out += dst.mStride;
-    }
+#endif
 
-    // Process the left-overs out-of-loop, 2-pixel at a time. Note that we don't
-    // need to consider odd case as the buffer is always aligned to even.
-    if (src.cropWidth() & 15) {
-        size_t xstart = (src.cropWidth() & ~15);
-
-        uint8_t *out = (uint8_t *)dst.mBits + dst.mCropTop * dst.mStride
-                + (dst.mCropLeft + xstart) * dst.mBpp;
-
-        const uint8_t *src_y = (const uint8_t *)src.mBits + src.mCropTop * src.mStride
-                + (src.mCropLeft + xstart) * src.mBpp;
-
-        const uint8_t *src_u = (const uint8_t *)src.mBits + src.mStride * src.mHeight
-            + (src.mCropTop / 2) * (src.mStride / 2)
-            + ((src.mCropLeft + xstart) / 2) * src.mBpp;
-
-        const uint8_t *src_v = src_u + (src.mStride / 2) * (src.mHeight / 2);
-
-        for (size_t y = 0; y < src.cropHeight(); y++) {
-            uint16_t *ptr_y = (uint16_t*) src_y;
-            uint16_t *ptr_u = (uint16_t*) src_u;
-            uint16_t *ptr_v = (uint16_t*) src_v;
-            uint32_t *ptr_out = (uint32_t *) out;
-            for (size_t x = xstart; x < src.cropWidth(); x += 2) {
-                uint16_t u = *ptr_u++;
-                uint16_t v = *ptr_v++;
-                uint32_t y01 = *((uint32_t*)ptr_y); ptr_y += 2;
-                uint32_t uv = u | (((uint32_t)v) << 20);
-                *ptr_out++ = ((y01 & 0x3FF) << 10) | uv;
-                *ptr_out++ = ((y01 >> 16) << 10) | uv;
+        // Process the left-overs 2-pixel at a time, leaving the pixel
+        // after an odd crop untouched.
+        for (; x < width; x += 2) {
+            uint32_t uv = (*ptr_u++ & 0x3FF) | ((uint32_t)(*ptr_v++ & 0x3FF) << 20);
+            *ptr_out++ = ((*ptr_y++ & 0x3FF) << 10) | uv;
+            if (x + 1 < width) {
+                *ptr_out++ = ((*ptr_y++ & 0x3FF) << 10) | uv;
             }
-            src_y += src.mStride;
-            if (y & 1) {
-                src_u += src.mStride / 2;
-                src_v += src.mStride / 2;
-            }
-            out += dst.mStride;
         }
     }
 
     return OK;
 }
 
-#endif // USE_NEON_Y410
-
 status_t ColorConverter::convertQCOMYUV420SemiPlanar(
         const BitmapParams &src, const BitmapParams &dst) {
-    uint8_t *kAdjustedClip = initClip();
-
     uint16_t *dst_ptr = (uint16_t *)dst.mBits
         + dst.mCropTop * dst.mWidth + dst.mCropLeft;
 
@@ -833,53 +800,12 @@ status_t ColorConverter::convertQCOMYUV420SemiPlanar(
         (const uint8_t *)src_y + src.mWidth * src.mHeight
         + src.mCropTop * src.mWidth + src.mCropLeft;
 
+    const size_t width = src.cropWidth();
+    YUVRow row(width);
     for (size_t y = 0; y < src.cropHeight(); ++y) {
-        for (size_t x = 0; x < src.cropWidth(); x += 2) {
-            signed y1 = (signed)src_y[x] - 16;
-            signed y2 = (signed)src_y[x + 1] - 16;
-
-            signed u = (signed)src_u[x & ~1] - 128;
-            signed v = (signed)src_u[(x & ~1) + 1] - 128;
-
-            signed u_b = u * 517;
-            signed u_g = -u * 100;
-            signed v_g = -v * 208;
-            signed v_r = v * 409;
-
-            signed tmp1 = y1 * 298;
-            signed b1 = (tmp1 + u_b) / 256;
-            signed g1 = (tmp1 + v_g + u_g) / 256;
-            signed r1 = (tmp1 + v_r) / 256;
-
-            signed tmp2 = y2 * 298;
-            signed b2 = (tmp2 + u_b) / 256;
-            signed g2 = (tmp2 + v_g + u_g) / 256;
-            signed r2 = (tmp2 + v_r) / 256;
-
-            uint32_t rgb1 =
-                ((kAdjustedClip[b1] >> 3) << 11)
-                | ((kAdjustedClip[g1] >> 2) << 5)
-                | (kAdjustedClip[r1] >> 3);
-
-            uint32_t rgb2 =
-                ((kAdjustedClip[b2] >> 3) << 11)
-                | ((kAdjustedClip[g2] >> 2) << 5)
-                | (kAdjustedClip[r2] >> 3);
-
-            if (x + 1 < src.cropWidth()) {
-                *(uint32_t *)(&dst_ptr[x]) = (rgb2 << 16) | rgb1;
-            } else {
-                dst_ptr[x] = rgb1;
-            }
-        }
-
-        src_y += src.mWidth;
-
-        if (y & 1) {
-            src_u += src.mWidth;
-        }
-
-        dst_ptr += dst.mWidth;
+        readSemiPlanarRow<false /* kVFirst */>(
+                src_y + y * src.mWidth, src_u + (y / 2) * src.mWidth, width, &row);
+        convertYUVToRGBRow(row, width, kBGR565, dst_ptr + y * dst.mWidth);
     }
 
     return OK;
@@ -889,10 +815,8 @@ status_t ColorConverter::convertYUV420SemiPlanar(
         const BitmapParams &src, const BitmapParams &dst) {
     // XXX Untested
 
-    uint8_t *kAdjustedClip = initClip();
-
-    uint16_t *dst_ptr = (uint16_t *)((uint8_t *)
-            dst.mBits + dst.mCropTop * dst.mStride + dst.mCropLeft * dst.mBpp);
+    uint8_t *dst_ptr = (uint8_t *)dst.mBits
+        + dst.mCropTop * dst.mStride + dst.mCropLeft * dst.mBpp;
 
     const uint8_t *src_y =
         (const uint8_t *)src.mBits + src.mCropTop * src.mStride + src.mCropLeft;
@@ -901,53 +825,12 @@ status_t ColorConverter::convertYUV420SemiPlanar(
         (const uint8_t *)src.mBits + src.mHeight * src.mStride +
         (src.mCropTop / 2) * src.mStride + src.mCropLeft;
 
+    const size_t width = src.cropWidth();
+    YUVRow row(width);
     for (size_t y = 0; y < src.cropHeight(); ++y) {
-        for (size_t x = 0; x < src.cropWidth(); x += 2) {
-            signed y1 = (signed)src_y[x] - 16;
-            signed y2 = (signed)src_y[x + 1] - 16;
-
-            signed v = (signed)src_u[x & ~1] - 128;
-            signed u = (signed)src_u[(x & ~1) + 1] - 128;
-
-            signed u_b = u * 517;
-            signed u_g = -u * 100;
-            signed v_g = -v * 208;
-            signed v_r = v * 409;
-
-            signed tmp1 = y1 * 298;
-            signed b1 = (tmp1 + u_b) / 256;
-            signed g1 = (tmp1 + v_g + u_g) / 256;
-            signed r1 = (tmp1 + v_r) / 256;
-
-            signed tmp2 = y2 * 298;
-            signed b2 = (tmp2 + u_b) / 256;
-            signed g2 = (tmp2 + v_g + u_g) / 256;
-            signed r2 = (tmp2 + v_r) / 256;
-
-            uint32_t rgb1 =
-                ((kAdjustedClip[b1] >> 3) << 11)
-                | ((kAdjustedClip[g1] >> 2) << 5)
-                | (kAdjustedClip[r1] >> 3);
-
-            uint32_t rgb2 =
-                ((kAdjustedClip[b2] >> 3) << 11)
-                | ((kAdjustedClip[g2] >> 2) << 5)
-                | (kAdjustedClip[r2] >> 3);
-
-            if (x + 1 < src.cropWidth()) {
-                *(uint32_t *)(&dst_ptr[x]) = (rgb2 << 16) | rgb1;
-            } else {
-                dst_ptr[x] = rgb1;
-            }
-        }
-
-        src_y += src.mStride;
-
-        if (y & 1) {
-            src_u += src.mStride;
-        }
-
-        dst_ptr = (uint16_t*)((uint8_t*)dst_ptr + dst.mStride);
+        readSemiPlanarRow<true /* kVFirst */>(
+                src_y + y * src.mStride, src_u + (y / 2) * src.mStride, width, &row);
+        convertYUVToRGBRow(row, width, kBGR565, dst_ptr + y * dst.mStride);
     }
 
     return OK;
@@ -955,8 +838,6 @@ status_t ColorConverter::convertYUV420SemiPlanar(
 
 status_t ColorConverter::convertTIYUV420PackedSemiPlanar(
         const BitmapParams &src, const BitmapParams &dst) {
-    uint8_t *kAdjustedClip = initClip();
-
     uint16_t *dst_ptr = (uint16_t *)dst.mBits
         + dst.mCropTop * dst.mWidth + dst.mCropLeft;
 
@@ -966,71 +847,15 @@ status_t ColorConverter::convertTIYUV420PackedSemiPlanar(
     const uint8_t *src_u =
         (const uint8_t *)src_y + src.mWidth * (src.mHeight - src.mCropTop / 2);
 
+    const size_t width = src.cropWidth();
+    YUVRow row(width);
     for (size_t y = 0; y < src.cropHeight(); ++y) {
-        for (size_t x = 0; x < src.cropWidth(); x += 2) {
-            signed y1 = (signed)src_y[x] - 16;
-            signed y2 = (signed)src_y[x + 1] - 16;
-
-            signed u = (signed)src_u[x & ~1] - 128;
-            signed v = (signed)src_u[(x & ~1) + 1] - 128;
-
-            signed u_b = u * 517;
-            signed u_g = -u * 100;
-            signed v_g = -v * 208;
-            signed v_r = v * 409;
-
-            signed tmp1 = y1 * 298;
-            signed b1 = (tmp1 + u_b) / 256;
-            signed g1 = (tmp1 + v_g + u_g) / 256;
-            signed r1 = (tmp1 + v_r) / 256;
-
-            signed tmp2 = y2 * 298;
-            signed b2 = (tmp2 + u_b) / 256;
-            signed g2 = (tmp2 + v_g + u_g) / 256;
-            signed r2 = (tmp2 + v_r) / 256;
-
-            uint32_t rgb1 =
-                ((kAdjustedClip[r1] >> 3) << 11)
-                | ((kAdjustedClip[g1] >> 2) << 5)
-                | (kAdjustedClip[b1] >> 3);
-
-            uint32_t rgb2 =
-                ((kAdjustedClip[r2] >> 3) << 11)
-                | ((kAdjustedClip[g2] >> 2) << 5)
-                | (kAdjustedClip[b2] >> 3);
-
-            if (x + 1 < src.cropWidth()) {
-                *(uint32_t *)(&dst_ptr[x]) = (rgb2 << 16) | rgb1;
-            } else {
-                dst_ptr[x] = rgb1;
-            }
-        }
-
-        src_y += src.mWidth;
-
-        if (y & 1) {
-            src_u += src.mWidth;
-        }
-
-        dst_ptr += dst.mWidth;
+        readSemiPlanarRow<false /* kVFirst */>(
+                src_y + y * src.mWidth, src_u + (y / 2) * src.mWidth, width, &row);
+        convertYUVToRGBRow(row, width, kRGB565, dst_ptr + y * dst.mWidth);
     }
 
     return OK;
 }
 
-uint8_t *ColorConverter::initClip() {
-    static const signed kClipMin = -278;
-    static const signed kClipMax = 535;
-
-    if (mClip == NULL) {
-        mClip = new uint8_t[kClipMax - kClipMin + 1];
-
-        for (signed i = kClipMin; i <= kClipMax; ++i) {
-            mClip[i - kClipMin] = (i < 0) ? 0 : (i > 255) ? 255 : (uint8_t)i;
-        }
-    }
-
-    return &mClip[-kClipMin];
-}
-
 }  // namespace android
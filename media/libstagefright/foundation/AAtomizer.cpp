@@ -54,13 +54,18 @@ const char *AAtomizer::atomize(const char *name) {
 }
 
 // static
-uint32_t AAtomizer::Hash(const char *s) {
+uint32_t AAtomizer::Hash(const char *s, size_t *len) {
+    const char *start = s;
     uint32_t sum = 0;
     while (*s != '\0') {
         sum = (sum * 31) + *s;
         ++s;
     }
 
+    if (len != NULL) {
+        *len = s - start;
+    }
+
     return sum;
 }
 
@@ -23,6 +23,9 @@
 
 #include <sys/time.h>
 
+#include <algorithm>
+#include <atomic>
+
 #include "ALooper.h"
 
 #include "AHandler.h"
@@ -70,7 +73,9 @@ int64_t ALooper::GetNowUs() {
 }
 
 ALooper::ALooper()
-    : mRunningLocally(false) {
+    : mNextSeq(0),
+      mWaiting(false),
+      mRunningLocally(false) {
     // clean up stale AHandlers. Doing it here instead of in the destructor avoids
     // the side effect of objects being deleted from the unregister function recursively.
     gLooperRoster.unregisterStaleHandlers();
@@ -168,29 +173,53 @@ status_t ALooper::stop() {
 void ALooper::post(const sp<AMessage> &msg, int64_t delayUs) {
     Mutex::Autolock autoLock(mLock);
 
-    int64_t whenUs;
-    if (delayUs > 0) {
-        int64_t nowUs = GetNowUs();
-        whenUs = (delayUs > INT64_MAX - nowUs ? INT64_MAX : nowUs + delayUs);
+    int64_t nowUs = GetNowUs();
+
+    Event event;
+    event.mSeq = mNextSeq++;
+    event.mMessage = msg;
 
+    const Event *head = peekEvent_l();
+    int64_t headWhenUs = head == NULL ? INT64_MAX : head->mWhenUs;
+    if (delayUs > 0) {
+        event.mWhenUs = (delayUs > INT64_MAX - nowUs ? INT64_MAX : nowUs + delayUs);
+        mDelayedHeap.push_back(event);
+        std::push_heap(mDelayedHeap.begin(), mDelayedHeap.end());
     } else {
-        whenUs = GetNowUs();
+        // GetNowUs() is monotonic, so appending keeps the FIFO sorted by mWhenUs.
+        event.mWhenUs = nowUs;
+        mImmediateQueue.push_back(event);
     }
 
-    List<Event>::iterator it = mEventQueue.begin();
-    while (it != mEventQueue.end() && (*it).mWhenUs <= whenUs) {
-        ++it;
+    // The looper thread only needs to be woken up if it is waiting and the new
+    // event is due before the one it is waiting for.
+    if (mWaiting && (head == NULL || event.mWhenUs < headWhenUs)) {
+        mQueueChangedCondition.signal();
     }
+}
 
-    Event event;
-    event.mWhenUs = whenUs;
-    event.mMessage = msg;
-
-    if (it == mEventQueue.begin()) {
-        mQueueChangedCondition.signal();
+const ALooper::Event *ALooper::peekEvent_l() const {
+    const Event *immediate = mImmediateQueue.empty() ? NULL : &mImmediateQueue.front();
+    const Event *delayed = mDelayedHeap.empty() ? NULL : &mDelayedHeap.front();
+    if (immediate == NULL) {
+        return delayed;
+    } else if (delayed == NULL) {
+        return immediate;
     }
+    return *immediate < *delayed ? delayed : immediate;
+}
 
-    mEventQueue.insert(it, event);
+void ALooper::popEvent_l(Event *event) {
+    const Event *next = peekEvent_l();
+    CHECK(next != NULL);
+    if (!mImmediateQueue.empty() && next == &mImmediateQueue.front()) {
+        *event = mImmediateQueue.front();
+        mImmediateQueue.pop_front();
+    } else {
+        std::pop_heap(mDelayedHeap.begin(), mDelayedHeap.end());
+        *event = mDelayedHeap.back();
+        mDelayedHeap.pop_back();
+    }
 }
 
 bool ALooper::loop() {
@@ -201,11 +230,14 @@ bool ALooper::loop() {
         if (mThread == NULL && !mRunningLocally) {
             return false;
         }
-        if (mEventQueue.empty()) {
+        const Event *next = peekEvent_l();
+        if (next == NULL) {
+            mWaiting = true;
             mQueueChangedCondition.wait(mLock);
+            mWaiting = false;
             return true;
         }
-        int64_t whenUs = (*mEventQueue.begin()).mWhenUs;
+        int64_t whenUs = next->mWhenUs;
         int64_t nowUs = GetNowUs();
 
         if (whenUs > nowUs) {
@@ -213,13 +245,14 @@ bool ALooper::loop() {
             if (delayUs > INT64_MAX / 1000) {
                 delayUs = INT64_MAX / 1000;
             }
+            mWaiting = true;
             mQueueChangedCondition.waitRelative(mLock, delayUs * 1000ll);
+            mWaiting = false;
 
             return true;
         }
 
-        event = *mEventQueue.begin();
-        mEventQueue.erase(mEventQueue.begin());
+        popEvent_l(&event);
     }
 
     event.mMessage->deliver();
@@ -232,9 +265,76 @@ bool ALooper::loop() {
     return true;
 }
 
+// Returns true if |ref| is the only reference, strong or weak, to its object.
+// No other thread can then make a new reference, not even through
+// wp::promote(), until |ref| is copied.
+template<typename T>
+static bool isOnlyReference(const sp<T> &ref) {
+    // strong references are also counted as weak references
+    if (ref->getWeakRefs()->getWeakCount() != 1) {
+        return false;
+    }
+    // pairs with the release of the previous reference, so that everything the
+    // previous owner did with the object happens before the caller reuses it
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return true;
+}
+
+// to be called by AMessage::Obtain and AMessage::ObtainReply only
+sp<AMessage> ALooper::obtainMessage() {
+    sp<AMessage> msg;
+    {
+        Mutex::Autolock autoLock(mPoolLock);
+        for (const sp<AMessage> &pooled : mMessagePool) {
+            if (isOnlyReference(pooled)) {
+                msg = pooled;
+                break;
+            }
+        }
+        if (msg == NULL) {
+            msg = new AMessage;
+            if (mMessagePool.size() < kMaxPooledMessages) {
+                msg->mPool = this;
+                mMessagePool.push_back(msg);
+            }
+            return msg;
+        }
+    }
+
+    // Pooled messages only hold plain values, but strings and copied item
+    // names are still freed outside of the lock.
+    msg->clear();
+    return msg;
+}
+
+// to be called by AMessage only
+void ALooper::removePooledMessage(const AMessage *msg) {
+    Mutex::Autolock autoLock(mPoolLock);
+    for (auto it = mMessagePool.begin(); it != mMessagePool.end(); ++it) {
+        if (it->get() == msg) {
+            // the caller holds another reference, so this does not destroy msg
+            mMessagePool.erase(it);
+            return;
+        }
+    }
+}
+
 // to be called by AMessage::postAndAwaitResponse only
 sp<AReplyToken> ALooper::createReplyToken() {
-    return new AReplyToken(this);
+    Mutex::Autolock autoLock(mPoolLock);
+    for (const sp<AReplyToken> &pooled : mReplyTokenPool) {
+        if (isOnlyReference(pooled)) {
+            // neither a waiter nor a replier holds the token anymore
+            pooled->reset();
+            return pooled;
+        }
+    }
+
+    sp<AReplyToken> token = new AReplyToken(this);
+    if (mReplyTokenPool.size() < kMaxPooledReplyTokens) {
+        mReplyTokenPool.push_back(token);
+    }
+    return token;
 }
 
 // to be called by AMessage::postAndAwaitResponse only
@@ -65,6 +65,41 @@ AMessage::~AMessage() {
     clear();
 }
 
+// static
+sp<AMessage> AMessage::Obtain(uint32_t what, const sp<const AHandler> &handler) {
+    sp<ALooper> looper = handler == NULL ? NULL : handler->looper();
+    if (looper == NULL) {
+        return new AMessage(what, handler);
+    }
+    sp<AMessage> msg = looper->obtainMessage();
+    msg->setWhat(what);
+    msg->setTarget(handler);
+    return msg;
+}
+
+// static
+sp<AMessage> AMessage::ObtainReply(const sp<AReplyToken> &replyID) {
+    sp<ALooper> looper = replyID == NULL ? NULL : replyID->getLooper();
+    if (looper == NULL) {
+        return new AMessage;
+    }
+    sp<AMessage> msg = looper->obtainMessage();
+    msg->setWhat(0);
+    msg->setTarget(NULL);
+    return msg;
+}
+
+void AMessage::leavePool() {
+    if (mPool.unsafe_get() == NULL) {
+        return;
+    }
+    sp<ALooper> looper = mPool.promote();
+    mPool.clear();
+    if (looper != NULL) {
+        looper->removePooledMessage(this);
+    }
+}
+
 void AMessage::setWhat(uint32_t what) {
     mWhat = what;
 }
@@ -149,13 +184,19 @@ static void reportStats() {
 }
 #endif
 
-inline size_t AMessage::findItemIndex(const char *name, size_t len) const {
+inline size_t AMessage::findItemIndex(const char *name) const {
+    size_t len;
+    uint32_t hash = AAtomizer::Hash(name, &len);
+    return findItemIndex(name, len, hash);
+}
+
+inline size_t AMessage::findItemIndex(const char *name, size_t len, uint32_t hash) const {
 #ifdef DUMP_STATS
     size_t memchecks = 0;
 #endif
     size_t i = 0;
     for (; i < mNumItems; i++) {
-        if (len != mItems[i].mNameLength) {
+        if (hash != mItems[i].mNameHash || len != mItems[i].mNameLength) {
             continue;
         }
 #ifdef DUMP_STATS
@@ -179,15 +220,17 @@ inline size_t AMessage::findItemIndex(const char *name, size_t len) const {
 }
 
 // assumes item's name was uninitialized or NULL
-void AMessage::Item::setName(const char *name, size_t len) {
+void AMessage::Item::setName(const char *name, size_t len, uint32_t hash) {
     mNameLength = len;
+    mNameHash = hash;
     mName = new char[len + 1];
     memcpy((void*)mName, name, len + 1);
 }
 
 AMessage::Item *AMessage::allocateItem(const char *name) {
-    size_t len = strlen(name);
-    size_t i = findItemIndex(name, len);
+    size_t len;
+    uint32_t hash = AAtomizer::Hash(name, &len);
+    size_t i = findItemIndex(name, len, hash);
     Item *item;
 
     if (i < mNumItems) {
@@ -198,7 +241,7 @@ AMessage::Item *AMessage::allocateItem(const char *name) {
         i = mNumItems++;
         item = &mItems[i];
         item->mType = kTypeInt32;
-        item->setName(name, len);
+        item->setName(name, len, hash);
     }
 
     return item;
@@ -206,7 +249,7 @@ AMessage::Item *AMessage::allocateItem(const char *name) {
 
 const AMessage::Item *AMessage::findItem(
         const char *name, Type type) const {
-    size_t i = findItemIndex(name, strlen(name));
+    size_t i = findItemIndex(name);
     if (i < mNumItems) {
         const Item *item = &mItems[i];
         return item->mType == type ? item : NULL;
@@ -216,7 +259,7 @@ const AMessage::Item *AMessage::findItem(
 }
 
 bool AMessage::findAsFloat(const char *name, float *value) const {
-    size_t i = findItemIndex(name, strlen(name));
+    size_t i = findItemIndex(name);
     if (i < mNumItems) {
         const Item *item = &mItems[i];
         switch (item->mType) {
@@ -243,7 +286,7 @@ bool AMessage::findAsFloat(const char *name, float *value) const {
 }
 
 bool AMessage::findAsInt64(const char *name, int64_t *value) const {
-    size_t i = findItemIndex(name, strlen(name));
+    size_t i = findItemIndex(name);
     if (i < mNumItems) {
         const Item *item = &mItems[i];
         switch (item->mType) {
@@ -261,7 +304,7 @@ bool AMessage::findAsInt64(const char *name, int64_t *value) const {
 }
 
 bool AMessage::contains(const char *name) const {
-    size_t i = findItemIndex(name, strlen(name));
+    size_t i = findItemIndex(name);
     return i < mNumItems;
 }
 
@@ -306,6 +349,7 @@ void AMessage::setString(
 
 void AMessage::setObjectInternal(
         const char *name, const sp<RefBase> &obj, Type type) {
+    if (obj != NULL) { leavePool(); }
     Item *item = allocateItem(name);
     item->mType = type;
 
@@ -322,6 +366,7 @@ void AMessage::setBuffer(const char *name, const sp<ABuffer> &buffer) {
 }
 
 void AMessage::setMessage(const char *name, const sp<AMessage> &obj) {
+    if (obj != NULL) { leavePool(); }
     Item *item = allocateItem(name);
     item->mType = kTypeMessage;
 
@@ -426,7 +471,12 @@ status_t AMessage::postAndAwaitResponse(sp<AMessage> *response) {
         ALOGE("failed to create reply token");
         return -ENOMEM;
     }
-    setObject("replyID", token);
+    // The token only refers back to the looper once its reply is retrieved,
+    // so unlike other objects it does not take the message out of its pool.
+    Item *item = allocateItem("replyID");
+    item->mType = kTypeObject;
+    token->incStrong(this);
+    item->u.refValue = token.get();
 
     looper->post(this, 0 /* delayUs */);
     return looper->awaitResponse(token, response);
@@ -478,7 +528,7 @@ sp<AMessage> AMessage::dup() const {
         const Item *from = &mItems[i];
         Item *to = &msg->mItems[i];
 
-        to->setName(from->mName, from->mNameLength);
+        to->setName(from->mName, from->mNameLength, from->mNameHash);
         to->mType = from->mType;
 
         switch (from->mType) {
@@ -742,7 +792,9 @@ sp<AMessage> AMessage::FromParcel(const Parcel &parcel, size_t maxNestingLevel)
             }
         }
 
-        item->setName(name, strlen(name));
+        size_t len;
+        uint32_t hash = AAtomizer::Hash(name, &len);
+        item->setName(name, len, hash);
     }
 
     return msg;
@@ -990,13 +1042,14 @@ status_t AMessage::setEntryNameAt(size_t index, const char *name) {
     if (!strcmp(name, mItems[index].mName)) {
         return OK; // name has not changed
     }
-    size_t len = strlen(name);
-    if (findItemIndex(name, len) < mNumItems) {
+    size_t len;
+    uint32_t hash = AAtomizer::Hash(name, &len);
+    if (findItemIndex(name, len, hash) < mNumItems) {
         return ALREADY_EXISTS;
     }
     delete[] mItems[index].mName;
     mItems[index].mName = nullptr;
-    mItems[index].setName(name, len);
+    mItems[index].setName(name, len, hash);
     return OK;
 }
 
@@ -1034,15 +1087,15 @@ status_t AMessage::setEntryAt(size_t index, const ItemData &item) {
         dst->u.stringValue = new AString(stringValue);
         dst->mType = kTypeString;
     } else if (item.find(&refValue)) {
-        if (refValue != NULL) { refValue->incStrong(this); }
+        if (refValue != NULL) { leavePool(); refValue->incStrong(this); }
         dst->u.refValue = refValue.get();
         dst->mType = kTypeObject;
     } else if (item.find(&msgValue)) {
-        if (msgValue != NULL) { msgValue->incStrong(this); }
+        if (msgValue != NULL) { leavePool(); msgValue->incStrong(this); }
         dst->u.refValue = msgValue.get();
         dst->mType = kTypeMessage;
     } else if (item.find(&bufValue)) {
-        if (bufValue != NULL) { bufValue->incStrong(this); }
+        if (bufValue != NULL) { leavePool(); bufValue->incStrong(this); }
         dst->u.refValue = bufValue.get();
         dst->mType = kTypeBuffer;
     } else {
@@ -1102,7 +1155,7 @@ void AMessage::extend(const sp<AMessage> &other) {
 }
 
 size_t AMessage::findEntryByName(const char *name) const {
-    return name == nullptr ? countEntries() : findItemIndex(name, strlen(name));
+    return name == nullptr ? countEntries() : findItemIndex(name);
 }
 
 }  // namespace android
@@ -26,6 +26,9 @@
 #include <utils/RefBase.h>
 #include <utils/threads.h>
 
+#include <deque>
+#include <vector>
+
 namespace android {
 
 struct AHandler;
@@ -66,7 +69,15 @@ private:
 
     struct Event {
         int64_t mWhenUs;
+        // orders events that are due at the same time by posting order
+        uint64_t mSeq;
         sp<AMessage> mMessage;
+
+        // heap ordering: the event that is due first sorts last
+        bool operator<(const Event &other) const {
+            return mWhenUs > other.mWhenUs
+                    || (mWhenUs == other.mWhenUs && mSeq > other.mSeq);
+        }
     };
 
     Mutex mLock;
@@ -74,7 +85,14 @@ private:
 
     AString mName;
 
-    List<Event> mEventQueue;
+    // Messages posted without a delay are due in posting order, so they are
+    // kept in a FIFO. Delayed messages are kept in a min-heap on mWhenUs.
+    // Both are only accessed with mLock held.
+    std::deque<Event> mImmediateQueue;
+    std::vector<Event> mDelayedHeap;
+    uint64_t mNextSeq;
+    // true while the looper thread is waiting on mQueueChangedCondition
+    bool mWaiting;
 
     struct LooperThread;
     sp<LooperThread> mThread;
@@ -85,12 +103,30 @@ private:
     Mutex mRepliesLock;
     Condition mRepliesCondition;
 
+    // Messages and reply tokens exchanged with handlers of this looper are
+    // recycled once the pool holds their only reference, so that steady-state
+    // per-frame messaging does not allocate. Messages that hold references
+    // are taken out of the pool.
+    enum {
+        kMaxPooledMessages = 16,
+        kMaxPooledReplyTokens = 8,
+    };
+    Mutex mPoolLock;
+    std::vector<sp<AMessage>> mMessagePool;
+    std::vector<sp<AReplyToken>> mReplyTokenPool;
+
     // START --- methods used only by AMessage
 
     // posts a message on this looper with the given timeout
     void post(const sp<AMessage> &msg, int64_t delayUs);
 
-    // creates a reply token to be used with this looper
+    // returns a message from this looper's pool, or a new message
+    sp<AMessage> obtainMessage();
+    // takes a message out of this looper's pool
+    void removePooledMessage(const AMessage *msg);
+
+    // creates a reply token to be used with this looper, reusing a pooled one
+    // when possible
     sp<AReplyToken> createReplyToken();
     // waits for a response for the reply token.  If status is OK, the response
     // is stored into the supplied variable.  Otherwise, it is unchanged.
@@ -103,6 +139,11 @@ private:
 
     bool loop();
 
+    // returns the event that is due first, or NULL if there are no events
+    const Event *peekEvent_l() const;
+    // removes the event that is due first and moves it into |event|
+    void popEvent_l(Event *event);
+
     DISALLOW_EVIL_CONSTRUCTORS(ALooper);
 };
 
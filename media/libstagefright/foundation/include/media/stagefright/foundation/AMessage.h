@@ -57,12 +57,29 @@ private:
     }
     // sets the reply for this token. returns OK or error
     status_t setReply(const sp<AMessage> &reply);
+    // prepares a pooled token for another exchange
+    void reset() {
+        mReply.clear();
+        mReplied = false;
+    }
 };
 
 struct AMessage : public RefBase {
     AMessage();
     AMessage(uint32_t what, const sp<const AHandler> &handler);
 
+    // Returns a message for |handler|, reusing one from the pool of the
+    // handler's looper when possible. A pooled message becomes reusable once
+    // nothing but the pool references it, strongly or weakly. Setting an
+    // object, buffer or message item takes the message out of the pool, so
+    // that the pool never keeps references alive; use this for per-frame
+    // messages that carry plain values.
+    static sp<AMessage> Obtain(uint32_t what, const sp<const AHandler> &handler);
+
+    // Returns an empty message to be posted as the reply for |replyID|,
+    // reusing one from the pool of the looper that awaits the reply.
+    static sp<AMessage> ObtainReply(const sp<AReplyToken> &replyID);
+
     // Construct an AMessage from a parcel.
     // nestingAllowed determines how many levels AMessage can be nested inside
     // AMessage. The default value here is arbitrarily set to 255.
@@ -263,7 +280,7 @@ protected:
     virtual ~AMessage();
 
 private:
-    friend struct ALooper; // deliver()
+    friend struct ALooper; // deliver(), mPool
 
     uint32_t mWhat;
 
@@ -273,6 +290,9 @@ private:
     wp<AHandler> mHandler;
     wp<ALooper> mLooper;
 
+    // the looper whose pool holds this message, if any
+    wp<ALooper> mPool;
+
     struct Item {
         union {
             int32_t int32Value;
@@ -287,8 +307,9 @@ private:
         } u;
         const char *mName;
         size_t      mNameLength;
+        uint32_t    mNameHash;
         Type mType;
-        void setName(const char *name, size_t len);
+        void setName(const char *name, size_t len, uint32_t hash);
     };
 
     enum {
@@ -298,13 +319,16 @@ private:
     size_t mNumItems;
 
     Item *allocateItem(const char *name);
+    // takes the message out of its looper's pool before it holds references
+    void leavePool();
     void freeItemValue(Item *item);
     const Item *findItem(const char *name, Type type) const;
 
     void setObjectInternal(
             const char *name, const sp<RefBase> &obj, Type type);
 
-    size_t findItemIndex(const char *name, size_t len) const;
+    size_t findItemIndex(const char *name) const;
+    size_t findItemIndex(const char *name, size_t len, uint32_t hash) const;
 
     void deliver();
 
@@ -0,0 +1,168 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "ALooper_test"
+
+#include <gtest/gtest.h>
+#include <utils/Log.h>
+#include <utils/threads.h>
+
+#include <media/stagefright/foundation/ADebug.h>
+#include <media/stagefright/foundation/AHandler.h>
+#include <media/stagefright/foundation/ALooper.h>
+#include <media/stagefright/foundation/AMessage.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace android {
+
+class ALooperTest : public ::testing::Test {
+protected:
+    struct Recorder : public AHandler {
+        enum {
+            kWhatRecord,
+            kWhatPoll,
+        };
+
+        Recorder() : mNumPolls(0) { }
+
+        // waits until |count| messages were recorded
+        void waitFor(size_t count) {
+            Mutex::Autolock autoLock(mLock);
+            while (mOrder.size() < count) {
+                mCondition.wait(mLock);
+            }
+        }
+
+        std::vector<int32_t> mOrder;
+        std::vector<int64_t> mLatenciesUs;
+        size_t mNumPolls;
+
+    protected:
+        virtual void onMessageReceived(const sp<AMessage> &msg) {
+            switch (msg->what()) {
+                case kWhatPoll:
+                {
+                    // a periodic poll such as NuPlayer or LiveSession keep on their loopers
+                    ++mNumPolls;
+                    int64_t periodUs;
+                    CHECK(msg->findInt64("periodUs", &periodUs));
+                    msg->post(periodUs);
+                    break;
+                }
+                case kWhatRecord:
+                {
+                    int32_t id;
+                    int64_t postedUs;
+                    CHECK(msg->findInt32("id", &id));
+                    CHECK(msg->findInt64("postedUs", &postedUs));
+                    Mutex::Autolock autoLock(mLock);
+                    mOrder.push_back(id);
+                    mLatenciesUs.push_back(ALooper::GetNowUs() - postedUs);
+                    mCondition.signal();
+                    break;
+                }
+                default:
+                    TRESPASS();
+            }
+        }
+
+    private:
+        Mutex mLock;
+        Condition mCondition;
+    };
+
+    virtual void SetUp() {
+        mLooper = new ALooper;
+        mLooper->setName("ALooper_test");
+        mRecorder = new Recorder;
+        mLooper->registerHandler(mRecorder);
+        ASSERT_EQ(OK, mLooper->start());
+    }
+
+    virtual void TearDown() {
+        mLooper->stop();
+        mLooper->unregisterHandler(mRecorder->id());
+    }
+
+    void post(int32_t id, int64_t delayUs) {
+        sp<AMessage> msg = new AMessage(Recorder::kWhatRecord, mRecorder);
+        msg->setInt32("id", id);
+        msg->setInt64("postedUs", ALooper::GetNowUs());
+        msg->post(delayUs);
+    }
+
+    sp<ALooper> mLooper;
+    sp<Recorder> mRecorder;
+};
+
+TEST_F(ALooperTest, OrderTest) {
+    // delayed messages are delivered by due time, immediate ones in posting order and
+    // ahead of later delayed ones
+    post(4, 40000);
+    post(2, 20000);
+    post(3, 30000);
+    post(0, 0);
+    post(1, 0);
+    post(5, 40000); // same due time as 4 (at best), must follow it
+    mRecorder->waitFor(6);
+
+    std::vector<int32_t> expected = { 0, 1, 2, 3, 4, 5 };
+    EXPECT_EQ(expected, mRecorder->mOrder);
+}
+
+// Measures post-to-deliver latency of immediate messages while many delayed polls share the
+// looper.
+TEST_F(ALooperTest, PostLatencyBenchmark) {
+    static const size_t kNumPolls = 500;
+    static const size_t kNumMessages = 20000;
+
+    for (size_t i = 0; i < kNumPolls; ++i) {
+        sp<AMessage> poll = new AMessage(Recorder::kWhatPoll, mRecorder);
+        int64_t periodUs = 10000 + 100 * i;
+        poll->setInt64("periodUs", periodUs);
+        poll->post(periodUs);
+    }
+
+    int64_t startUs = ALooper::GetNowUs();
+    for (size_t i = 0; i < kNumMessages; ++i) {
+        post(i, 0);
+    }
+    int64_t postedUs = ALooper::GetNowUs();
+    mRecorder->waitFor(kNumMessages);
+    int64_t deliveredUs = ALooper::GetNowUs();
+
+    for (size_t i = 0; i < kNumMessages; ++i) {
+        ASSERT_EQ((int32_t)i, mRecorder->mOrder[i]);
+    }
+
+    std::vector<int64_t> latencies = mRecorder->mLatenciesUs;
+    std::sort(latencies.begin(), latencies.end());
+    ALOGI("%zu posts with %zu pending polls: post %.2f us/msg, all delivered after %lld us, "
+            "latency p50 %lld us p99 %lld us",
+            kNumMessages, kNumPolls, (postedUs - startUs) / (double)kNumMessages,
+            (long long)(deliveredUs - startUs),
+            (long long)latencies[latencies.size() / 2],
+            (long long)latencies[latencies.size() * 99 / 100]);
+    printf("[ BENCH    ] post %.2f us/msg, latency p50 %lld us p99 %lld us\n",
+            (postedUs - startUs) / (double)kNumMessages,
+            (long long)latencies[latencies.size() / 2],
+            (long long)latencies[latencies.size() * 99 / 100]);
+}
+
+} // namespace android
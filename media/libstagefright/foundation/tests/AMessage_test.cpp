@@ -0,0 +1,243 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "AMessage_test"
+
+#include <gtest/gtest.h>
+#include <utils/Log.h>
+
+#include <binder/Parcel.h>
+#include <media/stagefright/foundation/ABuffer.h>
+#include <media/stagefright/foundation/ADebug.h>
+#include <media/stagefright/foundation/AHandler.h>
+#include <media/stagefright/foundation/ALooper.h>
+#include <media/stagefright/foundation/AMessage.h>
+#include <media/stagefright/foundation/AString.h>
+
+#include <set>
+
+namespace android {
+
+class AMessageTest : public ::testing::Test {
+};
+
+TEST_F(AMessageTest, NameMatchTest) {
+    sp<AMessage> msg = new AMessage;
+    msg->setInt64("timeUs", 1234ll);
+    int64_t timeUs;
+    EXPECT_TRUE(msg->findInt64("timeUs", &timeUs));
+    EXPECT_EQ(1234ll, timeUs);
+
+    // a name built at run time finds the item set with a literal
+    AString name("time");
+    name.append("Us");
+    msg->setInt64(name.c_str(), 5678ll);
+    EXPECT_EQ(1u, msg->countEntries());
+    EXPECT_TRUE(msg->findInt64("timeUs", &timeUs));
+    EXPECT_EQ(5678ll, timeUs);
+
+    // names that only differ in length or content must not match
+    char other[] = "timeUs2";
+    msg->setInt32(other, 1);
+    other[6] = '\0';
+    EXPECT_EQ(0u, msg->findEntryByName(other));
+    EXPECT_EQ(1u, msg->findEntryByName("timeUs2"));
+    EXPECT_FALSE(msg->contains("timeU"));
+    EXPECT_FALSE(msg->contains("timeUt"));
+
+    // "Aa" and "BB" have the same hash
+    msg->setInt32("Aa", 1);
+    msg->setInt32("BB", 2);
+    int32_t value;
+    EXPECT_TRUE(msg->findInt32("Aa", &value));
+    EXPECT_EQ(1, value);
+    EXPECT_TRUE(msg->findInt32("BB", &value));
+    EXPECT_EQ(2, value);
+
+    sp<AMessage> dup = msg->dup();
+    EXPECT_TRUE(dup->findInt32("BB", &value));
+    EXPECT_EQ(2, value);
+    EXPECT_EQ(OK, dup->setEntryNameAt(1, "flags"));
+    EXPECT_EQ(ALREADY_EXISTS, dup->setEntryNameAt(1, "timeUs"));
+    EXPECT_TRUE(dup->contains("flags"));
+    EXPECT_TRUE(msg->contains("timeUs2"));
+    EXPECT_EQ(OK, dup->removeEntryAt(0));
+    EXPECT_FALSE(dup->contains("timeUs"));
+    EXPECT_TRUE(dup->contains("BB"));
+    EXPECT_TRUE(msg->contains("timeUs"));
+}
+
+TEST_F(AMessageTest, ParcelKeyTest) {
+    sp<AMessage> msg = new AMessage;
+    msg->setInt32("parcel-key", 42);
+    msg->setString("mime", "video/avc");
+
+    Parcel parcel;
+    msg->writeToParcel(&parcel);
+    parcel.setDataPosition(0);
+    sp<AMessage> other = AMessage::FromParcel(parcel);
+    ASSERT_NE(nullptr, other.get());
+
+    // names from a parcel are found like any other
+    int32_t value;
+    EXPECT_TRUE(other->findInt32("parcel-key", &value));
+    EXPECT_EQ(42, value);
+    AString mime;
+    EXPECT_TRUE(other->findString("mime", &mime));
+    EXPECT_EQ(AString("video/avc"), mime);
+
+    sp<AMessage> dup = other->dup();
+    other.clear();
+    EXPECT_TRUE(dup->findInt32("parcel-key", &value));
+    EXPECT_EQ(42, value);
+}
+
+// Measures the message shapes exchanged per frame between ACodec and MediaCodec.
+TEST_F(AMessageTest, NameLookupBenchmark) {
+    static const size_t kNumIterations = 100000;
+    static const char *kNames[] = {
+        "buffer-id", "buffer", "reply", "flags", "timeUs", "range-offset", "range-length",
+        "index", "offset", "size", "type", "node", "event", "data1", "data2",
+    };
+    static const size_t kNumNames = sizeof(kNames) / sizeof(kNames[0]);
+    sp<ABuffer> buffer = new ABuffer(16);
+
+    int64_t startUs = ALooper::GetNowUs();
+    for (size_t n = 0; n < kNumIterations; ++n) {
+        sp<AMessage> msg = new AMessage;
+        for (size_t i = 0; i < kNumNames; ++i) {
+            if (i == 1) {
+                msg->setBuffer(kNames[i], buffer);
+            } else {
+                msg->setInt64(kNames[i], (int64_t)(n + i));
+            }
+        }
+        int64_t value;
+        for (size_t i = kNumNames; i > 0; --i) {
+            if (i - 1 != 1) {
+                EXPECT_TRUE(msg->findInt64(kNames[i - 1], &value));
+            }
+        }
+        sp<AMessage> dup = msg->dup();
+        EXPECT_TRUE(dup->findInt64(kNames[kNumNames - 1], &value));
+    }
+    int64_t elapsedUs = ALooper::GetNowUs() - startUs;
+    printf("[ BENCH    ] %zu messages of %zu items: %.1f ns/msg\n",
+            kNumIterations, kNumNames, elapsedUs * 1000. / kNumIterations);
+}
+
+struct Replier : public AHandler {
+    enum {
+        kWhatRequest,
+    };
+
+    // the objects of the last exchange, only used to tell whether they came
+    // from the pools
+    const AMessage *mRequest = nullptr;
+    const AReplyToken *mReplyToken = nullptr;
+
+protected:
+    virtual void onMessageReceived(const sp<AMessage> &msg) {
+        CHECK_EQ(msg->what(), (uint32_t)kWhatRequest);
+        sp<AReplyToken> replyID;
+        int32_t value;
+        CHECK(msg->senderAwaitsResponse(&replyID));
+        CHECK(msg->findInt32("value", &value));
+        mRequest = msg.get();
+        mReplyToken = replyID.get();
+
+        sp<AMessage> response = AMessage::ObtainReply(replyID);
+        response->setInt32("value", value + 1);
+        response->postReply(replyID);
+    }
+};
+
+// Verifies that a MediaCodec-style synchronous request/reply exchange only uses
+// pooled messages and reply tokens once the looper's pools are warmed up.
+// Pooled objects live as long as the looper, so any object that was not seen
+// during the warm-up was newly allocated.
+TEST_F(AMessageTest, PooledReplyTest) {
+    static const int32_t kNumWarmUps = 100;
+    static const int32_t kNumRequests = 1000;
+
+    sp<ALooper> looper = new ALooper;
+    sp<Replier> replier = new Replier;
+    looper->registerHandler(replier);
+    ASSERT_EQ(OK, looper->start());
+
+    std::set<const void *> pooled;
+    size_t numNew = 0;
+    int32_t numBadReplies = 0;
+    for (int32_t i = 0; i < kNumWarmUps + kNumRequests; ++i) {
+        sp<AMessage> msg = AMessage::Obtain(Replier::kWhatRequest, replier);
+        msg->setInt32("value", i);
+        sp<AMessage> response;
+        int32_t value;
+        if (msg->postAndAwaitResponse(&response) != OK
+                || !response->findInt32("value", &value) || value != i + 1) {
+            ++numBadReplies;
+            continue;
+        }
+        EXPECT_EQ(msg.get(), replier->mRequest);
+
+        for (const void *obj : { (const void *)msg.get(), (const void *)response.get(),
+                (const void *)replier->mReplyToken }) {
+            if (i < kNumWarmUps) {
+                pooled.insert(obj);
+            } else if (pooled.count(obj) == 0) {
+                ++numNew;
+            }
+        }
+    }
+
+    EXPECT_EQ(0, numBadReplies);
+    EXPECT_EQ(0u, numNew);
+    EXPECT_LE(pooled.size(), 8u);
+    ALOGI("%zu objects allocated for %d pooled requests", numNew, kNumRequests);
+
+    looper->stop();
+    looper->unregisterHandler(replier->id());
+}
+
+TEST_F(AMessageTest, PooledReferenceTest) {
+    sp<ALooper> looper = new ALooper;
+    sp<Replier> replier = new Replier;
+    looper->registerHandler(replier);
+
+    // a message that is weakly referenced is not reused
+    sp<AMessage> msg = AMessage::Obtain(Replier::kWhatRequest, replier);
+    const AMessage *first = msg.get();
+    wp<AMessage> weak = msg;
+    msg.clear();
+    msg = AMessage::Obtain(Replier::kWhatRequest, replier);
+    EXPECT_NE(first, msg.get());
+    msg.clear();
+    EXPECT_NE(nullptr, weak.promote().get());
+
+    // a message that holds a reference leaves the pool, and releases the
+    // reference with its last user
+    msg = AMessage::Obtain(Replier::kWhatRequest, replier);
+    sp<ABuffer> buffer = new ABuffer(16);
+    msg->setBuffer("buffer", buffer);
+    EXPECT_EQ(2, buffer->getStrongCount());
+    msg.clear();
+    EXPECT_EQ(1, buffer->getStrongCount());
+
+    looper->unregisterHandler(replier->id());
+}
+
+} // namespace android
@@ -9,12 +9,15 @@ LOCAL_MODULE_TAGS := tests
 
 LOCAL_SRC_FILES := \
 	AData_test.cpp \
+	ALooper_test.cpp \
+	AMessage_test.cpp \
 	Base64_test.cpp \
 	Flagged_test.cpp \
 	TypeTraits_test.cpp \
 	Utils_test.cpp \
 
 LOCAL_SHARED_LIBRARIES := \
+	libbinder \
 	liblog \
 	libstagefright_foundation \
 	libutils \
@@ -66,9 +66,11 @@ struct HTTPDownloader : public RefBase {
             sp<ABuffer> *out,
             String8 *actualUrl = NULL);
 
-    // fetch a playlist file
+    // fetch a playlist file, reusing what is unchanged from the previous
+    // version of it if given
     sp<M3UParser> fetchPlaylist(
-            const char *url, uint8_t *curPlaylistHash, bool *unchanged);
+            const char *url, uint8_t *curPlaylistHash, bool *unchanged,
+            const sp<M3UParser> &previous = NULL);
 
 private:
     sp<HTTPBase> mHTTPDataSource;
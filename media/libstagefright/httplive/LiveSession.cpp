@@ -22,6 +22,7 @@
 #include "HTTPDownloader.h"
 #include "M3UParser.h"
 #include "PlaylistFetcher.h"
+#include "SegmentPrefetcher.h"
 
 #include "mpeg2ts/AnotherPacketSource.h"
 
@@ -48,6 +49,7 @@ const int64_t LiveSession::kUpSwitchMarkUs = 15000000LL;
 const int64_t LiveSession::kDownSwitchMarkUs = 20000000LL;
 const int64_t LiveSession::kUpSwitchMarginUs = 5000000LL;
 const int64_t LiveSession::kResumeThresholdUs = 100000LL;
+const int32_t LiveSession::kMaxPrefetchSegments = 8;
 
 //TODO: redefine this mark to a fair value
 // default buffer underflow mark
@@ -494,6 +496,17 @@ sp<HTTPDownloader> LiveSession::getHTTPDownloader() {
     return new HTTPDownloader(mHTTPService, mExtraHeaders);
 }
 
+sp<SegmentPrefetcher> LiveSession::getSegmentPrefetcher() {
+    // The number of segments a fetcher may download concurrently; with 1 it
+    // downloads them one after the other.
+    int32_t maxDownloads = property_get_int32("media.httplive.prefetch-segments", 1);
+    if (maxDownloads <= 1) {
+        return NULL;
+    }
+    return new SegmentPrefetcher(
+            mHTTPService, mExtraHeaders, min(maxDownloads, kMaxPrefetchSegments));
+}
+
 void LiveSession::setBufferingSettings(
         const BufferingSettings &buffering) {
     sp<AMessage> msg = new AMessage(kWhatSetBufferingSettings, this);
@@ -39,6 +39,7 @@ struct M3UParser;
 struct PlaylistFetcher;
 struct HLSTime;
 struct HTTPDownloader;
+struct SegmentPrefetcher;
 
 struct LiveSession : public AHandler {
     enum Flags {
@@ -82,6 +83,9 @@ struct LiveSession : public AHandler {
 
     sp<HTTPDownloader> getHTTPDownloader();
 
+    // Returns NULL unless segments are to be downloaded ahead of time.
+    sp<SegmentPrefetcher> getSegmentPrefetcher();
+
     void connectAsync(
             const char *url,
             const KeyedVector<String8, String8> *headers = NULL);
@@ -141,6 +145,8 @@ private:
     static const int64_t kUpSwitchMarginUs;
     static const int64_t kResumeThresholdUs;
 
+    static const int32_t kMaxPrefetchSegments;
+
     // Buffer Prepare/Ready/Underflow Marks
     BufferingSettings mBufferingSettings;
 
@@ -249,7 +249,8 @@ bool M3UParser::MediaGroup::getActiveURI(AString *uri, const char *baseURL) cons
 ////////////////////////////////////////////////////////////////////////////////
 
 M3UParser::M3UParser(
-        const char *baseURI, const void *data, size_t size)
+        const char *baseURI, const void *data, size_t size,
+        const sp<M3UParser> &previous)
     : mInitCheck(NO_INIT),
       mBaseURI(baseURI),
       mIsExtM3U(false),
@@ -262,7 +263,7 @@ M3UParser::M3UParser(
       mDiscontinuitySeq(0),
       mDiscontinuityCount(0),
       mSelectedIndex(-1) {
-    mInitCheck = parse(data, size);
+    mInitCheck = parse(data, size, previous);
 }
 
 M3UParser::~M3UParser() {
@@ -565,10 +566,155 @@ AString M3UParser::MediaGroup::Media::makeURL(const char *baseURL) const {
     return out;
 }
 
-status_t M3UParser::parse(const void *_data, size_t size) {
+static bool LineStartsWith(const char *line, size_t length, const char *prefix) {
+    size_t prefixLength = strlen(prefix);
+    return length >= prefixLength && !memcmp(line, prefix, prefixLength);
+}
+
+// Tags that apply to the media segment following them.
+static bool IsItemTag(const char *line, size_t length) {
+    if (LineStartsWith(line, length, "#EXT-X-DISCONTINUITY")) {
+        return !LineStartsWith(line, length, "#EXT-X-DISCONTINUITY-SEQUENCE");
+    }
+    return LineStartsWith(line, length, "#EXTINF")
+            || LineStartsWith(line, length, "#EXT-X-KEY")
+            || LineStartsWith(line, length, "#EXT-X-BYTERANGE");
+}
+
+// Tags that apply to the whole playlist.
+static bool IsPlaylistTag(const char *line, size_t length) {
+    return LineStartsWith(line, length, "#EXT-X-TARGETDURATION")
+            || LineStartsWith(line, length, "#EXT-X-MEDIA")
+            || LineStartsWith(line, length, "#EXT-X-ENDLIST")
+            || LineStartsWith(line, length, "#EXT-X-PLAYLIST-TYPE")
+            || LineStartsWith(line, length, "#EXT-X-DISCONTINUITY-SEQUENCE")
+            || LineStartsWith(line, length, "#EXT-X-STREAM-INF");
+}
+
+static const uint64_t kItemHashSeed = 14695981039346656037ULL;
+
+// FNV-1a
+__attribute__((no_sanitize("integer")))
+static uint64_t HashBytes(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t HashItemLine(uint64_t hash, const char *line, size_t length) {
+    return HashBytes(HashBytes(hash, line, length), "\n", 1);
+}
+
+// The meta of an item also depends on the discontinuity sequence it ends up
+// in and, if it has a byte range without an offset, where the previous byte
+// range ended.
+static uint64_t HashItemState(
+        uint64_t hash, uint64_t discontinuitySeq, uint64_t rangeOffset) {
+    hash = HashBytes(hash, &discontinuitySeq, sizeof(discontinuitySeq));
+    return HashBytes(hash, &rangeOffset, sizeof(rangeOffset));
+}
+
+// Called at the first line of an item. If the previous playlist has the item
+// with the same sequence number and it was parsed from the same lines in the
+// same state, appends it and skips its lines.
+bool M3UParser::reuseItem(
+        const sp<M3UParser> &previous, const char *data, size_t size,
+        size_t *offset, uint64_t *segmentRangeOffset) {
+    int32_t firstSeqNumber = 0;
+    if (mMeta != NULL) {
+        mMeta->findInt32("media-sequence", &firstSeqNumber);
+    }
+    int64_t index = (int64_t)firstSeqNumber + (int64_t)mItems.size() - previous->mFirstSeqNumber;
+    if (index < 0 || index >= (int64_t)previous->mItems.size()) {
+        return false;
+    }
+    const Item &item = previous->mItems.itemAt(index);
+
+    uint64_t hash = kItemHashSeed;
+    int32_t discontinuityCount = 0;
+    bool hasRange = false;
+
+    size_t lineOffset = *offset;
+    while (lineOffset < size) {
+        size_t offsetLF = lineOffset;
+        while (offsetLF < size && data[offsetLF] != '\n') {
+            ++offsetLF;
+        }
+
+        const char *line = &data[lineOffset];
+        size_t length = offsetLF - lineOffset;
+        if (length > 0 && line[length - 1] == '\r') {
+            --length;
+        }
+        lineOffset = offsetLF + 1;
+
+        if (length == 0) {
+            continue;
+        }
+
+        if (line[0] != '#') {
+            if (length != item.mURI.size() || memcmp(line, item.mURI.c_str(), length)) {
+                return false;
+            }
+            hash = HashItemLine(hash, line, length);
+            hash = HashItemState(
+                    hash, mDiscontinuitySeq + mDiscontinuityCount + discontinuityCount,
+                    hasRange ? *segmentRangeOffset : 0);
+            if (hash != item.mHash) {
+                return false;
+            }
+
+            int64_t rangeOffset = 0, rangeLength = 0;
+            if (hasRange && (!item.mMeta->findInt64("range-offset", &rangeOffset)
+                    || !item.mMeta->findInt64("range-length", &rangeLength))) {
+                return false;
+            }
+
+            mItems.push(item);
+            mDiscontinuityCount += discontinuityCount;
+            if (hasRange) {
+                *segmentRangeOffset = rangeOffset + rangeLength;
+            }
+            *offset = lineOffset;
+            return true;
+        }
+
+        if (IsItemTag(line, length)) {
+            hash = HashItemLine(hash, line, length);
+            if (LineStartsWith(line, length, "#EXT-X-DISCONTINUITY")) {
+                ++discontinuityCount;
+            } else if (LineStartsWith(line, length, "#EXT-X-BYTERANGE")) {
+                hasRange = true;
+            }
+        } else if (IsPlaylistTag(line, length)) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+status_t M3UParser::parse(
+        const void *_data, size_t size, const sp<M3UParser> &previous) {
     int32_t lineNo = 0;
 
     sp<AMessage> itemMeta;
+    uint64_t itemHash = kItemHashSeed;
+    bool itemHasRange = false;
+    uint64_t itemRangeOffset = 0;
+
+    // Items of a refreshed media playlist that are still listed are shared
+    // with the previous playlist instead of being parsed again.
+    const bool canReuse = previous != NULL
+            && previous->mInitCheck == OK
+            && !previous->mIsVariantPlaylist
+            && previous->mBaseURI == mBaseURI;
+    bool reuse = canReuse;
+    if (canReuse) {
+        mItems.setCapacity(previous->mItems.size());
+    }
 
     const char *data = (const char *)_data;
     size_t offset = 0;
@@ -579,13 +725,23 @@ status_t M3UParser::parse(const void *_data, size_t size) {
             ++offsetLF;
         }
 
-        AString line;
-        if (offsetLF > offset && data[offsetLF - 1] == '\r') {
-            line.setTo(&data[offset], offsetLF - offset - 1);
-        } else {
-            line.setTo(&data[offset], offsetLF - offset);
+        size_t length = offsetLF - offset;
+        if (length > 0 && data[offsetLF - 1] == '\r') {
+            --length;
+        }
+
+        if (reuse && mIsExtM3U && !mIsVariantPlaylist && length > 0
+                && (data[offset] != '#' || IsItemTag(&data[offset], length))) {
+            if (reuseItem(previous, data, size, &offset, &segmentRangeOffset)) {
+                ++lineNo;
+                continue;
+            }
+            reuse = false;
         }
 
+        AString line;
+        line.setTo(&data[offset], length);
+
         // ALOGI("#%s#", line.c_str());
 
         if (line.empty()) {
@@ -656,6 +812,11 @@ status_t M3UParser::parse(const void *_data, size_t size) {
                     return ERROR_MALFORMED;
                 }
 
+                if (!itemHasRange) {
+                    itemRangeOffset = segmentRangeOffset;
+                    itemHasRange = true;
+                }
+
                 uint64_t length, offset;
                 err = parseByteRange(line, segmentRangeOffset, &length, &offset);
 
@@ -676,6 +837,10 @@ status_t M3UParser::parse(const void *_data, size_t size) {
             if (err != OK) {
                 return err;
             }
+
+            if (IsItemTag(line.c_str(), line.size())) {
+                itemHash = HashItemLine(itemHash, line.c_str(), line.size());
+            }
         }
 
         if (!line.startsWith("#")) {
@@ -699,7 +864,15 @@ status_t M3UParser::parse(const void *_data, size_t size) {
 
             item->mMeta = itemMeta;
 
+            item->mHash = HashItemState(
+                    HashItemLine(itemHash, line.c_str(), line.size()),
+                    mDiscontinuitySeq + mDiscontinuityCount,
+                    itemHasRange ? itemRangeOffset : 0);
+
             itemMeta.clear();
+            itemHash = kItemHashSeed;
+            itemHasRange = false;
+            reuse = canReuse;
         }
 
         offset = offsetLF + 1;
@@ -731,7 +904,8 @@ status_t M3UParser::parse(const void *_data, size_t size) {
         mLastSeqNumber = mFirstSeqNumber + mItems.size() - 1;
     }
 
-    for (size_t i = 0; i < mItems.size(); ++i) {
+    // Only the items of a variant playlist refer to media groups.
+    for (size_t i = 0; mIsVariantPlaylist && i < mItems.size(); ++i) {
         sp<AMessage> meta = mItems.itemAt(i).mMeta;
         const char *keys[] = {"audio", "video", "subtitles"};
         for (size_t j = 0; j < sizeof(keys) / sizeof(const char *); ++j) {
@@ -27,7 +27,11 @@
 namespace android {
 
 struct M3UParser : public RefBase {
-    M3UParser(const char *baseURI, const void *data, size_t size);
+    // If |previous| is a refresh of the same media playlist, the items it
+    // still lists are shared with it instead of being parsed again, so only
+    // the segments appended since are parsed.
+    M3UParser(const char *baseURI, const void *data, size_t size,
+              const sp<M3UParser> &previous = NULL);
 
     status_t initCheck() const;
 
@@ -64,6 +68,9 @@ private:
     struct Item {
         AString mURI;
         sp<AMessage> mMeta;
+        // Hash of the lines the item was parsed from and of the parser state
+        // they depend on, used to recognize the item in a refresh.
+        uint64_t mHash;
         AString makeURL(const char *baseURL) const;
     };
 
@@ -87,7 +94,11 @@ private:
     // Media groups keyed by group ID.
     KeyedVector<AString, sp<MediaGroup> > mMediaGroups;
 
-    status_t parse(const void *data, size_t size);
+    status_t parse(const void *data, size_t size, const sp<M3UParser> &previous);
+
+    bool reuseItem(
+            const sp<M3UParser> &previous, const char *data, size_t size,
+            size_t *offset, uint64_t *segmentRangeOffset);
 
     static status_t parseMetaData(
             const AString &line, sp<AMessage> *meta, const char *key);
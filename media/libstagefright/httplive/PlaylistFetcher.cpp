@@ -24,6 +24,7 @@
 #include "HTTPDownloader.h"
 #include "LiveSession.h"
 #include "M3UParser.h"
+#include "SegmentPrefetcher.h"
 #include "include/ID3.h"
 #include "mpeg2ts/AnotherPacketSource.h"
 #include "mpeg2ts/HlsSampleDecryptor.h"
@@ -52,6 +53,9 @@ namespace android {
 // static
 const int64_t PlaylistFetcher::kMinBufferedDurationUs = 30000000LL;
 const int64_t PlaylistFetcher::kMaxMonitorDelayUs = 3000000LL;
+// how long to block the looper waiting for a prefetched segment before
+// checking for messages again
+const int64_t PlaylistFetcher::kPrefetchWaitUs = 100000LL;
 // LCM of 188 (size of a TS packet) & 1k works well
 const int32_t PlaylistFetcher::kDownloadBlockSize = 47 * 1024;
 
@@ -179,6 +183,7 @@ PlaylistFetcher::PlaylistFetcher(
       mHasMetadata(false) {
     memset(mPlaylistHash, 0, sizeof(mPlaylistHash));
     mHTTPDownloader = mSession->getHTTPDownloader();
+    mSegmentPrefetcher = mSession->getSegmentPrefetcher();
 
     memset(mKeyData, 0, sizeof(mKeyData));
     memset(mAESInitVec, 0, sizeof(mAESInitVec));
@@ -523,6 +528,9 @@ void PlaylistFetcher::setStoppingThreshold(float thresholdRatio, bool disconnect
     }
     if (disconnect) {
         mHTTPDownloader->disconnect();
+        if (mSegmentPrefetcher != NULL) {
+            mSegmentPrefetcher->disconnect();
+        }
     }
 }
 
@@ -533,9 +541,15 @@ void PlaylistFetcher::resetStoppingThreshold(bool disconnect) {
     }
     if (disconnect) {
         mHTTPDownloader->disconnect();
+        if (mSegmentPrefetcher != NULL) {
+            mSegmentPrefetcher->disconnect();
+        }
     } else {
         // allow reconnect
         mHTTPDownloader->reconnect();
+        if (mSegmentPrefetcher != NULL) {
+            mSegmentPrefetcher->reconnect();
+        }
     }
 }
 
@@ -777,6 +791,9 @@ status_t PlaylistFetcher::onStart(const sp<AMessage> &msg) {
         mSeqNumber = -1;
         mTimeChangeSignaled = false;
         mDownloadState->resetState();
+        if (mSegmentPrefetcher != NULL) {
+            mSegmentPrefetcher->clear();
+        }
     }
 
     postMonitorQueue();
@@ -846,36 +863,14 @@ void PlaylistFetcher::queueDiscontinuity(
     }
 }
 
-void PlaylistFetcher::onMonitorQueue() {
-    // in the middle of an unfinished download, delay
-    // playlist refresh as it'll change seq numbers
-    if (!mDownloadState->hasSavedState()) {
-        status_t err = refreshPlaylist();
-        if (err != OK) {
-            if (mNumRetriesForMonitorQueue < kMaxNumRetries) {
-                ++mNumRetriesForMonitorQueue;
-            } else {
-                notifyError(err);
-            }
-            return;
-        } else {
-            mNumRetriesForMonitorQueue = 0;
-        }
-    }
-
-    int64_t targetDurationUs = kMinBufferedDurationUs;
-    if (mPlaylist != NULL) {
-        targetDurationUs = mPlaylist->getTargetDuration();
-    }
-
+int64_t PlaylistFetcher::getBufferedDurationUs(status_t *finalResult) {
     int64_t bufferedDurationUs = 0LL;
-    status_t finalResult = OK;
     if (mStreamTypeMask == LiveSession::STREAMTYPE_SUBTITLES) {
         sp<AnotherPacketSource> packetSource =
             mPacketSources.valueFor(LiveSession::STREAMTYPE_SUBTITLES);
 
         bufferedDurationUs =
-                packetSource->getBufferedDurationUs(&finalResult);
+                packetSource->getBufferedDurationUs(finalResult);
     } else {
         // Use min stream duration, but ignore streams that never have any packet
         // enqueued to prevent us from waiting on a non-existent stream;
@@ -889,7 +884,7 @@ void PlaylistFetcher::onMonitorQueue() {
             }
 
             int64_t bufferedStreamDurationUs =
-                mPacketSources.valueAt(i)->getBufferedDurationUs(&finalResult);
+                mPacketSources.valueAt(i)->getBufferedDurationUs(finalResult);
 
             FSLOGV(mPacketSources.keyAt(i), "buffered %lld", (long long)bufferedStreamDurationUs);
 
@@ -903,6 +898,34 @@ void PlaylistFetcher::onMonitorQueue() {
         }
     }
 
+    return bufferedDurationUs;
+}
+
+void PlaylistFetcher::onMonitorQueue() {
+    // in the middle of an unfinished download, delay
+    // playlist refresh as it'll change seq numbers
+    if (!mDownloadState->hasSavedState()) {
+        status_t err = refreshPlaylist();
+        if (err != OK) {
+            if (mNumRetriesForMonitorQueue < kMaxNumRetries) {
+                ++mNumRetriesForMonitorQueue;
+            } else {
+                notifyError(err);
+            }
+            return;
+        } else {
+            mNumRetriesForMonitorQueue = 0;
+        }
+    }
+
+    int64_t targetDurationUs = kMinBufferedDurationUs;
+    if (mPlaylist != NULL) {
+        targetDurationUs = mPlaylist->getTargetDuration();
+    }
+
+    status_t finalResult = OK;
+    int64_t bufferedDurationUs = getBufferedDurationUs(&finalResult);
+
     if (finalResult == OK && bufferedDurationUs < kMinBufferedDurationUs) {
         FLOGV("monitoring, buffered=%lld < %lld",
                 (long long)bufferedDurationUs, (long long)kMinBufferedDurationUs);
@@ -934,8 +957,10 @@ void PlaylistFetcher::onMonitorQueue() {
 status_t PlaylistFetcher::refreshPlaylist() {
     if (delayUsToRefreshPlaylist() <= 0) {
         bool unchanged;
+        // A refreshed live playlist mostly lists the same segments as the
+        // last one; only those appended since need to be parsed.
         sp<M3UParser> playlist = mHTTPDownloader->fetchPlaylist(
-                mURI.c_str(), mPlaylistHash, &unchanged);
+                mURI.c_str(), mPlaylistHash, &unchanged, mPlaylist);
 
         if (playlist == NULL) {
             if (unchanged) {
@@ -1325,6 +1350,42 @@ bool PlaylistFetcher::initDownloadState(
     return true;
 }
 
+void PlaylistFetcher::prefetchSegments(
+        int32_t firstSeqNumberInPlaylist, int32_t lastSeqNumberInPlaylist) {
+    // Besides the segment about to be parsed, download the ones after it as
+    // long as they fit in what remains to be buffered.
+    status_t finalResult = OK;
+    int64_t remainingUs = kMinBufferedDurationUs - getBufferedDurationUs(&finalResult);
+
+    for (int32_t seqNumber = mSeqNumber; seqNumber <= lastSeqNumberInPlaylist; ++seqNumber) {
+        if (seqNumber > mSeqNumber && remainingUs <= 0) {
+            break;
+        }
+
+        AString uri;
+        sp<AMessage> itemMeta;
+        if (!mPlaylist->itemAt(seqNumber - firstSeqNumberInPlaylist, &uri, &itemMeta)) {
+            break;
+        }
+
+        int64_t rangeOffset, rangeLength;
+        if (!itemMeta->findInt64("range-offset", &rangeOffset)
+                || !itemMeta->findInt64("range-length", &rangeLength)) {
+            rangeOffset = 0;
+            rangeLength = -1;
+        }
+
+        if (!mSegmentPrefetcher->prefetch(uri, rangeOffset, rangeLength)) {
+            break;
+        }
+
+        int64_t itemDurationUs;
+        if (itemMeta->findInt64("durationUs", &itemDurationUs)) {
+            remainingUs -= itemDurationUs;
+        }
+    }
+}
+
 void PlaylistFetcher::onDownloadNext() {
     AString uri;
     sp<AMessage> itemMeta;
@@ -1342,7 +1403,8 @@ void PlaylistFetcher::onDownloadNext() {
                 tsBuffer,
                 firstSeqNumberInPlaylist,
                 lastSeqNumberInPlaylist);
-        connectHTTP = false;
+        // A segment that was still being prefetched is taken again.
+        connectHTTP = (buffer == NULL);
         FLOGV("resuming: '%s'", uri.c_str());
     } else {
         if (!initDownloadState(
@@ -1362,15 +1424,65 @@ void PlaylistFetcher::onDownloadNext() {
         range_length = -1;
     }
 
+    // If the segments are downloaded ahead of time, wait for all of this one
+    // instead of downloading it block by block.
+    sp<ABuffer> prefetchedBuffer;
+    SegmentPrefetcher::Timing timing;
+    if (mSegmentPrefetcher != NULL && connectHTTP) {
+        prefetchSegments(firstSeqNumberInPlaylist, lastSeqNumberInPlaylist);
+
+        status_t err = mSegmentPrefetcher->take(
+                uri, range_offset, range_length, kPrefetchWaitUs, &prefetchedBuffer, &timing);
+        if (err == -EAGAIN) {
+            // Still downloading; let the looper handle pause, stop and seek
+            // before waiting again.
+            mDownloadState->saveState(
+                    uri,
+                    itemMeta,
+                    buffer,
+                    tsBuffer,
+                    firstSeqNumberInPlaylist,
+                    lastSeqNumberInPlaylist);
+            sp<AMessage> msg = new AMessage(kWhatDownloadNext, this);
+            msg->setInt32("generation", mMonitorQueueGeneration);
+            msg->post();
+            return;
+        } else if (err == ERROR_NOT_CONNECTED) {
+            return;
+        } else if (err == OK) {
+            FLOGV("segment %d: %zu bytes, downloaded in %lld us, "
+                    "%lld us after it was queued, %lld us before it was taken, "
+                    "link busy %lld us",
+                    mSeqNumber, timing.mBytes,
+                    (long long)(timing.mCompletedUs - timing.mStartedUs),
+                    (long long)(timing.mCompletedUs - timing.mQueuedUs),
+                    (long long)(timing.mTakenUs - timing.mCompletedUs),
+                    (long long)timing.mBusyUs);
+        } else if (err != NAME_NOT_FOUND) {
+            ALOGE("failed to fetch .ts segment at url '%s'", uriDebugString(uri).c_str());
+            notifyError(err);
+            return;
+        }
+    }
+
     // block-wise download
     bool shouldPause = false;
     ssize_t bytesRead;
     do {
-        int64_t startUs = ALooper::GetNowUs();
-        bytesRead = mHTTPDownloader->fetchBlock(
-                uri.c_str(), &buffer, range_offset, range_length, kDownloadBlockSize,
-                NULL /* actualURL */, connectHTTP);
-        int64_t delayUs = ALooper::GetNowUs() - startUs;
+        int64_t delayUs;
+        if (prefetchedBuffer != NULL) {
+            // Parse all of it as a single block. Its downloads overlapped
+            // others, so what counts for bandwidth is the time the link was busy.
+            buffer = prefetchedBuffer;
+            bytesRead = buffer->size();
+            delayUs = timing.mBusyUs;
+        } else {
+            int64_t startUs = ALooper::GetNowUs();
+            bytesRead = mHTTPDownloader->fetchBlock(
+                    uri.c_str(), &buffer, range_offset, range_length, kDownloadBlockSize,
+                    NULL /* actualURL */, connectHTTP);
+            delayUs = ALooper::GetNowUs() - startUs;
+        }
 
         if (bytesRead == ERROR_NOT_CONNECTED) {
             return;
@@ -1435,6 +1547,9 @@ void PlaylistFetcher::onDownloadNext() {
         if (err == -EAGAIN) {
             // starting sequence number too low/high
             mTSParser.clear();
+            if (mSegmentPrefetcher != NULL) {
+                mSegmentPrefetcher->clear();
+            }
             for (size_t i = 0; i < mPacketSources.size(); i++) {
                 sp<AnotherPacketSource> packetSource = mPacketSources.valueAt(i);
                 packetSource->clear();
@@ -1460,7 +1575,7 @@ void PlaylistFetcher::onDownloadNext() {
         if (shouldPause || shouldPauseDownload()) {
             // save state and return if this is not the last chunk,
             // leaving the fetcher in paused state.
-            if (bytesRead != 0) {
+            if (bytesRead != 0 && prefetchedBuffer == NULL) {
                 mDownloadState->saveState(
                         uri,
                         itemMeta,
@@ -1472,7 +1587,7 @@ void PlaylistFetcher::onDownloadNext() {
             }
             shouldPause = true;
         }
-    } while (bytesRead != 0);
+    } while (bytesRead != 0 && prefetchedBuffer == NULL);
 
     if (bufferStartsWithTsSyncByte(buffer)) {
         // If we don't see a stream in the program table after fetching a full ts segment
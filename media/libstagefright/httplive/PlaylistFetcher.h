@@ -32,6 +32,7 @@ class DataSource;
 struct HTTPBase;
 struct LiveDataSource;
 struct M3UParser;
+struct SegmentPrefetcher;
 class String8;
 
 struct PlaylistFetcher : public AHandler {
@@ -108,6 +109,7 @@ private:
     struct DownloadState;
 
     static const int64_t kMaxMonitorDelayUs;
+    static const int64_t kPrefetchWaitUs;
     static const int32_t kNumSkipFrames;
 
     static bool bufferStartsWithTsSyncByte(const sp<ABuffer>& buffer);
@@ -118,6 +120,7 @@ private:
     sp<AMessage> mStartTimeUsNotify;
 
     sp<HTTPDownloader> mHTTPDownloader;
+    sp<SegmentPrefetcher> mSegmentPrefetcher;
     sp<LiveSession> mSession;
     AString mURI;
 
@@ -222,6 +225,10 @@ private:
     void onPause();
     void onStop(const sp<AMessage> &msg);
     void onMonitorQueue();
+    int64_t getBufferedDurationUs(status_t *finalResult);
+    void prefetchSegments(
+            int32_t firstSeqNumberInPlaylist,
+            int32_t lastSeqNumberInPlaylist);
     void onDownloadNext();
     void initSeqNumberForLiveStream(
             int32_t &firstSeqNumberInPlaylist,
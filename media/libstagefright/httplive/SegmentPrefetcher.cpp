@@ -0,0 +1,361 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "SegmentPrefetcher"
+#include <utils/Log.h>
+
+#include "SegmentPrefetcher.h"
+#include "HTTPDownloader.h"
+
+#include <media/stagefright/foundation/ABuffer.h>
+#include <media/stagefright/foundation/ADebug.h>
+#include <media/stagefright/foundation/AHandler.h>
+#include <media/stagefright/foundation/ALooper.h>
+#include <media/stagefright/foundation/AMessage.h>
+#include <media/stagefright/MediaErrors.h>
+#include <media/stagefright/Utils.h>
+
+namespace android {
+
+struct SegmentPrefetcher::Segment : public RefBase {
+    Segment(const AString &uri, int64_t rangeOffset, int64_t rangeLength)
+        : mUri(uri),
+          mRangeOffset(rangeOffset),
+          mRangeLength(rangeLength),
+          mWorkerIndex(0),
+          mStarted(false),
+          mDone(false),
+          mCancelled(false),
+          mErr(OK) {
+        memset(&mTiming, 0, sizeof(mTiming));
+    }
+
+    bool matches(const AString &uri, int64_t rangeOffset, int64_t rangeLength) const {
+        return mUri == uri && mRangeOffset == rangeOffset && mRangeLength == rangeLength;
+    }
+
+    const AString mUri;
+    const int64_t mRangeOffset;
+    const int64_t mRangeLength;
+    size_t mWorkerIndex;
+
+    // Protected by the prefetcher's lock.
+    bool mStarted;
+    bool mDone;
+    bool mCancelled;
+    status_t mErr;
+    sp<ABuffer> mBuffer;
+    Timing mTiming;
+
+private:
+    DISALLOW_EVIL_CONSTRUCTORS(Segment);
+};
+
+// Downloads the segments it is given one at a time, on its own looper and
+// over its own connection.
+struct SegmentPrefetcher::Worker : public AHandler {
+    Worker(const wp<SegmentPrefetcher> &owner, const sp<HTTPDownloader> &downloader)
+        : mNumPending(0),
+          mOwner(owner),
+          mDownloader(downloader) {
+    }
+
+    void start(size_t index) {
+        mLooper = new ALooper;
+        mLooper->setName(AStringPrintf("SegmentPrefetcher-%zu", index).c_str());
+        mLooper->registerHandler(this);
+        mLooper->start();
+    }
+
+    void stop() {
+        mDownloader->disconnect();
+        mLooper->unregisterHandler(id());
+        mLooper->stop();
+    }
+
+    void download(const sp<Segment> &segment) {
+        sp<AMessage> msg = new AMessage(kWhatDownload, this);
+        msg->setObject("segment", segment);
+        msg->post();
+    }
+
+    const sp<HTTPDownloader> &downloader() const {
+        return mDownloader;
+    }
+
+    // Protected by the prefetcher's lock.
+    size_t mNumPending;
+
+protected:
+    virtual void onMessageReceived(const sp<AMessage> &msg) {
+        CHECK_EQ(msg->what(), (uint32_t)kWhatDownload);
+
+        sp<RefBase> obj;
+        CHECK(msg->findObject("segment", &obj));
+        sp<Segment> segment = static_cast<Segment *>(obj.get());
+
+        sp<SegmentPrefetcher> owner = mOwner.promote();
+        if (owner == NULL || !owner->onDownloadStarted(segment)) {
+            return;
+        }
+
+        ALOGV("downloading '%s' range %lld/%lld", uriDebugString(segment->mUri).c_str(),
+                (long long)segment->mRangeOffset, (long long)segment->mRangeLength);
+
+        sp<ABuffer> buffer;
+        ssize_t bytesRead = mDownloader->fetchBlock(
+                segment->mUri.c_str(), &buffer,
+                segment->mRangeOffset, segment->mRangeLength,
+                0 /* block_size */, NULL /* actualUrl */, true /* reconnect */);
+
+        owner->onDownloadCompleted(segment, bytesRead < 0 ? (status_t)bytesRead : OK, buffer);
+    }
+
+private:
+    enum {
+        kWhatDownload = 'dnld',
+    };
+
+    wp<SegmentPrefetcher> mOwner;
+    sp<HTTPDownloader> mDownloader;
+    sp<ALooper> mLooper;
+
+    DISALLOW_EVIL_CONSTRUCTORS(Worker);
+};
+
+SegmentPrefetcher::SegmentPrefetcher(
+        const sp<MediaHTTPService> &httpService,
+        const KeyedVector<String8, String8> &headers,
+        size_t maxDownloads)
+    : mMaxDownloads(maxDownloads),
+      mDisconnected(false),
+      mNumDownloading(0),
+      mBusySinceUs(0),
+      mBusyUs(0),
+      mBusyAtLastCompletionUs(0) {
+    CHECK_GT(maxDownloads, 0u);
+
+    for (size_t i = 0; i < maxDownloads; ++i) {
+        sp<Worker> worker = new Worker(this, new HTTPDownloader(httpService, headers));
+        worker->start(i);
+        mWorkers.push(worker);
+    }
+}
+
+SegmentPrefetcher::~SegmentPrefetcher() {
+    for (size_t i = 0; i < mWorkers.size(); ++i) {
+        mWorkers[i]->stop();
+    }
+}
+
+size_t SegmentPrefetcher::getMaxDownloads() const {
+    return mMaxDownloads;
+}
+
+bool SegmentPrefetcher::prefetch(
+        const AString &uri, int64_t rangeOffset, int64_t rangeLength) {
+    Mutex::Autolock autoLock(mLock);
+
+    if (mDisconnected) {
+        return false;
+    }
+
+    for (List<sp<Segment> >::iterator it = mSegments.begin(); it != mSegments.end(); ++it) {
+        if ((*it)->matches(uri, rangeOffset, rangeLength)) {
+            return true;
+        }
+    }
+
+    if (mSegments.size() >= mMaxDownloads) {
+        return false;
+    }
+
+    // Workers with pending downloads of dropped segments skip them quickly,
+    // but prefer one that is idle.
+    size_t index = 0;
+    for (size_t i = 1; i < mWorkers.size(); ++i) {
+        if (mWorkers[i]->mNumPending < mWorkers[index]->mNumPending) {
+            index = i;
+        }
+    }
+
+    sp<Segment> segment = new Segment(uri, rangeOffset, rangeLength);
+    segment->mWorkerIndex = index;
+    segment->mTiming.mQueuedUs = ALooper::GetNowUs();
+    mSegments.push_back(segment);
+
+    ++mWorkers[index]->mNumPending;
+    mWorkers[index]->download(segment);
+
+    return true;
+}
+
+bool SegmentPrefetcher::isPrefetched(
+        const AString &uri, int64_t rangeOffset, int64_t rangeLength) {
+    Mutex::Autolock autoLock(mLock);
+
+    for (List<sp<Segment> >::iterator it = mSegments.begin(); it != mSegments.end(); ++it) {
+        if ((*it)->matches(uri, rangeOffset, rangeLength)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+status_t SegmentPrefetcher::take(
+        const AString &uri, int64_t rangeOffset, int64_t rangeLength,
+        int64_t timeoutUs, sp<ABuffer> *buffer, Timing *timing) {
+    Mutex::Autolock autoLock(mLock);
+
+    if (mDisconnected) {
+        return ERROR_NOT_CONNECTED;
+    }
+
+    List<sp<Segment> >::iterator it = mSegments.begin();
+    while (it != mSegments.end() && !(*it)->matches(uri, rangeOffset, rangeLength)) {
+        ++it;
+    }
+    if (it == mSegments.end()) {
+        return NAME_NOT_FOUND;
+    }
+
+    // The segments before it were skipped.
+    while (mSegments.begin() != it) {
+        const sp<Segment> &skipped = *mSegments.begin();
+        ALOGV("dropping '%s'", uriDebugString(skipped->mUri).c_str());
+        skipped->mCancelled = true;
+        if (skipped->mStarted && !skipped->mDone) {
+            mWorkers[skipped->mWorkerIndex]->downloader()->disconnect();
+        }
+        mSegments.erase(mSegments.begin());
+    }
+
+    sp<Segment> segment = *it;
+    const int64_t deadlineUs = ALooper::GetNowUs() + timeoutUs;
+    while (!segment->mDone && !segment->mCancelled) {
+        int64_t remainingUs = deadlineUs - ALooper::GetNowUs();
+        if (remainingUs <= 0) {
+            return -EAGAIN;
+        }
+        mCondition.waitRelative(mLock, remainingUs * 1000LL);
+    }
+
+    if (segment->mCancelled) {
+        return ERROR_NOT_CONNECTED;
+    }
+
+    for (it = mSegments.begin(); it != mSegments.end(); ++it) {
+        if (*it == segment) {
+            mSegments.erase(it);
+            break;
+        }
+    }
+
+    segment->mTiming.mTakenUs = ALooper::GetNowUs();
+    *timing = segment->mTiming;
+    *buffer = segment->mBuffer;
+
+    return segment->mErr;
+}
+
+void SegmentPrefetcher::clear() {
+    Mutex::Autolock autoLock(mLock);
+    cancelSegments_l();
+}
+
+void SegmentPrefetcher::disconnect() {
+    Mutex::Autolock autoLock(mLock);
+    mDisconnected = true;
+    cancelSegments_l();
+}
+
+void SegmentPrefetcher::reconnect() {
+    Mutex::Autolock autoLock(mLock);
+    mDisconnected = false;
+}
+
+void SegmentPrefetcher::cancelSegments_l() {
+    for (List<sp<Segment> >::iterator it = mSegments.begin(); it != mSegments.end(); ++it) {
+        const sp<Segment> &segment = *it;
+        segment->mCancelled = true;
+        if (segment->mStarted && !segment->mDone) {
+            mWorkers[segment->mWorkerIndex]->downloader()->disconnect();
+        }
+    }
+    mSegments.clear();
+    mCondition.broadcast();
+}
+
+int64_t SegmentPrefetcher::getBusyUs_l(int64_t nowUs) const {
+    return mNumDownloading > 0 ? mBusyUs + nowUs - mBusySinceUs : mBusyUs;
+}
+
+bool SegmentPrefetcher::onDownloadStarted(const sp<Segment> &segment) {
+    Mutex::Autolock autoLock(mLock);
+
+    const sp<Worker> &worker = mWorkers[segment->mWorkerIndex];
+    if (segment->mCancelled) {
+        --worker->mNumPending;
+        return false;
+    }
+
+    // Downloads are interrupted by disconnecting the downloader; this is done
+    // with the lock held so that an interruption is not undone.
+    worker->downloader()->reconnect();
+
+    const int64_t nowUs = ALooper::GetNowUs();
+    if (mNumDownloading++ == 0) {
+        mBusySinceUs = nowUs;
+    }
+    segment->mStarted = true;
+    segment->mTiming.mStartedUs = nowUs;
+    return true;
+}
+
+void SegmentPrefetcher::onDownloadCompleted(
+        const sp<Segment> &segment, status_t err, const sp<ABuffer> &buffer) {
+    Mutex::Autolock autoLock(mLock);
+
+    --mWorkers[segment->mWorkerIndex]->mNumPending;
+
+    const int64_t nowUs = ALooper::GetNowUs();
+    const int64_t busyUs = getBusyUs_l(nowUs);
+    if (--mNumDownloading == 0) {
+        mBusyUs = busyUs;
+    }
+
+    if (segment->mCancelled) {
+        return;
+    }
+
+    segment->mDone = true;
+    segment->mErr = err;
+    segment->mBuffer = buffer;
+    segment->mTiming.mCompletedUs = nowUs;
+    segment->mTiming.mBytes = buffer != NULL ? buffer->size() : 0;
+    segment->mTiming.mBusyUs = busyUs - mBusyAtLastCompletionUs;
+    mBusyAtLastCompletionUs = busyUs;
+
+    ALOGV("downloaded '%s': %zu bytes in %lld us, %lld us after it was queued",
+            uriDebugString(segment->mUri).c_str(), segment->mTiming.mBytes,
+            (long long)(nowUs - segment->mTiming.mStartedUs),
+            (long long)(nowUs - segment->mTiming.mQueuedUs));
+
+    mCondition.broadcast();
+}
+
+}  // namespace android
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SEGMENT_PREFETCHER_H_
+
+#define SEGMENT_PREFETCHER_H_
+
+#include <media/stagefright/foundation/ABase.h>
+#include <media/stagefright/foundation/AString.h>
+#include <utils/Condition.h>
+#include <utils/KeyedVector.h>
+#include <utils/List.h>
+#include <utils/Mutex.h>
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+struct ABuffer;
+struct MediaHTTPService;
+
+// Downloads media segments ahead of time, each over its own connection, so
+// that on a high-latency link the round trips of up to maxDownloads segments
+// overlap. The segments are handed out whole, in the order they are taken.
+struct SegmentPrefetcher : public RefBase {
+    struct Timing {
+        int64_t mQueuedUs;      // when prefetch() was called
+        int64_t mStartedUs;     // when the download started
+        int64_t mCompletedUs;   // when the last byte was read
+        int64_t mTakenUs;       // when take() returned the segment
+        size_t mBytes;
+        // How long at least one download was running since the download that
+        // completed before this one, which is the time the link took to
+        // deliver mBytes when downloads overlap.
+        int64_t mBusyUs;
+    };
+
+    SegmentPrefetcher(
+            const sp<MediaHTTPService> &httpService,
+            const KeyedVector<String8, String8> &headers,
+            size_t maxDownloads);
+
+    size_t getMaxDownloads() const;
+
+    // Starts downloading the segment, unless it is already prefetched.
+    // Returns false if maxDownloads segments are downloading or waiting to be
+    // taken.
+    bool prefetch(const AString &uri, int64_t rangeOffset, int64_t rangeLength);
+
+    // Returns true if the segment is downloading or waiting to be taken.
+    bool isPrefetched(const AString &uri, int64_t rangeOffset, int64_t rangeLength);
+
+    // Waits up to timeoutUs until the segment is downloaded and returns all
+    // of it. The segments prefetched before it are dropped, as they were
+    // skipped. Returns NAME_NOT_FOUND if the segment was not prefetched,
+    // -EAGAIN if it is still downloading after timeoutUs, in which case it
+    // stays prefetched, ERROR_NOT_CONNECTED if disconnect() or clear() is
+    // called in the meantime, or the error the download failed with.
+    status_t take(
+            const AString &uri, int64_t rangeOffset, int64_t rangeLength,
+            int64_t timeoutUs, sp<ABuffer> *buffer, Timing *timing);
+
+    // Drops all the segments, interrupting the downloads in progress.
+    void clear();
+
+    // Like clear(), and makes prefetch() and take() fail until reconnect().
+    void disconnect();
+    void reconnect();
+
+protected:
+    virtual ~SegmentPrefetcher();
+
+private:
+    struct Segment;
+    struct Worker;
+
+    const size_t mMaxDownloads;
+    Vector<sp<Worker> > mWorkers;
+
+    Mutex mLock;
+    Condition mCondition;
+    bool mDisconnected;
+    List<sp<Segment> > mSegments;   // in the order they were prefetched
+
+    size_t mNumDownloading;
+    int64_t mBusySinceUs;           // when mNumDownloading became non-zero
+    int64_t mBusyUs;                // before mBusySinceUs
+    int64_t mBusyAtLastCompletionUs;
+
+    void cancelSegments_l();
+    int64_t getBusyUs_l(int64_t nowUs) const;
+
+    // Called by the workers.
+    bool onDownloadStarted(const sp<Segment> &segment);
+    void onDownloadCompleted(
+            const sp<Segment> &segment, status_t err, const sp<ABuffer> &buffer);
+
+    DISALLOW_EVIL_CONSTRUCTORS(SegmentPrefetcher);
+};
+
+}  // namespace android
+
+#endif  // SEGMENT_PREFETCHER_H_
@@ -25,6 +25,7 @@
 namespace android {
 
 struct ALooper;
+struct BlockCache;
 struct PageCache;
 
 struct NuCachedSource2 : public DataSource {
@@ -62,6 +63,17 @@ struct NuCachedSource2 : public DataSource {
 
     void resumeFetchingIfNecessary();
 
+    struct CacheStats {
+        // Reads served from memory, and reads that had to wait for the source.
+        int64_t mNumHits;
+        int64_t mNumMisses;
+
+        // Bytes kept from ranges outside the prefetch window.
+        size_t mRetainedBytes;
+    };
+
+    void getCacheStats(CacheStats *stats) const;
+
     // The following methods are supported only if the
     // data source is HTTP-based; otherwise, ERROR_UNSUPPORTED
     // is returned.
@@ -88,6 +100,7 @@ private:
         kPageSize                       = 65536,
         kDefaultHighWaterThreshold      = 20 * 1024 * 1024,
         kDefaultLowWaterThreshold       = 4 * 1024 * 1024,
+        kDefaultRetainedThreshold       = 4 * 1024 * 1024,
 
         // Read data after a 15 sec timeout whether we're actively
         // fetching or not.
@@ -114,6 +127,15 @@ private:
 
     PageCache *mCache;
     off64_t mCacheOffset;
+
+    // Data the prefetch window has moved away from, so that reading it again,
+    // e.g. a moov atom at the end of the file or a seek back, does not refetch it.
+    // Bounded by the cache config's fourth field, or by kDefaultRetainedThreshold.
+    BlockCache *mRetained;
+
+    int64_t mNumHits;
+    int64_t mNumMisses;
+
     status_t mFinalStatus;
     off64_t mLastAccessPos;
     sp<AMessage> mAsyncResult;
@@ -125,6 +147,7 @@ private:
 
     size_t mHighwaterThresholdBytes;
     size_t mLowwaterThresholdBytes;
+    size_t mRetainedThresholdBytes;
 
     // If the keep-alive interval is 0, keep-alives are disabled.
     int64_t mKeepAliveIntervalUs;
@@ -136,6 +159,7 @@ private:
     void onRead(const sp<AMessage> &msg);
 
     void fetchInternal();
+    bool fetchFromKeptData();
     ssize_t readInternal(off64_t offset, void *data, size_t size);
     status_t seekInternal_l(off64_t offset);
 
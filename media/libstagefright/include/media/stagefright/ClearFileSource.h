@@ -39,9 +39,13 @@ public:
     virtual status_t getSize(off64_t *size);
 
     virtual uint32_t flags() {
-        return kIsLocalFileSource;
+        return kIsLocalFileSource | (mMappable ? kIsMappable : 0);
     }
 
+    // Maps the file on first use, if it cannot be truncated underneath the
+    // mapping; see CannotShrink().
+    virtual const uint8_t *getMappedData(off64_t *size);
+
     virtual String8 toString() {
         return mName;
     }
@@ -58,6 +62,14 @@ protected:
 private:
     String8 mName;
 
+    void *mMapping;
+    size_t mMappingSize;
+    const uint8_t *mMappedData;
+    bool mMappingFailed;
+    bool mMappable;
+
+    static bool CannotShrink(int fd, bool opened);
+
     ClearFileSource(const ClearFileSource &);
     ClearFileSource &operator=(const ClearFileSource &);
 };
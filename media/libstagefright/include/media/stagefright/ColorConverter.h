@@ -77,9 +77,6 @@ private:
 
     OMX_COLOR_FORMATTYPE mSrcFormat, mDstFormat;
     ColorSpace mSrcColorSpace;
-    uint8_t *mClip;
-
-    uint8_t *initClip();
 
     status_t convertCbYCrY(
             const BitmapParams &src, const BitmapParams &dst);
@@ -89,6 +89,9 @@ public:
         mWrapper->getUri = [](void *handle, char *uriString, size_t bufferSize) -> bool {
             return ((DataSource*)handle)->getUri(uriString, bufferSize);
         };
+        mWrapper->getMappedData = [](void *handle, off64_t *size) -> const uint8_t * {
+            return ((DataSource*)handle)->getMappedData(size);
+        };
         return mWrapper;
     }
 
@@ -33,6 +33,8 @@ public:
         kIsCachingDataSource   = 4,
         kIsHTTPBasedSource     = 8,
         kIsLocalFileSource     = 16,
+        // getMappedData() may return the contents of the source.
+        kIsMappable            = 32,
     };
 
     DataSourceBase() {}
@@ -70,6 +72,13 @@ public:
         return -1;
     }
 
+    // Returns the whole contents of the source mapped into memory and sets
+    // |size| to their length, or returns NULL if the source cannot be mapped.
+    // The mapping stays valid until the source is destroyed.
+    virtual const uint8_t *getMappedData(off64_t * /*size*/) {
+        return NULL;
+    }
+
 protected:
     virtual ~DataSourceBase() {}
 
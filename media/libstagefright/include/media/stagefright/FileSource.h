@@ -35,6 +35,10 @@ public:
 
     virtual ssize_t readAt(off64_t offset, void *data, size_t size);
 
+    virtual uint32_t flags();
+
+    virtual const uint8_t *getMappedData(off64_t *size);
+
     virtual sp<DecryptHandle> DrmInitialization(const char *mime);
 
     static bool requiresDrm(int fd, int64_t offset, int64_t length, const char *mime);
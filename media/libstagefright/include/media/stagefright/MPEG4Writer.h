@@ -19,6 +19,9 @@
 #define MPEG4_WRITER_H_
 
 #include <stdio.h>
+#include <sys/uio.h>
+
+#include <vector>
 
 #include <media/stagefright/MediaWriter.h>
 #include <utils/List.h>
@@ -113,6 +116,18 @@ private:
     int32_t mStartTimeOffsetMs;
     bool mSwitchPending;
 
+    // Queued sample data, and room for the length prefixes and other
+    // small pieces that go with it
+    std::vector<struct iovec> mSampleIovecs;
+    uint8_t mSampleHeaders[4096];
+    size_t mSampleHeadersSize;
+
+    // Fragmented file writing
+    int64_t mFragmentDurationUs;        // 0 unless the file is fragmented
+    int64_t mFragmentStartTimeUs;       // first chunk time of the pending fragment
+    uint32_t mFragmentSequenceNumber;   // of the last fragment written
+    off64_t mMehdOffset;                // 0 until the moov box is written
+
     sp<ALooper> mLooper;
     sp<AHandlerReflector<MPEG4Writer> > mReflector;
 
@@ -156,6 +171,16 @@ private:
         // Max time interval between neighboring chunks
         int64_t mMaxInterChunkDurUs;
 
+        // Fragmented file: samples not written to a fragment yet, and the
+        // decode time after the last sample written and its duration, in
+        // the track time scale.
+        List<MediaBuffer *> mFragmentSamples;
+        int64_t mDecodeTimeTicks;
+        int64_t mLastSampleDurationTicks;
+
+        // Fragmented file: the track is described in the moov box. Tracks
+        // that had no sample when the moov box was written are left out.
+        bool mInMoov;
     };
 
     bool            mIsFirstChunk;
@@ -227,6 +252,24 @@ private:
     // Actually write the given chunk to the file.
     void writeChunkToFile(Chunk* chunk);
 
+    // Fragmented file: hand over the samples of the given chunk to the next
+    // fragment, and write the fragment once it spans the fragment duration.
+    void writeChunkToFragment(Chunk* chunk);
+
+    // Write a moof box and an mdat box with the pending samples of all
+    // tracks, preceded by the moov box if not written yet. Unless isLast is
+    // set, samples are held back so that the next fragment of each track
+    // starts with a sync sample. Return true if a fragment was written.
+    bool writeFragment(bool isLast);
+
+    // Fragmented file: write the moov box once every track has a pending
+    // sample, or with the tracks that have one if force is set or the
+    // pending samples span kMaxMoovDelayUs. Return true if it was written.
+    bool writeFragmentedMoovBox(bool force);
+
+    // Fragmented file: whether the track is described in the moov box.
+    bool isTrackInMoov(const Track *track) const;
+
     // Adjust other track media clock (presumably wall clock)
     // based on audio track media clock with the drift time.
     int64_t mDriftTimeUs;
@@ -256,7 +299,15 @@ private:
     off64_t addSample_l(
             MediaBuffer *buffer, bool usePrefix,
             uint32_t tiffHdrOffset, size_t *bytesWritten);
-    void addLengthPrefixedSample_l(MediaBuffer *buffer);
+    // Same as addSample_l(), except that the sample is only written to the
+    // file by the next flushSamples_l(), so the buffer must be kept until
+    // then. This writes the samples of a chunk with a single writev().
+    off64_t queueSample_l(
+            MediaBuffer *buffer, bool usePrefix,
+            uint32_t tiffHdrOffset, size_t *bytesWritten);
+    void queueSampleData_l(const void *data, size_t size, bool copy);
+    void flushSamples_l();
+    void addLengthPrefixedSample_l(const uint8_t *data, size_t length);
     void addMultipleLengthPrefixedSamples_l(MediaBuffer *buffer);
     uint16_t addProperty_l(const ItemProperty &);
     uint16_t addItem_l(const ItemInfo &);
@@ -267,10 +318,12 @@ private:
     bool exceedsFileDurationLimit();
     bool approachingFileSizeLimit();
     bool isFileStreamable() const;
+    bool isFragmented() const { return mFragmentDurationUs > 0; }
     void trackProgressStatus(size_t trackId, int64_t timeUs, status_t err = OK);
     void writeCompositionMatrix(int32_t degrees);
     void writeMvhdBox(int64_t durationUs);
     void writeMoovBox(int64_t durationUs);
+    void writeMvexBox();
     void writeFtypBox(MetaData *param);
     void writeUdtaBox();
     void writeGeoDataBox();
@@ -121,6 +121,10 @@ enum {
     // file output formats.
     kKeyFileType          = 'ftyp',  // int32_t
 
+    // Set this key to author a fragmented file: a moof box and its media data
+    // are written about every given interval instead of a moov box at the end.
+    kKeyFragmentDurationUs = 'fgdu',  // int64_t
+
     // Track authoring progress status
     // kKeyTrackTimeStatus is used to track progress in elapsed time
     kKeyTrackTimeStatus   = 'tktm',  // int64_t
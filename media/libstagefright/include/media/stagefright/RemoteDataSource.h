@@ -61,7 +61,8 @@ public:
         mMemory = nullptr;
     }
     virtual uint32_t getFlags() {
-        return mSource->flags();
+        // a mapping does not cross processes.
+        return mSource->flags() & ~DataSource::kIsMappable;
     }
     virtual String8 toString()  {
         return mName;
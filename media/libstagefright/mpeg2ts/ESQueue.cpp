@@ -38,6 +38,40 @@
 
 namespace android {
 
+// The queued data is the range of mBuffer (and of mScrambledBuffer). Access units are
+// consumed from its front by moving the start of the range, and appendToBuffer() reuses
+// the space before it, so that the rest of the data isn't moved for each access unit.
+
+static void appendToBuffer(sp<ABuffer> *buffer, const void *data, size_t size) {
+    size_t queuedSize = *buffer == NULL ? 0 : (*buffer)->size();
+    if (*buffer == NULL || (*buffer)->offset() + queuedSize + size > (*buffer)->capacity()) {
+        if (*buffer != NULL && queuedSize + size <= (*buffer)->capacity() / 2) {
+            // At least as much space is freed as is moved.
+            memmove((*buffer)->base(), (*buffer)->data(), queuedSize);
+            (*buffer)->setRange(0, queuedSize);
+        } else {
+            size_t neededSize = (2 * (queuedSize + size) + 65535) & ~65535;
+
+            ALOGV("resizing buffer to size %zu", neededSize);
+
+            sp<ABuffer> newBuffer = new ABuffer(neededSize);
+            if (*buffer != NULL) {
+                memcpy(newBuffer->data(), (*buffer)->data(), queuedSize);
+            }
+            newBuffer->setRange(0, queuedSize);
+
+            *buffer = newBuffer;
+        }
+    }
+
+    memcpy((*buffer)->data() + queuedSize, data, size);
+    (*buffer)->setRange((*buffer)->offset(), queuedSize + size);
+}
+
+static void consumeFromBuffer(const sp<ABuffer> &buffer, size_t size) {
+    buffer->setRange(buffer->offset() + size, buffer->size() - size);
+}
+
 ElementaryStreamQueue::ElementaryStreamQueue(Mode mode, uint32_t flags)
     : mMode(mode),
       mFlags(flags),
@@ -660,25 +694,7 @@ status_t ElementaryStreamQueue::appendData(
         }
     }
 
-    size_t neededSize = (mBuffer == NULL ? 0 : mBuffer->size()) + size;
-    if (mBuffer == NULL || neededSize > mBuffer->capacity()) {
-        neededSize = (neededSize + 65535) & ~65535;
-
-        ALOGV("resizing buffer to size %zu", neededSize);
-
-        sp<ABuffer> buffer = new ABuffer(neededSize);
-        if (mBuffer != NULL) {
-            memcpy(buffer->data(), mBuffer->data(), mBuffer->size());
-            buffer->setRange(0, mBuffer->size());
-        } else {
-            buffer->setRange(0, 0);
-        }
-
-        mBuffer = buffer;
-    }
-
-    memcpy(mBuffer->data() + mBuffer->size(), data, size);
-    mBuffer->setRange(0, mBuffer->size() + size);
+    appendToBuffer(&mBuffer, data, size);
 
     RangeInfo info;
     info.mLength = size;
@@ -706,24 +722,7 @@ void ElementaryStreamQueue::appendScrambledData(
         return;
     }
 
-    size_t neededSize = (mScrambledBuffer == NULL ? 0 : mScrambledBuffer->size()) + size;
-    if (mScrambledBuffer == NULL || neededSize > mScrambledBuffer->capacity()) {
-        neededSize = (neededSize + 65535) & ~65535;
-
-        ALOGI("resizing scrambled buffer to size %zu", neededSize);
-
-        sp<ABuffer> buffer = new ABuffer(neededSize);
-        if (mScrambledBuffer != NULL) {
-            memcpy(buffer->data(), mScrambledBuffer->data(), mScrambledBuffer->size());
-            buffer->setRange(0, mScrambledBuffer->size());
-        } else {
-            buffer->setRange(0, 0);
-        }
-
-        mScrambledBuffer = buffer;
-    }
-    memcpy(mScrambledBuffer->data() + mScrambledBuffer->size(), data, size);
-    mScrambledBuffer->setRange(0, mScrambledBuffer->size() + size);
+    appendToBuffer(&mScrambledBuffer, data, size);
 
     ScrambledRangeInfo scrambledInfo;
     scrambledInfo.mLength = size;
@@ -858,11 +857,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueScrambledAccessUnit() {
     scrambledAccessUnit->meta()->setBuffer("encBytes", encSizes);
     scrambledAccessUnit->meta()->setInt32("pesOffset", pesOffset);
 
-    memmove(mScrambledBuffer->data(),
-            mScrambledBuffer->data() + scrambledLength,
-            mScrambledBuffer->size() - scrambledLength);
-
-    mScrambledBuffer->setRange(0, mScrambledBuffer->size() - scrambledLength);
+    consumeFromBuffer(mScrambledBuffer, scrambledLength);
 
     ALOGV("[stream %d] dequeued scrambled AU: timeUs=%lld, size=%zu",
             mMode, (long long)timeUs, scrambledAccessUnit->size());
@@ -887,11 +882,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnit() {
         memcpy(accessUnit->data(), mBuffer->data(), info.mLength);
         accessUnit->meta()->setInt64("timeUs", info.mTimestampUs);
 
-        memmove(mBuffer->data(),
-                mBuffer->data() + info.mLength,
-                mBuffer->size() - info.mLength);
-
-        mBuffer->setRange(0, mBuffer->size() - info.mLength);
+        consumeFromBuffer(mBuffer, info.mLength);
 
         if (mFormat == NULL) {
             mFormat = new MetaData;
@@ -992,12 +983,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitEAC3() {
     accessUnit->meta()->setInt64("timeUs", timeUs);
     accessUnit->meta()->setInt32("isSync", 1);
 
-    memmove(
-            mBuffer->data(),
-            mBuffer->data() + syncStartPos + payloadSize,
-            mBuffer->size() - syncStartPos - payloadSize);
-
-    mBuffer->setRange(0, mBuffer->size() - syncStartPos - payloadSize);
+    consumeFromBuffer(mBuffer, syncStartPos + payloadSize);
 
     return accessUnit;
 }
@@ -1056,12 +1042,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitAC4() {
     accessUnit->meta()->setInt64("timeUs", timeUs);
     accessUnit->meta()->setInt32("isSync", 1);
 
-    memmove(
-            mBuffer->data(),
-            mBuffer->data() + syncStartPos + payloadSize,
-            mBuffer->size() - syncStartPos - payloadSize);
-
-    mBuffer->setRange(0, mBuffer->size() - syncStartPos - payloadSize);
+    consumeFromBuffer(mBuffer, syncStartPos + payloadSize);
     return accessUnit;
 }
 
@@ -1123,12 +1104,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitPCMAudio() {
         ptr[i] = ntohs(ptr[i]);
     }
 
-    memmove(
-            mBuffer->data(),
-            mBuffer->data() + 4 + payloadSize,
-            mBuffer->size() - 4 - payloadSize);
-
-    mBuffer->setRange(0, mBuffer->size() - 4 - payloadSize);
+    consumeFromBuffer(mBuffer, 4 + payloadSize);
 
     return accessUnit;
 }
@@ -1272,9 +1248,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitAAC() {
     sp<ABuffer> accessUnit = new ABuffer(offset);
     memcpy(accessUnit->data(), mBuffer->data(), offset);
 
-    memmove(mBuffer->data(), mBuffer->data() + offset,
-            mBuffer->size() - offset);
-    mBuffer->setRange(0, mBuffer->size() - offset);
+    consumeFromBuffer(mBuffer, offset);
 
     accessUnit->meta()->setInt64("timeUs", timeUs);
     accessUnit->meta()->setInt32("isSync", 1);
@@ -1453,11 +1427,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitH264() {
             const NALPosition &pos = nals.itemAt(nals.size() - 1);
             size_t nextScan = pos.nalOffset + pos.nalSize;
 
-            memmove(mBuffer->data(),
-                    mBuffer->data() + nextScan,
-                    mBuffer->size() - nextScan);
-
-            mBuffer->setRange(0, mBuffer->size() - nextScan);
+            consumeFromBuffer(mBuffer, nextScan);
 
             int64_t timeUs = fetchTimestamp(nextScan);
             if (timeUs < 0LL) {
@@ -1539,11 +1509,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitMPEGAudio() {
     sp<ABuffer> accessUnit = new ABuffer(frameSize);
     memcpy(accessUnit->data(), data, frameSize);
 
-    memmove(mBuffer->data(),
-            mBuffer->data() + frameSize,
-            mBuffer->size() - frameSize);
-
-    mBuffer->setRange(0, mBuffer->size() - frameSize);
+    consumeFromBuffer(mBuffer, frameSize);
 
     int64_t timeUs = fetchTimestamp(frameSize);
     if (timeUs < 0LL) {
@@ -1666,11 +1632,11 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitMPEGVideo() {
         currentStartCode = data[offset + 3];
 
         if (currentStartCode == 0xb3 && mFormat == NULL) {
-            memmove(mBuffer->data(), mBuffer->data() + offset, size - offset);
+            consumeFromBuffer(mBuffer, offset);
+            data = mBuffer->data();
             size -= offset;
             (void)fetchTimestamp(offset);
             offset = 0;
-            mBuffer->setRange(0, size);
         }
 
         if ((prevStartCode == 0xb3 && currentStartCode != 0xb5)
@@ -1699,11 +1665,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitMPEGVideo() {
                 sp<ABuffer> csd = new ABuffer(offset);
                 memcpy(csd->data(), data, offset);
 
-                memmove(mBuffer->data(),
-                        mBuffer->data() + offset,
-                        mBuffer->size() - offset);
-
-                mBuffer->setRange(0, mBuffer->size() - offset);
+                consumeFromBuffer(mBuffer, offset);
                 size -= offset;
                 (void)fetchTimestamp(offset);
                 offset = 0;
@@ -1742,11 +1704,7 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitMPEGVideo() {
                 sp<ABuffer> accessUnit = new ABuffer(offset);
                 memcpy(accessUnit->data(), data, offset);
 
-                memmove(mBuffer->data(),
-                        mBuffer->data() + offset,
-                        mBuffer->size() - offset);
-
-                mBuffer->setRange(0, mBuffer->size() - offset);
+                consumeFromBuffer(mBuffer, offset);
 
                 int64_t timeUs = fetchTimestamp(offset);
                 if (timeUs < 0LL) {
@@ -1941,9 +1899,8 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitMPEG4Video() {
                     sp<ABuffer> accessUnit = new ABuffer(offset);
                     memcpy(accessUnit->data(), data, offset);
 
-                    memmove(data, &data[offset], size - offset);
+                    consumeFromBuffer(mBuffer, offset);
                     size -= offset;
-                    mBuffer->setRange(0, size);
 
                     int64_t timeUs = fetchTimestamp(offset);
                     if (timeUs < 0LL) {
@@ -1979,10 +1936,10 @@ sp<ABuffer> ElementaryStreamQueue::dequeueAccessUnitMPEG4Video() {
 
         if (discard) {
             (void)fetchTimestamp(offset);
-            memmove(data, &data[offset], size - offset);
+            consumeFromBuffer(mBuffer, offset);
+            data = mBuffer->data();
             size -= offset;
             offset = 0;
-            mBuffer->setRange(0, size);
         } else {
             offset += chunkSize;
         }
@@ -0,0 +1,261 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// #define LOG_NDEBUG 0
+#define LOG_TAG "ColorConverter_test"
+#include <utils/Log.h>
+
+#include <gtest/gtest.h>
+
+#include <media/stagefright/ColorConverter.h>
+#include <media/stagefright/MediaErrors.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+namespace android {
+
+static int64_t nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ll + ts.tv_nsec / 1000;
+}
+
+struct Conversion {
+    const char *name;
+    OMX_COLOR_FORMATTYPE src;
+    OMX_COLOR_FORMATTYPE dst;
+};
+
+// Conversions done by ColorConverter itself rather than by libyuv.
+static const Conversion kConversions[] = {
+    { "Planar16->RGB565", OMX_COLOR_FormatYUV420Planar16, OMX_COLOR_Format16bitRGB565 },
+    { "Planar16->RGBA8888", OMX_COLOR_FormatYUV420Planar16, OMX_COLOR_Format32BitRGBA8888 },
+    { "Planar16->BGRA8888", OMX_COLOR_FormatYUV420Planar16, OMX_COLOR_Format32bitBGRA8888 },
+    { "Planar16->Y410", OMX_COLOR_FormatYUV420Planar16, OMX_COLOR_FormatYUV444Y410 },
+    { "CbYCrY->RGB565", OMX_COLOR_FormatCbYCrY, OMX_COLOR_Format16bitRGB565 },
+    { "QCOMSemiPlanar->RGB565",
+            OMX_QCOM_COLOR_FormatYVU420SemiPlanar, OMX_COLOR_Format16bitRGB565 },
+    { "TIPackedSemiPlanar->RGB565",
+            OMX_TI_COLOR_FormatYUV420PackedSemiPlanar, OMX_COLOR_Format16bitRGB565 },
+};
+
+static const Conversion kLibYUVConversions[] = {
+    { "Planar->RGB565", OMX_COLOR_FormatYUV420Planar, OMX_COLOR_Format16bitRGB565 },
+    { "Planar->RGBA8888", OMX_COLOR_FormatYUV420Planar, OMX_COLOR_Format32BitRGBA8888 },
+    { "SemiPlanar->RGBA8888", OMX_COLOR_FormatYUV420SemiPlanar, OMX_COLOR_Format32BitRGBA8888 },
+};
+
+static size_t bytesPerPixel(OMX_COLOR_FORMATTYPE format) {
+    switch (format) {
+    case OMX_COLOR_Format16bitRGB565:
+        return 2;
+    case OMX_COLOR_Format32BitRGBA8888:
+    case OMX_COLOR_Format32bitBGRA8888:
+    case OMX_COLOR_FormatYUV444Y410:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+static uint8_t clip(signed value) {
+    return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+class ColorConverterTest : public ::testing::Test {
+protected:
+    // A frame of width x height with a crop of cropWidth x cropHeight at
+    // (cropLeft, cropTop), in both the source and the destination.
+    struct Frame {
+        size_t width, height;
+        size_t cropLeft, cropTop, cropWidth, cropHeight;
+    };
+
+    // Fills a source frame with random samples, limited to 10 bits for
+    // 16 bit formats, with some slack at the end for readers of pixel pairs.
+    static std::vector<uint8_t> createSource(OMX_COLOR_FORMATTYPE format, const Frame &frame) {
+        const size_t pixels = frame.width * frame.height;
+        std::vector<uint8_t> source(4 * pixels + 64);
+        if (format == OMX_COLOR_FormatYUV420Planar16) {
+            uint16_t *samples = (uint16_t *)source.data();
+            for (size_t i = 0; i < source.size() / 2; ++i) {
+                samples[i] = rand() & 0x3FF;
+            }
+        } else {
+            for (size_t i = 0; i < source.size(); ++i) {
+                source[i] = rand();
+            }
+        }
+        return source;
+    }
+
+    static status_t convert(const Conversion &conversion,
+            const std::vector<uint8_t> &source, const Frame &frame, std::vector<uint8_t> *dest) {
+        ColorConverter converter(conversion.src, conversion.dst);
+        if (!converter.isValid()) {
+            return ERROR_UNSUPPORTED;
+        }
+        const size_t right = frame.cropLeft + frame.cropWidth - 1;
+        const size_t bottom = frame.cropTop + frame.cropHeight - 1;
+        return converter.convert(
+                source.data(), frame.width, frame.height, 0 /* stride */,
+                frame.cropLeft, frame.cropTop, right, bottom,
+                dest->data(), frame.width, frame.height, 0 /* stride */,
+                frame.cropLeft, frame.cropTop, right, bottom);
+    }
+
+    // Converts the crop one pixel at a time, addressing the source as
+    // ColorConverter always has for each format.
+    static void convertReference(const Conversion &conversion,
+            const std::vector<uint8_t> &source, const Frame &frame, std::vector<uint8_t> *dest) {
+        const size_t W = frame.width, H = frame.height;
+        const size_t L = frame.cropLeft, T = frame.cropTop;
+        const uint8_t *p8 = source.data();
+        const uint16_t *p16 = (const uint16_t *)source.data();
+        const size_t bpp = bytesPerPixel(conversion.dst);
+
+        for (size_t y = 0; y < frame.cropHeight; ++y) {
+            for (size_t x = 0; x < frame.cropWidth; ++x) {
+                signed Y, U, V;
+                bool bgr = false;
+                switch (conversion.src) {
+                case OMX_COLOR_FormatYUV420Planar16:
+                {
+                    const size_t u = W * H + (T / 2 + y / 2) * (W / 2) + L / 2 + x / 2;
+                    Y = p16[(T + y) * W + L + x];
+                    U = p16[u];
+                    V = p16[u + W * (H / 2) / 2];
+                    if (conversion.dst == OMX_COLOR_FormatYUV444Y410) {
+                        uint8_t *out = dest->data() + ((T + y) * W + L + x) * bpp;
+                        *(uint32_t *)out = (Y << 10) | U | (V << 20);
+                        continue;
+                    }
+                    Y >>= 2;
+                    U >>= 2;
+                    V >>= 2;
+                    break;
+                }
+                case OMX_COLOR_FormatCbYCrY:
+                {
+                    const uint8_t *pair = p8 + (T * W + L) * 2 + y * W * 2 + (x & ~1) * 2;
+                    Y = pair[(x & 1) ? 3 : 1];
+                    U = pair[0];
+                    V = pair[2];
+                    break;
+                }
+                case OMX_QCOM_COLOR_FormatYVU420SemiPlanar:
+                case OMX_TI_COLOR_FormatYUV420PackedSemiPlanar:
+                {
+                    const uint8_t *src_y = p8 + T * W + L;
+                    const uint8_t *src_uv =
+                            conversion.src == OMX_QCOM_COLOR_FormatYVU420SemiPlanar
+                            ? src_y + W * H + T * W + L : src_y + W * (H - T / 2);
+                    Y = src_y[y * W + x];
+                    U = src_uv[(y / 2) * W + (x & ~1)];
+                    V = src_uv[(y / 2) * W + (x & ~1) + 1];
+                    bgr = conversion.src == OMX_QCOM_COLOR_FormatYVU420SemiPlanar;
+                    break;
+                }
+                default:
+                    FAIL() << "no reference for " << conversion.name;
+                }
+
+                Y -= 16;
+                U -= 128;
+                V -= 128;
+                const uint8_t b = clip((Y * 298 + U * 517) / 256);
+                const uint8_t g = clip((Y * 298 - V * 208 - U * 100) / 256);
+                const uint8_t r = clip((Y * 298 + V * 409) / 256);
+
+                uint8_t *out = dest->data() + ((T + y) * W + L + x) * bpp;
+                switch (conversion.dst) {
+                case OMX_COLOR_Format16bitRGB565:
+                    *(uint16_t *)out = bgr
+                            ? ((b >> 3) << 11) | ((g >> 2) << 5) | (r >> 3)
+                            : ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+                    break;
+                case OMX_COLOR_Format32BitRGBA8888:
+                    *(uint32_t *)out = r | (g << 8) | (b << 16) | 0xFF000000u;
+                    break;
+                case OMX_COLOR_Format32bitBGRA8888:
+                    *(uint32_t *)out = b | (g << 8) | (r << 16) | 0xFF000000u;
+                    break;
+                default:
+                    FAIL() << "no reference for " << conversion.name;
+                }
+            }
+        }
+    }
+};
+
+TEST_F(ColorConverterTest, MatchesReference) {
+    static const Frame kFrames[] = {
+        { 64, 48, 0, 0, 64, 48 },
+        { 64, 48, 2, 1, 37, 21 },  // odd width and height
+        { 1920, 1088, 0, 0, 1920, 1080 },
+    };
+
+    for (const Conversion &conversion : kConversions) {
+        for (const Frame &frame : kFrames) {
+            const std::vector<uint8_t> source = createSource(conversion.src, frame);
+            const size_t size = frame.width * frame.height * bytesPerPixel(conversion.dst);
+            std::vector<uint8_t> expected(size, 0xA5);
+            std::vector<uint8_t> actual(size, 0xA5);
+
+            convertReference(conversion, source, frame, &expected);
+            ASSERT_EQ(OK, convert(conversion, source, frame, &actual)) << conversion.name;
+            EXPECT_EQ(0, memcmp(expected.data(), actual.data(), size))
+                    << conversion.name << " " << frame.cropWidth << "x" << frame.cropHeight;
+        }
+    }
+}
+
+TEST_F(ColorConverterTest, ConversionBenchmark) {
+    static const Frame kFrames[] = {
+        { 1280, 720, 0, 0, 1280, 720 },
+        { 1920, 1088, 0, 0, 1920, 1080 },
+        { 3840, 2160, 0, 0, 3840, 2160 },
+    };
+    static const int kIterations = 10;
+
+    for (const std::vector<Conversion> &conversions : {
+            std::vector<Conversion>(std::begin(kConversions), std::end(kConversions)),
+            std::vector<Conversion>(
+                    std::begin(kLibYUVConversions), std::end(kLibYUVConversions)) }) {
+        for (const Conversion &conversion : conversions) {
+            for (const Frame &frame : kFrames) {
+                const std::vector<uint8_t> source = createSource(conversion.src, frame);
+                std::vector<uint8_t> dest(
+                        frame.width * frame.height * bytesPerPixel(conversion.dst));
+
+                const int64_t startUs = nowUs();
+                for (int i = 0; i < kIterations; ++i) {
+                    ASSERT_EQ(OK, convert(conversion, source, frame, &dest));
+                }
+                printf("[ BENCH    ] %-26s %4zux%-4zu %6.2f ms\n", conversion.name,
+                        frame.cropWidth, frame.cropHeight,
+                        (nowUs() - startUs) / 1000.0 / kIterations);
+            }
+        }
+    }
+}
+
+}  // namespace android
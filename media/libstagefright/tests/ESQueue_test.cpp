@@ -0,0 +1,295 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// #define LOG_NDEBUG 0
+#define LOG_TAG "ESQueue_test"
+#include <utils/Log.h>
+
+#include <gtest/gtest.h>
+
+#include <media/stagefright/MediaErrors.h>
+#include <media/stagefright/foundation/ABuffer.h>
+
+#include "mpeg2ts/ATSParser.h"
+#include "mpeg2ts/AnotherPacketSource.h"
+#include "mpeg2ts/ESQueue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <atomic>
+#include <new>
+#include <vector>
+
+// Counts the allocations made by the code under test.
+static std::atomic<size_t> gAllocations(0);
+
+void *operator new(size_t size) {
+    ++gAllocations;
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t /* size */) noexcept {
+    operator delete(p);
+}
+
+namespace android {
+
+static const size_t kTSPacketSize = 188;
+static const unsigned kPMTPID = 0x100;
+static const unsigned kVideoPID = 0x101;
+
+// 320x240 Baseline profile, pic_order_cnt_type 2.
+static const uint8_t kSPS[] = { 0x67, 0x42, 0xc0, 0x0d, 0xda, 0x05, 0x07, 0xe4 };
+static const uint8_t kPPS[] = { 0x68, 0xce, 0x3c, 0x80 };
+
+static int64_t getNowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void appendStartCode(std::vector<uint8_t> *out) {
+    static const uint8_t kStartCode[] = { 0x00, 0x00, 0x00, 0x01 };
+    out->insert(out->end(), kStartCode, kStartCode + sizeof(kStartCode));
+}
+
+// An H.264 access unit: a single slice starting the frame (first_mb_in_slice 0),
+// preceded by the parameter sets if it is an IDR. Its payload has no start codes.
+static std::vector<uint8_t> makeAccessUnit(size_t sliceSize, bool idr) {
+    std::vector<uint8_t> au;
+    if (idr) {
+        appendStartCode(&au);
+        au.insert(au.end(), kSPS, kSPS + sizeof(kSPS));
+        appendStartCode(&au);
+        au.insert(au.end(), kPPS, kPPS + sizeof(kPPS));
+    }
+    appendStartCode(&au);
+    au.push_back(idr ? 0x65 : 0x41);
+    au.push_back(0x80);
+    au.resize(au.size() + sliceSize - 2, 0x55);
+    return au;
+}
+
+// Writes transport stream packets for a PAT, a PMT with one H.264 stream,
+// and PES packets carrying one access unit each.
+class TSWriter {
+public:
+    TSWriter() : mContinuity{} {}
+
+    void writeTables() {
+        writeSection(0, {
+            0x00, 0xb0, 0x0d,       // table_id, section_length
+            0x00, 0x01, 0xc1, 0x00, 0x00,
+            0x00, 0x01,             // program_number
+            0xe0 | (kPMTPID >> 8), kPMTPID & 0xff,
+        });
+        writeSection(kPMTPID, {
+            0x02, 0xb0, 0x12,       // table_id, section_length
+            0x00, 0x01, 0xc1, 0x00, 0x00,
+            0xe0 | (kVideoPID >> 8), kVideoPID & 0xff,  // PCR_PID
+            0xf0, 0x00,             // program_info_length
+            0x1b,                   // stream_type H.264
+            0xe0 | (kVideoPID >> 8), kVideoPID & 0xff,
+            0xf0, 0x00,             // ES_info_length
+        });
+    }
+
+    void writeAccessUnit(const std::vector<uint8_t> &au, int64_t timeUs) {
+        const uint64_t pts = timeUs * 9 / 100;
+        std::vector<uint8_t> pes = {
+            0x00, 0x00, 0x01, 0xe0,
+            0x00, 0x00,             // PES_packet_length, unbounded
+            0x80, 0x80, 0x05,       // PTS only
+            (uint8_t)(0x21 | ((pts >> 29) & 0x0e)),
+            (uint8_t)(pts >> 22),
+            (uint8_t)(((pts >> 14) & 0xfe) | 1),
+            (uint8_t)(pts >> 7),
+            (uint8_t)(((pts << 1) & 0xfe) | 1),
+        };
+        pes.insert(pes.end(), au.begin(), au.end());
+        writePackets(kVideoPID, pes.data(), pes.size(), false);
+    }
+
+    const std::vector<uint8_t> &data() const {
+        return mData;
+    }
+
+private:
+    std::vector<uint8_t> mData;
+    uint8_t mContinuity[0x2000];
+
+    // Writes a section after a pointer_field, followed by its CRC_32.
+    void writeSection(unsigned pid, std::vector<uint8_t> section) {
+        uint32_t crc = 0xffffffff;
+        for (uint8_t byte : section) {
+            crc ^= (uint32_t)byte << 24;
+            for (int i = 0; i < 8; ++i) {
+                crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+            }
+        }
+        section.insert(section.begin(), 0x00);
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            section.push_back(crc >> shift);
+        }
+        writePackets(pid, section.data(), section.size(), true);
+    }
+
+    // Sections are followed by 0xff, and PES are padded with adaptation field stuffing.
+    void writePackets(unsigned pid, const uint8_t *data, size_t size, bool section) {
+        bool start = true;
+        while (size > 0) {
+            uint8_t packet[kTSPacketSize];
+            size_t headerSize = 4;
+            size_t payloadSize = std::min(size, kTSPacketSize - headerSize);
+            bool adaptation = false;
+            if (!section && payloadSize < kTSPacketSize - headerSize) {
+                // The adaptation field takes up the rest of the last packet.
+                adaptation = true;
+                size_t stuffing = kTSPacketSize - headerSize - payloadSize;
+                packet[headerSize] = stuffing - 1;  // adaptation_field_length
+                if (stuffing > 1) {
+                    packet[headerSize + 1] = 0x00;
+                    memset(&packet[headerSize + 2], 0xff, stuffing - 2);
+                }
+                headerSize += stuffing;
+            }
+            packet[0] = 0x47;
+            packet[1] = (start ? 0x40 : 0x00) | (pid >> 8);
+            packet[2] = pid & 0xff;
+            packet[3] = (adaptation ? 0x30 : 0x10) | (mContinuity[pid]++ & 0x0f);
+            memcpy(&packet[headerSize], data, payloadSize);
+            memset(&packet[headerSize + payloadSize], 0xff,
+                    kTSPacketSize - headerSize - payloadSize);
+            mData.insert(mData.end(), packet, packet + kTSPacketSize);
+            data += payloadSize;
+            size -= payloadSize;
+            start = false;
+        }
+    }
+};
+
+TEST(ESQueueTest, H264AccessUnitsFromArbitraryChunks) {
+    // Access units of very different sizes, split at positions unrelated to them,
+    // as PES payloads of a stream that isn't aligned would be.
+    const std::vector<size_t> sliceSizes = { 3000, 20, 70000, 5, 64 * 1024, 2, 200000, 900 };
+    const std::vector<size_t> chunkSizes = { 188, 7, 4096, 1, 65536, 1000, 131072 };
+
+    std::vector<std::vector<uint8_t>> accessUnits;
+    std::vector<uint8_t> stream;
+    for (size_t i = 0; i < 3 * sliceSizes.size(); ++i) {
+        accessUnits.push_back(makeAccessUnit(sliceSizes[i % sliceSizes.size()],
+                i % sliceSizes.size() == 0));
+        stream.insert(stream.end(), accessUnits.back().begin(), accessUnits.back().end());
+    }
+
+    ElementaryStreamQueue queue(ElementaryStreamQueue::H264);
+    size_t dequeued = 0;
+    size_t chunk = 0;
+    for (size_t offset = 0; offset < stream.size(); ++chunk) {
+        size_t size = std::min(chunkSizes[chunk % chunkSizes.size()], stream.size() - offset);
+        ASSERT_EQ(OK, queue.appendData(&stream[offset], size, 33333 * (chunk + 1)));
+        offset += size;
+
+        sp<ABuffer> accessUnit;
+        while ((accessUnit = queue.dequeueAccessUnit()) != NULL) {
+            ASSERT_LT(dequeued, accessUnits.size());
+            const std::vector<uint8_t> &expected = accessUnits[dequeued];
+            ASSERT_EQ(expected.size(), accessUnit->size()) << "access unit " << dequeued;
+            EXPECT_EQ(0, memcmp(expected.data(), accessUnit->data(), expected.size()))
+                    << "access unit " << dequeued;
+            ++dequeued;
+        }
+    }
+
+    // A slice is only parsed once the start code after it arrives, and an access
+    // unit only ends when a slice of the next one is parsed: the last two are queued.
+    EXPECT_EQ(accessUnits.size() - 2, dequeued);
+    EXPECT_NE(nullptr, queue.getFormat().get());
+}
+
+TEST(ESQueueTest, Benchmark) {
+    // 40 Mbps at 25 fps, with a parameter set and IDR every 25 frames.
+    static const size_t kFrames = 100;
+    static const size_t kSliceSize = 200000;
+    static const int64_t kFrameDurationUs = 40000;
+    static const int kPasses = 5;
+
+    TSWriter writer;
+    writer.writeTables();
+    size_t expectedBytes = 0;
+    for (size_t i = 0; i < kFrames; ++i) {
+        std::vector<uint8_t> au = makeAccessUnit(kSliceSize, i % 25 == 0);
+        writer.writeAccessUnit(au, i * kFrameDurationUs);
+        expectedBytes += au.size();
+    }
+    const std::vector<uint8_t> &stream = writer.data();
+
+    int64_t elapsedUs = 0;
+    size_t allocations = 0;
+    for (int pass = 0; pass < kPasses; ++pass) {
+        const int64_t startUs = getNowUs();
+        const size_t startAllocations = gAllocations;
+
+        sp<ATSParser> parser = new ATSParser;
+        sp<AnotherPacketSource> source;
+        size_t accessUnits = 0;
+        size_t bytes = 0;
+        auto drain = [&]() {
+            if (source == NULL) {
+                source = parser->getSource(ATSParser::VIDEO);
+            }
+            status_t finalResult;
+            while (source != NULL && source->hasBufferAvailable(&finalResult)) {
+                sp<ABuffer> accessUnit;
+                if (source->dequeueAccessUnit(&accessUnit) == OK) {
+                    ++accessUnits;
+                    bytes += accessUnit->size();
+                }
+            }
+        };
+
+        for (size_t offset = 0; offset < stream.size(); offset += kTSPacketSize) {
+            ASSERT_EQ(OK, parser->feedTSPacket(&stream[offset], kTSPacketSize));
+            drain();
+        }
+        parser->signalEOS(ERROR_END_OF_STREAM);
+        drain();
+
+        elapsedUs += getNowUs() - startUs;
+        allocations += gAllocations - startAllocations;
+
+        // All but the last two access units, which the queue can't tell are complete.
+        EXPECT_EQ(kFrames - 2, accessUnits);
+        EXPECT_EQ(expectedBytes - 2 * makeAccessUnit(kSliceSize, false).size(), bytes);
+    }
+
+    printf("[ BENCH    ] H.264 transport stream %.1f MB/s, %.1f allocations per access unit\n",
+            (double)stream.size() * kPasses / elapsedUs,
+            (double)allocations / (kPasses * kFrames));
+}
+
+}  // namespace android
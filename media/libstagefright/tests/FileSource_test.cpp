@@ -0,0 +1,162 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// #define LOG_NDEBUG 0
+#define LOG_TAG "FileSource_test"
+#include <utils/Log.h>
+
+#include <gtest/gtest.h>
+
+#include <media/MediaExtractorPluginHelper.h>
+#include <media/stagefright/ClearFileSource.h>
+
+#include <fcntl.h>
+#include <linux/memfd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace android {
+
+static int64_t nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ll + ts.tv_nsec / 1000;
+}
+
+class FileSourceTest : public ::testing::Test {
+protected:
+    // Creates a temporary file of |size| bytes with a known pattern and opens
+    // it as a ClearFileSource starting at |offset|. Only a file that is sealed
+    // against shrinking can be mapped.
+    sp<ClearFileSource> createSource(size_t size, int64_t offset, bool sealed = true) {
+        int fd;
+        if (sealed) {
+            fd = syscall(__NR_memfd_create, "FileSource_test", MFD_ALLOW_SEALING);
+        } else {
+            char path[] = "/data/local/tmp/FileSource_test.XXXXXX";
+            fd = mkstemp(path);
+            unlink(path);
+        }
+        EXPECT_GE(fd, 0);
+
+        std::vector<uint8_t> chunk(1 << 20);
+        for (size_t written = 0; written < size; written += chunk.size()) {
+            size_t n = std::min(chunk.size(), size - written);
+            for (size_t i = 0; i < n; ++i) {
+                chunk[i] = pattern(written + i);
+            }
+            EXPECT_EQ((ssize_t)n, write(fd, chunk.data(), n));
+        }
+        if (sealed) {
+            EXPECT_EQ(0, fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK));
+        }
+
+        return new ClearFileSource(fd, offset, size - offset);
+    }
+
+    static uint8_t pattern(size_t position) {
+        return (position * 2654435761u) >> 24;
+    }
+};
+
+TEST_F(FileSourceTest, MappedDataTest) {
+    // an offset that is not page aligned, as for a file embedded in another.
+    static const int64_t kOffset = 12345;
+    sp<ClearFileSource> source = createSource(1 << 20, kOffset);
+    ASSERT_EQ(OK, source->initCheck());
+    EXPECT_TRUE(source->flags() & DataSourceBase::kIsMappable);
+
+    DataSourceHelper helper(source->wrap());
+    off64_t size = 0;
+    const uint8_t *data = helper.getMappedData(&size);
+    ASSERT_TRUE(data != NULL);
+    ASSERT_EQ((off64_t)(1 << 20) - kOffset, size);
+
+    for (off64_t i = 0; i < size; ++i) {
+        ASSERT_EQ(pattern(kOffset + i), data[i]) << "at " << i;
+    }
+
+    uint8_t buffer[4096];
+    ASSERT_EQ((ssize_t)sizeof(buffer), helper.readAt(5000, buffer, sizeof(buffer)));
+    EXPECT_EQ(0, memcmp(buffer, data + 5000, sizeof(buffer)));
+
+    // the mapping is made once.
+    EXPECT_EQ(data, helper.getMappedData(&size));
+}
+
+TEST_F(FileSourceTest, UnsealedFdTest) {
+    // a file descriptor from elsewhere may be truncated while it is mapped,
+    // which would raise SIGBUS, so it is only read through readAt().
+    sp<ClearFileSource> source = createSource(1 << 16, 0, false /* sealed */);
+    ASSERT_EQ(OK, source->initCheck());
+    EXPECT_FALSE(source->flags() & DataSourceBase::kIsMappable);
+
+    DataSourceHelper helper(source->wrap());
+    off64_t size = 0;
+    EXPECT_TRUE(helper.getMappedData(&size) == NULL);
+    EXPECT_TRUE(source->getMappedData(&size) == NULL);
+
+    uint8_t buffer[16];
+    ASSERT_EQ((ssize_t)sizeof(buffer), helper.readAt(100, buffer, sizeof(buffer)));
+    EXPECT_EQ(pattern(100), buffer[0]);
+}
+
+// Measures reading a large file in sample sized pieces through readAt() and
+// by copying from the mapping, as MPEG4Source does.
+TEST_F(FileSourceTest, ReadThroughputBenchmark) {
+    static const size_t kFileSize = 256 << 20;
+    static const size_t kSampleSize = 64 << 10;
+
+    sp<ClearFileSource> source = createSource(kFileSize, 0);
+    ASSERT_EQ(OK, source->initCheck());
+    DataSourceHelper helper(source->wrap());
+
+    std::vector<uint8_t> buffer(kSampleSize);
+    uint32_t checksum = 0;
+
+    int64_t startUs = nowUs();
+    for (size_t offset = 0; offset < kFileSize; offset += kSampleSize) {
+        ASSERT_EQ((ssize_t)kSampleSize, helper.readAt(offset, buffer.data(), kSampleSize));
+        checksum += buffer[0];
+    }
+    int64_t readAtUs = nowUs() - startUs;
+
+    off64_t size;
+    const uint8_t *data = helper.getMappedData(&size);
+    ASSERT_TRUE(data != NULL);
+
+    startUs = nowUs();
+    for (size_t offset = 0; offset < kFileSize; offset += kSampleSize) {
+        memcpy(buffer.data(), data + offset, kSampleSize);
+        checksum -= buffer[0];
+    }
+    int64_t mappedUs = nowUs() - startUs;
+    EXPECT_EQ(0u, checksum);
+
+    printf("[ BENCH    ] %zu KiB reads: readAt %.1f MB/s, mapped %.1f MB/s\n",
+            kSampleSize >> 10,
+            kFileSize / (double)std::max(readAtUs, (int64_t)1),
+            kFileSize / (double)std::max(mappedUs, (int64_t)1));
+}
+
+}  // namespace android
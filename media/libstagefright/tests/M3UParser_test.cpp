@@ -0,0 +1,305 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// #define LOG_NDEBUG 0
+#define LOG_TAG "M3UParser_test"
+#include <utils/Log.h>
+
+#include <gtest/gtest.h>
+
+#include <media/stagefright/foundation/ADebug.h>
+#include <media/stagefright/foundation/AMessage.h>
+
+#include "httplive/M3UParser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <atomic>
+#include <new>
+#include <string>
+
+// Counts the allocations made by the code under test.
+static std::atomic<size_t> gAllocations(0);
+
+void *operator new(size_t size) {
+    ++gAllocations;
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t /* size */) noexcept {
+    operator delete(p);
+}
+
+namespace android {
+
+static const char *kBaseUri = "http://example.com/live/index.m3u8";
+
+static int64_t getNowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+enum Ranges {
+    NO_RANGES,
+    RANGES,                 // all segments are ranges of one file
+    RANGES_WITHOUT_START,   // the same, but the first range has no offset
+};
+
+// Describes a window of a live stream in which segment n has a
+// discontinuity before it every 50 segments and a new key every 100.
+struct Window {
+    int32_t mFirstSeq;
+    size_t mNumSegments;
+    Ranges mRanges;
+    bool mEndList;
+    int32_t mChangedSeq;    // a segment republished with another duration, or -1
+};
+
+static size_t segmentLength(int32_t n) {
+    return 500000 + (n % 7) * 1000;
+}
+
+static uint64_t segmentOffset(int32_t n) {
+    uint64_t offset = 0;
+    for (int32_t i = 0; i < n; ++i) {
+        offset += segmentLength(i);
+    }
+    return offset;
+}
+
+static std::string makePlaylist(const Window &window) {
+    char line[256];
+    std::string playlist = "#EXTM3U\n#EXT-X-VERSION:4\n#EXT-X-TARGETDURATION:7\n";
+    snprintf(line, sizeof(line), "#EXT-X-MEDIA-SEQUENCE:%d\n", window.mFirstSeq);
+    playlist += line;
+    snprintf(line, sizeof(line), "#EXT-X-DISCONTINUITY-SEQUENCE:%d\n",
+            window.mFirstSeq > 0 ? (window.mFirstSeq - 1) / 50 : 0);
+    playlist += line;
+
+    for (size_t i = 0; i < window.mNumSegments; ++i) {
+        int32_t n = window.mFirstSeq + i;
+        if (n > 0 && n % 50 == 0) {
+            playlist += "#EXT-X-DISCONTINUITY\n";
+        }
+        if (n % 100 == 0 || i == 0) {
+            snprintf(line, sizeof(line),
+                    "#EXT-X-KEY:METHOD=AES-128,URI=\"keys/%d.key\",IV=0x%032x\n", n / 100, n);
+            playlist += line;
+        }
+        if (n % 10 == 0) {
+            snprintf(line, sizeof(line),
+                    "#EXT-X-PROGRAM-DATE-TIME:2019-01-01T00:%02d:%02d.000Z\n",
+                    (n / 10) % 60, n % 60);
+            playlist += line;
+        }
+        snprintf(line, sizeof(line), "#EXTINF:%.3f,\n",
+                n == window.mChangedSeq ? 4.0 : 6.006 - (n % 3) * 0.5);
+        playlist += line;
+        if (window.mRanges != NO_RANGES) {
+            // Only the first range says where it starts, the others follow it.
+            if (i == 0 && window.mRanges == RANGES) {
+                snprintf(line, sizeof(line), "#EXT-X-BYTERANGE:%zu@%llu\nall.ts\n",
+                        segmentLength(n), (unsigned long long)segmentOffset(n));
+            } else {
+                snprintf(line, sizeof(line), "#EXT-X-BYTERANGE:%zu\nall.ts\n",
+                        segmentLength(n));
+            }
+        } else {
+            snprintf(line, sizeof(line), "segments/%d.ts\n", n);
+        }
+        playlist += line;
+    }
+
+    if (window.mEndList) {
+        playlist += "#EXT-X-ENDLIST\n";
+    }
+    return playlist;
+}
+
+static sp<M3UParser> parse(const std::string &playlist, const sp<M3UParser> &previous = NULL) {
+    return new M3UParser(kBaseUri, playlist.data(), playlist.size(), previous);
+}
+
+static void expectSamePlaylist(const sp<M3UParser> &expected, const sp<M3UParser> &actual) {
+    ASSERT_EQ(expected->initCheck(), actual->initCheck());
+    EXPECT_EQ(expected->isComplete(), actual->isComplete());
+    EXPECT_EQ(expected->getDiscontinuitySeq(), actual->getDiscontinuitySeq());
+    EXPECT_EQ(expected->getTargetDuration(), actual->getTargetDuration());
+
+    int32_t expectedFirstSeq, expectedLastSeq, actualFirstSeq, actualLastSeq;
+    expected->getSeqNumberRange(&expectedFirstSeq, &expectedLastSeq);
+    actual->getSeqNumberRange(&actualFirstSeq, &actualLastSeq);
+    EXPECT_EQ(expectedFirstSeq, actualFirstSeq);
+    EXPECT_EQ(expectedLastSeq, actualLastSeq);
+
+    ASSERT_EQ(expected->size(), actual->size());
+    for (size_t i = 0; i < expected->size(); ++i) {
+        AString expectedUri, actualUri;
+        sp<AMessage> expectedMeta, actualMeta;
+        ASSERT_TRUE(expected->itemAt(i, &expectedUri, &expectedMeta));
+        ASSERT_TRUE(actual->itemAt(i, &actualUri, &actualMeta));
+        EXPECT_STREQ(expectedUri.c_str(), actualUri.c_str()) << "item " << i;
+        EXPECT_STREQ(expectedMeta->debugString().c_str(), actualMeta->debugString().c_str())
+                << "item " << i;
+    }
+}
+
+// Returns how many items of the playlist are shared with the previous one.
+static size_t countSharedItems(const sp<M3UParser> &playlist, const sp<M3UParser> &previous) {
+    size_t shared = 0;
+    for (size_t i = 0; i < playlist->size(); ++i) {
+        sp<AMessage> meta;
+        CHECK(playlist->itemAt(i, NULL /* uri */, &meta));
+        for (size_t j = 0; j < previous->size(); ++j) {
+            sp<AMessage> previousMeta;
+            CHECK(previous->itemAt(j, NULL /* uri */, &previousMeta));
+            if (meta == previousMeta) {
+                ++shared;
+                break;
+            }
+        }
+    }
+    return shared;
+}
+
+TEST(M3UParserTest, RefreshMatchesFullParse) {
+    static const struct {
+        const char *mName;
+        Window mPrevious;
+        Window mCurrent;
+    } kRefreshes[] = {
+        { "slid by one", { 95, 30, NO_RANGES, false, -1 }, { 96, 30, NO_RANGES, false, -1 } },
+        { "slid past a key",
+                { 70, 40, NO_RANGES, false, -1 }, { 101, 40, NO_RANGES, false, -1 } },
+        { "appended", { 0, 120, NO_RANGES, false, -1 }, { 0, 150, NO_RANGES, false, -1 } },
+        { "ended", { 240, 20, NO_RANGES, false, -1 }, { 240, 21, NO_RANGES, true, -1 } },
+        { "jumped ahead", { 10, 20, NO_RANGES, false, -1 }, { 500, 20, NO_RANGES, false, -1 } },
+        { "went back", { 500, 20, NO_RANGES, false, -1 }, { 490, 20, NO_RANGES, false, -1 } },
+        { "republished", { 40, 30, NO_RANGES, false, -1 }, { 42, 30, NO_RANGES, false, 50 } },
+        { "byte ranges", { 95, 30, RANGES, false, -1 }, { 97, 30, RANGES, false, -1 } },
+        { "byte ranges without a start",
+                { 95, 30, RANGES_WITHOUT_START, false, -1 },
+                { 97, 30, RANGES_WITHOUT_START, false, -1 } },
+    };
+
+    for (const auto &refresh : kRefreshes) {
+        SCOPED_TRACE(refresh.mName);
+
+        sp<M3UParser> previous = parse(makePlaylist(refresh.mPrevious));
+        ASSERT_EQ(OK, previous->initCheck());
+
+        std::string playlist = makePlaylist(refresh.mCurrent);
+        sp<M3UParser> full = parse(playlist);
+        ASSERT_EQ(OK, full->initCheck());
+        expectSamePlaylist(full, parse(playlist, previous));
+
+        // Refreshing again reuses the items reused the first time.
+        sp<M3UParser> refreshed = parse(playlist, previous);
+        expectSamePlaylist(full, parse(playlist, refreshed));
+        EXPECT_EQ(refreshed->size(), countSharedItems(parse(playlist, refreshed), refreshed));
+    }
+}
+
+TEST(M3UParserTest, RefreshSharesUnchangedItems) {
+    sp<M3UParser> previous = parse(makePlaylist({ 95, 30, NO_RANGES, false, -1 }));
+
+    // The 27 segments still listed are shared, except the first one, which
+    // is now preceded by its key.
+    sp<M3UParser> playlist = parse(makePlaylist({ 98, 30, NO_RANGES, false, -1 }), previous);
+    EXPECT_EQ(26u, countSharedItems(playlist, previous));
+
+    // Segments that were republished differently are parsed again.
+    playlist = parse(makePlaylist({ 98, 30, NO_RANGES, false, 110 }), previous);
+    EXPECT_EQ(25u, countSharedItems(playlist, previous));
+
+    // The first range now says where it starts, the others still follow the
+    // same ranges.
+    previous = parse(makePlaylist({ 95, 30, RANGES, false, -1 }));
+    playlist = parse(makePlaylist({ 98, 30, RANGES, false, -1 }), previous);
+    EXPECT_EQ(26u, countSharedItems(playlist, previous));
+
+    // Without a start, every range is now at another offset.
+    previous = parse(makePlaylist({ 95, 30, RANGES_WITHOUT_START, false, -1 }));
+    playlist = parse(makePlaylist({ 98, 30, RANGES_WITHOUT_START, false, -1 }), previous);
+    EXPECT_EQ(0u, countSharedItems(playlist, previous));
+
+    // Nothing is shared with a playlist of another URI.
+    std::string text = makePlaylist({ 95, 30, NO_RANGES, false, -1 });
+    sp<M3UParser> other = new M3UParser(
+            "http://example.com/other/index.m3u8", text.data(), text.size());
+    playlist = parse(makePlaylist({ 98, 30, NO_RANGES, false, -1 }), other);
+    EXPECT_EQ(0u, countSharedItems(playlist, other));
+
+    // Nor with a variant playlist.
+    static const char *kVariantPlaylist =
+        "#EXTM3U\n"
+        "#EXT-X-STREAM-INF:BANDWIDTH=1280000\n"
+        "segments/95.ts\n";
+    sp<M3UParser> variant = parse(kVariantPlaylist);
+    ASSERT_EQ(OK, variant->initCheck());
+    playlist = parse(makePlaylist({ 95, 30, NO_RANGES, false, -1 }), variant);
+    EXPECT_EQ(0u, countSharedItems(playlist, variant));
+}
+
+TEST(M3UParserTest, RefreshBenchmark) {
+    // A DVR window of 10000 six second segments, refreshed every segment.
+    static const size_t kNumSegments = 10000;
+    static const int kRefreshes = 20;
+
+    sp<M3UParser> previous =
+            parse(makePlaylist({ 1000, kNumSegments, NO_RANGES, false, -1 }));
+
+    int64_t fullUs = 0, incrementalUs = 0;
+    size_t fullAllocations = 0, incrementalAllocations = 0;
+    for (int i = 1; i <= kRefreshes; ++i) {
+        std::string playlist = makePlaylist({ 1000 + i, kNumSegments, NO_RANGES, false, -1 });
+
+        int64_t startUs = getNowUs();
+        size_t startAllocations = gAllocations;
+        sp<M3UParser> full = parse(playlist);
+        fullUs += getNowUs() - startUs;
+        fullAllocations += gAllocations - startAllocations;
+
+        startUs = getNowUs();
+        startAllocations = gAllocations;
+        sp<M3UParser> incremental = parse(playlist, previous);
+        incrementalUs += getNowUs() - startUs;
+        incrementalAllocations += gAllocations - startAllocations;
+
+        ASSERT_EQ(OK, incremental->initCheck());
+        ASSERT_EQ(kNumSegments, incremental->size());
+        previous = incremental;
+    }
+
+    printf("[ BENCH    ] %zu segment refresh: full parse %.2f ms, %zu allocations; "
+            "incremental %.2f ms, %zu allocations\n",
+            kNumSegments,
+            fullUs / 1000.0 / kRefreshes, fullAllocations / kRefreshes,
+            incrementalUs / 1000.0 / kRefreshes, incrementalAllocations / kRefreshes);
+}
+
+}  // namespace android
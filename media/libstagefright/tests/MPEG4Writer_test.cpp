@@ -0,0 +1,411 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// #define LOG_NDEBUG 0
+#define LOG_TAG "MPEG4Writer_test"
+#include <utils/Log.h>
+
+#include <gtest/gtest.h>
+
+#include <media/MediaExtractorPluginHelper.h>
+#include <media/MediaSource.h>
+#include <media/MediaTrack.h>
+#include <media/NdkMediaFormat.h>
+#include <media/stagefright/ClearFileSource.h>
+#include <media/stagefright/MPEG4Writer.h>
+#include <media/stagefright/MediaBuffer.h>
+#include <media/stagefright/MediaDefs.h>
+#include <media/stagefright/MediaErrors.h>
+#include <media/stagefright/MetaData.h>
+#include <media/stagefright/foundation/ADebug.h>
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "MPEG4Extractor.h"
+
+namespace android {
+
+// Produces frames with known contents. Video frames come in decoding order,
+// and of every three frames the last two are presented in reverse order, as
+// with B frames. AVC frames are made of several NAL units with start codes.
+class FakeSource : public MediaSource {
+public:
+    enum Kind {
+        kAmrAudio,
+        kH263Video,
+        kAvcVideo,  // 4K at 60 frames per second
+    };
+
+    FakeSource(Kind kind, size_t frameCount)
+        : mKind(kind), mFrameCount(frameCount), mIndex(0) {
+        mFormat = new MetaData;
+        if (kind == kAmrAudio) {
+            mFormat->setCString(kKeyMIMEType, MEDIA_MIMETYPE_AUDIO_AMR_NB);
+            mFormat->setInt32(kKeySampleRate, 8000);
+            mFormat->setInt32(kKeyChannelCount, 1);
+        } else if (kind == kH263Video) {
+            mFormat->setCString(kKeyMIMEType, MEDIA_MIMETYPE_VIDEO_H263);
+            mFormat->setInt32(kKeyWidth, 176);
+            mFormat->setInt32(kKeyHeight, 144);
+        } else {
+            static const uint8_t kAvcc[] = {
+                0x01, 0x64, 0x00, 0x33, 0xff,           // 4 byte NAL lengths
+                0xe1, 0x00, 0x04, 0x67, 0x64, 0x00, 0x33,  // SPS
+                0x01, 0x00, 0x02, 0x68, 0xee,           // PPS
+            };
+            mFormat->setCString(kKeyMIMEType, MEDIA_MIMETYPE_VIDEO_AVC);
+            mFormat->setInt32(kKeyWidth, 3840);
+            mFormat->setInt32(kKeyHeight, 2160);
+            mFormat->setData(kKeyAVCC, kTypeAVCC, kAvcc, sizeof(kAvcc));
+        }
+    }
+
+    status_t start(MetaData *) override { return OK; }
+    status_t stop() override { return OK; }
+    sp<MetaData> getFormat() override { return mFormat; }
+
+    status_t read(MediaBufferBase **buffer, const ReadOptions *) override {
+        if (mIndex == mFrameCount) {
+            return ERROR_END_OF_STREAM;
+        }
+        std::vector<uint8_t> data = frameData(mIndex);
+        MediaBuffer *frame = new MediaBuffer(data.size());
+        memcpy(frame->data(), data.data(), data.size());
+        frame->meta_data().setInt64(kKeyTime, frameTimeUs(mIndex));
+        if (isVideo()) {
+            frame->meta_data().setInt64(
+                    kKeyDecodingTime, (mIndex + 1) * frameDurationUs());
+        }
+        frame->meta_data().setInt32(kKeyIsSyncFrame, isSyncFrame(mIndex));
+        ++mIndex;
+        *buffer = frame;
+        return OK;
+    }
+
+    const char *mime() const {
+        const char *mime;
+        CHECK(mFormat->findCString(kKeyMIMEType, &mime));
+        return mime;
+    }
+
+    bool isVideo() const { return mKind != kAmrAudio; }
+    size_t frameCount() const { return mFrameCount; }
+
+    int64_t frameDurationUs() const {
+        return mKind == kAmrAudio ? 20000 : mKind == kH263Video ? 33333 : 16667;
+    }
+
+    std::vector<uint8_t> frameData(size_t index) const {
+        if (mKind == kAmrAudio) {
+            return pattern(index, 32, 0);
+        }
+        if (mKind == kH263Video) {
+            return pattern(index, 200 + (index * 397) % 1500, 0x55);
+        }
+        // About 40 Mbps in four slices, with larger sync frames
+        static const size_t kSlices = 4;
+        size_t sliceSize = isSyncFrame(index) ? 100000 : 15000 + (index * 397) % 10000;
+        std::vector<uint8_t> data;
+        for (size_t i = 0; i < kSlices; ++i) {
+            static const uint8_t kStartCode[] = { 0x00, 0x00, 0x00, 0x01 };
+            data.insert(data.end(), kStartCode, kStartCode + sizeof(kStartCode));
+            data.push_back(isSyncFrame(index) ? 0x65 : 0x41);  // NAL unit header
+            std::vector<uint8_t> slice = pattern(index, sliceSize + i, i);
+            for (uint8_t &byte : slice) {
+                byte |= 1;  // no start code emulation
+            }
+            data.insert(data.end(), slice.begin(), slice.end());
+        }
+        return data;
+    }
+
+    int64_t frameTimeUs(size_t index) const {
+        if (!isVideo()) {
+            return index * frameDurationUs();
+        }
+        int64_t reorder = index % 3 == 1 ? 1 : index % 3 == 2 ? -1 : 0;
+        return (index + reorder + 1) * frameDurationUs();
+    }
+
+    bool isSyncFrame(size_t index) const {
+        return !isVideo() || index % 30 == 0;
+    }
+
+private:
+    Kind mKind;
+    size_t mFrameCount;
+    size_t mIndex;
+    sp<MetaData> mFormat;
+
+    static std::vector<uint8_t> pattern(size_t index, size_t size, uint8_t seed) {
+        std::vector<uint8_t> data(size);
+        for (size_t i = 0; i < size; ++i) {
+            data[i] = (index * 31 + i * 7 + seed) & 0xff;
+        }
+        return data;
+    }
+};
+
+class MPEG4WriterTest : public ::testing::Test {
+protected:
+    // Records the given sources into a temporary file and returns its
+    // descriptor.
+    int record(const std::vector<sp<FakeSource>> &sources, int64_t fragmentDurationUs,
+            status_t stopStatus = OK) {
+        char path[] = "/data/local/tmp/MPEG4Writer_test.XXXXXX";
+        int fd = mkstemp(path);
+        EXPECT_GE(fd, 0);
+        unlink(path);
+
+        sp<MPEG4Writer> writer = new MPEG4Writer(fd);
+        for (const sp<FakeSource> &source : sources) {
+            EXPECT_EQ(OK, writer->addSource(source));
+        }
+
+        sp<MetaData> params = new MetaData;
+        params->setInt32(kKeyRealTimeRecording, false);
+        params->setInt64(kKeyTime, 0);
+        if (fragmentDurationUs > 0) {
+            params->setInt64(kKeyFragmentDurationUs, fragmentDurationUs);
+        }
+        EXPECT_EQ(OK, writer->start(params.get()));
+        while (!writer->reachedEOS()) {
+            usleep(10000);
+        }
+        EXPECT_EQ(stopStatus, writer->stop());
+        writer.clear();
+        return fd;
+    }
+
+    // Returns the types of the top level boxes of the file.
+    static std::vector<std::string> topLevelBoxes(int fd) {
+        std::vector<std::string> boxes;
+        off64_t size = lseek64(fd, 0, SEEK_END);
+        for (off64_t offset = 0; offset + 8 <= size;) {
+            uint32_t header[4];
+            if (pread64(fd, header, sizeof(header), offset) < 8) {
+                break;
+            }
+            uint64_t boxSize = ntohl(header[0]);
+            if (boxSize == 1) {
+                boxSize = ((uint64_t)ntohl(header[2]) << 32) | ntohl(header[3]);
+            }
+            boxes.push_back(std::string((const char *)&header[1], 4));
+            if (boxSize < 8) {
+                break;
+            }
+            offset += boxSize;
+        }
+        return boxes;
+    }
+
+    // Reads the file back through MPEG4Extractor and checks every sample
+    // against the sources. Timestamps are checked for fragmented files only,
+    // as regular files shift the video track by its edit list.
+    void verify(int fd, const std::vector<sp<FakeSource>> &sources, bool checkTimes) {
+        off64_t size = lseek64(fd, 0, SEEK_END);
+        sp<ClearFileSource> file = new ClearFileSource(dup(fd), 0, size);
+        ASSERT_EQ(OK, file->initCheck());
+        MediaExtractorPluginHelper *extractor = new MPEG4Extractor(new DataSourceHelper(file->wrap()));
+        ASSERT_EQ(sources.size(), extractor->countTracks());
+
+        for (size_t t = 0; t < extractor->countTracks(); ++t) {
+            AMediaFormat *format = AMediaFormat_new();
+            ASSERT_EQ(AMEDIA_OK, extractor->getTrackMetaData(format, t, 0));
+            const char *mime;
+            ASSERT_TRUE(AMediaFormat_getString(format, AMEDIAFORMAT_KEY_MIME, &mime));
+            sp<FakeSource> source;
+            for (const sp<FakeSource> &s : sources) {
+                if (!strcasecmp(mime, s->mime())) {
+                    source = s;
+                }
+            }
+            AMediaFormat_delete(format);
+            ASSERT_TRUE(source != NULL);
+
+            MediaTrack *track = MediaTrackCUnwrapper::create(wrap(extractor->getTrack(t)));
+            ASSERT_TRUE(track != NULL);
+            ASSERT_EQ(OK, track->start());
+            size_t index = 0;
+            MediaBufferBase *buffer;
+            status_t err;
+            while ((err = track->read(&buffer)) == OK) {
+                ASSERT_LT(index, source->frameCount());
+                std::vector<uint8_t> expected = source->frameData(index);
+                ASSERT_EQ(expected.size(), buffer->range_length()) << "at " << index;
+                EXPECT_EQ(0, memcmp(expected.data(),
+                        (const uint8_t *)buffer->data() + buffer->range_offset(),
+                        expected.size())) << "at " << index;
+
+                int64_t timeUs;
+                ASSERT_TRUE(buffer->meta_data().findInt64(kKeyTime, &timeUs));
+                if (checkTimes) {
+                    // within a tick of the track time scale
+                    EXPECT_NEAR(source->frameTimeUs(index), timeUs, 125) << "at " << index;
+                }
+                int32_t isSync = false;
+                buffer->meta_data().findInt32(kKeyIsSyncFrame, &isSync);
+                if (isSync) {
+                    EXPECT_TRUE(source->isSyncFrame(index)) << "at " << index;
+                }
+                buffer->release();
+                ++index;
+            }
+            EXPECT_EQ(ERROR_END_OF_STREAM, err);
+            EXPECT_EQ(source->frameCount(), index);
+            track->stop();
+            delete track;
+        }
+        delete extractor;
+    }
+};
+
+// Returns the number of write system calls made by the process so far, or -1
+// if I/O accounting is not available.
+static int64_t writeSyscalls() {
+    FILE *file = fopen("/proc/self/io", "r");
+    if (file == NULL) {
+        return -1;
+    }
+    int64_t count = -1;
+    char line[64];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, "syscw: %" SCNd64, &count) == 1) {
+            break;
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+static int64_t nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ll + ts.tv_nsec / 1000;
+}
+
+TEST_F(MPEG4WriterTest, FragmentedRoundTrip) {
+    std::vector<sp<FakeSource>> sources = {
+        new FakeSource(FakeSource::kAmrAudio, 500),
+        new FakeSource(FakeSource::kH263Video, 300),
+    };
+    int fd = record(sources, 1000000);
+
+    std::vector<std::string> boxes = topLevelBoxes(fd);
+    ASSERT_GE(boxes.size(), 4u);
+    EXPECT_EQ("ftyp", boxes[0]);
+    EXPECT_EQ("moov", boxes[1]);
+    size_t fragments = 0;
+    for (size_t i = 2; i < boxes.size(); i += 2) {
+        EXPECT_EQ("moof", boxes[i]);
+        ASSERT_LT(i + 1, boxes.size());
+        EXPECT_EQ("mdat", boxes[i + 1]);
+        ++fragments;
+    }
+    // 10 seconds in fragments of about a second, cut at video sync frames
+    EXPECT_GE(fragments, 5u);
+
+    verify(fd, sources, true /* checkTimes */);
+    close(fd);
+}
+
+TEST_F(MPEG4WriterTest, FragmentedSingleTrack) {
+    std::vector<sp<FakeSource>> sources = {
+        new FakeSource(FakeSource::kAmrAudio, 500),
+    };
+    int fd = record(sources, 500000);
+
+    std::vector<std::string> boxes = topLevelBoxes(fd);
+    ASSERT_GE(boxes.size(), 4u);
+    EXPECT_EQ("moov", boxes[1]);
+    EXPECT_EQ("moof", boxes[2]);
+
+    verify(fd, sources, true /* checkTimes */);
+    close(fd);
+}
+
+TEST_F(MPEG4WriterTest, FragmentedMissingTrack) {
+    // a track that never sends a sample is left out of the file, and fails
+    // the recording, but does not keep the other track from being written.
+    std::vector<sp<FakeSource>> sources = {
+        new FakeSource(FakeSource::kAmrAudio, 500),
+        new FakeSource(FakeSource::kH263Video, 0),
+    };
+    int fd = record(sources, 500000, ERROR_MALFORMED);
+
+    std::vector<std::string> boxes = topLevelBoxes(fd);
+    ASSERT_GE(boxes.size(), 4u);
+    EXPECT_EQ("moov", boxes[1]);
+    EXPECT_EQ("moof", boxes[2]);
+
+    verify(fd, { sources[0] }, true /* checkTimes */);
+    close(fd);
+}
+
+TEST_F(MPEG4WriterTest, RegularRoundTrip) {
+    std::vector<sp<FakeSource>> sources = {
+        new FakeSource(FakeSource::kAmrAudio, 500),
+        new FakeSource(FakeSource::kH263Video, 300),
+    };
+    int fd = record(sources, 0 /* fragmentDurationUs */);
+
+    std::vector<std::string> boxes = topLevelBoxes(fd);
+    for (const std::string &box : boxes) {
+        EXPECT_NE("moof", box);
+    }
+
+    verify(fd, sources, false /* checkTimes */);
+    close(fd);
+}
+
+// Records 10 seconds of 4K60 AVC video with audio, and reports the write
+// throughput and the number of write calls per video frame. The samples of
+// a chunk are written with a single writev().
+TEST_F(MPEG4WriterTest, RecordingBenchmark) {
+    static const size_t kVideoFrames = 600;
+    std::vector<sp<FakeSource>> sources = {
+        new FakeSource(FakeSource::kAmrAudio, 500),
+        new FakeSource(FakeSource::kAvcVideo, kVideoFrames),
+    };
+
+    int64_t syscalls = writeSyscalls();
+    int64_t startUs = nowUs();
+    int fd = record(sources, 0 /* fragmentDurationUs */);
+    int64_t elapsedUs = nowUs() - startUs;
+    if (syscalls >= 0) {
+        syscalls = writeSyscalls() - syscalls;
+    }
+    off64_t size = lseek64(fd, 0, SEEK_END);
+
+    printf("[ BENCH    ] 4K60 recording: %.1f MB/s, %.2f write calls per video frame\n",
+            size / (double)std::max(elapsedUs, (int64_t)1),
+            syscalls >= 0 ? syscalls / (double)kVideoFrames : -1.);
+
+    verify(fd, sources, false /* checkTimes */);
+    close(fd);
+}
+
+}  // namespace android
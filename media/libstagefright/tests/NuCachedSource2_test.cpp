@@ -0,0 +1,222 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// #define LOG_NDEBUG 0
+#define LOG_TAG "NuCachedSource2_test"
+#include <utils/Log.h>
+
+#include <gtest/gtest.h>
+
+#include <media/DataSource.h>
+#include <media/stagefright/MediaErrors.h>
+
+#include "include/NuCachedSource2.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace android {
+
+static const off64_t kFileSize = 16 * 1024 * 1024;
+
+// A small prefetch window, so that the traces below move it around.
+// low/high water marks in KB, keep-alive in secs, then the KB kept outside the window.
+static const char *kCacheConfig = "256/2048/0/4096";
+static const char *kNoRetainedCacheConfig = "256/2048/0/0";
+
+static uint8_t pattern(off64_t position) {
+    return (position * 2654435761u) >> 24;
+}
+
+// Stands in for an HTTP source: serves a generated file from memory
+// and counts the bytes fetched from it.
+class FakeHTTPSource : public DataSource {
+public:
+    FakeHTTPSource() : mBytesFetched(0) {}
+
+    virtual status_t initCheck() const {
+        return OK;
+    }
+
+    virtual ssize_t readAt(off64_t offset, void *data, size_t size) {
+        if (offset >= kFileSize) {
+            return 0;
+        }
+        size = std::min(size, (size_t)(kFileSize - offset));
+
+        uint8_t *bytes = (uint8_t *)data;
+        for (size_t i = 0; i < size; ++i) {
+            bytes[i] = pattern(offset + i);
+        }
+        mBytesFetched += size;
+        return size;
+    }
+
+    virtual status_t getSize(off64_t *size) {
+        *size = kFileSize;
+        return OK;
+    }
+
+    virtual uint32_t flags() {
+        return kWantsPrefetching;
+    }
+
+    // Like an HTTP source, a new range can be requested after the end of the file.
+    virtual status_t reconnectAtOffset(off64_t /*offset*/) {
+        return OK;
+    }
+
+    int64_t bytesFetched() const {
+        return mBytesFetched;
+    }
+
+private:
+    std::atomic<int64_t> mBytesFetched;
+};
+
+class NuCachedSource2Test : public ::testing::Test {
+protected:
+    void open(const char *cacheConfig) {
+        mSource = new FakeHTTPSource;
+        mCachedSource = NuCachedSource2::Create(mSource, cacheConfig);
+        ASSERT_EQ(OK, mCachedSource->initCheck());
+    }
+
+    void TearDown() override {
+        mCachedSource.clear();
+        mSource.clear();
+    }
+
+    // Reads [offset, offset + size) as a player would, a chunk at a time,
+    // and checks the data.
+    void read(off64_t offset, size_t size, size_t chunkSize = 16 * 1024) {
+        std::vector<uint8_t> data(chunkSize);
+        while (size > 0) {
+            size_t n = std::min(size, chunkSize);
+            ASSERT_EQ((ssize_t)n, mCachedSource->readAt(offset, data.data(), n));
+            for (size_t i = 0; i < n; ++i) {
+                ASSERT_EQ(pattern(offset + i), data[i]) << "at offset " << offset + i;
+            }
+            offset += n;
+            size -= n;
+        }
+    }
+
+    // Waits for the prefetcher to fill its window, as it would while the player
+    // is busy with what it has read.
+    void waitForPrefetch() {
+        int64_t bytesFetched = -1;
+        for (int i = 0; i < 100 && bytesFetched != mSource->bytesFetched(); ++i) {
+            bytesFetched = mSource->bytesFetched();
+            usleep(200000);
+        }
+    }
+
+    void report(const char *name) {
+        NuCachedSource2::CacheStats stats;
+        mCachedSource->getCacheStats(&stats);
+        printf("[ BENCH    ] %-24s fetched %6.2f MB  hits %6lld  misses %4lld  retained %5zu KB\n",
+               name, mSource->bytesFetched() / (1024.0 * 1024.0),
+               (long long)stats.mNumHits, (long long)stats.mNumMisses,
+               stats.mRetainedBytes / 1024);
+    }
+
+    // An MP4 file with the moov atom at the end: the extractor reads the ftyp box,
+    // skips to the moov atom, then playback starts at the beginning of the mdat.
+    int64_t moovAtEnd(const char *name, const char *cacheConfig) {
+        open(cacheConfig);
+        read(0, 32);
+        waitForPrefetch();
+        read(kFileSize - 512 * 1024, 512 * 1024, 4096);
+        waitForPrefetch();
+        read(64 * 1024, 3 * 1024 * 1024);
+        waitForPrefetch();
+        report(name);
+        return mSource->bytesFetched();
+    }
+
+    // Playback that is seeked back a couple of seconds.
+    int64_t seekBack(const char *name, const char *cacheConfig) {
+        open(cacheConfig);
+        read(0, 6 * 1024 * 1024);
+        waitForPrefetch();
+        read(4 * 1024 * 1024, 3 * 1024 * 1024);
+        waitForPrefetch();
+        report(name);
+        return mSource->bytesFetched();
+    }
+
+    sp<FakeHTTPSource> mSource;
+    sp<NuCachedSource2> mCachedSource;
+};
+
+TEST_F(NuCachedSource2Test, MoovAtEndTest) {
+    int64_t single = moovAtEnd("moov at end, one range", kNoRetainedCacheConfig);
+    int64_t retained = moovAtEnd("moov at end, retained", kCacheConfig);
+
+    // The start of the file is fetched once.
+    EXPECT_LT(retained, single);
+    EXPECT_LE(retained, single - 1024 * 1024);
+}
+
+TEST_F(NuCachedSource2Test, SeekBackTest) {
+    int64_t single = seekBack("seek back, one range", kNoRetainedCacheConfig);
+    int64_t retained = seekBack("seek back, retained", kCacheConfig);
+
+    EXPECT_LT(retained, single);
+}
+
+TEST_F(NuCachedSource2Test, RetainedHitsTest) {
+    open(kCacheConfig);
+    read(0, 32);
+    waitForPrefetch();
+    read(kFileSize - 64 * 1024, 64 * 1024);
+
+    // The first window was kept when the read at the end moved it.
+    NuCachedSource2::CacheStats before;
+    mCachedSource->getCacheStats(&before);
+    EXPECT_GE(before.mRetainedBytes, (size_t)(1024 * 1024));
+
+    int64_t bytesFetched = mSource->bytesFetched();
+    read(1024, 1024 * 1024);
+
+    NuCachedSource2::CacheStats after;
+    mCachedSource->getCacheStats(&after);
+    EXPECT_EQ(before.mNumMisses, after.mNumMisses);
+    EXPECT_EQ(before.mNumHits + 64, after.mNumHits);
+
+    // Only the prefetcher at the end of the file may have fetched more.
+    EXPECT_LE(mSource->bytesFetched() - bytesFetched, 1024 * 1024);
+}
+
+TEST_F(NuCachedSource2Test, DefaultRetainedTest) {
+    // Without a size in the cache config, up to 4MB outside the window is kept.
+    open("256/2048/0");
+    read(0, 32);
+    waitForPrefetch();
+    read(kFileSize - 64 * 1024, 64 * 1024);
+
+    NuCachedSource2::CacheStats stats;
+    mCachedSource->getCacheStats(&stats);
+    EXPECT_GE(stats.mRetainedBytes, (size_t)(1024 * 1024));
+    EXPECT_LE(stats.mRetainedBytes, (size_t)(4 * 1024 * 1024));
+}
+
+}  // namespace android
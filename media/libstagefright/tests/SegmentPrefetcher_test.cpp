@@ -0,0 +1,467 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// #define LOG_NDEBUG 0
+#define LOG_TAG "SegmentPrefetcher_test"
+#include <utils/Log.h>
+
+#include <gtest/gtest.h>
+
+#include <media/MediaHTTPConnection.h>
+#include <media/MediaHTTPService.h>
+#include <media/stagefright/foundation/ABuffer.h>
+#include <media/stagefright/foundation/ALooper.h>
+#include <media/stagefright/foundation/AMessage.h>
+#include <media/stagefright/MediaErrors.h>
+#include <utils/Mutex.h>
+#include <utils/Thread.h>
+
+#include "httplive/HTTPDownloader.h"
+#include "httplive/M3UParser.h"
+#include "httplive/SegmentPrefetcher.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace android {
+
+static const char *kServerUri = "http://localhost/";
+static const size_t kNumSegments = 12;
+static const size_t kSegmentSize = 96 * 1024;
+static const int64_t kTakeTimeoutUs = 10000000LL;
+
+static uint8_t pattern(size_t segment, size_t position) {
+    return ((segment + 1) * 131 + position * 2654435761u) >> 24;
+}
+
+// Stands in for an HTTP connection: serves the files under a directory, with
+// the latency of a round trip to open each request and a throughput limit
+// on each connection. Like a real connection, it can be disconnected from
+// another thread.
+class FileHTTPConnection : public MediaHTTPConnection {
+public:
+    FileHTTPConnection(const std::string &root, int64_t roundTripUs, size_t bytesPerSecond)
+        : mRoot(root),
+          mRoundTripUs(roundTripUs),
+          mBytesPerSecond(bytesPerSecond),
+          mFile(NULL),
+          mOffset(0),
+          mLength(0) {
+    }
+
+    virtual bool connect(const char *uri, const KeyedVector<String8, String8> *headers) {
+        disconnect();
+        usleep(mRoundTripUs);
+
+        if (strncmp(uri, kServerUri, strlen(kServerUri))) {
+            return false;
+        }
+        Mutex::Autolock autoLock(mLock);
+        mUri = uri;
+        mFile = fopen((mRoot + "/" + (uri + strlen(kServerUri))).c_str(), "rb");
+        if (mFile == NULL) {
+            return false;
+        }
+        fseek(mFile, 0, SEEK_END);
+        off64_t size = ftell(mFile);
+
+        mOffset = 0;
+        mLength = size;
+        ssize_t index = headers != NULL ? headers->indexOfKey(String8("Range")) : -1;
+        if (index >= 0) {
+            long long first, last = -1;
+            if (sscanf(headers->valueAt(index).string(), "bytes=%lld-%lld", &first, &last) < 1) {
+                return false;
+            }
+            mOffset = first;
+            mLength = (last >= 0 ? last + 1 : size) - first;
+        }
+        return true;
+    }
+
+    virtual void disconnect() {
+        Mutex::Autolock autoLock(mLock);
+        if (mFile != NULL) {
+            fclose(mFile);
+            mFile = NULL;
+        }
+    }
+
+    virtual ssize_t readAt(off64_t offset, void *data, size_t size) {
+        if (offset >= mLength) {
+            return 0;
+        }
+        size = std::min(size, (size_t)(mLength - offset));
+        usleep(size * 1000000LL / mBytesPerSecond);
+
+        Mutex::Autolock autoLock(mLock);
+        if (mFile == NULL) {
+            return ERROR_IO;
+        }
+        fseek(mFile, mOffset + offset, SEEK_SET);
+        return fread(data, 1, size, mFile);
+    }
+
+    virtual off64_t getSize() {
+        Mutex::Autolock autoLock(mLock);
+        return mFile != NULL ? mLength : -1;
+    }
+
+    virtual status_t getMIMEType(String8 *mimeType) {
+        *mimeType = "application/octet-stream";
+        return OK;
+    }
+
+    virtual status_t getUri(String8 *uri) {
+        Mutex::Autolock autoLock(mLock);
+        *uri = mUri;
+        return OK;
+    }
+
+protected:
+    virtual ~FileHTTPConnection() {
+        disconnect();
+    }
+
+private:
+    std::string mRoot;
+    int64_t mRoundTripUs;
+    size_t mBytesPerSecond;
+
+    Mutex mLock;
+    String8 mUri;
+    FILE *mFile;
+    off64_t mOffset;
+    off64_t mLength;
+};
+
+class FileHTTPService : public MediaHTTPService {
+public:
+    FileHTTPService(const std::string &root, int64_t roundTripUs, size_t bytesPerSecond)
+        : mRoot(root), mRoundTripUs(roundTripUs), mBytesPerSecond(bytesPerSecond) {}
+
+    virtual sp<MediaHTTPConnection> makeHTTPConnection() {
+        return new FileHTTPConnection(mRoot, mRoundTripUs, mBytesPerSecond);
+    }
+
+private:
+    std::string mRoot;
+    int64_t mRoundTripUs;
+    size_t mBytesPerSecond;
+};
+
+class SegmentPrefetcherTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        char path[] = "/data/local/tmp/SegmentPrefetcher_test.XXXXXX";
+        ASSERT_NE(nullptr, mkdtemp(path));
+        mRoot = path;
+
+        // A media playlist of separate segments, and one of byte ranges of a
+        // single file holding the same segments.
+        std::string playlist = "#EXTM3U\n#EXT-X-VERSION:4\n#EXT-X-TARGETDURATION:2\n"
+                "#EXT-X-MEDIA-SEQUENCE:0\n";
+        std::string rangePlaylist = playlist;
+        FILE *all = fopen((mRoot + "/all.ts").c_str(), "wb");
+        ASSERT_NE(nullptr, all);
+        for (size_t i = 0; i < kNumSegments; ++i) {
+            std::vector<uint8_t> data(kSegmentSize + i * 188);
+            for (size_t j = 0; j < data.size(); ++j) {
+                data[j] = pattern(i, j);
+            }
+            std::string name = "segment" + std::to_string(i) + ".ts";
+            writeFile(name, data.data(), data.size());
+            fwrite(data.data(), 1, data.size(), all);
+            mSegments.push_back(data);
+
+            playlist += "#EXTINF:2.0,\n" + name + "\n";
+            rangePlaylist += "#EXTINF:2.0,\n#EXT-X-BYTERANGE:" + std::to_string(data.size())
+                    + "\nall.ts\n";
+        }
+        fclose(all);
+        playlist += "#EXT-X-ENDLIST\n";
+        rangePlaylist += "#EXT-X-ENDLIST\n";
+        writeFile("index.m3u8", playlist.data(), playlist.size());
+        writeFile("range.m3u8", rangePlaylist.data(), rangePlaylist.size());
+    }
+
+    virtual void TearDown() {
+        for (size_t i = 0; i < kNumSegments; ++i) {
+            unlink((mRoot + "/segment" + std::to_string(i) + ".ts").c_str());
+        }
+        unlink((mRoot + "/all.ts").c_str());
+        unlink((mRoot + "/index.m3u8").c_str());
+        unlink((mRoot + "/range.m3u8").c_str());
+        rmdir(mRoot.c_str());
+    }
+
+    void writeFile(const std::string &name, const void *data, size_t size) {
+        FILE *file = fopen((mRoot + "/" + name).c_str(), "wb");
+        ASSERT_NE(nullptr, file);
+        ASSERT_EQ(size, fwrite(data, 1, size, file));
+        fclose(file);
+    }
+
+    sp<MediaHTTPService> makeService(int64_t roundTripUs, size_t bytesPerSecond) {
+        return new FileHTTPService(mRoot, roundTripUs, bytesPerSecond);
+    }
+
+    // Fetches the playlist, as PlaylistFetcher does.
+    sp<M3UParser> fetchPlaylist(const sp<MediaHTTPService> &service, const char *name) {
+        sp<HTTPDownloader> downloader =
+                new HTTPDownloader(service, KeyedVector<String8, String8>());
+        bool unchanged;
+        return downloader->fetchPlaylist(
+                (std::string(kServerUri) + name).c_str(), NULL /* curPlaylistHash */, &unchanged);
+    }
+
+    struct Item {
+        AString mUri;
+        int64_t mRangeOffset;
+        int64_t mRangeLength;
+    };
+
+    std::vector<Item> getItems(const sp<M3UParser> &playlist) {
+        std::vector<Item> items;
+        for (size_t i = 0; i < playlist->size(); ++i) {
+            Item item;
+            sp<AMessage> itemMeta;
+            EXPECT_TRUE(playlist->itemAt(i, &item.mUri, &itemMeta));
+            if (!itemMeta->findInt64("range-offset", &item.mRangeOffset)
+                    || !itemMeta->findInt64("range-length", &item.mRangeLength)) {
+                item.mRangeOffset = 0;
+                item.mRangeLength = -1;
+            }
+            items.push_back(item);
+        }
+        return items;
+    }
+
+    // Takes the segments in order, keeping up to maxDownloads of them
+    // prefetched, and returns how long it took.
+    int64_t takeAll(const sp<SegmentPrefetcher> &prefetcher, const std::vector<Item> &items,
+            std::vector<SegmentPrefetcher::Timing> *timings = NULL) {
+        const int64_t startUs = ALooper::GetNowUs();
+        for (size_t i = 0; i < items.size(); ++i) {
+            for (size_t j = i; j < items.size()
+                    && prefetcher->prefetch(
+                            items[j].mUri, items[j].mRangeOffset, items[j].mRangeLength); ++j) {
+            }
+
+            sp<ABuffer> buffer;
+            SegmentPrefetcher::Timing timing;
+            EXPECT_EQ(OK, prefetcher->take(items[i].mUri, items[i].mRangeOffset,
+                    items[i].mRangeLength, kTakeTimeoutUs, &buffer, &timing)) << "segment " << i;
+            if (buffer == NULL) {
+                ADD_FAILURE() << "segment " << i;
+                continue;
+            }
+            EXPECT_EQ(mSegments[i].size(), buffer->size()) << "segment " << i;
+            EXPECT_EQ(0, memcmp(mSegments[i].data(), buffer->data(),
+                    std::min(mSegments[i].size(), buffer->size()))) << "segment " << i;
+
+            EXPECT_EQ(buffer->size(), timing.mBytes);
+            EXPECT_LE(timing.mQueuedUs, timing.mStartedUs);
+            EXPECT_LE(timing.mStartedUs, timing.mCompletedUs);
+            EXPECT_LE(timing.mCompletedUs, timing.mTakenUs);
+            EXPECT_GT(timing.mBusyUs, 0);
+            if (timings != NULL) {
+                timings->push_back(timing);
+            }
+        }
+        return ALooper::GetNowUs() - startUs;
+    }
+
+    std::string mRoot;
+    std::vector<std::vector<uint8_t> > mSegments;
+};
+
+TEST_F(SegmentPrefetcherTest, TakesSegmentsInOrder) {
+    sp<MediaHTTPService> service = makeService(1000 /* roundTripUs */, 64 << 20);
+
+    for (const char *name : { "index.m3u8", "range.m3u8" }) {
+        sp<M3UParser> playlist = fetchPlaylist(service, name);
+        ASSERT_NE(nullptr, playlist.get()) << name;
+        std::vector<Item> items = getItems(playlist);
+        ASSERT_EQ(kNumSegments, items.size()) << name;
+
+        for (size_t maxDownloads : { 1, 3, 8 }) {
+            sp<SegmentPrefetcher> prefetcher =
+                    new SegmentPrefetcher(service, KeyedVector<String8, String8>(), maxDownloads);
+            takeAll(prefetcher, items);
+        }
+    }
+}
+
+TEST_F(SegmentPrefetcherTest, DropsSkippedSegments) {
+    sp<MediaHTTPService> service = makeService(1000 /* roundTripUs */, 64 << 20);
+    sp<M3UParser> playlist = fetchPlaylist(service, "index.m3u8");
+    ASSERT_NE(nullptr, playlist.get());
+    std::vector<Item> items = getItems(playlist);
+
+    sp<SegmentPrefetcher> prefetcher =
+            new SegmentPrefetcher(service, KeyedVector<String8, String8>(), 4);
+    for (size_t i = 0; i < 4; ++i) {
+        EXPECT_TRUE(prefetcher->prefetch(
+                items[i].mUri, items[i].mRangeOffset, items[i].mRangeLength));
+    }
+    EXPECT_FALSE(prefetcher->prefetch(
+            items[4].mUri, items[4].mRangeOffset, items[4].mRangeLength));
+
+    // Taking the third segment drops the first two.
+    sp<ABuffer> buffer;
+    SegmentPrefetcher::Timing timing;
+    EXPECT_EQ(OK, prefetcher->take(
+            items[2].mUri, items[2].mRangeOffset, items[2].mRangeLength,
+            kTakeTimeoutUs, &buffer, &timing));
+    EXPECT_EQ(mSegments[2].size(), buffer->size());
+    EXPECT_FALSE(prefetcher->isPrefetched(
+            items[0].mUri, items[0].mRangeOffset, items[0].mRangeLength));
+    EXPECT_EQ(NAME_NOT_FOUND, prefetcher->take(
+            items[0].mUri, items[0].mRangeOffset, items[0].mRangeLength,
+            kTakeTimeoutUs, &buffer, &timing));
+    EXPECT_TRUE(prefetcher->isPrefetched(
+            items[3].mUri, items[3].mRangeOffset, items[3].mRangeLength));
+
+    prefetcher->clear();
+    EXPECT_EQ(NAME_NOT_FOUND, prefetcher->take(
+            items[3].mUri, items[3].mRangeOffset, items[3].mRangeLength,
+            kTakeTimeoutUs, &buffer, &timing));
+
+    prefetcher->disconnect();
+    EXPECT_FALSE(prefetcher->prefetch(
+            items[5].mUri, items[5].mRangeOffset, items[5].mRangeLength));
+    EXPECT_EQ(ERROR_NOT_CONNECTED, prefetcher->take(
+            items[5].mUri, items[5].mRangeOffset, items[5].mRangeLength,
+            kTakeTimeoutUs, &buffer, &timing));
+
+    prefetcher->reconnect();
+    EXPECT_TRUE(prefetcher->prefetch(
+            items[5].mUri, items[5].mRangeOffset, items[5].mRangeLength));
+    EXPECT_EQ(OK, prefetcher->take(
+            items[5].mUri, items[5].mRangeOffset, items[5].mRangeLength,
+            kTakeTimeoutUs, &buffer, &timing));
+    EXPECT_EQ(0, memcmp(mSegments[5].data(), buffer->data(), mSegments[5].size()));
+
+    // A segment that cannot be downloaded fails when it is taken.
+    AString missing = AString(kServerUri) + "missing.ts";
+    EXPECT_TRUE(prefetcher->prefetch(missing, 0, -1));
+    EXPECT_NE(OK, prefetcher->take(missing, 0, -1, kTakeTimeoutUs, &buffer, &timing));
+}
+
+TEST_F(SegmentPrefetcherTest, DisconnectInterruptsTake) {
+    // Slow enough that the download is still running when disconnecting.
+    sp<MediaHTTPService> service = makeService(200000 /* roundTripUs */, 64 << 10);
+    sp<M3UParser> playlist = fetchPlaylist(service, "index.m3u8");
+    ASSERT_NE(nullptr, playlist.get());
+    std::vector<Item> items = getItems(playlist);
+
+    sp<SegmentPrefetcher> prefetcher =
+            new SegmentPrefetcher(service, KeyedVector<String8, String8>(), 2);
+    EXPECT_TRUE(prefetcher->prefetch(
+            items[0].mUri, items[0].mRangeOffset, items[0].mRangeLength));
+
+    struct Disconnecter : public Thread {
+        explicit Disconnecter(const sp<SegmentPrefetcher> &prefetcher)
+            : mPrefetcher(prefetcher) {}
+        virtual bool threadLoop() {
+            usleep(50000);
+            mPrefetcher->disconnect();
+            return false;
+        }
+        sp<SegmentPrefetcher> mPrefetcher;
+    };
+    sp<Disconnecter> disconnecter = new Disconnecter(prefetcher);
+    disconnecter->run("Disconnecter");
+
+    sp<ABuffer> buffer;
+    SegmentPrefetcher::Timing timing;
+    EXPECT_EQ(ERROR_NOT_CONNECTED, prefetcher->take(
+            items[0].mUri, items[0].mRangeOffset, items[0].mRangeLength,
+            kTakeTimeoutUs, &buffer, &timing));
+    disconnecter->join();
+}
+
+TEST_F(SegmentPrefetcherTest, TakeTimesOut) {
+    // Slow enough that the download is still running when the take times out.
+    sp<MediaHTTPService> service = makeService(200000 /* roundTripUs */, 64 << 10);
+    sp<M3UParser> playlist = fetchPlaylist(service, "index.m3u8");
+    ASSERT_NE(nullptr, playlist.get());
+    std::vector<Item> items = getItems(playlist);
+
+    sp<SegmentPrefetcher> prefetcher =
+            new SegmentPrefetcher(service, KeyedVector<String8, String8>(), 2);
+    EXPECT_TRUE(prefetcher->prefetch(
+            items[0].mUri, items[0].mRangeOffset, items[0].mRangeLength));
+
+    sp<ABuffer> buffer;
+    SegmentPrefetcher::Timing timing;
+    const int64_t startUs = ALooper::GetNowUs();
+    EXPECT_EQ(-EAGAIN, prefetcher->take(
+            items[0].mUri, items[0].mRangeOffset, items[0].mRangeLength,
+            10000 /* timeoutUs */, &buffer, &timing));
+    EXPECT_LT(ALooper::GetNowUs() - startUs, 150000);
+
+    // The segment stays prefetched and is taken once it is downloaded.
+    EXPECT_TRUE(prefetcher->isPrefetched(
+            items[0].mUri, items[0].mRangeOffset, items[0].mRangeLength));
+    EXPECT_EQ(OK, prefetcher->take(
+            items[0].mUri, items[0].mRangeOffset, items[0].mRangeLength,
+            kTakeTimeoutUs, &buffer, &timing));
+    ASSERT_NE(nullptr, buffer.get());
+    EXPECT_EQ(mSegments[0].size(), buffer->size());
+}
+
+TEST_F(SegmentPrefetcherTest, Benchmark) {
+    // A high-latency link, on which each connection is limited by its window.
+    const int64_t kRoundTripUs = 40000;
+    const size_t kBytesPerSecond = 4 << 20;
+    sp<MediaHTTPService> service = makeService(kRoundTripUs, kBytesPerSecond);
+    sp<M3UParser> playlist = fetchPlaylist(service, "index.m3u8");
+    ASSERT_NE(nullptr, playlist.get());
+    std::vector<Item> items = getItems(playlist);
+
+    size_t bytes = 0;
+    for (size_t i = 0; i < mSegments.size(); ++i) {
+        bytes += mSegments[i].size();
+    }
+
+    for (size_t maxDownloads : { 1, 2, 4, 8 }) {
+        sp<SegmentPrefetcher> prefetcher =
+                new SegmentPrefetcher(service, KeyedVector<String8, String8>(), maxDownloads);
+        std::vector<SegmentPrefetcher::Timing> timings;
+        int64_t elapsedUs = takeAll(prefetcher, items, &timings);
+
+        int64_t downloadUs = 0;
+        int64_t waitUs = 0;
+        for (const SegmentPrefetcher::Timing &timing : timings) {
+            downloadUs += timing.mCompletedUs - timing.mStartedUs;
+            waitUs += timing.mCompletedUs - timing.mQueuedUs;
+        }
+        printf("[ BENCH    ] %zu concurrent downloads: %.2f MB/s, per segment %.1f ms "
+                "downloading, %.1f ms from queued to downloaded\n",
+                maxDownloads, bytes / (elapsedUs / 1E6) / (1 << 20),
+                downloadUs / 1E3 / timings.size(), waitUs / 1E3 / timings.size());
+    }
+}
+
+}  // namespace android
@@ -73,6 +73,7 @@
 #include <audio_utils/clock.h>
 #include <audio_utils/FdToString.h>
 #include <audio_utils/SimpleLog.h>
+#include <audio_utils/Statistics.h>
 #include <audio_utils/TimestampVerifier.h>
 
 #include "FastCapture.h"
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_EFFECT_INT16_IN_PLACE_H
+#define ANDROID_AUDIO_EFFECT_INT16_IN_PLACE_H
+
+#include <audio_utils/primitives.h>
+#include <system/audio_effect.h>
+
+namespace android {
+
+// Conversions of an effect chain buffer for the int16 insert effects that process it in
+// place, see EffectModule::isInt16InPlace(). Float samples are larger than int16 samples,
+// so the buffer holds either, and both conversions may share the source and destination.
+
+static inline void convertEffectBufferToInt16(audio_buffer_t *buffer, size_t sampleCount)
+{
+    memcpy_to_i16_from_float(buffer->s16, buffer->f32, sampleCount);
+}
+
+static inline void convertEffectBufferToFloat(audio_buffer_t *buffer, size_t sampleCount)
+{
+    memcpy_to_float_from_i16(buffer->f32, buffer->s16, sampleCount);
+}
+
+} // namespace android
+
+#endif // ANDROID_AUDIO_EFFECT_INT16_IN_PLACE_H
@@ -35,6 +35,7 @@
 #include <mediautils/ServiceUtilities.h>
 
 #include "AudioFlinger.h"
+#include "EffectInt16InPlace.h"
 
 // ----------------------------------------------------------------------------
 
@@ -83,6 +84,7 @@ AudioFlinger::EffectModule::EffectModule(ThreadBase *thread,
       mAudioFlinger(thread->mAudioFlinger)
 #ifdef FLOAT_EFFECT_CHAIN
       , mSupportsFloat(false)
+      , mInt16InPlace(false)
 #endif
 {
     ALOGV("Constructor %p pinned %d", this, pinned);
@@ -351,7 +353,7 @@ bool AudioFlinger::EffectModule::updateState() {
     return started;
 }
 
-void AudioFlinger::EffectModule::process()
+void AudioFlinger::EffectModule::process(size_t *inBufferInt16Samples)
 {
     Mutex::Autolock _l(mLock);
 
@@ -460,7 +462,16 @@ void AudioFlinger::EffectModule::process()
                         * mOutChannelCountRequested * mConfig.outputCfg.buffer.frameCount);
                 outBuffer = mOutConversionBuffer;
             }
-            if (!mSupportsFloat) { // convert input to int16_t as effect doesn't support float.
+            if (mInt16InPlace) {
+                // Convert the chain buffer to int16 in place, unless the
+                // previous effect processing int16 in place left it so.
+                if (*inBufferInt16Samples == 0) {
+                    const size_t sampleCount =
+                            inChannelCount * mConfig.inputCfg.buffer.frameCount;
+                    convertEffectBufferToInt16(mInBuffer->audioBuffer(), sampleCount);
+                    *inBufferInt16Samples = sampleCount;
+                }
+            } else if (!mSupportsFloat) { // convert input to int16_t as effect doesn't support float.
                 if (!auxType) {
                     if (mInConversionBuffer.get() == nullptr) {
                         ALOGW("%s: mInConversionBuffer is null, bypassing", __func__);
@@ -487,7 +498,9 @@ void AudioFlinger::EffectModule::process()
 #endif
             ret = mEffectInterface->process();
 #ifdef FLOAT_EFFECT_CHAIN
-            if (!mSupportsFloat) { // convert output int16_t back to float.
+            // convert output int16_t back to float, unless the chain does it
+            // after the last effect processing int16 in place.
+            if (!mSupportsFloat && !mInt16InPlace) {
                 sp<EffectBufferHalInterface> target =
                         mOutChannelCountRequested != outChannelCount
                         ? mOutConversionBuffer : mOutBuffer;
@@ -721,6 +734,12 @@ status_t AudioFlinger::EffectModule::configure()
     }
 #endif
 
+#ifdef FLOAT_EFFECT_CHAIN
+    // decided once both buffers and the format are known, before the buffer
+    // strategy below depends on it.
+    mInt16InPlace = status == NO_ERROR && canProcessInt16InPlace();
+#endif
+
     if (status == NO_ERROR) {
         // Establish Buffer strategy
         setInBuffer(mInBuffer);
@@ -1101,14 +1120,21 @@ void AudioFlinger::EffectModule::setInBuffer(const sp<EffectBufferHalInterface>&
 
 #ifdef FLOAT_EFFECT_CHAIN
     // aux effects do in place conversion to float - we don't allocate mInConversionBuffer.
-    // Theoretically insert effects can also do in-place conversions (destroying
-    // the original buffer) when the output buffer is identical to the input buffer,
-    // but we don't optimize for it here.
+    // Insert effects whose output buffer is identical to the input buffer also do
+    // in-place conversions (destroying the original buffer), see canProcessInt16InPlace().
     const bool auxType = (mDescriptor.flags & EFFECT_FLAG_TYPE_MASK) == EFFECT_FLAG_TYPE_AUXILIARY;
     const uint32_t inChannelCount =
             audio_channel_count_from_out_mask(mConfig.inputCfg.channels);
     const bool formatMismatch = !mSupportsFloat || mInChannelCountRequested != inChannelCount;
-    if (!auxType && formatMismatch && mInBuffer.get() != nullptr) {
+    if (mInt16InPlace && !canProcessInt16InPlace()) {
+        // the buffers changed since configure(), use conversion buffers until the next one.
+        mInt16InPlace = false;
+        setOutBuffer(mOutBuffer);
+    }
+    if (mInt16InPlace) {
+        // process() converts the chain buffer in place.
+        mInConversionBuffer.clear();
+    } else if (!auxType && formatMismatch && mInBuffer.get() != nullptr) {
         // we need to translate - create hidl shared buffer and intercept
         const size_t inFrameCount = mConfig.inputCfg.buffer.frameCount;
         // Use FCC_2 in case mInChannelCountRequested is mono and the effect is stereo.
@@ -1151,11 +1177,19 @@ void AudioFlinger::EffectModule::setOutBuffer(const sp<EffectBufferHalInterface>
 
 #ifdef FLOAT_EFFECT_CHAIN
     // Note: Any effect that does not accumulate does not need mOutConversionBuffer and
-    // can do in-place conversion from int16_t to float.  We don't optimize here.
+    // can do in-place conversion from int16_t to float.  We only do it for insert
+    // effects, see canProcessInt16InPlace().
     const uint32_t outChannelCount =
             audio_channel_count_from_out_mask(mConfig.outputCfg.channels);
     const bool formatMismatch = !mSupportsFloat || mOutChannelCountRequested != outChannelCount;
-    if (formatMismatch && mOutBuffer.get() != nullptr) {
+    if (mInt16InPlace && !canProcessInt16InPlace()) {
+        // the buffers changed since configure(), use conversion buffers until the next one.
+        mInt16InPlace = false;
+        setInBuffer(mInBuffer);
+    }
+    if (mInt16InPlace) {
+        mOutConversionBuffer.clear();
+    } else if (formatMismatch && mOutBuffer.get() != nullptr) {
         const size_t outFrameCount = mConfig.outputCfg.buffer.frameCount;
         // Use FCC_2 in case mOutChannelCountRequested is mono and the effect is stereo.
         const uint32_t outChannels = std::max((uint32_t)FCC_2, mOutChannelCountRequested);
@@ -1182,6 +1216,22 @@ void AudioFlinger::EffectModule::setOutBuffer(const sp<EffectBufferHalInterface>
 #endif
 }
 
+#ifdef FLOAT_EFFECT_CHAIN
+bool AudioFlinger::EffectModule::canProcessInt16InPlace() const
+{
+    // The chain buffer holds float samples, which are at least as large as
+    // int16_t samples, so it can hold the converted samples itself.
+    return !mSupportsFloat
+            && (mDescriptor.flags & EFFECT_FLAG_TYPE_MASK) == EFFECT_FLAG_TYPE_INSERT
+            && mInBuffer != 0
+            && mConfig.inputCfg.buffer.raw == mConfig.outputCfg.buffer.raw
+            && mInChannelCountRequested
+                    == audio_channel_count_from_out_mask(mConfig.inputCfg.channels)
+            && mOutChannelCountRequested
+                    == audio_channel_count_from_out_mask(mConfig.outputCfg.channels);
+}
+#endif
+
 status_t AudioFlinger::EffectModule::setVolume(uint32_t *left, uint32_t *right, bool controller)
 {
     AutoLockReentrant _l(mLock, mSetVolumeReentrantTid);
@@ -1510,7 +1560,8 @@ void AudioFlinger::EffectModule::dump(int fd, const Vector<String16>& args __unu
     result.appendFormat("\t\t- implementor: %s\n",
             mDescriptor.implementor);
 
-    result.appendFormat("\t\t- data: %s\n", mSupportsFloat ? "float" : "int16");
+    result.appendFormat("\t\t- data: %s\n",
+            mSupportsFloat ? "float" : mInt16InPlace ? "int16 in place" : "int16");
 
     result.append("\t\t- Input configuration:\n");
     result.append("\t\t\tBuffer     Frames  Smp rate Channels Format\n");
@@ -2084,8 +2135,23 @@ void AudioFlinger::EffectChain::process_l()
         if (mInBuffer->audioBuffer()->raw != mOutBuffer->audioBuffer()->raw) {
             mOutBuffer->update();
         }
+        const nsecs_t startNs = systemTime();
+        size_t inBufferInt16Samples = 0;
         for (size_t i = 0; i < size; i++) {
-            mEffects[i]->process();
+#ifdef FLOAT_EFFECT_CHAIN
+            if (inBufferInt16Samples != 0 && !mEffects[i]->isInt16InPlace()) {
+                convertInBufferToFloat_l(&inBufferInt16Samples);
+            }
+#endif
+            mEffects[i]->process(&inBufferInt16Samples);
+        }
+#ifdef FLOAT_EFFECT_CHAIN
+        if (inBufferInt16Samples != 0) {
+            convertInBufferToFloat_l(&inBufferInt16Samples);
+        }
+#endif
+        if (size != 0) {
+            mProcessTimeUs.add((systemTime() - startNs) * 1e-3);
         }
         mInBuffer->commit();
         if (mInBuffer->audioBuffer()->raw != mOutBuffer->audioBuffer()->raw) {
@@ -2101,6 +2167,15 @@ void AudioFlinger::EffectChain::process_l()
     }
 }
 
+#ifdef FLOAT_EFFECT_CHAIN
+// Must be called with EffectChain::mLock locked
+void AudioFlinger::EffectChain::convertInBufferToFloat_l(size_t *int16Samples)
+{
+    convertEffectBufferToFloat(mInBuffer->audioBuffer(), *int16Samples);
+    *int16Samples = 0;
+}
+#endif
+
 // createEffect_l() must be called with ThreadBase::mLock held
 status_t AudioFlinger::EffectChain::createEffect_l(sp<EffectModule>& effect,
                                                    ThreadBase *thread,
@@ -2424,6 +2499,10 @@ void AudioFlinger::EffectChain::dump(int fd, const Vector<String16>& args)
                 (int)outBufferStr.size(), "Out buffer      ");
         result.appendFormat("\t%s   %s   %d\n",
                 inBufferStr.c_str(), outBufferStr.c_str(), mActiveTrackCnt);
+        if (mProcessTimeUs.getN() > 0) {
+            result.appendFormat("\tProcess time us stats: %s\n",
+                    mProcessTimeUs.toString().c_str());
+        }
         write(fd, result.string(), result.size());
 
         for (size_t i = 0; i < numEffects; ++i) {
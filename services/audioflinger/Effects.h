@@ -61,7 +61,11 @@ public:
     };
 
     int         id() const { return mId; }
-    void process();
+    // *inBufferInt16Samples is the number of int16 samples that previous effects
+    // left in place in the chain input buffer, or 0 if it holds float samples.
+    // Effects processing int16 in place set it, and the chain resets it when it
+    // converts the buffer back to float.
+    void process(size_t *inBufferInt16Samples);
     bool updateState();
     status_t command(uint32_t cmdCode,
                      uint32_t cmdSize,
@@ -146,6 +150,13 @@ public:
 
     void             dump(int fd, const Vector<String16>& args);
 
+#ifdef FLOAT_EFFECT_CHAIN
+    // An int16 insert effect overwriting its input with the same channels
+    // converts the chain buffer in place rather than through conversion
+    // buffers, so that consecutive such effects share the int16 samples.
+    bool             isInt16InPlace() const { return mInt16InPlace; }
+#endif
+
 private:
     friend class AudioFlinger;      // for mHandles
     bool                mPinned;
@@ -187,6 +198,9 @@ mutable Mutex               mLock;      // mutex for process, commands and handl
     sp<EffectBufferHalInterface> mOutConversionBuffer;
     uint32_t mInChannelCountRequested;
     uint32_t mOutChannelCountRequested;
+    bool    mInt16InPlace;          // see isInt16InPlace()
+
+    bool    canProcessInt16InPlace() const;
 #endif
 
     class AutoLockReentrant {
@@ -447,6 +461,12 @@ private:
 
     void setVolumeForOutput_l(uint32_t left, uint32_t right);
 
+#ifdef FLOAT_EFFECT_CHAIN
+    // converts int16 samples left in the input buffer by effects processing
+    // int16 in place back to float.
+    void convertInBufferToFloat_l(size_t *int16Samples);
+#endif
+
              wp<ThreadBase> mThread;     // parent mixer thread
     mutable  Mutex mLock;        // mutex protecting effect list
              Vector< sp<EffectModule> > mEffects; // list of effect modules
@@ -466,6 +486,8 @@ private:
              uint32_t mNewLeftVolume;       // new volume on left channel
              uint32_t mNewRightVolume;      // new volume on right channel
              uint32_t mStrategy; // strategy for this effect chain
+             // time spent processing effects per buffer
+             audio_utils::Statistics<double> mProcessTimeUs{0.995 /* alpha */};
              // mSuspendedEffects lists all effects currently suspended in the chain.
              // Use effect type UUID timelow field as key. There is no real risk of identical
              // timeLow fields among effect type UUIDs.
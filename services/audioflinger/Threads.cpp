@@ -3437,7 +3437,8 @@ bool AudioFlinger::PlaybackThread::threadLoop()
                 for (const sp<Track> &t : mActiveTracks) {
                     if (!t->isFastTrack()) {
                         t->updateTrackFrameInfo(
-                                t->mAudioTrackServerProxy->framesReleased(),
+                                t->mAudioTrackServerProxy->framesReleased()
+                                        - framesPrefetched_l(t),
                                 mFramesWritten,
                                 mSampleRate,
                                 mTimestamp);
@@ -4148,6 +4149,10 @@ AudioFlinger::MixerThread::MixerThread(const sp<AudioFlinger>& audioFlinger, Aud
             mSampleRate, mChannelMask, mChannelCount, mFormat, mFrameSize, mFrameCount,
             mNormalFrameCount);
     mAudioMixer = new AudioMixer(mNormalFrameCount, mSampleRate);
+    // Opt-in: resample tracks on additional threads, e.g. for car or TV outputs
+    // that mix many resampled streams.
+    mAudioMixer->setWorkerCount(
+            std::max(0, property_get_int32("ro.audio.mixer_worker_count", 0)));
 
     if (type == DUPLICATING) {
         // The Duplicating thread uses the AudioMixer and delivers data to OutputTracks
@@ -4358,6 +4363,11 @@ uint32_t AudioFlinger::MixerThread::correctLatency_l(uint32_t latency) const
     return latency;
 }
 
+size_t AudioFlinger::MixerThread::framesPrefetched_l(const sp<Track>& track) const
+{
+    return mAudioMixer->getPrefetchedFrames(track->id());
+}
+
 ssize_t AudioFlinger::MixerThread::threadLoop_write()
 {
     // FIXME we should only do one push per cycle; confirm this is true
@@ -4880,6 +4890,8 @@ AudioFlinger::PlaybackThread::mixer_state AudioFlinger::MixerThread::prepareTrac
         // add frames already consumed but not yet released by the resampler
         // because mAudioTrackServerProxy->framesReady() will include these frames
         desiredFrames += mAudioMixer->getUnreleasedFrames(trackId);
+        // frames the mixer has prefetched are no longer in framesReady() but are still mixed
+        desiredFrames -= std::min(desiredFrames, mAudioMixer->getPrefetchedFrames(trackId));
 
         uint32_t minFrames = 1;
         if ((track->sharedBuffer() == 0) && !track->isStopped() && !track->isPausing() &&
@@ -4949,7 +4961,8 @@ AudioFlinger::PlaybackThread::mixer_state AudioFlinger::MixerThread::prepareTrac
             // Always fetch volumeshaper volume to ensure state is updated.
             const sp<AudioTrackServerProxy> proxy = track->mAudioTrackServerProxy;
             const float vh = track->getVolumeHandler()->getVolume(
-                    track->mAudioTrackServerProxy->framesReleased()).first;
+                    track->mAudioTrackServerProxy->framesReleased()
+                            - mAudioMixer->getPrefetchedFrames(trackId)).first;
 
             if (mStreamTypes[track->streamType()].mute || track->isPlaybackRestricted()) {
                 v = 0;
@@ -5402,6 +5415,8 @@ bool AudioFlinger::MixerThread::checkForNewParameter_l(const String8& keyValuePa
             readOutputParameters_l();
             delete mAudioMixer;
             mAudioMixer = new AudioMixer(mNormalFrameCount, mSampleRate);
+            mAudioMixer->setWorkerCount(
+                    std::max(0, property_get_int32("ro.audio.mixer_worker_count", 0)));
             for (const auto &track : mTracks) {
                 const int trackId = track->id();
                 status_t status = mAudioMixer->create(
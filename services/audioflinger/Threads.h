@@ -1002,6 +1002,9 @@ protected:
 
     virtual     uint32_t    correctLatency_l(uint32_t latency) const;
 
+    // Frames the track has released that the thread has not mixed yet
+    virtual     size_t      framesPrefetched_l(const sp<Track>& track __unused) const { return 0; }
+
     virtual     status_t    createAudioPatch_l(const struct audio_patch *patch,
                                    audio_patch_handle_t *handle);
     virtual     status_t    releaseAudioPatch_l(const audio_patch_handle_t handle);
@@ -1206,6 +1209,7 @@ protected:
     virtual     void        threadLoop_mix();
     virtual     void        threadLoop_sleepTime();
     virtual     uint32_t    correctLatency_l(uint32_t latency) const;
+    virtual     size_t      framesPrefetched_l(const sp<Track>& track) const;
 
     virtual     status_t    createAudioPatch_l(const struct audio_patch *patch,
                                    audio_patch_handle_t *handle);
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <functional>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "EffectInt16InPlace.h"
+
+namespace android {
+
+static int64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+namespace {
+
+// An int16 effect processing sampleCount samples from in to out, which may be the same.
+using Int16Effect = std::function<void(const int16_t *in, int16_t *out, size_t sampleCount)>;
+
+// A gain that saturates, and a one pole low pass filter that keeps state across buffers.
+std::vector<Int16Effect> makeEffects() {
+    std::vector<Int16Effect> effects;
+    effects.push_back([](const int16_t *in, int16_t *out, size_t sampleCount) {
+        for (size_t i = 0; i < sampleCount; ++i) {
+            const int32_t sample = in[i] * 3 / 2;
+            out[i] = sample > INT16_MAX ? INT16_MAX : sample < INT16_MIN ? INT16_MIN : sample;
+        }
+    });
+    int32_t state = 0;
+    effects.push_back([state](const int16_t *in, int16_t *out, size_t sampleCount) mutable {
+        for (size_t i = 0; i < sampleCount; ++i) {
+            state += (in[i] - state) / 4;
+            out[i] = state;
+        }
+    });
+    return effects;
+}
+
+// Processes the chain buffer as EffectModule::process() does for int16 effects with
+// conversion buffers: each effect converts from and back to float.
+void processWithConversionBuffers(std::vector<Int16Effect> &effects, float *chain,
+        size_t sampleCount, std::vector<int16_t> &in, std::vector<int16_t> &out) {
+    for (Int16Effect &effect : effects) {
+        memcpy_to_i16_from_float(in.data(), chain, sampleCount);
+        effect(in.data(), out.data(), sampleCount);
+        memcpy_to_float_from_i16(chain, out.data(), sampleCount);
+    }
+}
+
+// Processes the chain buffer as EffectChain::process_l() does for consecutive effects
+// processing int16 in place: the buffer is converted once each way.
+void processInt16InPlace(std::vector<Int16Effect> &effects, float *chain, size_t sampleCount) {
+    audio_buffer_t buffer;
+    buffer.frameCount = sampleCount;
+    buffer.f32 = chain;
+    convertEffectBufferToInt16(&buffer, sampleCount);
+    for (Int16Effect &effect : effects) {
+        effect(buffer.s16, buffer.s16, sampleCount);
+    }
+    convertEffectBufferToFloat(&buffer, sampleCount);
+}
+
+// Fills a chain buffer with a sine that clips, as the mix of several tracks may.
+void fillChainBuffer(float *chain, size_t sampleCount, size_t offset) {
+    for (size_t i = 0; i < sampleCount; ++i) {
+        chain[i] = 1.2f * sinf((offset + i) * 0.01f);
+    }
+}
+
+} // namespace
+
+TEST(effect_int16_in_place, matches_conversion_buffers) {
+    static const size_t kSampleCount = 2 * 960;
+    static const size_t kBuffers = 100;
+    std::vector<Int16Effect> effects = makeEffects();
+    std::vector<Int16Effect> inPlaceEffects = makeEffects();
+    std::vector<float> reference(kSampleCount);
+    std::vector<float> chain(kSampleCount);
+    std::vector<int16_t> in(kSampleCount);
+    std::vector<int16_t> out(kSampleCount);
+
+    for (size_t buffer = 0; buffer < kBuffers; ++buffer) {
+        fillChainBuffer(reference.data(), kSampleCount, buffer * kSampleCount);
+        fillChainBuffer(chain.data(), kSampleCount, buffer * kSampleCount);
+        processWithConversionBuffers(effects, reference.data(), kSampleCount, in, out);
+        processInt16InPlace(inPlaceEffects, chain.data(), kSampleCount);
+        ASSERT_EQ(0, memcmp(reference.data(), chain.data(), kSampleCount * sizeof(float)))
+                << "buffer " << buffer;
+    }
+}
+
+TEST(effect_int16_in_place, benchmark) {
+    static const size_t kSampleCount = 2 * 960;
+    static const size_t kBuffers = 10000;
+    std::vector<Int16Effect> effects = makeEffects();
+    std::vector<float> chain(kSampleCount);
+    std::vector<int16_t> in(kSampleCount);
+    std::vector<int16_t> out(kSampleCount);
+    fillChainBuffer(chain.data(), kSampleCount, 0);
+
+    int64_t startNs = nowNs();
+    for (size_t buffer = 0; buffer < kBuffers; ++buffer) {
+        processWithConversionBuffers(effects, chain.data(), kSampleCount, in, out);
+    }
+    const int64_t conversionBuffersNs = nowNs() - startNs;
+
+    startNs = nowNs();
+    for (size_t buffer = 0; buffer < kBuffers; ++buffer) {
+        processInt16InPlace(effects, chain.data(), kSampleCount);
+    }
+    const int64_t inPlaceNs = nowNs() - startNs;
+
+    printf("[ BENCH    ] %zu samples through %zu int16 effects: "
+            "conversion buffers %.2f us/buffer, in place %.2f us/buffer\n",
+            kSampleCount, effects.size(),
+            conversionBuffersNs * 1e-3 / kBuffers, inPlaceNs * 1e-3 / kBuffers);
+}
+
+} // namespace android
@@ -23,6 +23,7 @@
 #include <cstring>
 #include <utils/Trace.h>
 
+#include "utility/AAudioMixKernels.h"
 #include "AAudioMixer.h"
 
 #ifndef AAUDIO_MIXER_ATRACE_ENABLED
@@ -49,7 +50,14 @@ void AAudioMixer::clear() {
     memset(mOutputBuffer, 0, mBufferSizeInBytes);
 }
 
-int32_t AAudioMixer::mix(int streamIndex, FifoBuffer *fifo, bool allowUnderflow) {
+bool AAudioMixer::isFormatSupported(audio_format_t format) {
+    return format == AUDIO_FORMAT_PCM_FLOAT
+            || format == AUDIO_FORMAT_PCM_16_BIT
+            || format == AUDIO_FORMAT_PCM_24_BIT_PACKED;
+}
+
+int32_t AAudioMixer::mix(int streamIndex, FifoBuffer *fifo, bool allowUnderflow,
+                         audio_format_t format) {
     WrappingBuffer wrappingBuffer;
     float *destination = mOutputBuffer;
 
@@ -91,8 +99,8 @@ int32_t AAudioMixer::mix(int streamIndex, FifoBuffer *fifo, bool allowUnderflow)
             if (framesToMixFromPart > framesAvailableFromPart) {
                 framesToMixFromPart = framesAvailableFromPart;
             }
-            mixPart(destination, (float *)wrappingBuffer.data[partIndex],
-                    framesToMixFromPart);
+            mixPart(destination, wrappingBuffer.data[partIndex],
+                    framesToMixFromPart, format);
 
             destination += framesToMixFromPart * mSamplesPerFrame;
             framesLeft -= framesToMixFromPart;
@@ -108,11 +116,22 @@ int32_t AAudioMixer::mix(int streamIndex, FifoBuffer *fifo, bool allowUnderflow)
     return (framesDesired - framesLeft); // framesRead
 }
 
-void AAudioMixer::mixPart(float *destination, float *source, int32_t numFrames) {
-    int32_t numSamples = numFrames * mSamplesPerFrame;
-    // TODO maybe optimize using SIMD
-    for (int sampleIndex = 0; sampleIndex < numSamples; sampleIndex++) {
-        *destination++ += *source++;
+void AAudioMixer::mixPart(float *destination, const void *source, int32_t numFrames,
+                          audio_format_t format) {
+    switch (format) {
+        case AUDIO_FORMAT_PCM_16_BIT:
+            AAudioMix_i16(destination, static_cast<const int16_t *>(source),
+                          numFrames, mSamplesPerFrame);
+            break;
+        case AUDIO_FORMAT_PCM_24_BIT_PACKED:
+            AAudioMix_p24(destination, static_cast<const uint8_t *>(source),
+                          numFrames, mSamplesPerFrame);
+            break;
+        case AUDIO_FORMAT_PCM_FLOAT:
+        default:
+            AAudioMix_float(destination, static_cast<const float *>(source),
+                            numFrames, mSamplesPerFrame);
+            break;
     }
 }
 
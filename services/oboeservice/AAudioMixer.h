@@ -21,6 +21,7 @@
 
 #include <aaudio/AAudio.h>
 #include <fifo/FifoBuffer.h>
+#include <system/audio.h>
 
 class AAudioMixer {
 public:
@@ -36,16 +37,24 @@ public:
      * @param streamIndex for marking stream variables in systrace
      * @param fifo to read from
      * @param allowUnderflow if true then allow mixer to advance read index past the write index
+     * @param format of the data in the FIFO, FLOAT, I16 or packed I24
      * @return frames read from this stream
      */
-    int32_t mix(int streamIndex, android::FifoBuffer *fifo, bool allowUnderflow);
+    int32_t mix(int streamIndex, android::FifoBuffer *fifo, bool allowUnderflow,
+                audio_format_t format = AUDIO_FORMAT_PCM_FLOAT);
+
+    /**
+     * @return true if mix() can read a FIFO in this format
+     */
+    static bool isFormatSupported(audio_format_t format);
 
     float *getOutputBuffer();
 
     int32_t getFramesPerBurst() const { return mFramesPerBurst; }
 
 private:
-    void mixPart(float *destination, float *source, int32_t numFrames);
+    void mixPart(float *destination, const void *source, int32_t numFrames,
+                 audio_format_t format);
 
     float   *mOutputBuffer = nullptr;
     int32_t  mSamplesPerFrame = 0;
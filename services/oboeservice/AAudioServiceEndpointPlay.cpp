@@ -111,7 +111,8 @@ void *AAudioServiceEndpointPlay::callbackLoop() {
                         int64_t positionOffset = mmapFramesWritten - clientFramesRead;
                         streamShared->setTimestampPositionOffset(positionOffset);
 
-                        int32_t framesMixed = mMixer.mix(index, fifo, allowUnderflow);
+                        int32_t framesMixed = mMixer.mix(index, fifo, allowUnderflow,
+                                                         streamShared->getFormat());
 
                         if (streamShared->isFlowing()) {
                             // Consider it an underflow if we got less than a burst
@@ -65,6 +65,8 @@ aaudio_result_t AAudioServiceEndpointShared::open(const aaudio::AAudioStreamRequ
 
     AudioStreamBuilder builder;
     builder.copyFrom(configuration);
+    // The first client may use I16 but the mixer output is always FLOAT.
+    builder.setFormat(AUDIO_FORMAT_PCM_FLOAT);
 
     builder.setSharingMode(AAUDIO_SHARING_MODE_EXCLUSIVE);
     // Don't fall back to SHARED because that would cause recursion.
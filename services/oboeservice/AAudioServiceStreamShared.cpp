@@ -32,6 +32,7 @@
 #include "AAudioEndpointManager.h"
 #include "AAudioService.h"
 #include "AAudioServiceEndpoint.h"
+#include "AAudioMixer.h"
 
 using namespace android;
 using namespace aaudio;
@@ -140,10 +141,13 @@ aaudio_result_t AAudioServiceStreamShared::open(const aaudio::AAudioStreamReques
     }
 
     // Is the request compatible with the shared endpoint?
+    // The mixer reads integer output streams directly. Input is distributed as FLOAT.
     setFormat(configurationInput.getFormat());
     if (getFormat() == AUDIO_FORMAT_DEFAULT) {
         setFormat(AUDIO_FORMAT_PCM_FLOAT);
-    } else if (getFormat() != AUDIO_FORMAT_PCM_FLOAT) {
+    } else if (getFormat() != AUDIO_FORMAT_PCM_FLOAT
+            && (configurationInput.getDirection() != AAUDIO_DIRECTION_OUTPUT
+                || !AAudioMixer::isFormatSupported(getFormat()))) {
         ALOGD("%s() audio_format_t mAudioFormat = %d, need FLOAT", __func__, getFormat());
         result = AAUDIO_ERROR_INVALID_FORMAT;
         goto error;